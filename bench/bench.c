@@ -0,0 +1,322 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#include "bench.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/utsname.h>
+
+#include "slip.h"
+#include "timestamp.h"
+#include "tlvc.h"
+
+//---------------------------------------------------------------------------
+static const bench_suite_t benchSuites[] = {
+    { "transport", "loopback report latency for each socket policy", bench_transport },
+    { "relmouse", "report rate vs. motion fidelity for a 1000 Hz mouse", bench_relmouse },
+    { "remap", "server report cost, pass-through vs. remapped", bench_remap },
+    { "rtload", "wakeup and delivery latency under CPU load, with and without real-time scheduling", bench_rtload },
+    { "busypoll", "server wakeup latency and CPU cost for each poll mode", bench_busypoll },
+    { "pipeline", "server decode/inject throughput into a null or recording output", bench_pipeline },
+    { "replay", "replay a netstick or netstickd capture into a virtual device", bench_replay },
+    { "protocol", "slip, tlvc, framing and report decode cost per operation", bench_protocol },
+    { "loopback", "end-to-end report latency and throughput, client to server to null output", bench_loopback },
+    { "check", "run protocol and loopback and compare against a baseline, failing on regressions", bench_check },
+};
+
+//---------------------------------------------------------------------------
+#if defined(__clang__)
+#define BENCH_COMPILER "clang " __clang_version__
+#elif defined(__GNUC__)
+#define BENCH_COMPILER "gcc " __VERSION__
+#else
+#define BENCH_COMPILER "unknown"
+#endif
+
+// Set by the build to the flags the suites were compiled with
+#if !defined(BENCH_FLAGS)
+#define BENCH_FLAGS "unknown"
+#endif
+
+//---------------------------------------------------------------------------
+bool benchJson = false;
+
+//---------------------------------------------------------------------------
+bench_results_t* benchResults = NULL;
+
+//---------------------------------------------------------------------------
+const char* bench_arch(void)
+{
+    static struct utsname host;
+    if (!host.machine[0]) {
+        uname(&host);
+    }
+    return host.machine;
+}
+
+//---------------------------------------------------------------------------
+const char* bench_compiler(void)
+{
+    return BENCH_COMPILER;
+}
+
+//---------------------------------------------------------------------------
+const char* bench_flags(void)
+{
+    return BENCH_FLAGS;
+}
+
+//---------------------------------------------------------------------------
+// Start a JSON result line with the fields every result carries
+static void bench_json_begin(const char* suite_, const char* case_)
+{
+    printf("{\"suite\":\"%s\",\"case\":\"%s\",\"arch\":\"%s\",\"compiler\":\"%s\",\"flags\":\"%s\"",
+           suite_,
+           case_,
+           bench_arch(),
+           BENCH_COMPILER,
+           BENCH_FLAGS);
+}
+
+//---------------------------------------------------------------------------
+// Add a result to benchResults, if a collector is installed
+static void bench_collect(const char* suite_, const char* case_, bool latency_, double valueNs_)
+{
+    if (!benchResults) {
+        return;
+    }
+    if (benchResults->count == benchResults->capacity) {
+        size_t newCapacity     = benchResults->capacity ? (benchResults->capacity * 2) : 32;
+        benchResults->results
+            = (bench_result_t*)(realloc(benchResults->results, newCapacity * sizeof(bench_result_t)));
+        benchResults->capacity = newCapacity;
+    }
+    bench_result_t* result = &benchResults->results[benchResults->count++];
+    snprintf(result->suite, sizeof(result->suite), "%s", suite_);
+    snprintf(result->name, sizeof(result->name), "%s", case_);
+    result->latency = latency_;
+    result->valueNs = valueNs_;
+}
+
+//---------------------------------------------------------------------------
+void bench_samples_init(bench_samples_t* samples_, size_t capacity_)
+{
+    samples_->samples  = (uint64_t*)(calloc(capacity_, sizeof(uint64_t)));
+    samples_->count    = 0;
+    samples_->capacity = capacity_;
+}
+
+//---------------------------------------------------------------------------
+void bench_samples_free(bench_samples_t* samples_)
+{
+    free(samples_->samples);
+    samples_->samples  = NULL;
+    samples_->count    = 0;
+    samples_->capacity = 0;
+}
+
+//---------------------------------------------------------------------------
+void bench_samples_add(bench_samples_t* samples_, uint64_t valueNs_)
+{
+    if (samples_->count == samples_->capacity) {
+        size_t newCapacity = samples_->capacity ? (samples_->capacity * 2) : 1024;
+        samples_->samples  = (uint64_t*)(realloc(samples_->samples, newCapacity * sizeof(uint64_t)));
+        samples_->capacity = newCapacity;
+    }
+    samples_->samples[samples_->count++] = valueNs_;
+}
+
+//---------------------------------------------------------------------------
+static int bench_compare_u64(const void* a_, const void* b_)
+{
+    uint64_t a = *(const uint64_t*)a_;
+    uint64_t b = *(const uint64_t*)b_;
+    return (a > b) - (a < b);
+}
+
+//---------------------------------------------------------------------------
+uint64_t bench_samples_percentile(bench_samples_t* samples_, double percentile_)
+{
+    if (samples_->count == 0) {
+        return 0;
+    }
+    qsort(samples_->samples, samples_->count, sizeof(uint64_t), bench_compare_u64);
+
+    size_t index = (size_t)((percentile_ / 100.0) * (double)(samples_->count - 1) + 0.5);
+    if (index >= samples_->count) {
+        index = samples_->count - 1;
+    }
+    return samples_->samples[index];
+}
+
+//---------------------------------------------------------------------------
+void bench_report_latency(const char* suite_, const char* case_, bench_samples_t* samples_)
+{
+    bench_collect(suite_, case_, true, (double)bench_samples_percentile(samples_, 99.0));
+    if (benchJson) {
+        bench_json_begin(suite_, case_);
+        printf(",\"n\":%zu,\"min_ns\":%llu,\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,"
+               "\"max_ns\":%llu}\n",
+               samples_->count,
+               (unsigned long long)bench_samples_percentile(samples_, 0.0),
+               (unsigned long long)bench_samples_percentile(samples_, 50.0),
+               (unsigned long long)bench_samples_percentile(samples_, 90.0),
+               (unsigned long long)bench_samples_percentile(samples_, 99.0),
+               (unsigned long long)bench_samples_percentile(samples_, 99.9),
+               (unsigned long long)bench_samples_percentile(samples_, 100.0));
+        return;
+    }
+    printf("%s/%s: n=%zu min=%.1fus p50=%.1fus p90=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus\n",
+           suite_,
+           case_,
+           samples_->count,
+           bench_samples_percentile(samples_, 0.0) / 1000.0,
+           bench_samples_percentile(samples_, 50.0) / 1000.0,
+           bench_samples_percentile(samples_, 90.0) / 1000.0,
+           bench_samples_percentile(samples_, 99.0) / 1000.0,
+           bench_samples_percentile(samples_, 99.9) / 1000.0,
+           bench_samples_percentile(samples_, 100.0) / 1000.0);
+}
+
+//---------------------------------------------------------------------------
+void bench_report_throughput(const char* suite_, const char* case_, const bench_throughput_t* result_)
+{
+    double nsPerOp     = result_->ops ? ((double)result_->elapsedNs / result_->ops) : 0.0;
+    double bytesPerSec = result_->elapsedNs ? ((result_->bytes * (double)NSEC_PER_SEC) / result_->elapsedNs) : 0.0;
+    bench_collect(suite_, case_, false, nsPerOp);
+    if (benchJson) {
+        bench_json_begin(suite_, case_);
+        printf(",\"ops\":%llu,\"bytes\":%llu,\"elapsed_ns\":%llu,\"ns_per_op\":%.3f,\"bytes_per_s\":%.0f}\n",
+               (unsigned long long)result_->ops,
+               (unsigned long long)result_->bytes,
+               (unsigned long long)result_->elapsedNs,
+               nsPerOp,
+               bytesPerSec);
+        return;
+    }
+    printf("%s/%s: ops=%llu cost=%.2fns/op rate=%.1fMB/s\n",
+           suite_,
+           case_,
+           (unsigned long long)result_->ops,
+           nsPerOp,
+           bytesPerSec / 1e6);
+}
+
+//---------------------------------------------------------------------------
+bool bench_loopback_pair(int* clientFd_, int* serverFd_)
+{
+    int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        printf("error creating socket\n");
+        return false;
+    }
+
+    struct sockaddr_in addr = {};
+    addr.sin_family         = AF_INET;
+    addr.sin_addr.s_addr    = htonl(INADDR_LOOPBACK);
+    addr.sin_port           = 0;
+
+    socklen_t addrLen = sizeof(addr);
+    if ((bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) < 0) || (listen(listenFd, 1) < 0)
+        || (getsockname(listenFd, (struct sockaddr*)&addr, &addrLen) < 0)) {
+        printf("error setting up loopback listener\n");
+        close(listenFd);
+        return false;
+    }
+
+    int clientFd = socket(AF_INET, SOCK_STREAM, 0);
+    if ((clientFd < 0) || (connect(clientFd, (struct sockaddr*)&addr, sizeof(addr)) < 0)) {
+        printf("error connecting loopback socket\n");
+        close(listenFd);
+        return false;
+    }
+
+    int serverFd = accept(listenFd, NULL, NULL);
+    close(listenFd);
+    if (serverFd < 0) {
+        printf("error accepting loopback socket\n");
+        close(clientFd);
+        return false;
+    }
+
+    *clientFd_ = clientFd;
+    *serverFd_ = serverFd;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+void bench_read_frames(int fd_, void (*onRead_)(int fd_, void* arg_), bench_frame_handler_t handler_, void* arg_)
+{
+    slip_decode_message_t* decode = slip_decode_message_create(4096);
+    slip_decode_begin(decode);
+
+    bool running = true;
+    while (running) {
+        uint8_t buf[4096];
+        int     nRead = read(fd_, buf, sizeof(buf));
+        if (nRead <= 0) {
+            break;
+        }
+        if (onRead_) {
+            onRead_(fd_, arg_);
+        }
+
+        for (int i = 0; (i < nRead) && running; i++) {
+            slip_decode_return_t rc = slip_decode_byte(decode, buf[i]);
+            if (rc == SlipDecodeEndOfFrame) {
+                tlvc_data_t tlvc;
+                if (tlvc_decode_data(&tlvc, decode->raw, decode->index)) {
+                    running = handler_(tlvc.header.tag, tlvc.data, tlvc.dataLen, arg_);
+                }
+                slip_decode_begin(decode);
+            } else if (rc != SlipDecodeOk) {
+                slip_decode_begin(decode);
+            }
+        }
+    }
+
+    slip_decode_message_destroy(decode);
+}
+
+//---------------------------------------------------------------------------
+static void usage(void)
+{
+    printf("usage: netstick_bench [-j|--json] [suite] [suite options]\n"
+           "  -j, --json   print results as JSON lines, tagged with the machine and compiler\n"
+           "suites:\n");
+    for (size_t i = 0; i < sizeof(benchSuites) / sizeof(benchSuites[0]); i++) {
+        printf("  %-12s %s\n", benchSuites[i].name, benchSuites[i].description);
+    }
+}
+
+//---------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+    if ((argc > 1) && (!strcmp(argv[1], "-j") || !strcmp(argv[1], "--json"))) {
+        benchJson = true;
+        argc--;
+        argv++;
+    }
+    if (argc < 2) {
+        usage();
+        return -1;
+    }
+
+    for (size_t i = 0; i < sizeof(benchSuites) / sizeof(benchSuites[0]); i++) {
+        if (!strcmp(argv[1], benchSuites[i].name)) {
+            return benchSuites[i].run(argc - 1, argv + 1);
+        }
+    }
+
+    usage();
+    return -1;
+}
@@ -0,0 +1,178 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+// A benchmark suite, selected by name on the netstick_bench command line
+typedef struct {
+    const char* name;                       //!< Name used to select the suite
+    const char* description;                //!< One-line description for the usage text
+    int (*run)(int argc_, char** argv_);    //!< Entry point; argv_[0] is the suite name
+} bench_suite_t;
+
+//---------------------------------------------------------------------------
+// Outcome of a throughput measurement
+typedef struct {
+    uint64_t ops;       //!< Operations timed
+    uint64_t bytes;     //!< Payload bytes processed by those operations
+    uint64_t elapsedNs; //!< Time taken
+} bench_throughput_t;
+
+//---------------------------------------------------------------------------
+// Whether results are printed as JSON lines (netstick_bench --json), one object
+// per result, tagged with the machine and compiler so runs can be compared
+extern bool benchJson;
+
+//---------------------------------------------------------------------------
+// Headline figure of one result: cost per operation for throughput results,
+// the 99th percentile for latency results
+typedef struct {
+    char   suite[32];   //!< Suite the result belongs to
+    char   name[64];    //!< Case within the suite
+    bool   latency;     //!< True for a p99 latency, false for a cost per operation
+    double valueNs;     //!< ns_per_op or p99_ns
+} bench_result_t;
+
+//---------------------------------------------------------------------------
+// Growable array of results
+typedef struct {
+    bench_result_t* results;    //!< Result data
+    size_t          count;      //!< Number of results recorded
+    size_t          capacity;   //!< Number of results allocated
+} bench_results_t;
+
+//---------------------------------------------------------------------------
+// When set, every result reported by a suite is also added here (used by the
+// check suite to compare a run against a baseline)
+extern bench_results_t* benchResults;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief bench_arch return the machine architecture results are tagged with
+ */
+const char* bench_arch(void);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief bench_compiler return the compiler results are tagged with
+ */
+const char* bench_compiler(void);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief bench_flags return the compiler flags results are tagged with
+ */
+const char* bench_flags(void);
+
+//---------------------------------------------------------------------------
+// Growable array of latency samples, in nanoseconds
+typedef struct {
+    uint64_t* samples;  //!< Sample data
+    size_t    count;    //!< Number of samples recorded
+    size_t    capacity; //!< Number of samples allocated
+} bench_samples_t;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief bench_samples_init prepare a sample array
+ * @param samples_ object to initialize
+ * @param capacity_ initial number of samples to allocate room for
+ */
+void bench_samples_init(bench_samples_t* samples_, size_t capacity_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief bench_samples_free release the memory held by a sample array
+ * @param samples_ object to free
+ */
+void bench_samples_free(bench_samples_t* samples_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief bench_samples_add record a sample
+ * @param samples_ array to add to
+ * @param valueNs_ sample value in nanoseconds
+ */
+void bench_samples_add(bench_samples_t* samples_, uint64_t valueNs_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief bench_samples_percentile return the given percentile of the recorded
+ * samples.  Sorts the samples in place.
+ * @param samples_ array to query
+ * @param percentile_ percentile, from 0.0 to 100.0
+ * @return sample value at the given percentile, 0 if there are no samples
+ */
+uint64_t bench_samples_percentile(bench_samples_t* samples_, double percentile_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief bench_report_latency print the distribution of a set of latency samples
+ * @param suite_ name of the suite the samples belong to
+ * @param case_ name of the case within the suite
+ * @param samples_ latency samples, in nanoseconds
+ */
+void bench_report_latency(const char* suite_, const char* case_, bench_samples_t* samples_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief bench_report_throughput print the cost per operation and the data rate
+ * of a throughput measurement
+ * @param suite_ name of the suite the measurement belongs to
+ * @param case_ name of the case within the suite
+ * @param result_ measurement to print
+ */
+void bench_report_throughput(const char* suite_, const char* case_, const bench_throughput_t* result_);
+
+//---------------------------------------------------------------------------
+/**
+ * Function called for each intact frame read by bench_read_frames().  Returns
+ * false to stop reading.
+ */
+typedef bool (*bench_frame_handler_t)(uint16_t tag_, const void* data_, size_t dataLen_, void* arg_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief bench_loopback_pair create a connected pair of TCP sockets over the
+ * IPv4 loopback interface.
+ * @param clientFd_ [out] connecting end of the connection
+ * @param serverFd_ [out] accepted end of the connection
+ * @return true on success
+ */
+bool bench_loopback_pair(int* clientFd_, int* serverFd_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief bench_read_frames read slip-framed tlvc messages from a blocking
+ * socket until the handler returns false or the socket closes.
+ * @param fd_ socket to read from
+ * @param onRead_ called after every read() on the socket (may be NULL)
+ * @param handler_ called for every intact frame
+ * @param arg_ argument passed to both functions
+ */
+void bench_read_frames(int fd_, void (*onRead_)(int fd_, void* arg_), bench_frame_handler_t handler_, void* arg_);
+
+//---------------------------------------------------------------------------
+// Suite entry points
+int bench_transport(int argc_, char** argv_);
+int bench_relmouse(int argc_, char** argv_);
+int bench_remap(int argc_, char** argv_);
+int bench_rtload(int argc_, char** argv_);
+int bench_busypoll(int argc_, char** argv_);
+int bench_pipeline(int argc_, char** argv_);
+int bench_replay(int argc_, char** argv_);
+int bench_protocol(int argc_, char** argv_);
+int bench_loopback(int argc_, char** argv_);
+int bench_check(int argc_, char** argv_);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
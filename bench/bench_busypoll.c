@@ -0,0 +1,225 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+//
+// Server wakeup benchmark.  Runs the netstickd event loop (server_run()) in each
+// poll mode, sends it timestamped reports over loopback at a fixed rate, and
+// measures the time from send() until the server's read handler runs, along
+// with the CPU time the server thread burns doing it.
+//
+// Over loopback there is no NIC queue for SO_BUSY_POLL to poll, so this shows
+// the benefit of not sleeping in epoll_wait(); on a real NIC whose driver
+// supports busy polling, the busy and spin modes also skip interrupt latency.
+#include "bench.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "server.h"
+#include "timestamp.h"
+
+//---------------------------------------------------------------------------
+#define BENCH_BUSYPOLL_PORT (19500)
+
+//---------------------------------------------------------------------------
+// State of the single client connection, shared with the server's handlers
+typedef struct {
+    bench_samples_t wakeup;     //!< Time from send() until the read handler ran, per report
+    uint8_t         partial[sizeof(uint64_t)];
+    size_t          partialLen;
+} bench_busypoll_conn_t;
+
+//---------------------------------------------------------------------------
+static bench_busypoll_conn_t benchConn;
+
+//---------------------------------------------------------------------------
+static void* bench_busypoll_connect(int clientFd_)
+{
+    int enable = 1;
+    setsockopt(clientFd_, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    benchConn.partialLen = 0;
+    return &benchConn;
+}
+
+//---------------------------------------------------------------------------
+static void bench_busypoll_disconnect(void* clientContext_)
+{
+    (void)clientContext_;
+}
+
+//---------------------------------------------------------------------------
+static bool bench_busypoll_read(int clientFd_, void* clientContext_)
+{
+    bench_busypoll_conn_t* conn = (bench_busypoll_conn_t*)clientContext_;
+    uint64_t               now  = timestamp_now_ns();
+
+    while (1) {
+        uint8_t buf[256];
+        int     nRead = read(clientFd_, buf, sizeof(buf));
+        if (nRead == 0) {
+            return false;
+        }
+        if (nRead < 0) {
+            return (errno == EAGAIN) || (errno == EINTR);
+        }
+
+        // Reports are bare 8-byte timestamps
+        for (int i = 0; i < nRead; i++) {
+            conn->partial[conn->partialLen++] = buf[i];
+            if (conn->partialLen == sizeof(uint64_t)) {
+                uint64_t sent;
+                memcpy(&sent, conn->partial, sizeof(sent));
+                bench_samples_add(&conn->wakeup, now - sent);
+                conn->partialLen = 0;
+            }
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+static void* bench_busypoll_serve(void* arg_)
+{
+    server_run((server_context_t*)arg_);
+    return NULL;
+}
+
+//---------------------------------------------------------------------------
+static uint64_t bench_busypoll_thread_cpu_ns(pthread_t thread_)
+{
+    clockid_t       clock;
+    struct timespec ts = {};
+    if ((pthread_getcpuclockid(thread_, &clock) != 0) || (clock_gettime(clock, &ts) != 0)) {
+        return 0;
+    }
+    return ((uint64_t)ts.tv_sec * NSEC_PER_SEC) + ts.tv_nsec;
+}
+
+//---------------------------------------------------------------------------
+static bool bench_busypoll_run_mode(const server_poll_config_t* config_, int port_, int count_, int rateHz_)
+{
+    client_handlers_t handlers = { .onConnect    = bench_busypoll_connect,
+                                   .onDisconnect = bench_busypoll_disconnect,
+                                   .onReadData   = bench_busypoll_read };
+
+    server_context_t* server = server_create(port_, 1, &handlers);
+    if (!server) {
+        return false;
+    }
+    server_set_poll_config(server, config_);
+    bench_samples_init(&benchConn.wakeup, count_);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, bench_busypoll_serve, server);
+
+    struct sockaddr_in addr = {};
+    addr.sin_family         = AF_INET;
+    addr.sin_addr.s_addr    = htonl(INADDR_LOOPBACK);
+    addr.sin_port           = htons(port_);
+
+    int fd     = socket(AF_INET, SOCK_STREAM, 0);
+    int enable = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    bool ok = (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+
+    uint64_t period   = NSEC_PER_SEC / rateHz_;
+    uint64_t start    = timestamp_now_ns() + (10 * NSEC_PER_MSEC);
+    uint64_t cpuStart = bench_busypoll_thread_cpu_ns(thread);
+    for (int i = 0; (i < count_) && ok; i++) {
+        struct timespec deadline = timestamp_to_timespec(start + (period * i));
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) != 0) {}
+
+        uint64_t now = timestamp_now_ns();
+        ok           = (write(fd, &now, sizeof(now)) == sizeof(now));
+    }
+
+    // Give the last report time to land before measuring CPU usage
+    struct timespec settle = timestamp_to_timespec(period);
+    nanosleep(&settle, NULL);
+    uint64_t cpuNs  = bench_busypoll_thread_cpu_ns(thread) - cpuStart;
+    uint64_t wallNs = timestamp_now_ns() - start;
+
+    // Closing the connection wakes the server, which then notices the stop request
+    server_stop(server);
+    close(fd);
+    pthread_join(thread, NULL);
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s", server_poll_mode_to_string(config_->mode));
+    if (config_->mode == ServerPollBusy) {
+        snprintf(name, sizeof(name), "%s-%dus", server_poll_mode_to_string(config_->mode), config_->spinUs);
+    }
+    bench_report_latency("busypoll", name, &benchConn.wakeup);
+    printf("busypoll/%s: server-cpu=%.1f%%\n", name, (100.0 * cpuNs) / wallNs);
+
+    bench_samples_free(&benchConn.wakeup);
+    server_destroy(server);
+    return ok;
+}
+
+//---------------------------------------------------------------------------
+int bench_busypoll(int argc_, char** argv_)
+{
+    int count  = 2000;
+    int rateHz = 1000;
+    int port   = BENCH_BUSYPOLL_PORT;
+
+    server_poll_config_t config;
+    server_poll_config_init(&config);
+
+    static const struct option options[] = { { "count", required_argument, NULL, 'n' },
+                                             { "rate", required_argument, NULL, 'r' },
+                                             { "port", required_argument, NULL, 'p' },
+                                             { NULL, 0, NULL, 0 } };
+
+    int opt;
+    while ((opt = getopt_long(argc_, argv_, "n:r:p:", options, NULL)) != -1) {
+        switch (opt) {
+            case 'n': count = atoi(optarg); break;
+            case 'r': rateHz = atoi(optarg); break;
+            case 'p': port = atoi(optarg); break;
+            default: {
+                printf("usage: netstick_bench busypoll [-n count] [-r rate Hz] [-p loopback port]\n");
+                return -1;
+            }
+        }
+    }
+    if ((count <= 0) || (rateHz <= 0) || (port <= 0)) {
+        printf("invalid benchmark parameters\n");
+        return -1;
+    }
+
+    printf("# %d reports at %d Hz over loopback\n", count, rateHz);
+
+    // Spin windows shorter and longer than the report period
+    int periodUs = 1000000 / rateHz;
+    const struct {
+        server_poll_mode_t mode;
+        int                spinUs;
+    } cases[] = { { ServerPollBlocking, 0 },
+                  { ServerPollBusy, periodUs / 4 },
+                  { ServerPollBusy, periodUs * 2 },
+                  { ServerPollSpin, 0 } };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        config.mode   = cases[i].mode;
+        config.spinUs = cases[i].spinUs;
+        if (!bench_busypoll_run_mode(&config, port + (int)i, count, rateHz)) {
+            printf("busypoll benchmark failed for mode %s\n", server_poll_mode_to_string(config.mode));
+            return -1;
+        }
+    }
+    return 0;
+}
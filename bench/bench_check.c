@@ -0,0 +1,539 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+//
+// Performance regression check.  Runs the protocol and loopback suites, then
+// compares each result's headline figure (cost per operation, or p99 latency)
+// against a checked-in baseline, and fails if any result is worse than the
+// baseline by more than its tolerance.  Every run is appended to a history
+// file as one JSON line, so trends are visible between baseline updates.  The
+// suites are run several times and the best figure for each case is kept;
+// when recording a baseline, the median is kept instead.
+//
+// The baseline is a JSON-lines file with one object per result:
+//   {"suite":"protocol","case":"slip_encode/mouse","metric":"ns_per_op","value":10.5,"arch":"x86_64",
+//    "compiler":"gcc 12.2.0","flags":"-Wall -Werror -Os"}
+// An object may carry its own "tolerance" (percent) to override the default
+// for its metric.  Figures are only compared with those recorded on the same
+// architecture, by the same compiler with the same flags; with none for this
+// build, the check is skipped.  Use -u to record this build's figures,
+// replacing any earlier ones for it and keeping the rest.
+#include "bench.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+//---------------------------------------------------------------------------
+#define BENCH_CHECK_DEFAULT_BASELINE "bench/baseline.json"
+#define BENCH_CHECK_DEFAULT_HISTORY "netstick-bench-history.jsonl"
+#define BENCH_CHECK_DEFAULT_COUNT "50000"
+#define BENCH_CHECK_DEFAULT_REPEATS (3)
+#define BENCH_CHECK_MAX_ROUNDS (3)     //!< Rounds of repeats run before a regression is believed
+#define BENCH_CHECK_THROUGHPUT_TOLERANCE (15.0)    //!< Default slowdown allowed in ns_per_op, percent
+#define BENCH_CHECK_LATENCY_TOLERANCE (50.0)       //!< Default increase allowed in p99_ns, percent
+#define BENCH_CHECK_ESCAPES_TOLERANCE (100.0)      //!< Slowdown recorded for escape-heavy cases, percent
+#define BENCH_CHECK_MIN_SLACK_NS (10.0)            //!< Smallest slowdown allowed in ns_per_op, whatever the tolerance
+#define BENCH_CHECK_SKIPPED (77)                   //!< Exit code when there is no baseline to compare with
+#define BENCH_CHECK_MAX_LINE (512)                 //!< Longest line in the baseline file
+
+//---------------------------------------------------------------------------
+// One line of the baseline file
+typedef struct {
+    bench_result_t result;      //!< Baseline figure
+    double         tolerance;   //!< Percentage the figure may grow by, < 0 for the metric's default
+    bool           matched;     //!< Whether the current run produced this result
+} bench_check_baseline_t;
+
+//---------------------------------------------------------------------------
+// Copy the string value of "key_" in a JSON line
+static bool bench_check_string(const char* line_, const char* key_, char* value_, size_t size_)
+{
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\":\"", key_);
+    const char* start = strstr(line_, pattern);
+    if (!start) {
+        return false;
+    }
+    start += strlen(pattern);
+    const char* end = strchr(start, '"');
+    if (!end || ((size_t)(end - start) >= size_)) {
+        return false;
+    }
+    memcpy(value_, start, end - start);
+    value_[end - start] = '\0';
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Read the numeric value of "key_" in a JSON line
+static bool bench_check_number(const char* line_, const char* key_, double* value_)
+{
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key_);
+    const char* start = strstr(line_, pattern);
+    if (!start) {
+        return false;
+    }
+    char* end;
+    *value_ = strtod(start + strlen(pattern), &end);
+    return end != start + strlen(pattern);
+}
+
+//---------------------------------------------------------------------------
+static const char* bench_check_metric(const bench_result_t* result_)
+{
+    return result_->latency ? "p99_ns" : "ns_per_op";
+}
+
+//---------------------------------------------------------------------------
+// Whether a baseline line was recorded on this machine's architecture, by this
+// build's compiler and flags
+static bool bench_check_this_build(const char* line_)
+{
+    char arch[32];
+    char compiler[128];
+    char flags[256];
+    return bench_check_string(line_, "arch", arch, sizeof(arch)) && !strcmp(arch, bench_arch())
+           && bench_check_string(line_, "compiler", compiler, sizeof(compiler)) && !strcmp(compiler, bench_compiler())
+           && bench_check_string(line_, "flags", flags, sizeof(flags)) && !strcmp(flags, bench_flags());
+}
+
+//---------------------------------------------------------------------------
+// Load the entries recorded by this build
+static bool bench_check_load(const char* path_, bench_check_baseline_t** baseline_, size_t* count_)
+{
+    FILE* file = fopen(path_, "r");
+    if (!file) {
+        printf("error opening baseline %s\n", path_);
+        return false;
+    }
+
+    bench_check_baseline_t* baseline = NULL;
+    size_t                  count    = 0;
+    char                    line[BENCH_CHECK_MAX_LINE];
+    int                     lineNum = 0;
+    while (fgets(line, sizeof(line), file)) {
+        lineNum++;
+        if (!strchr(line, '{') || !bench_check_this_build(line)) {
+            continue;
+        }
+
+        bench_check_baseline_t entry = {};
+        char                   metric[16];
+        if (!bench_check_string(line, "suite", entry.result.suite, sizeof(entry.result.suite))
+            || !bench_check_string(line, "case", entry.result.name, sizeof(entry.result.name))
+            || !bench_check_string(line, "metric", metric, sizeof(metric))
+            || !bench_check_number(line, "value", &entry.result.valueNs)
+            || (strcmp(metric, "ns_per_op") && strcmp(metric, "p99_ns"))) {
+            printf("%s:%d: malformed baseline entry\n", path_, lineNum);
+            free(baseline);
+            fclose(file);
+            return false;
+        }
+        entry.result.latency = !strcmp(metric, "p99_ns");
+        if (!bench_check_number(line, "tolerance", &entry.tolerance)) {
+            entry.tolerance = -1.0;
+        }
+
+        baseline          = (bench_check_baseline_t*)(realloc(baseline, (count + 1) * sizeof(bench_check_baseline_t)));
+        baseline[count++] = entry;
+    }
+    fclose(file);
+
+    *baseline_ = baseline;
+    *count_    = count;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Tolerance recorded with a new baseline entry, < 0 for the metric's default.
+// Cases dominated by SLIP escaping swing by over half between runs of the same
+// build (the escape branches mispredict differently from one run to the next),
+// so they are only held to catching gross slowdowns.
+static double bench_check_recorded_tolerance(const bench_result_t* result_)
+{
+    return strstr(result_->name, "escapes") ? BENCH_CHECK_ESCAPES_TOLERANCE : -1.0;
+}
+
+//---------------------------------------------------------------------------
+// Replace this build's entries in the baseline with the results of this run,
+// keeping those of other builds
+static bool bench_check_write_baseline(const char* path_, const bench_results_t* results_)
+{
+    char*  others    = NULL;
+    size_t othersLen = 0;
+    FILE*  file      = fopen(path_, "r");
+    if (file) {
+        char line[BENCH_CHECK_MAX_LINE];
+        while (fgets(line, sizeof(line), file)) {
+            if (!strchr(line, '{') || bench_check_this_build(line)) {
+                continue;
+            }
+            size_t len = strlen(line);
+            others     = (char*)(realloc(others, othersLen + len + 1));
+            memcpy(others + othersLen, line, len + 1);
+            othersLen += len;
+        }
+        fclose(file);
+    }
+
+    file = fopen(path_, "w");
+    if (!file) {
+        printf("error creating baseline %s\n", path_);
+        free(others);
+        return false;
+    }
+    if (others) {
+        fputs(others, file);
+        free(others);
+    }
+    for (size_t i = 0; i < results_->count; i++) {
+        const bench_result_t* result = &results_->results[i];
+        fprintf(file,
+                "{\"suite\":\"%s\",\"case\":\"%s\",\"metric\":\"%s\",\"value\":%.3f",
+                result->suite,
+                result->name,
+                bench_check_metric(result),
+                result->valueNs);
+        double tolerance = bench_check_recorded_tolerance(result);
+        if (tolerance >= 0.0) {
+            fprintf(file, ",\"tolerance\":%.0f", tolerance);
+        }
+        fprintf(file,
+                ",\"arch\":\"%s\",\"compiler\":\"%s\",\"flags\":\"%s\"}\n",
+                bench_arch(),
+                bench_compiler(),
+                bench_flags());
+    }
+    fclose(file);
+    printf("wrote %zu baseline entries for %s, %s, %s to %s\n",
+           results_->count,
+           bench_arch(),
+           bench_compiler(),
+           bench_flags(),
+           path_);
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Whether two results are for the same case and metric
+static bool bench_check_same(const bench_result_t* a_, const bench_result_t* b_)
+{
+    return (a_->latency == b_->latency) && !strcmp(a_->suite, b_->suite) && !strcmp(a_->name, b_->name);
+}
+
+//---------------------------------------------------------------------------
+// Run a suite with its own argument vector
+static int bench_check_run(int (*suite_)(int, char**), int argc_, char** argv_)
+{
+    optind = 0;
+    return suite_(argc_, argv_);
+}
+
+//---------------------------------------------------------------------------
+// Fold results of repeated runs into one per case, keeping the best: noise
+// from other work on the machine only ever makes a figure worse
+static void bench_check_keep_best(bench_results_t* results_)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < results_->count; i++) {
+        bench_result_t* result = &results_->results[i];
+        size_t          j      = 0;
+        while ((j < kept) && !bench_check_same(&results_->results[j], result)) {
+            j++;
+        }
+        if (j == kept) {
+            results_->results[kept++] = *result;
+        } else if (result->valueNs < results_->results[j].valueNs) {
+            results_->results[j].valueNs = result->valueNs;
+        }
+    }
+    results_->count = kept;
+}
+
+//---------------------------------------------------------------------------
+static int bench_check_compare_values(const void* a_, const void* b_)
+{
+    double a = *(const double*)a_;
+    double b = *(const double*)b_;
+    return (a > b) - (a < b);
+}
+
+//---------------------------------------------------------------------------
+// Fold results of repeated runs into one per case, keeping the median.  This is
+// what a baseline records: a typical figure, rather than the luckiest, so that
+// the best of a later run's repeats isn't held to an outlier.
+static void bench_check_keep_median(bench_results_t* results_)
+{
+    double* values = (double*)(malloc(results_->count * sizeof(double)));
+    if (!values) {
+        bench_check_keep_best(results_);
+        return;
+    }
+
+    // Every entry before i belongs to a case already folded into the first kept
+    // slots, so those entries can be overwritten
+    size_t kept = 0;
+    for (size_t i = 0; i < results_->count; i++) {
+        const bench_result_t* result = &results_->results[i];
+        size_t                j      = 0;
+        while ((j < kept) && !bench_check_same(&results_->results[j], result)) {
+            j++;
+        }
+        if (j < kept) {
+            continue;
+        }
+
+        size_t count = 0;
+        for (size_t k = i; k < results_->count; k++) {
+            if (bench_check_same(&results_->results[k], result)) {
+                values[count++] = results_->results[k].valueNs;
+            }
+        }
+        qsort(values, count, sizeof(double), bench_check_compare_values);
+        results_->results[kept]           = *result;
+        results_->results[kept++].valueNs = values[count / 2];
+    }
+    results_->count = kept;
+    free(values);
+}
+
+//---------------------------------------------------------------------------
+static bench_check_baseline_t* bench_check_find(bench_check_baseline_t* baseline_,
+                                                size_t                  count_,
+                                                const bench_result_t*   result_)
+{
+    for (size_t i = 0; i < count_; i++) {
+        if (bench_check_same(&baseline_[i].result, result_)) {
+            return &baseline_[i];
+        }
+    }
+    return NULL;
+}
+
+//---------------------------------------------------------------------------
+// Highest acceptable figure for a result.  The cheapest cases take only a few
+// nanoseconds, and move by more than their percentage from run to run with code
+// and data alignment alone, so every cost gets at least a fixed allowance.
+static double bench_check_limit(const bench_check_baseline_t* baseline_, double throughputTol_, double latencyTol_)
+{
+    double tolerance = baseline_->tolerance;
+    if (tolerance < 0.0) {
+        tolerance = baseline_->result.latency ? latencyTol_ : throughputTol_;
+    }
+    double limit = baseline_->result.valueNs * (1.0 + (tolerance / 100.0));
+    if (!baseline_->result.latency && (limit < baseline_->result.valueNs + BENCH_CHECK_MIN_SLACK_NS)) {
+        limit = baseline_->result.valueNs + BENCH_CHECK_MIN_SLACK_NS;
+    }
+    return limit;
+}
+
+//---------------------------------------------------------------------------
+static int bench_check_count_regressions(const bench_results_t*  results_,
+                                         bench_check_baseline_t* baseline_,
+                                         size_t                  count_,
+                                         double                  throughputTol_,
+                                         double                  latencyTol_)
+{
+    int regressions = 0;
+    for (size_t i = 0; i < results_->count; i++) {
+        bench_check_baseline_t* match = bench_check_find(baseline_, count_, &results_->results[i]);
+        if (match && (results_->results[i].valueNs > bench_check_limit(match, throughputTol_, latencyTol_))) {
+            regressions++;
+        }
+    }
+    return regressions;
+}
+
+//---------------------------------------------------------------------------
+int bench_check(int argc_, char** argv_)
+{
+    const char* baselinePath        = BENCH_CHECK_DEFAULT_BASELINE;
+    const char* historyPath         = BENCH_CHECK_DEFAULT_HISTORY;
+    const char* count               = BENCH_CHECK_DEFAULT_COUNT;
+    double      throughputTolerance = BENCH_CHECK_THROUGHPUT_TOLERANCE;
+    double      latencyTolerance    = BENCH_CHECK_LATENCY_TOLERANCE;
+    int         repeats             = BENCH_CHECK_DEFAULT_REPEATS;
+    bool        update              = false;
+
+    static const struct option options[] = { { "baseline", required_argument, NULL, 'b' },
+                                             { "history", required_argument, NULL, 'H' },
+                                             { "count", required_argument, NULL, 'n' },
+                                             { "repeats", required_argument, NULL, 'R' },
+                                             { "throughput-tolerance", required_argument, NULL, 't' },
+                                             { "latency-tolerance", required_argument, NULL, 'l' },
+                                             { "update", no_argument, NULL, 'u' },
+                                             { NULL, 0, NULL, 0 } };
+
+    int opt;
+    while ((opt = getopt_long(argc_, argv_, "b:H:n:R:t:l:u", options, NULL)) != -1) {
+        switch (opt) {
+            case 'b': baselinePath = optarg; break;
+            case 'H': historyPath = optarg; break;
+            case 'n': count = optarg; break;
+            case 'R': repeats = atoi(optarg); break;
+            case 't': throughputTolerance = atof(optarg); break;
+            case 'l': latencyTolerance = atof(optarg); break;
+            case 'u': update = true; break;
+            default: {
+                printf("usage: netstick_bench check [-b baseline] [-H history] [-n protocol count] [-R repeats] "
+                       "[-t throughput tolerance %%] [-l latency tolerance %%] [-u update baseline]\n");
+                return -1;
+            }
+        }
+    }
+    if ((throughputTolerance < 0.0) || (latencyTolerance < 0.0) || (repeats <= 0)) {
+        printf("invalid check parameters\n");
+        return -1;
+    }
+
+    bench_check_baseline_t* baseline      = NULL;
+    size_t                  baselineCount = 0;
+    if (!update && !bench_check_load(baselinePath, &baseline, &baselineCount)) {
+        return -1;
+    }
+    if (!update && (baselineCount == 0)) {
+        printf("check: skipped, %s has no baseline for %s, %s, %s (record one with -u)\n",
+               baselinePath,
+               bench_arch(),
+               bench_compiler(),
+               bench_flags());
+        return BENCH_CHECK_SKIPPED;
+    }
+
+    bench_results_t results = {};
+    benchResults            = &results;
+
+    char* protocolArgs[] = { (char*)"protocol", (char*)"-n", (char*)count, NULL };
+    char* loopbackArgs[] = { (char*)"loopback", NULL };
+    bool  ran            = true;
+
+    // A slower figure may just be a busy machine.  Keep running until every
+    // result is within its limit, or the slowdown has persisted for a few rounds.
+    for (int round = 0; (round < BENCH_CHECK_MAX_ROUNDS) && ran; round++) {
+        for (int i = 0; (i < repeats) && ran; i++) {
+            ran = (bench_check_run(bench_protocol, 3, protocolArgs) == 0)
+                  && (bench_check_run(bench_loopback, 1, loopbackArgs) == 0);
+        }
+        if (update) {
+            bench_check_keep_median(&results);
+            break;
+        }
+        bench_check_keep_best(&results);
+        int regressions
+            = bench_check_count_regressions(&results, baseline, baselineCount, throughputTolerance, latencyTolerance);
+        if (regressions == 0) {
+            break;
+        }
+        if ((round + 1) < BENCH_CHECK_MAX_ROUNDS) {
+            printf("# %d results over their limit, running again to confirm\n", regressions);
+        }
+    }
+    benchResults = NULL;
+
+    if (!ran) {
+        printf("check: a benchmark failed to run\n");
+        free(results.results);
+        free(baseline);
+        return -1;
+    }
+    if (update) {
+        bool ok = bench_check_write_baseline(baselinePath, &results);
+        free(results.results);
+        return ok ? 0 : -1;
+    }
+
+    // Compare, recording each result in the history line as we go
+    FILE* history = fopen(historyPath, "a");
+    if (!history) {
+        printf("warning: can't append to history file %s\n", historyPath);
+    } else {
+        fprintf(history,
+                "{\"time\":%lld,\"arch\":\"%s\",\"compiler\":\"%s\",\"flags\":\"%s\",\"results\":[",
+                (long long)time(NULL),
+                bench_arch(),
+                bench_compiler(),
+                bench_flags());
+    }
+
+    printf("# comparing against %s\n", baselinePath);
+    int regressions = 0;
+    for (size_t i = 0; i < results.count; i++) {
+        const bench_result_t*   result = &results.results[i];
+        bench_check_baseline_t* match  = bench_check_find(baseline, baselineCount, result);
+
+        const char* status = "new";
+        double      limit  = 0.0;
+        if (match) {
+            match->matched = true;
+            limit          = bench_check_limit(match, throughputTolerance, latencyTolerance);
+            status         = "ok";
+            if (result->valueNs > limit) {
+                status = "REGRESSION";
+                regressions++;
+            }
+            printf("%-10s %s/%s %s=%.1f baseline=%.1f limit=%.1f (%+.0f%%)\n",
+                   status,
+                   result->suite,
+                   result->name,
+                   bench_check_metric(result),
+                   result->valueNs,
+                   match->result.valueNs,
+                   limit,
+                   match->result.valueNs ? ((result->valueNs / match->result.valueNs) - 1.0) * 100.0 : 0.0);
+        } else {
+            printf("%-10s %s/%s %s=%.1f (not in baseline)\n",
+                   status,
+                   result->suite,
+                   result->name,
+                   bench_check_metric(result),
+                   result->valueNs);
+        }
+
+        if (history) {
+            fprintf(history,
+                    "%s{\"suite\":\"%s\",\"case\":\"%s\",\"metric\":\"%s\",\"value\":%.3f",
+                    i ? "," : "",
+                    result->suite,
+                    result->name,
+                    bench_check_metric(result),
+                    result->valueNs);
+            if (match) {
+                fprintf(history, ",\"baseline\":%.3f,\"limit\":%.3f", match->result.valueNs, limit);
+            }
+            fprintf(history, ",\"status\":\"%s\"}", status);
+        }
+    }
+
+    // A baseline entry the run no longer produces means a case was renamed or
+    // removed; fail so the baseline gets updated deliberately
+    for (size_t j = 0; j < baselineCount; j++) {
+        if (!baseline[j].matched) {
+            printf("%-10s %s/%s %s (in baseline, not produced by this run)\n",
+                   "MISSING",
+                   baseline[j].result.suite,
+                   baseline[j].result.name,
+                   bench_check_metric(&baseline[j].result));
+            regressions++;
+        }
+    }
+
+    if (history) {
+        fprintf(history, "],\"regressions\":%d,\"passed\":%s}\n", regressions, regressions ? "false" : "true");
+        fclose(history);
+    }
+
+    printf("check: %s, %d of %zu results outside their tolerance\n",
+           regressions ? "FAILED" : "passed",
+           regressions,
+           results.count);
+
+    free(results.results);
+    free(baseline);
+    return regressions ? -1 : 0;
+}
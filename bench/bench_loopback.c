@@ -0,0 +1,269 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+//
+// End-to-end loopback benchmark.  A client thread registers a gamepad and sends
+// timed reports with message_transmit(), as netstick does, to netstickd's own
+// server (jsproxy_server_create()) over loopback, which applies them to an
+// output sink that, like -o null, only notes their arrival.  First the reports
+// are paced, to measure the latency from send to apply, then flooded, to
+// measure how many reports per second make it all the way through.
+#include "bench.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "joystick.h"
+#include "jsproxy.h"
+#include "message.h"
+#include "server.h"
+#include "timestamp.h"
+
+//---------------------------------------------------------------------------
+// What the server has done with the reports, as seen by its output sink
+typedef struct {
+    uint64_t*       sentNs;     //!< When each paced report was sent, by sequence number
+    bench_samples_t latency;    //!< Time from send until the report was applied
+    bool            sampling;   //!< Whether latency is being recorded
+    uint64_t        applied;    //!< Reports applied (read by the client thread)
+    uint64_t        errors;     //!< Reports applied out of order, or more than once
+    bool            finished;   //!< Every report was applied; what follows is the device being released
+} bench_loopback_conn_t;
+
+//---------------------------------------------------------------------------
+static bench_loopback_conn_t benchLoopback;
+
+//---------------------------------------------------------------------------
+static void bench_loopback_config(js_config_t* config_)
+{
+    static const uint32_t axes[] = { ABS_X, ABS_Y, ABS_Z, ABS_RX, ABS_RY, ABS_RZ, ABS_HAT0X, ABS_HAT0Y };
+
+    memset(config_, 0, sizeof(*config_));
+    snprintf(config_->name, sizeof(config_->name), "Benchmark Pad");
+    config_->absAxisCount = sizeof(axes) / sizeof(axes[0]);
+    config_->buttonCount  = 11;
+    for (int i = 0; i < config_->absAxisCount; i++) {
+        config_->absAxis[i]    = axes[i];
+        config_->absAxisMin[i] = (axes[i] >= ABS_HAT0X) ? -1 : -32768;
+        config_->absAxisMax[i] = (axes[i] >= ABS_HAT0X) ? 1 : 32767;
+    }
+    for (int i = 0; i < config_->buttonCount; i++) { config_->buttons[i] = BTN_SOUTH + i; }
+}
+
+//---------------------------------------------------------------------------
+static bool bench_loopback_sink_open(js_context_t*              context_,
+                                     const js_config_t*         config_,
+                                     const js_device_options_t* options_)
+{
+    return true;
+}
+
+//---------------------------------------------------------------------------
+static void bench_loopback_sink_close(js_context_t* context_) {}
+
+//---------------------------------------------------------------------------
+// Discard the events like the null sink, noting when each report got here.
+// Every report moves ABS_X to the low 16 bits of its sequence number, which
+// identifies it.
+static bool bench_loopback_sink_write(js_context_t* context_, const struct input_event* events_, size_t count_)
+{
+    for (size_t i = 0; (i < count_) && !benchLoopback.finished; i++) {
+        if ((events_[i].type != EV_ABS) || (events_[i].code != ABS_X)) {
+            continue;
+        }
+        uint64_t sequence = benchLoopback.applied;
+        if ((uint16_t)(events_[i].value + 32768) != (uint16_t)sequence) {
+            benchLoopback.errors++;
+        }
+        if (benchLoopback.sampling) {
+            bench_samples_add(&benchLoopback.latency, timestamp_now_ns() - benchLoopback.sentNs[sequence]);
+        }
+        __atomic_store_n(&benchLoopback.applied, sequence + 1, __ATOMIC_RELEASE);
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+static const js_sink_ops_t benchLoopbackSink
+    = { "null", bench_loopback_sink_open, bench_loopback_sink_close, bench_loopback_sink_write };
+
+//---------------------------------------------------------------------------
+static void* bench_loopback_serve(void* arg_)
+{
+    server_run((server_context_t*)arg_);
+    return NULL;
+}
+
+//---------------------------------------------------------------------------
+// Send one timed report, moving a stick and now and then pressing a button
+static bool bench_loopback_send(int fd_, const js_config_t* config_, uint8_t* payload_, uint32_t sequence_)
+{
+    size_t   reportSize = joystick_get_report_size(config_);
+    uint8_t* report     = payload_ + sizeof(message_report_header_t);
+    int32_t  tag        = (int32_t)(sequence_ & 0xFFFF) - 32768;
+    int32_t  value      = (int32_t)((sequence_ * 2654435761U) >> 16) - 32768;
+    memcpy(report, &tag, sizeof(tag));
+    memcpy(report + (((sequence_ % 5) + 1) * sizeof(int32_t)), &value, sizeof(value));
+    if ((sequence_ % 8) == 0) {
+        report[(config_->absAxisCount * sizeof(int32_t)) + ((sequence_ / 8) % config_->buttonCount)] ^= 1;
+    }
+
+    message_report_header_t header;
+    header.sequence    = sequence_;
+    header.timestampNs = timestamp_now_ns();
+    memcpy(payload_, &header, sizeof(header));
+    if (benchLoopback.sampling) {
+        benchLoopback.sentNs[sequence_] = header.timestampNs;
+    }
+    return message_transmit(fd_, MessageTagTimedReport, payload_, sizeof(header) + reportSize);
+}
+
+//---------------------------------------------------------------------------
+// Wait for the server to have applied a number of reports
+static bool bench_loopback_wait_applied(uint64_t count_)
+{
+    uint64_t deadline = timestamp_now_ns() + (5 * NSEC_PER_SEC);
+    while (__atomic_load_n(&benchLoopback.applied, __ATOMIC_ACQUIRE) < count_) {
+        if (timestamp_now_ns() > deadline) {
+            printf("loopback: server applied %llu of %llu reports\n",
+                   (unsigned long long)benchLoopback.applied,
+                   (unsigned long long)count_);
+            return false;
+        }
+        sched_yield();
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+int bench_loopback(int argc_, char** argv_)
+{
+    int count  = 2000;
+    int rateHz = 1000;
+    int flood  = 100000;
+    int port   = 0;
+
+    static const struct option options[] = { { "count", required_argument, NULL, 'n' },
+                                             { "rate", required_argument, NULL, 'r' },
+                                             { "flood", required_argument, NULL, 'f' },
+                                             { "port", required_argument, NULL, 'p' },
+                                             { NULL, 0, NULL, 0 } };
+
+    int opt;
+    while ((opt = getopt_long(argc_, argv_, "n:r:f:p:", options, NULL)) != -1) {
+        switch (opt) {
+            case 'n': count = atoi(optarg); break;
+            case 'r': rateHz = atoi(optarg); break;
+            case 'f': flood = atoi(optarg); break;
+            case 'p': port = atoi(optarg); break;
+            default: {
+                printf("usage: netstick_bench loopback [-n paced count] [-r rate Hz] [-f flood count] "
+                       "[-p loopback port (default: any free port)]\n");
+                return -1;
+            }
+        }
+    }
+    if ((count <= 0) || (rateHz <= 0) || (flood <= 0) || (port < 0) || (port > UINT16_MAX)) {
+        printf("invalid benchmark parameters\n");
+        return -1;
+    }
+
+    // netstickd's own client handling, with -o null and no heartbeat timeout
+    // (the benchmark never answers pings)
+    jsproxy_config_t config;
+    jsproxy_config_init(&config);
+    config.device.sink         = &benchLoopbackSink;
+    config.heartbeat.missLimit = 0;
+    config.maxClients          = 1;
+
+    memset(&benchLoopback, 0, sizeof(benchLoopback));
+    benchLoopback.sentNs = (uint64_t*)(calloc(count, sizeof(uint64_t)));
+    bench_samples_init(&benchLoopback.latency, count);
+
+    server_context_t* server = jsproxy_server_create((uint16_t)port, &config);
+    if (!server) {
+        free(benchLoopback.sentNs);
+        bench_samples_free(&benchLoopback.latency);
+        return -1;
+    }
+    pthread_t thread;
+    pthread_create(&thread, NULL, bench_loopback_serve, server);
+
+    struct sockaddr_in addr = {};
+    addr.sin_family         = AF_INET;
+    addr.sin_addr.s_addr    = htonl(INADDR_LOOPBACK);
+    addr.sin_port           = htons(server->port);
+
+    int fd     = socket(AF_INET, SOCK_STREAM, 0);
+    int enable = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    bool ok = (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+
+    js_config_t device;
+    bench_loopback_config(&device);
+    uint8_t* payload = (uint8_t*)(calloc(1, sizeof(message_report_header_t) + joystick_get_report_size(&device)));
+    ok               = ok && message_transmit(fd, MessageTagConfig, &device, sizeof(device));
+
+    printf("# %d reports at %d Hz, then %d as fast as possible, over loopback into a null sink\n",
+           count,
+           rateHz,
+           flood);
+
+    // Paced: latency from send to apply
+    uint32_t sequence = 0;
+    uint64_t period   = NSEC_PER_SEC / rateHz;
+    uint64_t start    = timestamp_now_ns() + (10 * NSEC_PER_MSEC);
+    benchLoopback.sampling = true;
+    for (int i = 0; (i < count) && ok; i++) {
+        struct timespec deadline = timestamp_to_timespec(start + (period * i));
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) != 0) {}
+        ok = bench_loopback_send(fd, &device, payload, sequence++);
+    }
+    ok = ok && bench_loopback_wait_applied(sequence);
+    benchLoopback.sampling = false;
+
+    // Flood: reports per second through the whole pipeline
+    bench_throughput_t result = {};
+    uint64_t           floodStart = timestamp_now_ns();
+    for (int i = 0; (i < flood) && ok; i++) {
+        ok = bench_loopback_send(fd, &device, payload, sequence++);
+    }
+    ok               = ok && bench_loopback_wait_applied(sequence);
+    result.elapsedNs = timestamp_now_ns() - floodStart;
+    result.ops       = flood;
+    result.bytes     = (uint64_t)flood * (sizeof(message_report_header_t) + joystick_get_report_size(&device));
+
+    // Closing the connection wakes the server, which then notices the stop request
+    benchLoopback.finished = true;
+    server_stop(server);
+    close(fd);
+    pthread_join(thread, NULL);
+
+    if (ok) {
+        bench_report_latency("loopback", "latency", &benchLoopback.latency);
+        bench_report_throughput("loopback", "flood", &result);
+        if (benchLoopback.errors > 0) {
+            printf("loopback: %llu reports applied out of order\n", (unsigned long long)benchLoopback.errors);
+            ok = false;
+        }
+    }
+
+    free(payload);
+    free(benchLoopback.sentNs);
+    bench_samples_free(&benchLoopback.latency);
+    jsproxy_server_destroy(server);
+    return ok ? 0 : -1;
+}
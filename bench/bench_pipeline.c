@@ -0,0 +1,172 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+//
+// Server decode/inject pipeline benchmark.  A stream of slip-encoded report
+// frames is pushed through everything netstickd does with the bytes it reads:
+// slip decoding, tlvc validation, diffing the report against the last one, and
+// writing the resulting events to the device.  The device is a null (or
+// recording) output sink, so this runs anywhere, without /dev/uinput.
+#include "bench.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "joystick.h"
+#include "message.h"
+#include "slip.h"
+#include "timestamp.h"
+#include "tlvc.h"
+
+//---------------------------------------------------------------------------
+static void bench_pipeline_config(js_config_t* config_)
+{
+    static const uint32_t axes[]    = { ABS_X, ABS_Y, ABS_Z, ABS_RX, ABS_RY, ABS_RZ, ABS_HAT0X, ABS_HAT0Y };
+    static const uint32_t buttons[] = { BTN_SOUTH, BTN_EAST,   BTN_NORTH,  BTN_WEST,   BTN_TL,     BTN_TR,
+                                        BTN_SELECT, BTN_START, BTN_MODE, BTN_THUMBL, BTN_THUMBR };
+
+    snprintf(config_->name, sizeof(config_->name), "Benchmark Pad");
+    config_->absAxisCount = sizeof(axes) / sizeof(axes[0]);
+    config_->buttonCount  = sizeof(buttons) / sizeof(buttons[0]);
+    for (int i = 0; i < config_->absAxisCount; i++) {
+        config_->absAxis[i]    = axes[i];
+        config_->absAxisMin[i] = (axes[i] >= ABS_HAT0X) ? -1 : -32768;
+        config_->absAxisMax[i] = (axes[i] >= ABS_HAT0X) ? 1 : 32767;
+    }
+    for (int i = 0; i < config_->buttonCount; i++) {
+        config_->buttons[i] = buttons[i];
+    }
+}
+
+//---------------------------------------------------------------------------
+// Encode count_ reports, each moving one stick axis and every eighth one also
+// toggling a button, into a single stream of frames.
+static uint8_t* bench_pipeline_generate(const js_config_t* config_, int count_, size_t* streamLen_)
+{
+    size_t   reportSize = joystick_get_report_size(config_);
+    size_t   frameMax   = message_encoded_size_max(reportSize);
+    uint8_t* stream     = (uint8_t*)(malloc(frameMax * count_));
+    uint8_t* report     = (uint8_t*)(calloc(1, reportSize));
+    size_t   streamLen  = 0;
+    uint32_t seed       = 1;
+
+    for (int i = 0; i < count_; i++) {
+        seed          = (seed * 1103515245) + 12345;
+        int     axis  = (seed >> 16) % 6;
+        int32_t value = (int32_t)((seed >> 8) & 0xFFFF) - 32768;
+        memcpy(report + (axis * sizeof(int32_t)), &value, sizeof(int32_t));
+        if ((i % 8) == 0) {
+            report[(config_->absAxisCount * sizeof(int32_t)) + ((seed >> 4) % config_->buttonCount)] ^= 1;
+        }
+        streamLen += message_encode(stream + streamLen, frameMax, MessageTagReport, report, reportSize);
+    }
+
+    free(report);
+    *streamLen_ = streamLen;
+    return stream;
+}
+
+//---------------------------------------------------------------------------
+int bench_pipeline(int argc_, char** argv_)
+{
+    int                  count = 1000000;
+    const js_sink_ops_t* sink  = &jsSinkNull;
+
+    static const struct option options[] = { { "count", required_argument, NULL, 'n' },
+                                             { "output", required_argument, NULL, 'o' },
+                                             { NULL, 0, NULL, 0 } };
+
+    int opt;
+    while ((opt = getopt_long(argc_, argv_, "n:o:", options, NULL)) != -1) {
+        switch (opt) {
+            case 'n': count = atoi(optarg); break;
+            case 'o': {
+                if (!joystick_sink_from_string(optarg, &sink)) {
+                    printf("unknown output: %s\n", optarg);
+                    return -1;
+                }
+            } break;
+            default: {
+                printf("usage: netstick_bench pipeline [-n count] [-o null|record|uinput]\n");
+                return -1;
+            }
+        }
+    }
+    if (count <= 0) {
+        printf("invalid benchmark parameters\n");
+        return -1;
+    }
+
+    js_config_t* config = (js_config_t*)(calloc(1, sizeof(js_config_t)));
+    bench_pipeline_config(config);
+
+    js_device_options_t deviceOptions;
+    joystick_device_options_init(&deviceOptions);
+    deviceOptions.sink     = sink;
+    js_context_t* joystick = joystick_create(config, &deviceOptions);
+    if (!joystick) {
+        free(config);
+        return -1;
+    }
+
+    size_t   streamLen;
+    uint8_t* stream = bench_pipeline_generate(config, count, &streamLen);
+
+    size_t                 reportSize = joystick_get_report_size(config);
+    js_layout_t*           layout     = joystick_layout_init(malloc(joystick_layout_size(config)), config);
+    slip_decode_message_t* decode     = slip_decode_message_create(32768);
+    size_t                 maxEvents  = joystick_layout_max_events(layout) + 1;
+    struct input_event*    events     = (struct input_event*)(calloc(maxEvents, sizeof(*events)));
+    slip_decode_begin(decode);
+
+    printf("# %d reports (%zu bytes), %d axes, %d buttons, output: %s\n",
+           count,
+           streamLen,
+           config->absAxisCount,
+           config->buttonCount,
+           sink->name);
+
+    uint64_t reports = 0;
+    uint64_t errors  = 0;
+    uint64_t start   = timestamp_now_ns();
+    for (size_t i = 0; i < streamLen; i++) {
+        if (slip_decode_byte(decode, stream[i]) != SlipDecodeEndOfFrame) {
+            continue;
+        }
+        tlvc_data_t tlvc;
+        if (tlvc_decode_data(&tlvc, decode->raw, decode->index) && (tlvc.dataLen == reportSize)) {
+            size_t n = joystick_layout_diff(layout, joystick->lastReport, (const uint8_t*)tlvc.data, events);
+            if (n > 0) {
+                memset(&events[n], 0, sizeof(events[n]));
+                events[n].type = EV_SYN;
+                events[n].code = SYN_REPORT;
+                if (!joystick_write_events(joystick, events, n + 1)) {
+                    errors++;
+                }
+            }
+            reports++;
+        }
+        slip_decode_begin(decode);
+    }
+    uint64_t elapsed = timestamp_now_ns() - start;
+
+    printf("pipeline/%s: reports=%llu cost=%.1fns/report rate=%.2fM reports/s events=%llu errors=%llu\n",
+           sink->name,
+           (unsigned long long)reports,
+           (double)elapsed / reports,
+           (reports * 1000.0) / elapsed,
+           (unsigned long long)joystick->eventsWritten,
+           (unsigned long long)errors);
+
+    free(events);
+    slip_decode_message_destroy(decode);
+    free(layout);
+    free(stream);
+    joystick_destroy(joystick);
+    free(config);
+    return 0;
+}
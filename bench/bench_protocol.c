@@ -0,0 +1,413 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+//
+// Protocol layer microbenchmarks.  Times each layer a report goes through on
+// its way between the two ends, one operation at a time: slip encoding and
+// decoding (of realistic reports, and of the worst case where every byte has
+// to be escaped), tlvc encoding and decoding, the client's framing of a whole
+// message (alone, and with the write to a descriptor), and the server's decode
+// of a frame into a batch of input events.  Each case is run several times and
+// the fastest run is reported, in ns/op and bytes/s of payload.
+#include "bench.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+
+#include "joystick.h"
+#include "message.h"
+#include "slip.h"
+#include "timestamp.h"
+#include "tlvc.h"
+
+//---------------------------------------------------------------------------
+#define BENCH_PROTOCOL_STREAM (64)  //!< Distinct reports cycled through by the report decode cases
+
+//---------------------------------------------------------------------------
+// A payload, and everything derived from it that the cases work on
+typedef struct {
+    const char*  name;          //!< Name of the payload, used in the case names
+    js_config_t* config;        //!< Device the payload is a report of (NULL for synthetic payloads)
+    js_layout_t* layout;        //!< Compact form of config, as netstickd keeps it (NULL for synthetic payloads)
+    uint8_t*     payload;       //!< Raw report
+    size_t       len;           //!< Size of the raw report
+    uint8_t*     slip;          //!< payload, slip-encoded on its own
+    size_t       slipLen;       //!< Size of slip
+    uint8_t*     tlvc;          //!< payload wrapped in a tlvc message (not slip-encoded)
+    size_t       tlvcLen;       //!< Size of tlvc
+    uint8_t*     frames;        //!< BENCH_PROTOCOL_STREAM distinct reports, framed, back to back
+    size_t       framesLen;     //!< Size of frames
+} bench_protocol_payload_t;
+
+//---------------------------------------------------------------------------
+// State shared by every case
+typedef struct {
+    uint8_t*               scratch;     //!< Output buffer for encoders
+    size_t                 scratchSize; //!< Size of scratch
+    slip_decode_message_t* decode;      //!< Decoder for the decode cases
+    uint8_t*               lastReport;  //!< Last report decoded, for diffing
+    struct input_event*    events;      //!< Events produced by a report decode
+    int                    fd;          //!< Descriptor written to by the transmit case
+} bench_protocol_t;
+
+//---------------------------------------------------------------------------
+// Loop running count_ operations of one case; returns a value derived from the
+// results, so the work can't be optimized away
+typedef uint64_t (*bench_protocol_loop_t)(bench_protocol_t*               bench_,
+                                          const bench_protocol_payload_t* payload_,
+                                          uint64_t                        count_);
+
+//---------------------------------------------------------------------------
+static volatile uint64_t benchProtocolSink;
+
+//---------------------------------------------------------------------------
+static uint64_t
+bench_protocol_slip_encode(bench_protocol_t* bench_, const bench_protocol_payload_t* payload_, uint64_t count_)
+{
+    slip_encode_message_t encode = {};
+    encode.encoded               = bench_->scratch;
+    encode.encodedSize           = bench_->scratchSize;
+
+    uint64_t sum = 0;
+    for (uint64_t n = 0; n < count_; n++) {
+        slip_encode_begin(&encode);
+        for (size_t i = 0; i < payload_->len; i++) { slip_encode_byte(&encode, payload_->payload[i]); }
+        slip_encode_finish(&encode);
+        sum += encode.index;
+    }
+    return sum;
+}
+
+//---------------------------------------------------------------------------
+static uint64_t
+bench_protocol_slip_decode(bench_protocol_t* bench_, const bench_protocol_payload_t* payload_, uint64_t count_)
+{
+    uint64_t sum = 0;
+    for (uint64_t n = 0; n < count_; n++) {
+        slip_decode_begin(bench_->decode);
+        for (size_t i = 0; i < payload_->slipLen; i++) { slip_decode_byte(bench_->decode, payload_->slip[i]); }
+        sum += bench_->decode->index;
+    }
+    return sum;
+}
+
+//---------------------------------------------------------------------------
+static uint64_t
+bench_protocol_tlvc_encode(bench_protocol_t* bench_, const bench_protocol_payload_t* payload_, uint64_t count_)
+{
+    uint64_t sum = 0;
+    for (uint64_t n = 0; n < count_; n++) {
+        tlvc_data_t tlvc;
+        tlvc_encode_data(&tlvc, MessageTagReport, payload_->len, payload_->payload);
+        sum += tlvc.footer.checksum;
+    }
+    return sum;
+}
+
+//---------------------------------------------------------------------------
+static uint64_t
+bench_protocol_tlvc_decode(bench_protocol_t* bench_, const bench_protocol_payload_t* payload_, uint64_t count_)
+{
+    uint64_t sum = 0;
+    for (uint64_t n = 0; n < count_; n++) {
+        tlvc_data_t tlvc;
+        if (tlvc_decode_data(&tlvc, payload_->tlvc, payload_->tlvcLen)) {
+            sum += tlvc.dataLen;
+        }
+    }
+    return sum;
+}
+
+//---------------------------------------------------------------------------
+static uint64_t
+bench_protocol_frame(bench_protocol_t* bench_, const bench_protocol_payload_t* payload_, uint64_t count_)
+{
+    uint64_t sum = 0;
+    for (uint64_t n = 0; n < count_; n++) {
+        sum += message_encode(bench_->scratch, bench_->scratchSize, MessageTagReport, payload_->payload, payload_->len);
+    }
+    return sum;
+}
+
+//---------------------------------------------------------------------------
+static uint64_t
+bench_protocol_transmit(bench_protocol_t* bench_, const bench_protocol_payload_t* payload_, uint64_t count_)
+{
+    uint64_t sum = 0;
+    for (uint64_t n = 0; n < count_; n++) {
+        sum += message_transmit(bench_->fd, MessageTagReport, payload_->payload, payload_->len);
+    }
+    return sum;
+}
+
+//---------------------------------------------------------------------------
+// What netstickd does with each frame: slip decode, tlvc decode, then diff the
+// report against the last one into a batch of events, using the device's layout
+static uint64_t
+bench_protocol_report_decode(bench_protocol_t* bench_, const bench_protocol_payload_t* payload_, uint64_t count_)
+{
+    uint64_t sum    = 0;
+    size_t   offset = 0;
+    slip_decode_begin(bench_->decode);
+    for (uint64_t n = 0; n < count_;) {
+        if (offset == payload_->framesLen) {
+            offset = 0;
+        }
+        if (slip_decode_byte(bench_->decode, payload_->frames[offset++]) != SlipDecodeEndOfFrame) {
+            continue;
+        }
+        tlvc_data_t tlvc;
+        if (tlvc_decode_data(&tlvc, bench_->decode->raw, bench_->decode->index) && (tlvc.dataLen == payload_->len)) {
+            sum += joystick_layout_diff(
+                payload_->layout, bench_->lastReport, (const uint8_t*)tlvc.data, bench_->events);
+        }
+        slip_decode_begin(bench_->decode);
+        n++;
+    }
+    return sum;
+}
+
+//---------------------------------------------------------------------------
+static js_config_t* bench_protocol_config(int absAxes_, int relAxes_, int buttons_)
+{
+    static const uint32_t axes[] = { ABS_X, ABS_Y, ABS_Z, ABS_RX, ABS_RY, ABS_RZ, ABS_HAT0X, ABS_HAT0Y };
+
+    js_config_t* config = (js_config_t*)(calloc(1, sizeof(js_config_t)));
+    for (int i = 0; i < absAxes_; i++) {
+        config->absAxis[i]    = axes[i];
+        config->absAxisMin[i] = (axes[i] >= ABS_HAT0X) ? -1 : -32768;
+        config->absAxisMax[i] = (axes[i] >= ABS_HAT0X) ? 1 : 32767;
+    }
+    for (int i = 0; i < relAxes_; i++) { config->relAxis[i] = REL_X + i; }
+    for (int i = 0; i < buttons_; i++) { config->buttons[i] = (absAxes_ > 0) ? (BTN_SOUTH + i) : (KEY_ESC + i); }
+    config->absAxisCount = absAxes_;
+    config->relAxisCount = relAxes_;
+    config->buttonCount  = buttons_;
+    return config;
+}
+
+//---------------------------------------------------------------------------
+// Fill in the next report of a device in use: one or two axes move, relative
+// axes report small motions, and now and then a button changes
+static void bench_protocol_next_report(const js_config_t* config_, uint32_t* seed_, uint8_t* report_)
+{
+    for (int i = 0; i < config_->absAxisCount; i++) {
+        *seed_ = (*seed_ * 1103515245) + 12345;
+        if ((*seed_ >> 28) < 4) {
+            int64_t range = (int64_t)config_->absAxisMax[i] - config_->absAxisMin[i] + 1;
+            int32_t value = (int32_t)(config_->absAxisMin[i] + ((*seed_ >> 8) % range));
+            memcpy(report_ + (i * sizeof(int32_t)), &value, sizeof(int32_t));
+        }
+    }
+    uint8_t* rel = report_ + (config_->absAxisCount * sizeof(int32_t));
+    for (int i = 0; i < config_->relAxisCount; i++) {
+        *seed_        = (*seed_ * 1103515245) + 12345;
+        int32_t value = (int32_t)((*seed_ >> 16) % 21) - 10;
+        memcpy(rel + (i * sizeof(int32_t)), &value, sizeof(int32_t));
+    }
+    uint8_t* buttons = rel + (config_->relAxisCount * sizeof(int32_t));
+    *seed_           = (*seed_ * 1103515245) + 12345;
+    if ((config_->buttonCount > 0) && ((*seed_ >> 29) == 0)) {
+        buttons[(*seed_ >> 8) % config_->buttonCount] ^= 1;
+    }
+}
+
+//---------------------------------------------------------------------------
+static void bench_protocol_payload_init(bench_protocol_payload_t* payload_, const char* name_, js_config_t* config_)
+{
+    uint32_t seed  = 1;
+    payload_->name = name_;
+    if (config_) {
+        payload_->config  = config_;
+        payload_->layout  = joystick_layout_init(malloc(joystick_layout_size(config_)), config_);
+        payload_->len     = joystick_get_report_size(config_);
+        payload_->payload = (uint8_t*)(calloc(1, payload_->len));
+        for (int i = 0; i < 16; i++) { bench_protocol_next_report(config_, &seed, payload_->payload); }
+    } else {
+        // Worst case for slip: every byte of a gamepad-sized payload is escaped
+        payload_->len     = 43;
+        payload_->payload = (uint8_t*)(malloc(payload_->len));
+        for (size_t i = 0; i < payload_->len; i++) { payload_->payload[i] = (i & 1) ? SLIP_ESC : SLIP_END; }
+    }
+
+    slip_encode_message_t encode = {};
+    encode.encodedSize           = (payload_->len * 2) + 2;
+    encode.encoded               = (uint8_t*)(malloc(encode.encodedSize));
+    slip_encode_begin(&encode);
+    for (size_t i = 0; i < payload_->len; i++) { slip_encode_byte(&encode, payload_->payload[i]); }
+    slip_encode_finish(&encode);
+    payload_->slip    = encode.encoded;
+    payload_->slipLen = encode.index;
+
+    tlvc_data_t tlvc;
+    tlvc_encode_data(&tlvc, MessageTagReport, payload_->len, payload_->payload);
+    payload_->tlvcLen = sizeof(tlvc.header) + payload_->len + sizeof(tlvc.footer);
+    payload_->tlvc    = (uint8_t*)(malloc(payload_->tlvcLen));
+    memcpy(payload_->tlvc, &tlvc.header, sizeof(tlvc.header));
+    memcpy(payload_->tlvc + sizeof(tlvc.header), payload_->payload, payload_->len);
+    memcpy(payload_->tlvc + sizeof(tlvc.header) + payload_->len, &tlvc.footer, sizeof(tlvc.footer));
+
+    if (config_) {
+        size_t   frameMax = message_encoded_size_max(payload_->len);
+        uint8_t* report   = (uint8_t*)(malloc(payload_->len));
+        memcpy(report, payload_->payload, payload_->len);
+        payload_->frames = (uint8_t*)(malloc(frameMax * BENCH_PROTOCOL_STREAM));
+        for (int i = 0; i < BENCH_PROTOCOL_STREAM; i++) {
+            bench_protocol_next_report(config_, &seed, report);
+            payload_->framesLen += message_encode(
+                payload_->frames + payload_->framesLen, frameMax, MessageTagReport, report, payload_->len);
+        }
+        free(report);
+    }
+}
+
+//---------------------------------------------------------------------------
+static void bench_protocol_payload_free(bench_protocol_payload_t* payload_)
+{
+    free(payload_->config);
+    free(payload_->layout);
+    free(payload_->payload);
+    free(payload_->slip);
+    free(payload_->tlvc);
+    free(payload_->frames);
+}
+
+//---------------------------------------------------------------------------
+// Warm up, then time a case reps_ times and report the fastest run
+static void bench_protocol_run(bench_protocol_t*               bench_,
+                               const char*                     case_,
+                               const char*                     filter_,
+                               bench_protocol_loop_t           loop_,
+                               const bench_protocol_payload_t* payload_,
+                               uint64_t                        count_,
+                               int                             reps_)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "%s/%s", case_, payload_->name);
+    if (filter_ && !strstr(name, filter_)) {
+        return;
+    }
+
+    benchProtocolSink += loop_(bench_, payload_, (count_ / 10) + 1);
+
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < reps_; i++) {
+        uint64_t start = timestamp_now_ns();
+        benchProtocolSink += loop_(bench_, payload_, count_);
+        uint64_t elapsed = timestamp_now_ns() - start;
+        if (elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    bench_throughput_t result = {};
+    result.ops                = count_;
+    result.bytes              = count_ * payload_->len;
+    result.elapsedNs          = best;
+    bench_report_throughput("protocol", name, &result);
+}
+
+//---------------------------------------------------------------------------
+int bench_protocol(int argc_, char** argv_)
+{
+    uint64_t    count  = 200000;
+    int         reps   = 5;
+    const char* filter = NULL;
+
+    static const struct option options[] = { { "count", required_argument, NULL, 'n' },
+                                             { "reps", required_argument, NULL, 'r' },
+                                             { "case", required_argument, NULL, 'c' },
+                                             { NULL, 0, NULL, 0 } };
+
+    int opt;
+    while ((opt = getopt_long(argc_, argv_, "n:r:c:", options, NULL)) != -1) {
+        switch (opt) {
+            case 'n': count = strtoull(optarg, NULL, 10); break;
+            case 'r': reps = atoi(optarg); break;
+            case 'c': filter = optarg; break;
+            default: {
+                printf("usage: netstick_bench protocol [-n count] [-r repetitions] [-c case name filter]\n");
+                return -1;
+            }
+        }
+    }
+    if ((count == 0) || (reps <= 0)) {
+        printf("invalid benchmark parameters\n");
+        return -1;
+    }
+
+    bench_protocol_payload_t mouse    = {};
+    bench_protocol_payload_t gamepad  = {};
+    bench_protocol_payload_t keyboard = {};
+    bench_protocol_payload_t escapes  = {};
+    bench_protocol_payload_init(&mouse, "mouse", bench_protocol_config(0, 3, 3));
+    bench_protocol_payload_init(&gamepad, "gamepad", bench_protocol_config(8, 0, 11));
+    bench_protocol_payload_init(&keyboard, "keyboard", bench_protocol_config(0, 0, 84));
+    bench_protocol_payload_init(&escapes, "escapes", NULL);
+
+    // The transmit case writes to /dev/null: the cost of the write() call is
+    // counted, without any network stack behind it
+    bench_protocol_t bench = {};
+    bench.scratchSize      = message_encoded_size_max(keyboard.len);
+    bench.scratch          = (uint8_t*)(malloc(bench.scratchSize));
+    bench.decode           = slip_decode_message_create(bench.scratchSize);
+    bench.lastReport       = (uint8_t*)(calloc(1, keyboard.len));
+    bench.events           = (struct input_event*)(calloc(KEY_CNT, sizeof(struct input_event)));
+    bench.fd               = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (bench.fd < 0) {
+        printf("error opening /dev/null: %d (%s)\n", errno, strerror(errno));
+        return -1;
+    }
+
+    if (!benchJson) {
+        printf("# %llu operations per run, fastest of %d runs; report sizes: mouse=%zu gamepad=%zu keyboard=%zu\n",
+               (unsigned long long)count,
+               reps,
+               mouse.len,
+               gamepad.len,
+               keyboard.len);
+    }
+
+    const bench_protocol_payload_t* slipPayloads[]   = { &gamepad, &keyboard, &escapes };
+    const bench_protocol_payload_t* reportPayloads[] = { &mouse, &gamepad, &keyboard };
+    for (int i = 0; i < 3; i++) {
+        bench_protocol_run(&bench, "slip_encode", filter, bench_protocol_slip_encode, slipPayloads[i], count, reps);
+    }
+    for (int i = 0; i < 3; i++) {
+        bench_protocol_run(&bench, "slip_decode", filter, bench_protocol_slip_decode, slipPayloads[i], count, reps);
+    }
+    for (int i = 0; i < 3; i++) {
+        bench_protocol_run(&bench, "tlvc_encode", filter, bench_protocol_tlvc_encode, reportPayloads[i], count, reps);
+    }
+    for (int i = 0; i < 3; i++) {
+        bench_protocol_run(&bench, "tlvc_decode", filter, bench_protocol_tlvc_decode, reportPayloads[i], count, reps);
+    }
+    for (int i = 0; i < 3; i++) {
+        bench_protocol_run(&bench, "frame", filter, bench_protocol_frame, reportPayloads[i], count, reps);
+    }
+    bench_protocol_run(&bench, "frame", filter, bench_protocol_frame, &escapes, count, reps);
+    bench_protocol_run(&bench, "transmit", filter, bench_protocol_transmit, &gamepad, count, reps);
+    for (int i = 0; i < 3; i++) {
+        memset(bench.lastReport, 0, keyboard.len);
+        bench_protocol_run(
+            &bench, "report_decode", filter, bench_protocol_report_decode, reportPayloads[i], count, reps);
+    }
+
+    close(bench.fd);
+    free(bench.events);
+    free(bench.lastReport);
+    slip_decode_message_destroy(bench.decode);
+    free(bench.scratch);
+    bench_protocol_payload_free(&mouse);
+    bench_protocol_payload_free(&gamepad);
+    bench_protocol_payload_free(&keyboard);
+    bench_protocol_payload_free(&escapes);
+    return 0;
+}
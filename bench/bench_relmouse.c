@@ -0,0 +1,271 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+//
+// Relative-axis benchmark.  Feeds a simulated 1000 Hz gaming mouse through the
+// client's report builder at several motion-report rates, and compares the
+// number of reports sent against how faithfully the server would reconstruct
+// the pointer's path.  The "legacy" case reproduces the original behaviour of
+// overwriting deltas between SYNs and never clearing them.
+#include "bench.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+
+#include "joystick.h"
+#include "report_builder.h"
+#include "timestamp.h"
+
+//---------------------------------------------------------------------------
+#define BENCH_MOUSE_PERIOD_NS (NSEC_PER_MSEC)
+
+//---------------------------------------------------------------------------
+// A single mouse sample; only non-zero axes generate events, and only samples
+// with events generate a SYN, as with real mice
+typedef struct {
+    int32_t dx;
+    int32_t dy;
+    bool    button;
+} bench_mouse_sample_t;
+
+//---------------------------------------------------------------------------
+typedef struct {
+    uint64_t reports;   //!< Reports sent to the server
+    double   errorSum;  //!< Sum of the distance between true and reconstructed position, per sample
+    double   errorMax;  //!< Largest distance between true and reconstructed position
+    double   drift;     //!< Distance between true and reconstructed position at the end of the run
+    int      edges;     //!< Button edges seen by the server
+    uint64_t costNs;    //!< Wall-clock time spent in the report path
+} bench_mouse_result_t;
+
+//---------------------------------------------------------------------------
+static void bench_relmouse_generate(bench_mouse_sample_t* samples_, int count_)
+{
+    // Sweeping circles whose speed varies over time, with the occasional pause
+    // and axis-aligned movement, plus a click every half second.
+    double x  = 0.0;
+    double y  = 0.0;
+    long   ix = 0;
+    long   iy = 0;
+    for (int i = 0; i < count_; i++) {
+        double t     = i / 1000.0;
+        double speed = 6.0 * (1.0 + sin(t * 1.7));
+        if ((i % 1500) > 1300) {
+            speed = 0.0;
+        }
+        double angle = t * 3.0;
+        x += speed * cos(angle);
+        y += ((i % 4000) < 1000) ? 0.0 : speed * sin(angle);
+
+        samples_[i].dx     = (int32_t)(lround(x) - ix);
+        samples_[i].dy     = (int32_t)(lround(y) - iy);
+        samples_[i].button = ((i % 500) < 50);
+        ix += samples_[i].dx;
+        iy += samples_[i].dy;
+    }
+}
+
+//---------------------------------------------------------------------------
+static void bench_relmouse_track(bench_mouse_result_t* result_, double trueX_, double trueY_, double x_, double y_)
+{
+    double error = hypot(trueX_ - x_, trueY_ - y_);
+    result_->errorSum += error;
+    if (error > result_->errorMax) {
+        result_->errorMax = error;
+    }
+    result_->drift = error;
+}
+
+//---------------------------------------------------------------------------
+static void bench_relmouse_legacy(const bench_mouse_sample_t* samples_, int count_, bench_mouse_result_t* result_)
+{
+    int32_t rel[2]     = {};
+    uint8_t button     = 0;
+    uint8_t lastButton = 0;
+    double  trueX      = 0.0;
+    double  trueY      = 0.0;
+    double  x          = 0.0;
+    double  y          = 0.0;
+
+    uint64_t start = timestamp_now_ns();
+    for (int i = 0; i < count_; i++) {
+        if (samples_[i].dx) {
+            rel[0] = samples_[i].dx;
+        }
+        if (samples_[i].dy) {
+            rel[1] = samples_[i].dy;
+        }
+        bool changed = samples_[i].dx || samples_[i].dy || (samples_[i].button != button);
+        button       = samples_[i].button;
+
+        trueX += samples_[i].dx;
+        trueY += samples_[i].dy;
+        if (!changed) {
+            bench_relmouse_track(result_, trueX, trueY, x, y);
+            continue;
+        }
+
+        // One report per SYN, deltas re-sent until overwritten
+        result_->reports++;
+        x += rel[0];
+        y += rel[1];
+        if (button != lastButton) {
+            result_->edges++;
+            lastButton = button;
+        }
+        bench_relmouse_track(result_, trueX, trueY, x, y);
+    }
+    result_->costNs = timestamp_now_ns() - start;
+}
+
+//---------------------------------------------------------------------------
+static void bench_relmouse_builder(const js_config_t*          config_,
+                                   const bench_mouse_sample_t* samples_,
+                                   int                         count_,
+                                   int                         relRateHz_,
+                                   bench_mouse_result_t*       result_)
+{
+    report_builder_config_t options;
+    report_builder_config_init(&options);
+    options.relRateHz = relRateHz_;
+
+    report_builder_t* builder    = report_builder_create(config_, &options);
+    uint8_t           lastButton = 0;
+    double            trueX      = 0.0;
+    double            trueY      = 0.0;
+    double            x          = 0.0;
+    double            y          = 0.0;
+
+    uint64_t costNs = 0;
+    for (int i = 0; i < count_; i++) {
+        uint64_t now = (i + 1) * BENCH_MOUSE_PERIOD_NS;
+
+        // A device with nothing to say doesn't send a SYN
+        bool changed = samples_[i].dx || samples_[i].dy || (samples_[i].button != builder->report.buttons[0]);
+
+        uint64_t start = timestamp_now_ns();
+        if (samples_[i].dx) {
+            report_builder_add_rel(builder, 0, samples_[i].dx);
+        }
+        if (samples_[i].dy) {
+            report_builder_add_rel(builder, 1, samples_[i].dy);
+        }
+        report_builder_set_button(builder, 0, samples_[i].button);
+
+        bool send = changed ? report_builder_sync(builder, now) : report_builder_expire(builder, now);
+        if (send) {
+            // "Server" side: apply the report as it would arrive
+            x += builder->report.relAxis[0];
+            y += builder->report.relAxis[1];
+            if (builder->report.buttons[0] != lastButton) {
+                result_->edges++;
+                lastButton = builder->report.buttons[0];
+            }
+            result_->reports++;
+            report_builder_sent(builder, now);
+        }
+        costNs += timestamp_now_ns() - start;
+
+        trueX += samples_[i].dx;
+        trueY += samples_[i].dy;
+        bench_relmouse_track(result_, trueX, trueY, x, y);
+    }
+
+    // The client's timer would flush any motion still held back
+    if (report_builder_timeout(builder, count_ * BENCH_MOUSE_PERIOD_NS) >= 0) {
+        x += builder->report.relAxis[0];
+        y += builder->report.relAxis[1];
+        result_->reports++;
+        bench_relmouse_track(result_, trueX, trueY, x, y);
+    }
+
+    result_->costNs = costNs;
+    report_builder_destroy(builder);
+}
+
+//---------------------------------------------------------------------------
+static void bench_relmouse_print(const char* case_, const bench_mouse_result_t* result_, int count_, int edges_)
+{
+    double seconds = (count_ * (double)BENCH_MOUSE_PERIOD_NS) / NSEC_PER_SEC;
+    printf("relmouse/%s: reports/s=%.0f mean-error=%.2f max-error=%.2f final-drift=%.2f edges=%d/%d cost=%.1fns/sample\n",
+           case_,
+           result_->reports / seconds,
+           result_->errorSum / count_,
+           result_->errorMax,
+           result_->drift,
+           result_->edges,
+           edges_,
+           (double)result_->costNs / count_);
+}
+
+//---------------------------------------------------------------------------
+int bench_relmouse(int argc_, char** argv_)
+{
+    int durationMs = 10000;
+
+    static const struct option options[]
+        = { { "duration-ms", required_argument, NULL, 'd' }, { NULL, 0, NULL, 0 } };
+
+    int opt;
+    while ((opt = getopt_long(argc_, argv_, "d:", options, NULL)) != -1) {
+        switch (opt) {
+            case 'd': durationMs = atoi(optarg); break;
+            default: {
+                printf("usage: netstick_bench relmouse [-d duration ms]\n");
+                return -1;
+            }
+        }
+    }
+    if (durationMs <= 0) {
+        printf("invalid benchmark parameters\n");
+        return -1;
+    }
+
+    js_config_t* config  = (js_config_t*)(calloc(1, sizeof(js_config_t)));
+    config->relAxisCount = 2;
+    config->relAxis[0]   = REL_X;
+    config->relAxis[1]   = REL_Y;
+    config->buttonCount  = 1;
+    config->buttons[0]   = BTN_LEFT;
+
+    bench_mouse_sample_t* samples = (bench_mouse_sample_t*)(calloc(durationMs, sizeof(bench_mouse_sample_t)));
+    bench_relmouse_generate(samples, durationMs);
+
+    int  edges      = 0;
+    bool lastButton = false;
+    for (int i = 0; i < durationMs; i++) {
+        if (samples[i].button != lastButton) {
+            edges++;
+            lastButton = samples[i].button;
+        }
+    }
+
+    printf("# %d ms of 1000 Hz mouse motion; errors in counts\n", durationMs);
+
+    bench_mouse_result_t legacy = {};
+    bench_relmouse_legacy(samples, durationMs, &legacy);
+    bench_relmouse_print("legacy", &legacy, durationMs, edges);
+
+    const int rates[] = { 0, 500, 250, 125 };
+    for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        bench_mouse_result_t result = {};
+        bench_relmouse_builder(config, samples, durationMs, rates[i], &result);
+
+        char name[32];
+        if (rates[i] == 0) {
+            snprintf(name, sizeof(name), "every-syn");
+        } else {
+            snprintf(name, sizeof(name), "rate-%dHz", rates[i]);
+        }
+        bench_relmouse_print(name, &result, durationMs, edges);
+    }
+
+    free(samples);
+    free(config);
+    return 0;
+}
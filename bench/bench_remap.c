@@ -0,0 +1,177 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+//
+// Server-side report cost benchmark.  Feeds a stream of gamepad reports, in
+// which only a few fields change at a time, through the pass-through path
+// (joystick_layout_diff) and through a remapping that turns the pad into a
+// keyboard and mouse, and compares the cost per report.
+#include "bench.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "joystick.h"
+#include "remap.h"
+#include "timestamp.h"
+
+//---------------------------------------------------------------------------
+static const char benchRemapRules[] = "[*]\n"
+                                      "BTN_SOUTH -> KEY_ENTER\n"
+                                      "BTN_EAST -> KEY_ESC\n"
+                                      "BTN_NORTH -> KEY_SPACE\n"
+                                      "BTN_WEST -> KEY_LEFTSHIFT\n"
+                                      "BTN_TL -> REL_WHEEL 1\n"
+                                      "BTN_TR -> REL_WHEEL -1\n"
+                                      "BTN_MODE -> none\n"
+                                      "ABS_X < -16384 -> KEY_A\n"
+                                      "ABS_X > 16384 -> KEY_D\n"
+                                      "ABS_Y < -16384 -> KEY_W\n"
+                                      "ABS_Y > 16384 -> KEY_S\n"
+                                      "ABS_HAT0X < 0 -> KEY_LEFT\n"
+                                      "ABS_HAT0X > 0 -> KEY_RIGHT\n"
+                                      "ABS_HAT0Y < 0 -> KEY_UP\n"
+                                      "ABS_HAT0Y > 0 -> KEY_DOWN\n"
+                                      "ABS_Z -> ABS_BRAKE\n"
+                                      "ABS_RZ -> ABS_GAS\n";
+
+//---------------------------------------------------------------------------
+static void bench_remap_config(js_config_t* config_)
+{
+    static const uint32_t axes[]    = { ABS_X, ABS_Y, ABS_Z, ABS_RX, ABS_RY, ABS_RZ, ABS_HAT0X, ABS_HAT0Y };
+    static const uint32_t buttons[] = { BTN_SOUTH, BTN_EAST,   BTN_NORTH,  BTN_WEST,   BTN_TL,     BTN_TR,
+                                        BTN_SELECT, BTN_START, BTN_MODE, BTN_THUMBL, BTN_THUMBR };
+
+    snprintf(config_->name, sizeof(config_->name), "Benchmark Pad");
+    config_->absAxisCount = sizeof(axes) / sizeof(axes[0]);
+    config_->buttonCount  = sizeof(buttons) / sizeof(buttons[0]);
+    for (int i = 0; i < config_->absAxisCount; i++) {
+        config_->absAxis[i]    = axes[i];
+        config_->absAxisMin[i] = (axes[i] >= ABS_HAT0X) ? -1 : -32768;
+        config_->absAxisMax[i] = (axes[i] >= ABS_HAT0X) ? 1 : 32767;
+    }
+    for (int i = 0; i < config_->buttonCount; i++) {
+        config_->buttons[i] = buttons[i];
+    }
+}
+
+//---------------------------------------------------------------------------
+// Each report changes a stick axis, and now and then a button or the hat, as a
+// pad being played would.
+static void bench_remap_generate(const js_config_t* config_, uint8_t* reports_, size_t reportSize_, int count_)
+{
+    uint32_t seed = 1;
+    memset(reports_, 0, reportSize_);
+    for (int i = 1; i < count_; i++) {
+        uint8_t* report = reports_ + (i * reportSize_);
+        memcpy(report, report - reportSize_, reportSize_);
+
+        seed = (seed * 1103515245) + 12345;
+        int     axis  = (seed >> 16) % 6;
+        int32_t value = (int32_t)((seed >> 8) & 0xFFFF) - 32768;
+        memcpy(report + (axis * sizeof(int32_t)), &value, sizeof(int32_t));
+
+        if ((i % 8) == 0) {
+            int button = (seed >> 4) % config_->buttonCount;
+            report[(config_->absAxisCount * sizeof(int32_t)) + button] ^= 1;
+        }
+        if ((i % 32) == 0) {
+            int32_t hat = (int32_t)((seed >> 2) % 3) - 1;
+            memcpy(report + ((6 + (i / 32) % 2) * sizeof(int32_t)), &hat, sizeof(int32_t));
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+static void bench_remap_print(const char* case_, uint64_t costNs_, uint64_t events_, int count_)
+{
+    printf("remap/%s: cost=%.1fns/report events=%.2f/report\n",
+           case_,
+           (double)costNs_ / count_,
+           (double)events_ / count_);
+}
+
+//---------------------------------------------------------------------------
+int bench_remap(int argc_, char** argv_)
+{
+    int count = 1000000;
+
+    static const struct option options[] = { { "count", required_argument, NULL, 'n' }, { NULL, 0, NULL, 0 } };
+
+    int opt;
+    while ((opt = getopt_long(argc_, argv_, "n:", options, NULL)) != -1) {
+        switch (opt) {
+            case 'n': count = atoi(optarg); break;
+            default: {
+                printf("usage: netstick_bench remap [-n count]\n");
+                return -1;
+            }
+        }
+    }
+    if (count <= 0) {
+        printf("invalid benchmark parameters\n");
+        return -1;
+    }
+
+    js_config_t* input  = (js_config_t*)(calloc(1, sizeof(js_config_t)));
+    js_config_t* output = (js_config_t*)(calloc(1, sizeof(js_config_t)));
+    bench_remap_config(input);
+
+    remap_config_t* rules  = remap_config_parse(benchRemapRules, "benchmark");
+    remap_device_t* device = rules ? remap_device_create(rules, input, output) : NULL;
+    if (!device) {
+        printf("unable to compile benchmark remapping\n");
+        remap_config_destroy(rules);
+        free(output);
+        free(input);
+        return -1;
+    }
+
+    size_t   reportSize = joystick_get_report_size(input);
+    uint8_t* reports    = (uint8_t*)(calloc(count, reportSize));
+    uint8_t* lastReport = (uint8_t*)(calloc(1, reportSize));
+    bench_remap_generate(input, reports, reportSize, count);
+
+    js_layout_t* layout    = joystick_layout_init(malloc(joystick_layout_size(input)), input);
+    size_t       maxEvents = joystick_layout_max_events(layout);
+    if (device->maxEvents > maxEvents) {
+        maxEvents = device->maxEvents;
+    }
+    struct input_event* events = (struct input_event*)(calloc(maxEvents, sizeof(struct input_event)));
+
+    printf("# %d reports, %d axes, %d buttons; remapped to %d keys, %d rel, %d abs\n",
+           count,
+           input->absAxisCount,
+           input->buttonCount,
+           output->buttonCount,
+           output->relAxisCount,
+           output->absAxisCount);
+
+    uint64_t eventCount = 0;
+    uint64_t start      = timestamp_now_ns();
+    for (int i = 0; i < count; i++) {
+        eventCount += joystick_layout_diff(layout, lastReport, reports + (i * reportSize), events);
+    }
+    bench_remap_print("passthrough", timestamp_now_ns() - start, eventCount, count);
+
+    eventCount = 0;
+    start      = timestamp_now_ns();
+    for (int i = 0; i < count; i++) {
+        eventCount += remap_device_apply(device, reports + (i * reportSize), events);
+    }
+    bench_remap_print("remapped", timestamp_now_ns() - start, eventCount, count);
+
+    free(events);
+    free(layout);
+    free(lastReport);
+    free(reports);
+    remap_device_destroy(device);
+    remap_config_destroy(rules);
+    free(output);
+    free(input);
+    return 0;
+}
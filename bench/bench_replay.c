@@ -0,0 +1,226 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+//
+// Capture replay benchmark.  A capture made by netstick (input events) or
+// netstickd (reports) is replayed, straight from the mapped file, into a
+// virtual device: reports go through the same diffing netstickd does, events
+// are written as they were read, one SYN_REPORT-terminated group at a time.  At
+// full speed this measures the cost of the recorded workload; at the recorded
+// pace (or a multiple of it) it measures how late each record is applied.
+#include "bench.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "capture.h"
+#include "joystick.h"
+#include "message.h"
+#include "timestamp.h"
+
+//---------------------------------------------------------------------------
+typedef struct {
+    capture_reader_t*   reader;
+    js_context_t*       joystick;
+    js_layout_t*        layout;     //!< compact form of the captured device, as netstickd keeps it
+    struct input_event* events;     //!< events waiting to be written
+    size_t              count;      //!< number of events waiting
+    size_t              capacity;   //!< room in events
+    double              speed;      //!< replay speed (0 == as fast as possible)
+    uint64_t            startNs;    //!< CLOCK_MONOTONIC time at which replay started
+    uint64_t            records;    //!< records replayed
+    uint64_t            errors;     //!< records that couldn't be applied
+    bench_samples_t     lateness;   //!< time between a record coming due and being applied
+} bench_replay_t;
+
+//---------------------------------------------------------------------------
+// Wait until a record is due; returns the time it was due (0 == right away)
+static uint64_t bench_replay_wait(bench_replay_t* replay_, uint64_t timeNs_)
+{
+    uint64_t due = capture_replay_due_ns(replay_->startNs, timeNs_, replay_->speed);
+    if (due == 0) {
+        return 0;
+    }
+    struct timespec deadline = timestamp_to_timespec(due);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {}
+    return due;
+}
+
+//---------------------------------------------------------------------------
+static void bench_replay_applied(bench_replay_t* replay_, uint64_t due_)
+{
+    if (due_ != 0) {
+        bench_samples_add(&replay_->lateness, timestamp_now_ns() - due_);
+    }
+}
+
+//---------------------------------------------------------------------------
+static void bench_replay_reports(bench_replay_t* replay_)
+{
+    size_t reportSize = replay_->layout->reportSize;
+
+    uint64_t                timeNs;
+    const capture_report_t* record;
+    while ((record = capture_reader_peek_report(replay_->reader, &timeNs)) != NULL) {
+        const uint8_t* report = (const uint8_t*)(record + 1);
+        size_t         length = record->length;
+        if (record->tag == MessageTagTimedReport) {
+            report += sizeof(message_report_header_t);
+            length -= (length >= sizeof(message_report_header_t)) ? sizeof(message_report_header_t) : length;
+        }
+
+        uint64_t due = bench_replay_wait(replay_, timeNs);
+        if (length != reportSize) {
+            replay_->errors++;
+        } else {
+            size_t n = joystick_layout_diff(replay_->layout, replay_->joystick->lastReport, report, replay_->events);
+            if (n > 0) {
+                memset(&replay_->events[n], 0, sizeof(replay_->events[n]));
+                replay_->events[n].type = EV_SYN;
+                replay_->events[n].code = SYN_REPORT;
+                if (!joystick_write_events(replay_->joystick, replay_->events, n + 1)) {
+                    replay_->errors++;
+                }
+            }
+        }
+        bench_replay_applied(replay_, due);
+        replay_->records++;
+        capture_reader_advance(replay_->reader);
+    }
+}
+
+//---------------------------------------------------------------------------
+static void bench_replay_events(bench_replay_t* replay_)
+{
+    uint64_t               timeNs;
+    const capture_event_t* record;
+    while ((record = capture_reader_peek_event(replay_->reader, &timeNs)) != NULL) {
+        uint64_t            due   = bench_replay_wait(replay_, timeNs);
+        struct input_event* event = &replay_->events[replay_->count++];
+        memset(event, 0, sizeof(*event));
+        event->type  = record->type;
+        event->code  = record->code;
+        event->value = record->value;
+        replay_->records++;
+        capture_reader_advance(replay_->reader);
+
+        // Write whole updates, as the server would
+        bool syn = (record->type == EV_SYN) && (record->code == SYN_REPORT);
+        if (syn || (replay_->count == replay_->capacity)) {
+            if (!joystick_write_events(replay_->joystick, replay_->events, replay_->count)) {
+                replay_->errors++;
+            }
+            replay_->count = 0;
+            bench_replay_applied(replay_, due);
+        }
+    }
+    if ((replay_->count > 0) && !joystick_write_events(replay_->joystick, replay_->events, replay_->count)) {
+        replay_->errors++;
+    }
+}
+
+//---------------------------------------------------------------------------
+int bench_replay(int argc_, char** argv_)
+{
+    const char*          path   = NULL;
+    double               speed  = 0.0;
+    int                  repeat = 1;
+    const js_sink_ops_t* sink   = &jsSinkNull;
+
+    static const struct option options[] = { { "file", required_argument, NULL, 'f' },
+                                             { "speed", required_argument, NULL, 's' },
+                                             { "repeat", required_argument, NULL, 'r' },
+                                             { "output", required_argument, NULL, 'o' },
+                                             { NULL, 0, NULL, 0 } };
+
+    int opt;
+    while ((opt = getopt_long(argc_, argv_, "f:s:r:o:", options, NULL)) != -1) {
+        switch (opt) {
+            case 'f': path = optarg; break;
+            case 's': speed = atof(optarg); break;
+            case 'r': repeat = atoi(optarg); break;
+            case 'o': {
+                if (!joystick_sink_from_string(optarg, &sink)) {
+                    printf("unknown output: %s\n", optarg);
+                    return -1;
+                }
+            } break;
+            default: {
+                printf("usage: netstick_bench replay -f capture [-s speed (0 = full speed)] [-r repeat] "
+                       "[-o null|record|uinput]\n");
+                return -1;
+            }
+        }
+    }
+    if (!path || (speed < 0.0) || (repeat <= 0)) {
+        printf("invalid benchmark parameters\n");
+        return -1;
+    }
+
+    bench_replay_t replay = {};
+    replay.reader         = capture_reader_open(path);
+    if (!replay.reader) {
+        return -1;
+    }
+    const js_config_t* config = &replay.reader->header->config;
+    bool               events = (replay.reader->header->kind == CaptureKindEvents);
+
+    js_device_options_t deviceOptions;
+    joystick_device_options_init(&deviceOptions);
+    deviceOptions.sink = sink;
+    replay.joystick    = joystick_create(config, &deviceOptions);
+    if (!replay.joystick) {
+        capture_reader_close(replay.reader);
+        return -1;
+    }
+    replay.layout   = joystick_layout_init(malloc(joystick_layout_size(config)), config);
+    replay.capacity = joystick_layout_max_events(replay.layout) + 1;
+    replay.events   = (struct input_event*)(calloc(replay.capacity, sizeof(struct input_event)));
+    replay.speed    = speed;
+    bench_samples_init(&replay.lateness, 65536);
+
+    printf("# %s: %s capture of %s (%zu bytes), output: %s, speed: %.2f (0 = full speed)\n",
+           path,
+           events ? "event" : "report",
+           config->name,
+           replay.reader->size,
+           sink->name,
+           speed);
+
+    uint64_t start = timestamp_now_ns();
+    for (int i = 0; i < repeat; i++) {
+        capture_reader_rewind(replay.reader);
+        replay.startNs = timestamp_now_ns();
+        if (events) {
+            bench_replay_events(&replay);
+        } else {
+            bench_replay_reports(&replay);
+        }
+    }
+    uint64_t elapsed = timestamp_now_ns() - start;
+
+    printf("replay/%s/%s: records=%llu cost=%.1fns/record rate=%.2fM records/s events=%llu errors=%llu\n",
+           events ? "events" : "reports",
+           sink->name,
+           (unsigned long long)replay.records,
+           replay.records ? ((double)elapsed / replay.records) : 0.0,
+           (replay.records * 1000.0) / elapsed,
+           (unsigned long long)replay.joystick->eventsWritten,
+           (unsigned long long)replay.errors);
+    if (replay.lateness.count > 0) {
+        bench_report_latency("replay", "lateness", &replay.lateness);
+    }
+
+    bench_samples_free(&replay.lateness);
+    free(replay.events);
+    free(replay.layout);
+    joystick_destroy(replay.joystick);
+    capture_reader_close(replay.reader);
+    return 0;
+}
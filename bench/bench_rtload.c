@@ -0,0 +1,224 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+//
+// Latency under CPU load.  A sender thread wakes up on a fixed schedule and
+// sends a timestamped report over loopback to a receiver thread, as netstick
+// and netstickd would, while other threads keep every CPU busy.  Measures how
+// late the sender wakes up and how long the report takes to arrive, with and
+// without the real-time scheduling used by --realtime.
+#include "bench.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+
+#include "message.h"
+#include "realtime.h"
+#include "timestamp.h"
+#include "transport.h"
+
+//---------------------------------------------------------------------------
+typedef struct {
+    int               fd;           //!< Receiving socket
+    int               expected;     //!< Number of reports to wait for
+    bool              realtime;     //!< Whether to run with real-time scheduling
+    realtime_config_t config;       //!< Real-time options
+    bench_samples_t   delivery;     //!< Time from send until decode, per report
+} bench_rtload_receiver_t;
+
+//---------------------------------------------------------------------------
+static volatile int benchLoadRunning;
+
+//---------------------------------------------------------------------------
+static void* bench_rtload_spin(void* arg_)
+{
+    (void)arg_;
+    volatile uint64_t counter = 0;
+    while (__atomic_load_n(&benchLoadRunning, __ATOMIC_RELAXED)) {
+        counter++;
+    }
+    return NULL;
+}
+
+//---------------------------------------------------------------------------
+static bool bench_rtload_on_frame(uint16_t tag_, const void* data_, size_t dataLen_, void* arg_)
+{
+    bench_rtload_receiver_t* receiver = (bench_rtload_receiver_t*)arg_;
+    uint64_t                 now      = timestamp_now_ns();
+
+    uint64_t sent;
+    if ((tag_ == MessageTagReport) && (dataLen_ >= sizeof(sent))) {
+        memcpy(&sent, data_, sizeof(sent));
+        bench_samples_add(&receiver->delivery, now - sent);
+    }
+    return ((int)receiver->delivery.count < receiver->expected);
+}
+
+//---------------------------------------------------------------------------
+static void* bench_rtload_receive(void* arg_)
+{
+    bench_rtload_receiver_t* receiver = (bench_rtload_receiver_t*)arg_;
+    if (receiver->realtime) {
+        realtime_set_scheduler(&receiver->config);
+    }
+    bench_read_frames(receiver->fd, NULL, bench_rtload_on_frame, receiver);
+    return NULL;
+}
+
+//---------------------------------------------------------------------------
+static bool bench_rtload_run_case(const char*              case_,
+                                  int                      count_,
+                                  int                      rateHz_,
+                                  int                      loadThreads_,
+                                  bool                     realtime_,
+                                  const realtime_config_t* config_)
+{
+    int clientFd;
+    int serverFd;
+    if (!bench_loopback_pair(&clientFd, &serverFd)) {
+        return false;
+    }
+
+    transport_config_t transport;
+    transport_config_init(&transport);
+    transport.policy = TransportPolicyLowLatency;
+    transport_apply(clientFd, &transport);
+    transport_apply(serverFd, &transport);
+
+    // Start the load first, so the measured threads have to compete with it
+    pthread_t* load = (pthread_t*)(calloc(loadThreads_ + 1, sizeof(pthread_t)));
+    __atomic_store_n(&benchLoadRunning, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < loadThreads_; i++) {
+        pthread_create(&load[i], NULL, bench_rtload_spin, NULL);
+    }
+
+    bench_rtload_receiver_t receiver = {};
+    receiver.fd                      = serverFd;
+    receiver.expected                = count_;
+    receiver.realtime                = realtime_;
+    receiver.config                  = *config_;
+    bench_samples_init(&receiver.delivery, count_);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, bench_rtload_receive, &receiver);
+
+    // The sender runs on the calling thread; restore its scheduling afterwards
+    int                oldPolicy;
+    struct sched_param oldParam;
+    pthread_getschedparam(pthread_self(), &oldPolicy, &oldParam);
+    if (realtime_) {
+        realtime_set_scheduler(config_);
+    }
+
+    bench_samples_t wakeup;
+    bench_samples_init(&wakeup, count_);
+
+    size_t   encodedSize = message_encoded_size_max(sizeof(uint64_t));
+    uint8_t* encoded     = (uint8_t*)(malloc(encodedSize));
+    uint64_t period      = NSEC_PER_SEC / rateHz_;
+    uint64_t start       = timestamp_now_ns() + (10 * NSEC_PER_MSEC);
+
+    bool ok = true;
+    for (int i = 0; (i < count_) && ok; i++) {
+        uint64_t        due      = start + (period * i);
+        struct timespec deadline = timestamp_to_timespec(due);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) != 0) {}
+
+        uint64_t now = timestamp_now_ns();
+        bench_samples_add(&wakeup, now - due);
+
+        size_t len = message_encode(encoded, encodedSize, MessageTagReport, &now, sizeof(now));
+        ok         = (write(clientFd, encoded, len) == (ssize_t)len);
+    }
+
+    pthread_setschedparam(pthread_self(), oldPolicy, &oldParam);
+    if (!ok) {
+        shutdown(serverFd, SHUT_RDWR);
+    }
+    pthread_join(thread, NULL);
+
+    __atomic_store_n(&benchLoadRunning, 0, __ATOMIC_RELAXED);
+    for (int i = 0; i < loadThreads_; i++) {
+        pthread_join(load[i], NULL);
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s-wakeup", case_);
+    bench_report_latency("rtload", name, &wakeup);
+    snprintf(name, sizeof(name), "%s-delivery", case_);
+    bench_report_latency("rtload", name, &receiver.delivery);
+
+    free(encoded);
+    free(load);
+    bench_samples_free(&wakeup);
+    bench_samples_free(&receiver.delivery);
+    close(clientFd);
+    close(serverFd);
+    return ok;
+}
+
+//---------------------------------------------------------------------------
+int bench_rtload(int argc_, char** argv_)
+{
+    int count       = 2000;
+    int rateHz      = 1000;
+    int loadThreads = 2 * (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    realtime_config_t config;
+    realtime_config_init(&config);
+
+    static const struct option options[] = { { "count", required_argument, NULL, 'n' },
+                                             { "rate", required_argument, NULL, 'r' },
+                                             { "load", required_argument, NULL, 'l' },
+                                             { "rt-priority", required_argument, NULL, 'P' },
+                                             { NULL, 0, NULL, 0 } };
+
+    int opt;
+    while ((opt = getopt_long(argc_, argv_, "n:r:l:P:", options, NULL)) != -1) {
+        switch (opt) {
+            case 'n': count = atoi(optarg); break;
+            case 'r': rateHz = atoi(optarg); break;
+            case 'l': loadThreads = atoi(optarg); break;
+            case 'P': config.priority = atoi(optarg); break;
+            default: {
+                printf("usage: netstick_bench rtload [-n count] [-r rate Hz] [-l load threads] [-P rt priority]\n");
+                return -1;
+            }
+        }
+    }
+    if ((count <= 0) || (rateHz <= 0) || (loadThreads < 0)) {
+        printf("invalid benchmark parameters\n");
+        return -1;
+    }
+
+    printf("# %d reports at %d Hz over loopback; %d busy threads for the load cases\n", count, rateHz, loadThreads);
+
+    if (!bench_rtload_run_case("idle", count, rateHz, 0, false, &config)
+        || !bench_rtload_run_case("load", count, rateHz, loadThreads, false, &config)) {
+        printf("rtload benchmark failed\n");
+        return -1;
+    }
+
+    if (!realtime_set_scheduler(&config)) {
+        printf("# real-time scheduling not permitted; skipping load-realtime\n");
+        return 0;
+    }
+    struct sched_param param = {};
+    pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+
+    if (!bench_rtload_run_case("load-realtime", count, rateHz, loadThreads, true, &config)) {
+        printf("rtload benchmark failed\n");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,216 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+//
+// Loopback latency benchmark for the socket policies in transport.c.  Reports
+// are generated at a fixed rate and sent through the same send queue and
+// transport code used by netstick; the receiving thread measures the time from
+// report generation until the frame is decoded.
+#include "bench.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+
+#include "message.h"
+#include "sendqueue.h"
+#include "timestamp.h"
+#include "transport.h"
+
+//---------------------------------------------------------------------------
+typedef struct {
+    int                fd;          //!< Receiving socket
+    transport_config_t config;      //!< Policy applied to the receiving socket
+    int                expected;    //!< Number of reports to wait for
+    bench_samples_t    latency;     //!< Time from generation to decode, per report
+} bench_transport_receiver_t;
+
+//---------------------------------------------------------------------------
+static void bench_transport_on_read(int fd_, void* arg_)
+{
+    bench_transport_receiver_t* receiver = (bench_transport_receiver_t*)arg_;
+    transport_on_read(fd_, &receiver->config);
+}
+
+//---------------------------------------------------------------------------
+static bool bench_transport_on_frame(uint16_t tag_, const void* data_, size_t dataLen_, void* arg_)
+{
+    bench_transport_receiver_t* receiver = (bench_transport_receiver_t*)arg_;
+    uint64_t                    now      = timestamp_now_ns();
+
+    uint64_t sent;
+    if ((tag_ == MessageTagReport) && (dataLen_ >= sizeof(sent))) {
+        memcpy(&sent, data_, sizeof(sent));
+        bench_samples_add(&receiver->latency, now - sent);
+    }
+    return ((int)receiver->latency.count < receiver->expected);
+}
+
+//---------------------------------------------------------------------------
+static void* bench_transport_receive(void* arg_)
+{
+    bench_transport_receiver_t* receiver = (bench_transport_receiver_t*)arg_;
+    bench_read_frames(receiver->fd, bench_transport_on_read, bench_transport_on_frame, receiver);
+    return NULL;
+}
+
+//---------------------------------------------------------------------------
+// Service the sender until the given time, sleeping in ppoll() in between.
+static bool bench_transport_wait(transport_sender_t* sender_, uint64_t until_)
+{
+    while (1) {
+        uint64_t now = timestamp_now_ns();
+        if (transport_sender_service(sender_, now) == SendQueueErrorSocket) {
+            return false;
+        }
+        if (now >= until_) {
+            return true;
+        }
+
+        uint64_t waitNs    = until_ - now;
+        int64_t  timeoutNs = transport_sender_timeout(sender_, now);
+        if ((timeoutNs >= 0) && ((uint64_t)timeoutNs < waitNs)) {
+            waitNs = timeoutNs;
+        }
+
+        struct pollfd   pfd     = { .fd = sender_->fd, .events = 0 };
+        struct timespec timeout = timestamp_to_timespec(waitNs);
+        if (transport_sender_wants_write(sender_)) {
+            pfd.events = POLLOUT;
+        }
+        ppoll(&pfd, 1, &timeout, NULL);
+    }
+}
+
+//---------------------------------------------------------------------------
+static bool bench_transport_run_policy(const transport_config_t* config_, int count_, int rateHz_, size_t reportSize_)
+{
+    int clientFd;
+    int serverFd;
+    if (!bench_loopback_pair(&clientFd, &serverFd)) {
+        return false;
+    }
+
+    transport_apply(clientFd, config_);
+    transport_apply(serverFd, config_);
+    fcntl(clientFd, F_SETFL, fcntl(clientFd, F_GETFL) | O_NONBLOCK);
+
+    bench_transport_receiver_t receiver = {};
+    receiver.fd                         = serverFd;
+    receiver.config                     = *config_;
+    receiver.expected                   = count_;
+    bench_samples_init(&receiver.latency, count_);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, bench_transport_receive, &receiver);
+
+    // Reports are never merged here; every report must arrive to be measured
+    send_queue_t*      queue = send_queue_create(64, reportSize_, NULL, NULL);
+    transport_sender_t sender;
+    transport_sender_init(&sender, clientFd, config_, queue);
+
+    uint8_t* report = (uint8_t*)(calloc(1, reportSize_));
+    uint64_t period = NSEC_PER_SEC / rateHz_;
+    uint64_t start  = timestamp_now_ns() + NSEC_PER_MSEC;
+
+    bool ok = true;
+    for (int i = 0; (i < count_) && ok; i++) {
+        ok = bench_transport_wait(&sender, start + (period * i));
+
+        uint64_t now = timestamp_now_ns();
+        memcpy(report, &now, sizeof(now));
+        report[sizeof(now)] = (uint8_t)i;
+
+        send_queue_return_t rc = transport_sender_send(&sender, MessageTagReport, report, reportSize_, false, now);
+        while (ok && (rc == SendQueueErrorFull)) {
+            ok = bench_transport_wait(&sender, timestamp_now_ns() + (10 * NSEC_PER_USEC));
+            rc = transport_sender_send(&sender, MessageTagReport, report, reportSize_, false, now);
+        }
+        if ((rc != SendQueueOk) && (rc != SendQueueWouldBlock)) {
+            ok = false;
+        }
+    }
+
+    // Drain whatever is still queued or batched
+    while (ok && (!send_queue_is_empty(queue) || (transport_sender_timeout(&sender, timestamp_now_ns()) >= 0))) {
+        ok = bench_transport_wait(&sender, timestamp_now_ns() + (100 * NSEC_PER_USEC));
+    }
+
+    if (!ok) {
+        shutdown(serverFd, SHUT_RDWR);
+    }
+    pthread_join(thread, NULL);
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s", transport_policy_to_string(config_->policy));
+    if (config_->policy == TransportPolicyThroughput) {
+        snprintf(name, sizeof(name), "%s-%dus", transport_policy_to_string(config_->policy), config_->batchWindowUs);
+    }
+    bench_report_latency("transport", name, &receiver.latency);
+
+    bench_samples_free(&receiver.latency);
+    free(report);
+    send_queue_destroy(queue);
+    close(clientFd);
+    close(serverFd);
+    return ok;
+}
+
+//---------------------------------------------------------------------------
+int bench_transport(int argc_, char** argv_)
+{
+    int    count      = 5000;
+    int    rateHz     = 1000;
+    size_t reportSize = 48;
+
+    transport_config_t config;
+    transport_config_init(&config);
+
+    static const struct option options[] = { { "count", required_argument, NULL, 'n' },
+                                             { "rate", required_argument, NULL, 'r' },
+                                             { "size", required_argument, NULL, 's' },
+                                             { "batch-us", required_argument, NULL, 'b' },
+                                             { NULL, 0, NULL, 0 } };
+
+    int opt;
+    while ((opt = getopt_long(argc_, argv_, "n:r:s:b:", options, NULL)) != -1) {
+        switch (opt) {
+            case 'n': count = atoi(optarg); break;
+            case 'r': rateHz = atoi(optarg); break;
+            case 's': reportSize = (size_t)atoi(optarg); break;
+            case 'b': config.batchWindowUs = atoi(optarg); break;
+            default: {
+                printf("usage: netstick_bench transport [-n count] [-r rate Hz] [-s report size] [-b batch usec]\n");
+                return -1;
+            }
+        }
+    }
+
+    if ((count <= 0) || (rateHz <= 0) || (reportSize < sizeof(uint64_t) + 1)) {
+        printf("invalid benchmark parameters\n");
+        return -1;
+    }
+
+    printf("# %d reports of %zu bytes at %d Hz over loopback\n", count, reportSize, rateHz);
+
+    const transport_policy_t policies[]
+        = { TransportPolicyDefault, TransportPolicyLowLatency, TransportPolicyThroughput };
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        config.policy = policies[i];
+        if (!bench_transport_run_policy(&config, count, rateHz, reportSize)) {
+            printf("transport benchmark failed for policy %s\n", transport_policy_to_string(policies[i]));
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,342 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#include "capture.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "timestamp.h"
+
+//---------------------------------------------------------------------------
+static bool capture_write_all(int fd_, const void* data_, size_t len_)
+{
+    const uint8_t* raw = (const uint8_t*)data_;
+    while (len_ > 0) {
+        ssize_t nWritten = write(fd_, raw, len_);
+        if (nWritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        raw += nWritten;
+        len_ -= nWritten;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+capture_writer_t* capture_writer_create(const char* path_, capture_kind_t kind_, const js_config_t* config_)
+{
+    int fd = open(path_, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        printf("error creating capture %s: %d (%s)\n", path_, errno, strerror(errno));
+        return NULL;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    capture_header_t* header = (capture_header_t*)(calloc(1, sizeof(capture_header_t)));
+    header->magic            = CAPTURE_MAGIC;
+    header->version          = CAPTURE_VERSION;
+    header->kind             = kind_;
+    header->configSize       = sizeof(js_config_t);
+    header->startNs          = ((uint64_t)now.tv_sec * NSEC_PER_SEC) + (uint64_t)now.tv_nsec;
+    header->config           = *config_;
+    bool written             = capture_write_all(fd, header, sizeof(*header));
+    free(header);
+    if (!written) {
+        printf("error writing capture %s: %d (%s)\n", path_, errno, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    capture_writer_t* writer = (capture_writer_t*)(calloc(1, sizeof(capture_writer_t)));
+    writer->fd               = fd;
+    writer->kind             = kind_;
+    writer->flushedNs        = timestamp_now_ns();
+    writer->buffer           = (uint8_t*)(malloc(CAPTURE_BUFFER_SIZE));
+    writer->bytes            = sizeof(capture_header_t);
+    return writer;
+}
+
+//---------------------------------------------------------------------------
+void capture_writer_destroy(capture_writer_t* writer_)
+{
+    if (!writer_) {
+        return;
+    }
+    capture_writer_flush(writer_);
+    printf("capture: %llu records, %llu bytes%s\n",
+           (unsigned long long)writer_->records,
+           (unsigned long long)writer_->bytes,
+           writer_->failed ? " (incomplete - write failed)" : "");
+    close(writer_->fd);
+    free(writer_->buffer);
+    free(writer_);
+}
+
+//---------------------------------------------------------------------------
+bool capture_writer_flush(capture_writer_t* writer_)
+{
+    writer_->flushedNs = timestamp_now_ns();
+    if (writer_->failed || (writer_->used == 0)) {
+        return !writer_->failed;
+    }
+    if (!capture_write_all(writer_->fd, writer_->buffer, writer_->used)) {
+        printf("error writing capture: %d (%s)\n", errno, strerror(errno));
+        writer_->failed = true;
+        return false;
+    }
+    writer_->bytes += writer_->used;
+    writer_->used = 0;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Make room for a record of the given size, and work out its time delta.
+// Returns NULL if the record can't be written.
+static uint8_t* capture_writer_reserve(capture_writer_t* writer_, size_t size_, uint64_t timeNs_, uint32_t* deltaUs_)
+{
+    if (writer_->failed) {
+        return NULL;
+    }
+    if (((writer_->used + size_) > CAPTURE_BUFFER_SIZE) && !capture_writer_flush(writer_)) {
+        return NULL;
+    }
+
+    // Clocks can step backwards (CLOCK_REALTIME event timestamps), and gaps
+    // longer than the delta can hold are shortened; neither matters for replay
+    uint64_t deltaUs = 0;
+    if ((writer_->lastNs != 0) && (timeNs_ > writer_->lastNs)) {
+        deltaUs = (timeNs_ - writer_->lastNs) / NSEC_PER_USEC;
+    }
+    *deltaUs_       = (deltaUs > UINT32_MAX) ? UINT32_MAX : (uint32_t)deltaUs;
+    writer_->lastNs = (timeNs_ > writer_->lastNs) ? timeNs_ : writer_->lastNs;
+
+    uint8_t* record = writer_->buffer + writer_->used;
+    writer_->used += size_;
+    writer_->records++;
+    return record;
+}
+
+//---------------------------------------------------------------------------
+// Keep records from sitting in the buffer for long, so that a capture of a
+// client that gets killed still holds everything up to the last second or so
+static void capture_writer_maybe_flush(capture_writer_t* writer_)
+{
+    if ((timestamp_now_ns() - writer_->flushedNs) >= (CAPTURE_FLUSH_INTERVAL_MS * NSEC_PER_MSEC)) {
+        capture_writer_flush(writer_);
+    }
+}
+
+//---------------------------------------------------------------------------
+static bool
+capture_write_event_at(capture_writer_t* writer_, uint64_t timeNs_, uint16_t type_, uint16_t code_, int32_t value_)
+{
+    capture_event_t record;
+    uint32_t        deltaUs;
+    uint8_t*        dest = capture_writer_reserve(writer_, sizeof(record), timeNs_, &deltaUs);
+    if (!dest) {
+        return false;
+    }
+    record.deltaUs = deltaUs;
+    record.type    = type_;
+    record.code    = code_;
+    record.value   = value_;
+    memcpy(dest, &record, sizeof(record));
+    return true;
+}
+
+//---------------------------------------------------------------------------
+bool capture_write_event(capture_writer_t* writer_, const struct input_event* event_)
+{
+    uint64_t timeNs
+        = ((uint64_t)event_->input_event_sec * NSEC_PER_SEC) + ((uint64_t)event_->input_event_usec * NSEC_PER_USEC);
+    if (!capture_write_event_at(writer_, timeNs, event_->type, event_->code, event_->value)) {
+        return false;
+    }
+    capture_writer_maybe_flush(writer_);
+    return true;
+}
+
+//---------------------------------------------------------------------------
+bool capture_write_state(capture_writer_t*  writer_,
+                         const js_config_t* config_,
+                         uint64_t           timeNs_,
+                         const uint8_t*     buttons_,
+                         const int32_t*     absValues_)
+{
+    bool ok = true;
+    for (int i = 0; (i < config_->buttonCount) && ok; i++) {
+        if (buttons_[i]) {
+            ok = capture_write_event_at(writer_, timeNs_, EV_KEY, config_->buttons[i], buttons_[i]);
+        }
+    }
+    for (int i = 0; (i < config_->absAxisCount) && ok; i++) {
+        ok = capture_write_event_at(writer_, timeNs_, EV_ABS, config_->absAxis[i], absValues_[i]);
+    }
+    return ok && capture_write_event_at(writer_, timeNs_, EV_SYN, SYN_REPORT, 0);
+}
+
+//---------------------------------------------------------------------------
+bool capture_write_report(
+    capture_writer_t* writer_, uint64_t timeNs_, uint16_t tag_, const void* data_, size_t dataLen_)
+{
+    if ((dataLen_ > UINT16_MAX) || ((sizeof(capture_report_t) + dataLen_) > CAPTURE_BUFFER_SIZE)) {
+        return false;
+    }
+
+    capture_report_t record;
+    uint32_t         deltaUs;
+    uint8_t*         dest = capture_writer_reserve(writer_, sizeof(record) + dataLen_, timeNs_, &deltaUs);
+    if (!dest) {
+        return false;
+    }
+    record.deltaUs = deltaUs;
+    record.tag     = tag_;
+    record.length  = (uint16_t)dataLen_;
+    memcpy(dest, &record, sizeof(record));
+    memcpy(dest + sizeof(record), data_, dataLen_);
+    capture_writer_maybe_flush(writer_);
+    return true;
+}
+
+//---------------------------------------------------------------------------
+static bool capture_header_valid(const capture_header_t* header_)
+{
+    const js_config_t* config = &header_->config;
+    return (header_->magic == CAPTURE_MAGIC) && (header_->version == CAPTURE_VERSION) && (header_->kind < CaptureKinds)
+           && (header_->configSize == sizeof(js_config_t)) && (config->absAxisCount >= 0)
+           && (config->absAxisCount <= ABS_CNT) && (config->relAxisCount >= 0) && (config->relAxisCount <= REL_CNT)
+           && (config->buttonCount >= 0) && (config->buttonCount <= KEY_CNT);
+}
+
+//---------------------------------------------------------------------------
+capture_reader_t* capture_reader_open(const char* path_)
+{
+    int fd = open(path_, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        printf("error opening capture %s: %d (%s)\n", path_, errno, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(capture_header_t))) {
+        printf("capture %s is too short\n", path_);
+        close(fd);
+        return NULL;
+    }
+
+    // The mapping outlives the descriptor
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("error mapping capture %s: %d (%s)\n", path_, errno, strerror(errno));
+        return NULL;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    const capture_header_t* header = (const capture_header_t*)map;
+    if (!capture_header_valid(header)) {
+        printf("%s is not a capture made by this version of netstick\n", path_);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    capture_reader_t* reader = (capture_reader_t*)(calloc(1, sizeof(capture_reader_t)));
+    reader->map              = (const uint8_t*)map;
+    reader->size             = st.st_size;
+    reader->header           = header;
+    capture_reader_rewind(reader);
+    return reader;
+}
+
+//---------------------------------------------------------------------------
+void capture_reader_close(capture_reader_t* reader_)
+{
+    if (!reader_) {
+        return;
+    }
+    munmap((void*)reader_->map, reader_->size);
+    free(reader_);
+}
+
+//---------------------------------------------------------------------------
+void capture_reader_rewind(capture_reader_t* reader_)
+{
+    reader_->offset  = sizeof(capture_header_t);
+    reader_->timeNs  = 0;
+    reader_->records = 0;
+}
+
+//---------------------------------------------------------------------------
+// Size of the record at the reader's position; 0 if there isn't a whole one
+// (at the end of the capture, or a record cut short when the capture stopped)
+static size_t capture_reader_record_size(const capture_reader_t* reader_)
+{
+    size_t remaining = reader_->size - reader_->offset;
+    size_t size;
+    if (reader_->header->kind == CaptureKindEvents) {
+        size = sizeof(capture_event_t);
+    } else {
+        if (remaining < sizeof(capture_report_t)) {
+            return 0;
+        }
+        const capture_report_t* record = (const capture_report_t*)(reader_->map + reader_->offset);
+        size                           = sizeof(capture_report_t) + record->length;
+    }
+    return (size <= remaining) ? size : 0;
+}
+
+//---------------------------------------------------------------------------
+// Both record types start with the time delta
+static uint64_t capture_reader_record_time(const capture_reader_t* reader_)
+{
+    uint32_t deltaUs;
+    memcpy(&deltaUs, reader_->map + reader_->offset, sizeof(deltaUs));
+    return reader_->timeNs + ((reader_->records > 0) ? ((uint64_t)deltaUs * NSEC_PER_USEC) : 0);
+}
+
+//---------------------------------------------------------------------------
+const capture_event_t* capture_reader_peek_event(const capture_reader_t* reader_, uint64_t* timeNs_)
+{
+    if ((reader_->header->kind != CaptureKindEvents) || (capture_reader_record_size(reader_) == 0)) {
+        return NULL;
+    }
+    *timeNs_ = capture_reader_record_time(reader_);
+    return (const capture_event_t*)(reader_->map + reader_->offset);
+}
+
+//---------------------------------------------------------------------------
+const capture_report_t* capture_reader_peek_report(const capture_reader_t* reader_, uint64_t* timeNs_)
+{
+    if ((reader_->header->kind != CaptureKindReports) || (capture_reader_record_size(reader_) == 0)) {
+        return NULL;
+    }
+    *timeNs_ = capture_reader_record_time(reader_);
+    return (const capture_report_t*)(reader_->map + reader_->offset);
+}
+
+//---------------------------------------------------------------------------
+void capture_reader_advance(capture_reader_t* reader_)
+{
+    size_t size = capture_reader_record_size(reader_);
+    if (size == 0) {
+        return;
+    }
+    reader_->timeNs = capture_reader_record_time(reader_);
+    reader_->offset += size;
+    reader_->records++;
+}
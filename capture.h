@@ -0,0 +1,222 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <linux/input.h>
+
+#include "joystick.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+#define CAPTURE_MAGIC (0x5043534EU)         //!< "NSCP", little-endian
+#define CAPTURE_VERSION (1)                 //!< Format version written by this code
+#define CAPTURE_BUFFER_SIZE (65536)         //!< Records buffered before they're written out
+#define CAPTURE_FLUSH_INTERVAL_MS (1000)    //!< Longest time a record is left in the buffer
+
+//---------------------------------------------------------------------------
+// What a capture file holds
+typedef enum {
+    CaptureKindEvents = 0,  //!< input events read by netstick
+    CaptureKindReports,     //!< report messages received by netstickd
+    CaptureKinds
+} capture_kind_t;
+
+//---------------------------------------------------------------------------
+// File header.  Records follow it directly, up to the end of the file; there is
+// no record count, so a capture cut short by a crash is still readable.
+typedef struct __attribute__((packed)) {
+    uint32_t    magic;      //!< CAPTURE_MAGIC
+    uint16_t    version;    //!< CAPTURE_VERSION
+    uint16_t    kind;       //!< capture_kind_t
+    uint32_t    configSize; //!< sizeof(js_config_t), to catch captures from incompatible builds
+    uint32_t    reserved;
+    uint64_t    startNs;    //!< CLOCK_REALTIME time at which the capture started
+    js_config_t config;     //!< device the records belong to
+} capture_header_t;
+
+//---------------------------------------------------------------------------
+// Record of an event capture: half the size of a struct input_event
+typedef struct __attribute__((packed)) {
+    uint32_t deltaUs;   //!< time since the previous record
+    uint16_t type;      //!< event type
+    uint16_t code;      //!< event code
+    int32_t  value;     //!< event value
+} capture_event_t;
+
+//---------------------------------------------------------------------------
+// Record of a report capture, followed by length bytes of message data
+typedef struct __attribute__((packed)) {
+    uint32_t deltaUs;   //!< time since the previous record
+    uint16_t tag;       //!< message tag (MessageTagReport or MessageTagTimedReport)
+    uint16_t length;    //!< length of the message data that follows
+} capture_report_t;
+
+//---------------------------------------------------------------------------
+// Append-only capture being written
+typedef struct {
+    int            fd;          //!< file being written
+    capture_kind_t kind;        //!< kind of records accepted
+    uint64_t       lastNs;      //!< time of the previous record (0 == none yet)
+    uint64_t       flushedNs;   //!< CLOCK_MONOTONIC time of the last write to the file
+    uint8_t*       buffer;      //!< records not yet written
+    size_t         used;        //!< bytes in buffer
+    uint64_t       records;     //!< records captured
+    uint64_t       bytes;       //!< bytes written, including the header
+    bool           failed;      //!< whether a write failed (nothing more is written)
+} capture_writer_t;
+
+//---------------------------------------------------------------------------
+// Capture mapped for replay.  Records are read in place.
+typedef struct {
+    const uint8_t*          map;        //!< whole file
+    size_t                  size;       //!< size of the file
+    const capture_header_t* header;     //!< header at the start of the file
+    size_t                  offset;     //!< offset of the next record
+    uint64_t                timeNs;     //!< time of the last record read, relative to the first
+    uint64_t                records;    //!< records read so far
+} capture_reader_t;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief capture_writer_create start a capture file, replacing any existing one
+ * @param path_ file to write
+ * @param kind_ kind of records to be written
+ * @param config_ device the records belong to
+ * @return newly-constructed writer, or NULL on error
+ */
+capture_writer_t* capture_writer_create(const char* path_, capture_kind_t kind_, const js_config_t* config_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief capture_writer_destroy write out any buffered records and close the file
+ * NOTE: object must not be used after this is called.
+ * @param writer_ writer to destroy (may be NULL)
+ */
+void capture_writer_destroy(capture_writer_t* writer_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief capture_write_event append an event to an event capture, timed by the
+ * event's own timestamp
+ * @param writer_ capture to append to
+ * @param event_ event to record
+ * @return true on success
+ */
+bool capture_write_event(capture_writer_t* writer_, const struct input_event* event_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief capture_write_state append events describing a device's complete state,
+ * followed by SYN_REPORT.  Used at the start of a capture, so that replay
+ * begins from the same state as the device did.
+ * @param writer_ capture to append to
+ * @param config_ device the state belongs to
+ * @param timeNs_ time of the state (same clock as the events that follow)
+ * @param buttons_ state of each of config.buttonCount buttons
+ * @param absValues_ value of each of config.absAxisCount absolute axes
+ * @return true on success
+ */
+bool capture_write_state(capture_writer_t*  writer_,
+                         const js_config_t* config_,
+                         uint64_t           timeNs_,
+                         const uint8_t*     buttons_,
+                         const int32_t*     absValues_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief capture_write_report append a message to a report capture
+ * @param writer_ capture to append to
+ * @param timeNs_ time at which the message was received
+ * @param tag_ message tag
+ * @param data_ message data
+ * @param dataLen_ length of the message data
+ * @return true on success
+ */
+bool capture_write_report(
+    capture_writer_t* writer_, uint64_t timeNs_, uint16_t tag_, const void* data_, size_t dataLen_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief capture_writer_flush write out any buffered records
+ * @param writer_ capture to flush
+ * @return true on success
+ */
+bool capture_writer_flush(capture_writer_t* writer_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief capture_reader_open map a capture file for replay, and check its header
+ * @param path_ file to read
+ * @return newly-constructed reader, or NULL on error
+ */
+capture_reader_t* capture_reader_open(const char* path_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief capture_reader_close unmap a capture file
+ * NOTE: object must not be used after this is called.
+ * @param reader_ reader to close (may be NULL)
+ */
+void capture_reader_close(capture_reader_t* reader_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief capture_reader_rewind go back to the first record
+ * @param reader_ reader to rewind
+ */
+void capture_reader_rewind(capture_reader_t* reader_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief capture_reader_peek_event return the next record of an event capture,
+ * without consuming it
+ * @param reader_ reader to read from
+ * @param timeNs_ [out] time of the record, relative to the first record
+ * @return record (pointing into the mapped file), or NULL at the end of the capture
+ */
+const capture_event_t* capture_reader_peek_event(const capture_reader_t* reader_, uint64_t* timeNs_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief capture_reader_peek_report return the next record of a report capture,
+ * without consuming it
+ * @param reader_ reader to read from
+ * @param timeNs_ [out] time of the record, relative to the first record
+ * @return record (pointing into the mapped file, with its data directly after
+ * it), or NULL at the end of the capture
+ */
+const capture_report_t* capture_reader_peek_report(const capture_reader_t* reader_, uint64_t* timeNs_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief capture_reader_advance consume the record returned by the last peek
+ * @param reader_ reader to advance
+ */
+void capture_reader_advance(capture_reader_t* reader_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief capture_replay_due_ns return when a record is due during replay
+ * @param startNs_ CLOCK_MONOTONIC time at which replay started
+ * @param recordNs_ time of the record, relative to the first record
+ * @param speed_ playback speed (1.0 == original speed); 0 replays as fast as possible
+ * @return CLOCK_MONOTONIC time at which the record is due; 0 if it's due right away
+ */
+static inline uint64_t capture_replay_due_ns(uint64_t startNs_, uint64_t recordNs_, double speed_)
+{
+    if (speed_ <= 0.0) {
+        return 0;
+    }
+    return startNs_ + (uint64_t)((double)recordNs_ / speed_);
+}
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
@@ -0,0 +1,49 @@
+# Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+# for more details.
+#
+# Checks the USDT probe notes in netstick's binaries; run with cmake -P.
+#
+#   -DMODE=present -DREADELF=<readelf> -DBINARY=<file> -DPROBES=<a;b;...>
+#       every probe listed must have a note in BINARY
+#   -DMODE=absent -DREADELF=<readelf> -DSOURCE_DIR=<dir> -DBUILD_DIR=<dir> -DTARGETS=<a;b;...>
+#       a -DNETSTICK_PROBES=OFF build of TARGETS must carry no probe notes at all
+
+function(read_notes binary_ out_)
+	execute_process(COMMAND ${READELF} -n ${binary_} OUTPUT_VARIABLE notes RESULT_VARIABLE rc)
+	if(NOT rc EQUAL 0)
+		message(FATAL_ERROR "${READELF} -n ${binary_} failed")
+	endif()
+	set(${out_} "${notes}" PARENT_SCOPE)
+endfunction()
+
+if(MODE STREQUAL "present")
+	read_notes(${BINARY} notes)
+	set(missing "")
+	foreach(probe ${PROBES})
+		if(NOT notes MATCHES "Provider: netstick[\r\n]+ *Name: ${probe}[\r\n]")
+			list(APPEND missing ${probe})
+		endif()
+	endforeach()
+	if(missing)
+		message(FATAL_ERROR "${BINARY}: no note for probe(s): ${missing}")
+	endif()
+elseif(MODE STREQUAL "absent")
+	execute_process(COMMAND ${CMAKE_COMMAND} -S ${SOURCE_DIR} -B ${BUILD_DIR} -DNETSTICK_PROBES=OFF
+	                OUTPUT_QUIET RESULT_VARIABLE rc)
+	if(NOT rc EQUAL 0)
+		message(FATAL_ERROR "unable to configure ${BUILD_DIR}")
+	endif()
+	execute_process(COMMAND ${CMAKE_COMMAND} --build ${BUILD_DIR} --target ${TARGETS}
+	                OUTPUT_QUIET RESULT_VARIABLE rc)
+	if(NOT rc EQUAL 0)
+		message(FATAL_ERROR "unable to build ${TARGETS} in ${BUILD_DIR}")
+	endif()
+	foreach(target ${TARGETS})
+		read_notes(${BUILD_DIR}/${target} notes)
+		if(notes MATCHES "stapsdt")
+			message(FATAL_ERROR "${target} built with NETSTICK_PROBES=OFF still carries probe notes")
+		endif()
+	endforeach()
+else()
+	message(FATAL_ERROR "unknown MODE: ${MODE}")
+endif()
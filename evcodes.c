@@ -0,0 +1,437 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#include "evcodes.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <linux/input.h>
+
+//---------------------------------------------------------------------------
+// Names of the event codes that may be used in configuration files.  Limited
+// to codes that have been in the kernel headers long enough to build anywhere.
+typedef struct {
+    const char* name;
+    uint16_t    type;
+    uint16_t    code;
+} evcode_entry_t;
+
+#define EVCODE_KEY(x) { #x, EV_KEY, x }
+#define EVCODE_ABS(x) { #x, EV_ABS, x }
+#define EVCODE_REL(x) { #x, EV_REL, x }
+
+static const evcode_entry_t evcodeTable[] = {
+    EVCODE_KEY(KEY_ESC),
+    EVCODE_KEY(KEY_1),
+    EVCODE_KEY(KEY_2),
+    EVCODE_KEY(KEY_3),
+    EVCODE_KEY(KEY_4),
+    EVCODE_KEY(KEY_5),
+    EVCODE_KEY(KEY_6),
+    EVCODE_KEY(KEY_7),
+    EVCODE_KEY(KEY_8),
+    EVCODE_KEY(KEY_9),
+    EVCODE_KEY(KEY_0),
+    EVCODE_KEY(KEY_MINUS),
+    EVCODE_KEY(KEY_EQUAL),
+    EVCODE_KEY(KEY_BACKSPACE),
+    EVCODE_KEY(KEY_TAB),
+    EVCODE_KEY(KEY_Q),
+    EVCODE_KEY(KEY_W),
+    EVCODE_KEY(KEY_E),
+    EVCODE_KEY(KEY_R),
+    EVCODE_KEY(KEY_T),
+    EVCODE_KEY(KEY_Y),
+    EVCODE_KEY(KEY_U),
+    EVCODE_KEY(KEY_I),
+    EVCODE_KEY(KEY_O),
+    EVCODE_KEY(KEY_P),
+    EVCODE_KEY(KEY_LEFTBRACE),
+    EVCODE_KEY(KEY_RIGHTBRACE),
+    EVCODE_KEY(KEY_ENTER),
+    EVCODE_KEY(KEY_LEFTCTRL),
+    EVCODE_KEY(KEY_A),
+    EVCODE_KEY(KEY_S),
+    EVCODE_KEY(KEY_D),
+    EVCODE_KEY(KEY_F),
+    EVCODE_KEY(KEY_G),
+    EVCODE_KEY(KEY_H),
+    EVCODE_KEY(KEY_J),
+    EVCODE_KEY(KEY_K),
+    EVCODE_KEY(KEY_L),
+    EVCODE_KEY(KEY_SEMICOLON),
+    EVCODE_KEY(KEY_APOSTROPHE),
+    EVCODE_KEY(KEY_GRAVE),
+    EVCODE_KEY(KEY_LEFTSHIFT),
+    EVCODE_KEY(KEY_BACKSLASH),
+    EVCODE_KEY(KEY_Z),
+    EVCODE_KEY(KEY_X),
+    EVCODE_KEY(KEY_C),
+    EVCODE_KEY(KEY_V),
+    EVCODE_KEY(KEY_B),
+    EVCODE_KEY(KEY_N),
+    EVCODE_KEY(KEY_M),
+    EVCODE_KEY(KEY_COMMA),
+    EVCODE_KEY(KEY_DOT),
+    EVCODE_KEY(KEY_SLASH),
+    EVCODE_KEY(KEY_RIGHTSHIFT),
+    EVCODE_KEY(KEY_KPASTERISK),
+    EVCODE_KEY(KEY_LEFTALT),
+    EVCODE_KEY(KEY_SPACE),
+    EVCODE_KEY(KEY_CAPSLOCK),
+    EVCODE_KEY(KEY_F1),
+    EVCODE_KEY(KEY_F2),
+    EVCODE_KEY(KEY_F3),
+    EVCODE_KEY(KEY_F4),
+    EVCODE_KEY(KEY_F5),
+    EVCODE_KEY(KEY_F6),
+    EVCODE_KEY(KEY_F7),
+    EVCODE_KEY(KEY_F8),
+    EVCODE_KEY(KEY_F9),
+    EVCODE_KEY(KEY_F10),
+    EVCODE_KEY(KEY_NUMLOCK),
+    EVCODE_KEY(KEY_SCROLLLOCK),
+    EVCODE_KEY(KEY_KP7),
+    EVCODE_KEY(KEY_KP8),
+    EVCODE_KEY(KEY_KP9),
+    EVCODE_KEY(KEY_KPMINUS),
+    EVCODE_KEY(KEY_KP4),
+    EVCODE_KEY(KEY_KP5),
+    EVCODE_KEY(KEY_KP6),
+    EVCODE_KEY(KEY_KPPLUS),
+    EVCODE_KEY(KEY_KP1),
+    EVCODE_KEY(KEY_KP2),
+    EVCODE_KEY(KEY_KP3),
+    EVCODE_KEY(KEY_KP0),
+    EVCODE_KEY(KEY_KPDOT),
+    EVCODE_KEY(KEY_ZENKAKUHANKAKU),
+    EVCODE_KEY(KEY_102ND),
+    EVCODE_KEY(KEY_F11),
+    EVCODE_KEY(KEY_F12),
+    EVCODE_KEY(KEY_RO),
+    EVCODE_KEY(KEY_KATAKANA),
+    EVCODE_KEY(KEY_HIRAGANA),
+    EVCODE_KEY(KEY_HENKAN),
+    EVCODE_KEY(KEY_KATAKANAHIRAGANA),
+    EVCODE_KEY(KEY_MUHENKAN),
+    EVCODE_KEY(KEY_KPJPCOMMA),
+    EVCODE_KEY(KEY_KPENTER),
+    EVCODE_KEY(KEY_RIGHTCTRL),
+    EVCODE_KEY(KEY_KPSLASH),
+    EVCODE_KEY(KEY_SYSRQ),
+    EVCODE_KEY(KEY_RIGHTALT),
+    EVCODE_KEY(KEY_LINEFEED),
+    EVCODE_KEY(KEY_HOME),
+    EVCODE_KEY(KEY_UP),
+    EVCODE_KEY(KEY_PAGEUP),
+    EVCODE_KEY(KEY_LEFT),
+    EVCODE_KEY(KEY_RIGHT),
+    EVCODE_KEY(KEY_END),
+    EVCODE_KEY(KEY_DOWN),
+    EVCODE_KEY(KEY_PAGEDOWN),
+    EVCODE_KEY(KEY_INSERT),
+    EVCODE_KEY(KEY_DELETE),
+    EVCODE_KEY(KEY_MACRO),
+    EVCODE_KEY(KEY_MUTE),
+    EVCODE_KEY(KEY_VOLUMEDOWN),
+    EVCODE_KEY(KEY_VOLUMEUP),
+    EVCODE_KEY(KEY_POWER),
+    EVCODE_KEY(KEY_KPEQUAL),
+    EVCODE_KEY(KEY_KPPLUSMINUS),
+    EVCODE_KEY(KEY_PAUSE),
+    EVCODE_KEY(KEY_SCALE),
+    EVCODE_KEY(KEY_KPCOMMA),
+    EVCODE_KEY(KEY_HANGEUL),
+    EVCODE_KEY(KEY_HANJA),
+    EVCODE_KEY(KEY_YEN),
+    EVCODE_KEY(KEY_LEFTMETA),
+    EVCODE_KEY(KEY_RIGHTMETA),
+    EVCODE_KEY(KEY_COMPOSE),
+    EVCODE_KEY(KEY_STOP),
+    EVCODE_KEY(KEY_AGAIN),
+    EVCODE_KEY(KEY_PROPS),
+    EVCODE_KEY(KEY_UNDO),
+    EVCODE_KEY(KEY_FRONT),
+    EVCODE_KEY(KEY_COPY),
+    EVCODE_KEY(KEY_OPEN),
+    EVCODE_KEY(KEY_PASTE),
+    EVCODE_KEY(KEY_FIND),
+    EVCODE_KEY(KEY_CUT),
+    EVCODE_KEY(KEY_HELP),
+    EVCODE_KEY(KEY_MENU),
+    EVCODE_KEY(KEY_CALC),
+    EVCODE_KEY(KEY_SETUP),
+    EVCODE_KEY(KEY_SLEEP),
+    EVCODE_KEY(KEY_WAKEUP),
+    EVCODE_KEY(KEY_FILE),
+    EVCODE_KEY(KEY_SENDFILE),
+    EVCODE_KEY(KEY_DELETEFILE),
+    EVCODE_KEY(KEY_XFER),
+    EVCODE_KEY(KEY_PROG1),
+    EVCODE_KEY(KEY_PROG2),
+    EVCODE_KEY(KEY_WWW),
+    EVCODE_KEY(KEY_MSDOS),
+    EVCODE_KEY(KEY_COFFEE),
+    EVCODE_KEY(KEY_ROTATE_DISPLAY),
+    EVCODE_KEY(KEY_CYCLEWINDOWS),
+    EVCODE_KEY(KEY_MAIL),
+    EVCODE_KEY(KEY_BOOKMARKS),
+    EVCODE_KEY(KEY_COMPUTER),
+    EVCODE_KEY(KEY_BACK),
+    EVCODE_KEY(KEY_FORWARD),
+    EVCODE_KEY(KEY_CLOSECD),
+    EVCODE_KEY(KEY_EJECTCD),
+    EVCODE_KEY(KEY_EJECTCLOSECD),
+    EVCODE_KEY(KEY_NEXTSONG),
+    EVCODE_KEY(KEY_PLAYPAUSE),
+    EVCODE_KEY(KEY_PREVIOUSSONG),
+    EVCODE_KEY(KEY_STOPCD),
+    EVCODE_KEY(KEY_RECORD),
+    EVCODE_KEY(KEY_REWIND),
+    EVCODE_KEY(KEY_PHONE),
+    EVCODE_KEY(KEY_ISO),
+    EVCODE_KEY(KEY_CONFIG),
+    EVCODE_KEY(KEY_HOMEPAGE),
+    EVCODE_KEY(KEY_REFRESH),
+    EVCODE_KEY(KEY_EXIT),
+    EVCODE_KEY(KEY_MOVE),
+    EVCODE_KEY(KEY_EDIT),
+    EVCODE_KEY(KEY_SCROLLUP),
+    EVCODE_KEY(KEY_SCROLLDOWN),
+    EVCODE_KEY(KEY_KPLEFTPAREN),
+    EVCODE_KEY(KEY_KPRIGHTPAREN),
+    EVCODE_KEY(KEY_NEW),
+    EVCODE_KEY(KEY_REDO),
+    EVCODE_KEY(KEY_F13),
+    EVCODE_KEY(KEY_F14),
+    EVCODE_KEY(KEY_F15),
+    EVCODE_KEY(KEY_F16),
+    EVCODE_KEY(KEY_F17),
+    EVCODE_KEY(KEY_F18),
+    EVCODE_KEY(KEY_F19),
+    EVCODE_KEY(KEY_F20),
+    EVCODE_KEY(KEY_F21),
+    EVCODE_KEY(KEY_F22),
+    EVCODE_KEY(KEY_F23),
+    EVCODE_KEY(KEY_F24),
+    EVCODE_KEY(KEY_PLAYCD),
+    EVCODE_KEY(KEY_PAUSECD),
+    EVCODE_KEY(KEY_PROG3),
+    EVCODE_KEY(KEY_PROG4),
+    EVCODE_KEY(KEY_ALL_APPLICATIONS),
+    EVCODE_KEY(KEY_SUSPEND),
+    EVCODE_KEY(KEY_CLOSE),
+    EVCODE_KEY(KEY_PLAY),
+    EVCODE_KEY(KEY_FASTFORWARD),
+    EVCODE_KEY(KEY_BASSBOOST),
+    EVCODE_KEY(KEY_PRINT),
+    EVCODE_KEY(KEY_HP),
+    EVCODE_KEY(KEY_CAMERA),
+    EVCODE_KEY(KEY_SOUND),
+    EVCODE_KEY(KEY_QUESTION),
+    EVCODE_KEY(KEY_EMAIL),
+    EVCODE_KEY(KEY_CHAT),
+    EVCODE_KEY(KEY_SEARCH),
+    EVCODE_KEY(KEY_CONNECT),
+    EVCODE_KEY(KEY_FINANCE),
+    EVCODE_KEY(KEY_SPORT),
+    EVCODE_KEY(KEY_SHOP),
+    EVCODE_KEY(KEY_ALTERASE),
+    EVCODE_KEY(KEY_CANCEL),
+    EVCODE_KEY(KEY_BRIGHTNESSDOWN),
+    EVCODE_KEY(KEY_BRIGHTNESSUP),
+    EVCODE_KEY(KEY_MEDIA),
+    EVCODE_KEY(KEY_SWITCHVIDEOMODE),
+    EVCODE_KEY(KEY_KBDILLUMTOGGLE),
+    EVCODE_KEY(KEY_KBDILLUMDOWN),
+    EVCODE_KEY(KEY_KBDILLUMUP),
+    EVCODE_KEY(KEY_SEND),
+    EVCODE_KEY(KEY_REPLY),
+    EVCODE_KEY(KEY_FORWARDMAIL),
+    EVCODE_KEY(KEY_SAVE),
+    EVCODE_KEY(KEY_DOCUMENTS),
+    EVCODE_KEY(KEY_BATTERY),
+    EVCODE_KEY(KEY_BLUETOOTH),
+    EVCODE_KEY(KEY_WLAN),
+    EVCODE_KEY(KEY_UWB),
+    EVCODE_KEY(KEY_UNKNOWN),
+    EVCODE_KEY(KEY_VIDEO_NEXT),
+    EVCODE_KEY(KEY_VIDEO_PREV),
+    EVCODE_KEY(KEY_BRIGHTNESS_CYCLE),
+    EVCODE_KEY(KEY_BRIGHTNESS_AUTO),
+    EVCODE_KEY(KEY_DISPLAY_OFF),
+    EVCODE_KEY(KEY_WWAN),
+    EVCODE_KEY(KEY_RFKILL),
+    EVCODE_KEY(KEY_MICMUTE),
+    EVCODE_KEY(BTN_MISC),
+    EVCODE_KEY(BTN_0),
+    EVCODE_KEY(BTN_1),
+    EVCODE_KEY(BTN_2),
+    EVCODE_KEY(BTN_3),
+    EVCODE_KEY(BTN_4),
+    EVCODE_KEY(BTN_5),
+    EVCODE_KEY(BTN_6),
+    EVCODE_KEY(BTN_7),
+    EVCODE_KEY(BTN_8),
+    EVCODE_KEY(BTN_9),
+    EVCODE_KEY(BTN_MOUSE),
+    EVCODE_KEY(BTN_LEFT),
+    EVCODE_KEY(BTN_RIGHT),
+    EVCODE_KEY(BTN_MIDDLE),
+    EVCODE_KEY(BTN_SIDE),
+    EVCODE_KEY(BTN_EXTRA),
+    EVCODE_KEY(BTN_FORWARD),
+    EVCODE_KEY(BTN_BACK),
+    EVCODE_KEY(BTN_TASK),
+    EVCODE_KEY(BTN_JOYSTICK),
+    EVCODE_KEY(BTN_TRIGGER),
+    EVCODE_KEY(BTN_THUMB),
+    EVCODE_KEY(BTN_THUMB2),
+    EVCODE_KEY(BTN_TOP),
+    EVCODE_KEY(BTN_TOP2),
+    EVCODE_KEY(BTN_PINKIE),
+    EVCODE_KEY(BTN_BASE),
+    EVCODE_KEY(BTN_BASE2),
+    EVCODE_KEY(BTN_BASE3),
+    EVCODE_KEY(BTN_BASE4),
+    EVCODE_KEY(BTN_BASE5),
+    EVCODE_KEY(BTN_BASE6),
+    EVCODE_KEY(BTN_DEAD),
+    EVCODE_KEY(BTN_GAMEPAD),
+    EVCODE_KEY(BTN_SOUTH),
+    EVCODE_KEY(BTN_A),
+    EVCODE_KEY(BTN_EAST),
+    EVCODE_KEY(BTN_B),
+    EVCODE_KEY(BTN_C),
+    EVCODE_KEY(BTN_NORTH),
+    EVCODE_KEY(BTN_X),
+    EVCODE_KEY(BTN_WEST),
+    EVCODE_KEY(BTN_Y),
+    EVCODE_KEY(BTN_Z),
+    EVCODE_KEY(BTN_TL),
+    EVCODE_KEY(BTN_TR),
+    EVCODE_KEY(BTN_TL2),
+    EVCODE_KEY(BTN_TR2),
+    EVCODE_KEY(BTN_SELECT),
+    EVCODE_KEY(BTN_START),
+    EVCODE_KEY(BTN_MODE),
+    EVCODE_KEY(BTN_THUMBL),
+    EVCODE_KEY(BTN_THUMBR),
+    EVCODE_KEY(BTN_DIGI),
+    EVCODE_KEY(BTN_TOOL_PEN),
+    EVCODE_KEY(BTN_TOOL_RUBBER),
+    EVCODE_KEY(BTN_TOOL_BRUSH),
+    EVCODE_KEY(BTN_TOOL_PENCIL),
+    EVCODE_KEY(BTN_TOOL_AIRBRUSH),
+    EVCODE_KEY(BTN_TOOL_FINGER),
+    EVCODE_KEY(BTN_TOOL_MOUSE),
+    EVCODE_KEY(BTN_TOOL_LENS),
+    EVCODE_KEY(BTN_TOOL_QUINTTAP),
+    EVCODE_KEY(BTN_STYLUS3),
+    EVCODE_KEY(BTN_TOUCH),
+    EVCODE_KEY(BTN_STYLUS),
+    EVCODE_KEY(BTN_STYLUS2),
+    EVCODE_KEY(BTN_TOOL_DOUBLETAP),
+    EVCODE_KEY(BTN_TOOL_TRIPLETAP),
+    EVCODE_KEY(BTN_TOOL_QUADTAP),
+    EVCODE_KEY(BTN_WHEEL),
+    EVCODE_KEY(BTN_GEAR_DOWN),
+    EVCODE_KEY(BTN_GEAR_UP),
+    EVCODE_KEY(BTN_DPAD_UP),
+    EVCODE_KEY(BTN_DPAD_DOWN),
+    EVCODE_KEY(BTN_DPAD_LEFT),
+    EVCODE_KEY(BTN_DPAD_RIGHT),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY1),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY2),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY3),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY4),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY5),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY6),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY7),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY8),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY9),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY10),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY11),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY12),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY13),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY14),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY15),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY16),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY17),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY18),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY19),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY20),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY21),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY22),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY23),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY24),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY25),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY26),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY27),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY28),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY29),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY30),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY31),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY32),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY33),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY34),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY35),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY36),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY37),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY38),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY39),
+    EVCODE_KEY(BTN_TRIGGER_HAPPY40),
+    EVCODE_REL(REL_X),
+    EVCODE_REL(REL_Y),
+    EVCODE_REL(REL_Z),
+    EVCODE_REL(REL_RX),
+    EVCODE_REL(REL_RY),
+    EVCODE_REL(REL_RZ),
+    EVCODE_REL(REL_HWHEEL),
+    EVCODE_REL(REL_DIAL),
+    EVCODE_REL(REL_WHEEL),
+    EVCODE_REL(REL_MISC),
+    EVCODE_ABS(ABS_X),
+    EVCODE_ABS(ABS_Y),
+    EVCODE_ABS(ABS_Z),
+    EVCODE_ABS(ABS_RX),
+    EVCODE_ABS(ABS_RY),
+    EVCODE_ABS(ABS_RZ),
+    EVCODE_ABS(ABS_THROTTLE),
+    EVCODE_ABS(ABS_RUDDER),
+    EVCODE_ABS(ABS_WHEEL),
+    EVCODE_ABS(ABS_GAS),
+    EVCODE_ABS(ABS_BRAKE),
+    EVCODE_ABS(ABS_HAT0X),
+    EVCODE_ABS(ABS_HAT0Y),
+    EVCODE_ABS(ABS_HAT1X),
+    EVCODE_ABS(ABS_HAT1Y),
+    EVCODE_ABS(ABS_HAT2X),
+    EVCODE_ABS(ABS_HAT2Y),
+    EVCODE_ABS(ABS_HAT3X),
+    EVCODE_ABS(ABS_HAT3Y),
+    EVCODE_ABS(ABS_PRESSURE),
+    EVCODE_ABS(ABS_DISTANCE),
+    EVCODE_ABS(ABS_TILT_X),
+    EVCODE_ABS(ABS_TILT_Y),
+    EVCODE_ABS(ABS_TOOL_WIDTH),
+    EVCODE_ABS(ABS_VOLUME),
+    EVCODE_ABS(ABS_PROFILE),
+    EVCODE_ABS(ABS_MISC),
+};
+
+//---------------------------------------------------------------------------
+bool evcodes_lookup(const char* name_, uint16_t* type_, uint16_t* code_)
+{
+    for (size_t i = 0; i < sizeof(evcodeTable) / sizeof(evcodeTable[0]); i++) {
+        if (!strcmp(name_, evcodeTable[i].name)) {
+            *type_ = evcodeTable[i].type;
+            *code_ = evcodeTable[i].code;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,25 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+/**
+ * @brief evcodes_lookup Find the event type and code for a kernel event code
+ * name, such as "KEY_ENTER", "BTN_SOUTH", "ABS_X" or "REL_WHEEL".
+ * @param name_ name of the event code
+ * @param type_ [out] event type (EV_KEY, EV_ABS or EV_REL)
+ * @param code_ [out] event code
+ * @return true if the name is known, false otherwise
+ */
+bool evcodes_lookup(const char* name_, uint16_t* type_, uint16_t* code_);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
@@ -0,0 +1,70 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#include "heartbeat.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+//---------------------------------------------------------------------------
+void heartbeat_config_init(heartbeat_config_t* config_)
+{
+    config_->intervalMs = HEARTBEAT_DEFAULT_INTERVAL_MS;
+    config_->missLimit  = HEARTBEAT_DEFAULT_MISS_LIMIT;
+}
+
+//---------------------------------------------------------------------------
+void heartbeat_init(heartbeat_t* heartbeat_)
+{
+    memset(heartbeat_, 0, sizeof(*heartbeat_));
+}
+
+//---------------------------------------------------------------------------
+uint32_t heartbeat_next_ping(heartbeat_t* heartbeat_)
+{
+    heartbeat_->outstanding++;
+    return heartbeat_->nextId++;
+}
+
+//---------------------------------------------------------------------------
+void heartbeat_on_pong(heartbeat_t* heartbeat_, uint32_t id_, uint64_t rttNs_)
+{
+    // Ignore answers to pings older than one already answered
+    if (heartbeat_->answered && ((int32_t)(id_ - heartbeat_->ackedId) <= 0)) {
+        return;
+    }
+
+    heartbeat_->ackedId     = id_;
+    heartbeat_->outstanding = (int)(heartbeat_->nextId - id_ - 1);
+    heartbeat_->rttNs       = rttNs_;
+    heartbeat_->pongs++;
+
+    if (!heartbeat_->answered) {
+        heartbeat_->answered = true;
+        heartbeat_->srttNs   = rttNs_;
+        heartbeat_->rttVarNs = rttNs_ / 2;
+        heartbeat_->rttMinNs = rttNs_;
+        heartbeat_->rttMaxNs = rttNs_;
+        return;
+    }
+
+    uint64_t delta = (rttNs_ > heartbeat_->srttNs) ? (rttNs_ - heartbeat_->srttNs) : (heartbeat_->srttNs - rttNs_);
+    heartbeat_->rttVarNs = ((3 * heartbeat_->rttVarNs) + delta) / 4;
+    heartbeat_->srttNs   = ((7 * heartbeat_->srttNs) + rttNs_) / 8;
+    if (rttNs_ < heartbeat_->rttMinNs) {
+        heartbeat_->rttMinNs = rttNs_;
+    }
+    if (rttNs_ > heartbeat_->rttMaxNs) {
+        heartbeat_->rttMaxNs = rttNs_;
+    }
+}
+
+//---------------------------------------------------------------------------
+bool heartbeat_is_dead(const heartbeat_t* heartbeat_, const heartbeat_config_t* config_)
+{
+    if ((config_->intervalMs <= 0) || (config_->missLimit <= 0) || !heartbeat_->answered) {
+        return false;
+    }
+    return (heartbeat_->outstanding >= config_->missLimit);
+}
@@ -0,0 +1,83 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+#define HEARTBEAT_DEFAULT_INTERVAL_MS (250)    //!< Default time between pings
+#define HEARTBEAT_DEFAULT_MISS_LIMIT (4)       //!< Default number of unanswered pings before a peer is dead
+
+//---------------------------------------------------------------------------
+// Heartbeat options
+typedef struct {
+    int intervalMs; //!< Time between pings (0 == heartbeat disabled)
+    int missLimit;  //!< Number of consecutive unanswered pings after which the peer is declared dead (0 == never)
+} heartbeat_config_t;
+
+//---------------------------------------------------------------------------
+// Ping/pong bookkeeping for a single peer
+typedef struct {
+    uint32_t nextId;        //!< id of the next ping to send
+    uint32_t ackedId;       //!< id of the most recent ping that was answered
+    bool     answered;      //!< whether the peer has ever answered a ping
+    int      outstanding;   //!< pings sent since the last answer
+
+    uint64_t rttNs;         //!< most recent round-trip time
+    uint64_t srttNs;        //!< smoothed round-trip time (RFC 6298)
+    uint64_t rttVarNs;      //!< round-trip time variation (RFC 6298)
+    uint64_t rttMinNs;      //!< smallest round-trip time seen
+    uint64_t rttMaxNs;      //!< largest round-trip time seen
+    uint64_t pongs;         //!< number of answers received
+} heartbeat_t;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief heartbeat_config_init initialize heartbeat options to their defaults
+ * @param config_ object to initialize
+ */
+void heartbeat_config_init(heartbeat_config_t* config_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief heartbeat_init reset the state for a peer
+ * @param heartbeat_ object to initialize
+ */
+void heartbeat_init(heartbeat_t* heartbeat_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief heartbeat_next_ping allocate the id of a ping that is about to be sent
+ * @param heartbeat_ peer state
+ * @return ping id
+ */
+uint32_t heartbeat_next_ping(heartbeat_t* heartbeat_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief heartbeat_on_pong account for an answer from the peer
+ * @param heartbeat_ peer state
+ * @param id_ id of the ping being answered
+ * @param rttNs_ round-trip time of the exchange
+ */
+void heartbeat_on_pong(heartbeat_t* heartbeat_, uint32_t id_, uint64_t rttNs_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief heartbeat_is_dead check whether a peer has stopped answering.  Peers
+ * that have never answered a ping (e.g. older clients) are never declared dead.
+ * @param heartbeat_ peer state
+ * @param config_ heartbeat options
+ * @return true if the last missLimit pings have all gone unanswered
+ */
+bool heartbeat_is_dead(const heartbeat_t* heartbeat_, const heartbeat_config_t* config_);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
@@ -0,0 +1,109 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#include "histogram.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+//---------------------------------------------------------------------------
+// Values below HISTOGRAM_SUB_BUCKETS get a bucket each.  Above that, a value
+// whose highest set bit is b lands in power-of-two group (b - SUB_BUCKET_BITS),
+// indexed within the group by the SUB_BUCKET_BITS bits below its highest bit.
+static int histogram_index(uint64_t value_)
+{
+    if (value_ >= (1ULL << HISTOGRAM_MAX_BITS)) {
+        return HISTOGRAM_BUCKETS - 1;
+    }
+    if (value_ < HISTOGRAM_SUB_BUCKETS) {
+        return (int)value_;
+    }
+    int msb   = 63 - __builtin_clzll(value_);
+    int shift = msb - HISTOGRAM_SUB_BUCKET_BITS;
+    int top   = (int)(value_ >> shift);
+    return ((shift + 1) * HISTOGRAM_SUB_BUCKETS) + (top - HISTOGRAM_SUB_BUCKETS);
+}
+
+//---------------------------------------------------------------------------
+// Largest value that maps to a bucket
+static uint64_t histogram_bucket_max(int index_)
+{
+    if (index_ < (2 * HISTOGRAM_SUB_BUCKETS)) {
+        return (uint64_t)index_;
+    }
+    int      shift = (index_ / HISTOGRAM_SUB_BUCKETS) - 1;
+    uint64_t top   = (uint64_t)((index_ % HISTOGRAM_SUB_BUCKETS) + HISTOGRAM_SUB_BUCKETS);
+    return ((top + 1) << shift) - 1;
+}
+
+//---------------------------------------------------------------------------
+void histogram_init(histogram_t* histogram_)
+{
+    memset(histogram_, 0, sizeof(*histogram_));
+}
+
+//---------------------------------------------------------------------------
+void histogram_record(histogram_t* histogram_, uint64_t value_)
+{
+    histogram_->counts[histogram_index(value_)]++;
+    if ((histogram_->total == 0) || (value_ < histogram_->min)) {
+        histogram_->min = value_;
+    }
+    if (value_ > histogram_->max) {
+        histogram_->max = value_;
+    }
+    histogram_->total++;
+    histogram_->sum += value_;
+}
+
+//---------------------------------------------------------------------------
+void histogram_merge(histogram_t* dest_, const histogram_t* src_)
+{
+    if (src_->total == 0) {
+        return;
+    }
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        dest_->counts[i] += src_->counts[i];
+    }
+    if ((dest_->total == 0) || (src_->min < dest_->min)) {
+        dest_->min = src_->min;
+    }
+    if (src_->max > dest_->max) {
+        dest_->max = src_->max;
+    }
+    dest_->total += src_->total;
+    dest_->sum += src_->sum;
+}
+
+//---------------------------------------------------------------------------
+uint64_t histogram_percentile(const histogram_t* histogram_, double percentile_)
+{
+    if (histogram_->total == 0) {
+        return 0;
+    }
+
+    uint64_t target = (uint64_t)((percentile_ / 100.0) * (double)histogram_->total + 0.5);
+    if (target < 1) {
+        target = 1;
+    }
+
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += histogram_->counts[i];
+        if (seen >= target) {
+            uint64_t value = histogram_bucket_max(i);
+            return (value > histogram_->max) ? histogram_->max : value;
+        }
+    }
+    return histogram_->max;
+}
+
+//---------------------------------------------------------------------------
+double histogram_mean(const histogram_t* histogram_)
+{
+    if (histogram_->total == 0) {
+        return 0.0;
+    }
+    return (double)histogram_->sum / (double)histogram_->total;
+}
@@ -0,0 +1,75 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+// Log-linear ("HDR") histogram: each power of two is split into a fixed number
+// of linear sub-buckets, so every recorded value is kept to within ~3% of its
+// true value with a fixed amount of memory and O(1) recording.
+#define HISTOGRAM_SUB_BUCKET_BITS (5)                                   //!< log2(sub-buckets per power of two)
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)          //!< Sub-buckets per power of two
+#define HISTOGRAM_MAX_BITS (40)                                         //!< Values up to 2^40 (~18 minutes in ns)
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+//---------------------------------------------------------------------------
+typedef struct {
+    uint64_t counts[HISTOGRAM_BUCKETS]; //!< Number of values recorded in each bucket
+    uint64_t total;                     //!< Number of values recorded
+    uint64_t sum;                       //!< Sum of all values recorded
+    uint64_t min;                       //!< Smallest value recorded
+    uint64_t max;                       //!< Largest value recorded
+} histogram_t;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief histogram_init clear a histogram
+ * @param histogram_ histogram to clear
+ */
+void histogram_init(histogram_t* histogram_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief histogram_record record a value.  Values beyond the histogram's range
+ * are recorded in its last bucket.
+ * @param histogram_ histogram to update
+ * @param value_ value to record
+ */
+void histogram_record(histogram_t* histogram_, uint64_t value_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief histogram_merge add the contents of one histogram to another
+ * @param dest_ histogram to update
+ * @param src_ histogram to add
+ */
+void histogram_merge(histogram_t* dest_, const histogram_t* src_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief histogram_percentile return the value below which the given
+ * percentage of recorded values fall
+ * @param histogram_ histogram to query
+ * @param percentile_ percentile (0.0 - 100.0)
+ * @return value at the percentile (upper bound of its bucket), or 0 if empty
+ */
+uint64_t histogram_percentile(const histogram_t* histogram_, double percentile_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief histogram_mean return the mean of all recorded values
+ * @param histogram_ histogram to query
+ * @return mean value, or 0 if empty
+ */
+double histogram_mean(const histogram_t* histogram_);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
@@ -0,0 +1,719 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+//
+// Network impairment proxy.  Sits between netstick and netstickd, relaying each
+// connection to the server, and holds every slip frame passing through for as
+// long as a bad link would: frames queue behind a bandwidth cap, are delayed by
+// a fixed amount plus jitter, and some are lost or overtake the frames ahead of
+// them.  Every random choice comes from a seeded generator per connection and
+// direction, so a run can be repeated frame for frame.  Runs unprivileged, with
+// no tc/netem setup.
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+
+#include "histogram.h"
+#include "slip.h"
+#include "timestamp.h"
+
+//---------------------------------------------------------------------------
+#define IMPAIR_DEFAULT_RTO_MS (200)         //!< Default stall after a loss in stall mode (Linux's minimum RTO)
+#define IMPAIR_DEFAULT_QUEUE_BYTES (65536)  //!< Default bytes held per direction before reading stops
+#define IMPAIR_MAX_FRAME (65536)            //!< Longer runs of bytes without a frame end are passed on as one frame
+#define IMPAIR_READ_SIZE (16384)            //!< Bytes read from a socket at a time
+#define IMPAIR_MAX_EVENTS (64)              //!< Socket events handled per epoll_wait() call
+
+//---------------------------------------------------------------------------
+// What happens to a lost frame
+typedef enum {
+    ImpairLossDrop = 0, //!< The frame vanishes, as a datagram would
+    ImpairLossStall     //!< The frame, and everything behind it, waits out a retransmission timeout, as over TCP
+} impair_loss_mode_t;
+
+//---------------------------------------------------------------------------
+// Directions of a connection
+typedef enum {
+    ImpairUp = 0,   //!< Client to server
+    ImpairDown,     //!< Server to client
+    ImpairDirections
+} impair_direction_id_t;
+
+//---------------------------------------------------------------------------
+typedef struct {
+    uint64_t           delayNs;     //!< One-way delay
+    uint64_t           jitterNs;    //!< Delay varies uniformly by up to +/- this much
+    double             loss;        //!< Probability of a frame being lost
+    impair_loss_mode_t lossMode;    //!< What happens to a lost frame
+    uint64_t           rtoNs;       //!< Stall mode: how long a lost frame holds up the direction
+    double             reorder;     //!< Probability of a frame skipping the delay, overtaking those ahead of it
+    uint64_t           rateBps;     //!< Bandwidth cap in bits per second (0 == unlimited)
+    size_t             queueBytes;  //!< Bytes held per direction before reading from the sender stops
+    uint64_t           seed;        //!< Seed for every random choice
+    bool               impaired[ImpairDirections];  //!< Which directions are impaired
+} impair_config_t;
+
+//---------------------------------------------------------------------------
+// Frame in flight
+typedef struct {
+    uint64_t dueNs;     //!< When the frame is delivered
+    uint64_t order;     //!< Arrival order, so frames due at the same time keep it
+    uint32_t len;       //!< Size of the frame
+    uint8_t* data;      //!< Bytes of the frame
+} impair_frame_t;
+
+//---------------------------------------------------------------------------
+// One direction of a connection
+typedef struct {
+    const char*     name;           //!< "up" or "down"
+    bool            impaired;       //!< Whether frames are impaired, or passed straight on
+    uint64_t        random;         //!< Random number generator state
+    int             dstFd;          //!< Socket frames are delivered to
+    uint8_t*        partial;        //!< Frame being assembled from the bytes read so far
+    size_t          partialLen;     //!< Bytes in partial
+    bool            partialData;    //!< Whether partial holds anything but END bytes
+    impair_frame_t* heap;           //!< Frames in flight, as a min-heap on (dueNs, order)
+    size_t          count;          //!< Frames in heap
+    size_t          capacity;       //!< Room in heap
+    size_t          queuedBytes;    //!< Bytes in flight or waiting in out
+    uint64_t        linkFreeNs;     //!< When the capped link has finished sending what it has been given
+    uint64_t        lastDueNs;      //!< Delivery time of the last in-order frame
+    uint64_t        order;          //!< Frames admitted so far
+    uint8_t*        out;            //!< Delivered bytes waiting for room in dstFd
+    size_t          outLen;         //!< Bytes in out
+    size_t          outCapacity;    //!< Room in out
+    bool            eof;            //!< Whether the sender has finished
+    bool            shut;           //!< Whether the receiver has been told
+    uint64_t        bytes;          //!< Bytes delivered
+    uint64_t        dropped;        //!< Frames lost in drop mode
+    uint64_t        stalled;        //!< Frames lost in stall mode
+    uint64_t        reordered;      //!< Frames sent ahead of those before them
+    histogram_t     lateness;       //!< How late frames were delivered: the proxy's own overhead
+} impair_direction_t;
+
+//---------------------------------------------------------------------------
+typedef struct impair_connection impair_connection_t;
+
+//---------------------------------------------------------------------------
+// One of a connection's sockets, as registered with epoll
+typedef struct {
+    impair_connection_t* connection;
+    int                  fd;        //!< Socket
+    int                  side;      //!< ImpairUp for the client's socket, ImpairDown for the server's
+    uint32_t             events;    //!< Events currently registered
+} impair_endpoint_t;
+
+//---------------------------------------------------------------------------
+struct impair_connection {
+    unsigned int         id;                            //!< Connection number
+    impair_endpoint_t    endpoints[ImpairDirections];   //!< [ImpairUp] client socket, [ImpairDown] server socket
+    impair_direction_t   directions[ImpairDirections];  //!< Frames going each way
+    bool                 closed;                        //!< Freed at the end of the current batch of events
+    impair_connection_t* next;
+};
+
+//---------------------------------------------------------------------------
+typedef struct {
+    impair_config_t      config;
+    struct sockaddr_in   server;        //!< Where connections are relayed to
+    int                  listenFd;
+    int                  timerFd;       //!< Fires when the next frame is due
+    int                  ePollFd;
+    impair_connection_t* connections;
+    unsigned int         connectionCount;
+} impair_t;
+
+//---------------------------------------------------------------------------
+// epoll data of the listening socket and the timer; endpoints use their address
+static int impairListenKey;
+static int impairTimerKey;
+
+//---------------------------------------------------------------------------
+static uint64_t impair_splitmix(uint64_t* state_)
+{
+    uint64_t z = (*state_ += 0x9E3779B97F4A7C15ULL);
+    z          = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z          = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+//---------------------------------------------------------------------------
+// Uniformly distributed in [0, 1)
+static double impair_random(impair_direction_t* direction_)
+{
+    return (impair_splitmix(&direction_->random) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+//---------------------------------------------------------------------------
+static bool impair_frame_before(const impair_frame_t* a_, const impair_frame_t* b_)
+{
+    return (a_->dueNs < b_->dueNs) || ((a_->dueNs == b_->dueNs) && (a_->order < b_->order));
+}
+
+//---------------------------------------------------------------------------
+static void impair_heap_push(impair_direction_t* direction_, const impair_frame_t* frame_)
+{
+    if (direction_->count == direction_->capacity) {
+        direction_->capacity = direction_->capacity ? (direction_->capacity * 2) : 64;
+        direction_->heap
+            = (impair_frame_t*)(realloc(direction_->heap, direction_->capacity * sizeof(impair_frame_t)));
+    }
+    impair_frame_t* heap = direction_->heap;
+    size_t          i    = direction_->count++;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!impair_frame_before(frame_, &heap[parent])) {
+            break;
+        }
+        heap[i] = heap[parent];
+        i       = parent;
+    }
+    heap[i] = *frame_;
+}
+
+//---------------------------------------------------------------------------
+static void impair_heap_pop(impair_direction_t* direction_)
+{
+    impair_frame_t* heap = direction_->heap;
+    impair_frame_t  last = heap[--direction_->count];
+    size_t          i    = 0;
+    while (1) {
+        size_t child = (i * 2) + 1;
+        if (child >= direction_->count) {
+            break;
+        }
+        if (((child + 1) < direction_->count) && impair_frame_before(&heap[child + 1], &heap[child])) {
+            child++;
+        }
+        if (!impair_frame_before(&heap[child], &last)) {
+            break;
+        }
+        heap[i] = heap[child];
+        i       = child;
+    }
+    heap[i] = last;
+}
+
+//---------------------------------------------------------------------------
+// Decide the fate of a frame that has just arrived from the sender
+static void impair_admit(const impair_config_t* config_, impair_direction_t* direction_, uint64_t now_)
+{
+    impair_frame_t frame;
+    frame.order = direction_->order++;
+    frame.len   = (uint32_t)direction_->partialLen;
+    frame.dueNs = now_;
+
+    if (direction_->impaired) {
+        // The first frame sets up the session (netstick's configuration), which
+        // a real transport would retry until it got through
+        uint64_t stallNs = 0;
+        if ((frame.order > 0) && (config_->loss > 0.0) && (impair_random(direction_) < config_->loss)) {
+            if (config_->lossMode == ImpairLossDrop) {
+                direction_->dropped++;
+                return;
+            }
+            direction_->stalled++;
+            stallNs = config_->rtoNs;
+        }
+
+        // Serialization onto the capped link, then propagation
+        uint64_t sentNs = now_;
+        if (config_->rateBps > 0) {
+            sentNs = (direction_->linkFreeNs > now_) ? direction_->linkFreeNs : now_;
+            sentNs += ((uint64_t)frame.len * 8 * NSEC_PER_SEC) / config_->rateBps;
+            direction_->linkFreeNs = sentNs;
+        }
+
+        if ((config_->reorder > 0.0) && (impair_random(direction_) < config_->reorder)) {
+            // Skips the delay, overtaking whatever is still in flight
+            direction_->reordered++;
+            frame.dueNs = sentNs + stallNs;
+        } else {
+            int64_t jitter = 0;
+            if (config_->jitterNs > 0) {
+                jitter = (int64_t)((impair_random(direction_) * 2.0 - 1.0) * (double)config_->jitterNs);
+            }
+            int64_t delay = (int64_t)config_->delayNs + jitter;
+            frame.dueNs   = sentNs + ((delay > 0) ? (uint64_t)delay : 0) + stallNs;
+
+            // Frames stay in order, so jitter (and a stall) holds up those behind
+            if (frame.dueNs < direction_->lastDueNs) {
+                frame.dueNs = direction_->lastDueNs;
+            }
+            direction_->lastDueNs = frame.dueNs;
+        }
+    }
+
+    frame.data = (uint8_t*)malloc(frame.len);
+    memcpy(frame.data, direction_->partial, frame.len);
+    direction_->queuedBytes += frame.len;
+    impair_heap_push(direction_, &frame);
+}
+
+//---------------------------------------------------------------------------
+// Split what the sender wrote into slip frames.  Each frame is taken up to the
+// END that closes it; an END on its own opens the next frame.
+static void impair_on_bytes(
+    const impair_config_t* config_, impair_direction_t* direction_, const uint8_t* data_, size_t len_, uint64_t now_)
+{
+    for (size_t i = 0; i < len_; i++) {
+        direction_->partial[direction_->partialLen++] = data_[i];
+        bool end = (data_[i] == SLIP_END) && direction_->partialData;
+        if (data_[i] != SLIP_END) {
+            direction_->partialData = true;
+        }
+        if (end || (direction_->partialLen == IMPAIR_MAX_FRAME)) {
+            impair_admit(config_, direction_, now_);
+            direction_->partialLen  = 0;
+            direction_->partialData = false;
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+// Register the events an endpoint currently needs: input while its direction
+// has room, output while the other direction has bytes waiting for it
+static void impair_endpoint_update(impair_t* impair_, impair_endpoint_t* endpoint_)
+{
+    impair_connection_t*      connection = endpoint_->connection;
+    const impair_direction_t* in         = &connection->directions[endpoint_->side];
+    const impair_direction_t* out        = &connection->directions[1 - endpoint_->side];
+
+    uint32_t events = 0;
+    if (!in->eof && (in->queuedBytes < impair_->config.queueBytes)) {
+        events |= EPOLLIN;
+    }
+    if (out->outLen > 0) {
+        events |= EPOLLOUT;
+    }
+    if (events == endpoint_->events) {
+        return;
+    }
+    struct epoll_event ev = {};
+    ev.events             = events;
+    ev.data.ptr           = endpoint_;
+    epoll_ctl(impair_->ePollFd, EPOLL_CTL_MOD, endpoint_->fd, &ev);
+    endpoint_->events = events;
+}
+
+//---------------------------------------------------------------------------
+// Write out delivered bytes; once the sender has finished and everything has
+// been delivered, pass the end of the stream on
+static bool impair_flush(impair_direction_t* direction_)
+{
+    size_t written = 0;
+    while (written < direction_->outLen) {
+        ssize_t rc = send(direction_->dstFd, direction_->out + written, direction_->outLen - written, MSG_NOSIGNAL);
+        if (rc < 0) {
+            if ((errno != EAGAIN) && (errno != EINTR)) {
+                return false;
+            }
+            break;
+        }
+        written += rc;
+    }
+    memmove(direction_->out, direction_->out + written, direction_->outLen - written);
+    direction_->outLen -= written;
+    direction_->queuedBytes -= written;
+    direction_->bytes += written;
+
+    if (direction_->eof && !direction_->shut && (direction_->count == 0) && (direction_->outLen == 0)) {
+        shutdown(direction_->dstFd, SHUT_WR);
+        direction_->shut = true;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Deliver the frames that have come due
+static bool impair_deliver(impair_direction_t* direction_, uint64_t now_)
+{
+    while ((direction_->count > 0) && (direction_->heap[0].dueNs <= now_)) {
+        impair_frame_t* frame = &direction_->heap[0];
+        if ((direction_->outLen + frame->len) > direction_->outCapacity) {
+            direction_->outCapacity = (direction_->outLen + frame->len) * 2;
+            direction_->out         = (uint8_t*)(realloc(direction_->out, direction_->outCapacity));
+        }
+        memcpy(direction_->out + direction_->outLen, frame->data, frame->len);
+        direction_->outLen += frame->len;
+        histogram_record(&direction_->lateness, now_ - frame->dueNs);
+        free(frame->data);
+        impair_heap_pop(direction_);
+    }
+    return impair_flush(direction_);
+}
+
+//---------------------------------------------------------------------------
+// Read what the sender has written, while there's room for it.  A hangup is
+// reported whether or not we're asking for input, so then read regardless.
+static bool impair_read(impair_t* impair_, impair_endpoint_t* endpoint_, bool hangup_)
+{
+    impair_direction_t* direction = &endpoint_->connection->directions[endpoint_->side];
+    uint8_t             buf[IMPAIR_READ_SIZE];
+    while (!direction->eof && (hangup_ || (direction->queuedBytes < impair_->config.queueBytes))) {
+        ssize_t nRead = read(endpoint_->fd, buf, sizeof(buf));
+        if (nRead == 0) {
+            direction->eof = true;
+            break;
+        }
+        if (nRead < 0) {
+            return (errno == EAGAIN) || (errno == EINTR);
+        }
+        uint64_t now = timestamp_now_ns();
+        impair_on_bytes(&impair_->config, direction, buf, nRead, now);
+        if (!impair_deliver(direction, now)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+static void impair_connection_print(const impair_connection_t* connection_)
+{
+    for (int d = 0; d < ImpairDirections; d++) {
+        const impair_direction_t* direction = &connection_->directions[d];
+        printf("connection %u %s: %llu frames (%llu bytes) delivered, %llu dropped, %llu stalled, %llu reordered; "
+               "proxy overhead p50=%.1fus p99=%.1fus max=%.1fus\n",
+               connection_->id,
+               direction->name,
+               (unsigned long long)direction->lateness.total,
+               (unsigned long long)direction->bytes,
+               (unsigned long long)direction->dropped,
+               (unsigned long long)direction->stalled,
+               (unsigned long long)direction->reordered,
+               histogram_percentile(&direction->lateness, 50.0) / 1e3,
+               histogram_percentile(&direction->lateness, 99.0) / 1e3,
+               direction->lateness.max / 1e3);
+    }
+}
+
+//---------------------------------------------------------------------------
+static void impair_connection_close(impair_t* impair_, impair_connection_t* connection_)
+{
+    if (connection_->closed) {
+        return;
+    }
+    impair_connection_print(connection_);
+    for (int d = 0; d < ImpairDirections; d++) {
+        impair_direction_t* direction = &connection_->directions[d];
+        close(connection_->endpoints[d].fd);
+        for (size_t i = 0; i < direction->count; i++) { free(direction->heap[i].data); }
+        free(direction->heap);
+        free(direction->partial);
+        free(direction->out);
+    }
+    connection_->closed = true;
+}
+
+//---------------------------------------------------------------------------
+static void impair_on_accept(impair_t* impair_)
+{
+    while (1) {
+        int clientFd = accept4(impair_->listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (clientFd < 0) {
+            if ((errno != EAGAIN) && (errno != EINTR) && (errno != ECONNABORTED)) {
+                printf("error accepting socket %d (%s)\n", errno, strerror(errno));
+            }
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            return;
+        }
+
+        // The server is expected to be local, so a blocking connect is brief
+        int serverFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if ((serverFd < 0)
+            || (connect(serverFd, (const struct sockaddr*)&impair_->server, sizeof(impair_->server)) != 0)) {
+            printf("error connecting to server: %d (%s)\n", errno, strerror(errno));
+            if (serverFd >= 0) {
+                close(serverFd);
+            }
+            close(clientFd);
+            continue;
+        }
+        fcntl(serverFd, F_SETFL, fcntl(serverFd, F_GETFL) | O_NONBLOCK);
+
+        // The proxy must not add a Nagle delay of its own
+        int enable = 1;
+        setsockopt(clientFd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        setsockopt(serverFd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+        impair_connection_t* connection = (impair_connection_t*)(calloc(1, sizeof(impair_connection_t)));
+        connection->id                  = impair_->connectionCount++;
+        connection->next                = impair_->connections;
+        impair_->connections            = connection;
+
+        int fds[ImpairDirections] = { clientFd, serverFd };
+        for (int d = 0; d < ImpairDirections; d++) {
+            impair_direction_t* direction = &connection->directions[d];
+            direction->name               = (d == ImpairUp) ? "up" : "down";
+            direction->impaired           = impair_->config.impaired[d];
+            direction->random             = impair_->config.seed ^ (((uint64_t)connection->id << 1) | d);
+            impair_splitmix(&direction->random);
+            direction->dstFd   = fds[1 - d];
+            direction->partial = (uint8_t*)malloc(IMPAIR_MAX_FRAME);
+            histogram_init(&direction->lateness);
+
+            impair_endpoint_t* endpoint = &connection->endpoints[d];
+            endpoint->connection        = connection;
+            endpoint->fd                = fds[d];
+            endpoint->side              = d;
+            endpoint->events            = EPOLLIN;
+
+            struct epoll_event ev = {};
+            ev.events             = endpoint->events;
+            ev.data.ptr           = endpoint;
+            epoll_ctl(impair_->ePollFd, EPOLL_CTL_ADD, endpoint->fd, &ev);
+        }
+        printf("connection %u: relaying\n", connection->id);
+    }
+}
+
+//---------------------------------------------------------------------------
+static void impair_on_endpoint(impair_t* impair_, impair_endpoint_t* endpoint_, uint32_t events_)
+{
+    impair_connection_t* connection = endpoint_->connection;
+    if (connection->closed) {
+        return;
+    }
+    bool ok = true;
+    if (events_ & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        ok = impair_read(impair_, endpoint_, (events_ & (EPOLLHUP | EPOLLERR)) != 0);
+    }
+    if (ok && (events_ & EPOLLOUT)) {
+        ok = impair_flush(&connection->directions[1 - endpoint_->side]);
+    }
+    if (!ok) {
+        impair_connection_close(impair_, connection);
+    }
+}
+
+//---------------------------------------------------------------------------
+// Deliver whatever has come due, drop finished connections, and arm the timer
+// for the next frame due
+static void impair_service(impair_t* impair_)
+{
+    uint64_t              now  = timestamp_now_ns();
+    uint64_t              next = 0;
+    impair_connection_t** link = &impair_->connections;
+    while (*link) {
+        impair_connection_t* connection = *link;
+        for (int d = 0; !connection->closed && (d < ImpairDirections); d++) {
+            if (!impair_deliver(&connection->directions[d], now)) {
+                impair_connection_close(impair_, connection);
+            }
+        }
+        bool finished = connection->directions[ImpairUp].shut && connection->directions[ImpairDown].shut;
+        if (finished) {
+            impair_connection_close(impair_, connection);
+        }
+        if (connection->closed) {
+            *link = connection->next;
+            free(connection);
+            continue;
+        }
+        for (int d = 0; d < ImpairDirections; d++) {
+            const impair_direction_t* direction = &connection->directions[d];
+            if ((direction->count > 0) && ((next == 0) || (direction->heap[0].dueNs < next))) {
+                next = direction->heap[0].dueNs;
+            }
+            impair_endpoint_update(impair_, &connection->endpoints[d]);
+        }
+        link = &connection->next;
+    }
+
+    struct itimerspec spec = {};
+    if (next != 0) {
+        spec.it_value = timestamp_to_timespec(next);
+    }
+    timerfd_settime(impair_->timerFd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+//---------------------------------------------------------------------------
+static int impair_listen(uint16_t port_)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        printf("error creating socket: %d (%s)\n", errno, strerror(errno));
+        return -1;
+    }
+    int enable = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    struct sockaddr_in addr = {};
+    addr.sin_family         = AF_INET;
+    addr.sin_addr.s_addr    = htonl(INADDR_LOOPBACK);
+    addr.sin_port           = htons(port_);
+    if ((bind(fd, (const struct sockaddr*)&addr, sizeof(addr)) != 0) || (listen(fd, SOMAXCONN) != 0)) {
+        printf("error listening on port %d: %d (%s)\n", port_, errno, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//---------------------------------------------------------------------------
+static void usage(void)
+{
+    printf("usage: netstick-impair [options] [listen port] [server address] [server port]\n"
+           "options:\n"
+           "  -d, --delay-ms <ms>          one-way delay (default: 0)\n"
+           "  -j, --jitter-ms <ms>         delay varies uniformly by up to +/- this much (default: 0)\n"
+           "  -l, --loss <percent>         frames lost (default: 0)\n"
+           "  -L, --loss-mode <drop|stall> drop: lost frames vanish; stall: they hold up the stream for an RTO, as "
+           "over TCP (default: drop)\n"
+           "  -t, --rto-ms <ms>            stall mode: how long a lost frame holds up the stream (default: %d)\n"
+           "  -r, --reorder <percent>      frames sent without delay, overtaking those ahead of them (default: 0)\n"
+           "  -b, --rate-kbps <kbit/s>     bandwidth cap, per direction; 0 = unlimited (default: 0)\n"
+           "  -q, --queue-bytes <n>        bytes held per direction before the sender is pushed back (default: %d)\n"
+           "  -D, --direction <up|down|both> directions to impair; up is client to server (default: both)\n"
+           "  -s, --seed <n>               seed for every random choice (default: 1)\n",
+           IMPAIR_DEFAULT_RTO_MS,
+           IMPAIR_DEFAULT_QUEUE_BYTES);
+}
+
+//---------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+    impair_t impair                      = {};
+    impair.config.rtoNs                  = IMPAIR_DEFAULT_RTO_MS * NSEC_PER_MSEC;
+    impair.config.queueBytes             = IMPAIR_DEFAULT_QUEUE_BYTES;
+    impair.config.seed                   = 1;
+    impair.config.impaired[ImpairUp]     = true;
+    impair.config.impaired[ImpairDown]   = true;
+
+    static const struct option options[] = { { "delay-ms", required_argument, NULL, 'd' },
+                                             { "jitter-ms", required_argument, NULL, 'j' },
+                                             { "loss", required_argument, NULL, 'l' },
+                                             { "loss-mode", required_argument, NULL, 'L' },
+                                             { "rto-ms", required_argument, NULL, 't' },
+                                             { "reorder", required_argument, NULL, 'r' },
+                                             { "rate-kbps", required_argument, NULL, 'b' },
+                                             { "queue-bytes", required_argument, NULL, 'q' },
+                                             { "direction", required_argument, NULL, 'D' },
+                                             { "seed", required_argument, NULL, 's' },
+                                             { "help", no_argument, NULL, 'h' },
+                                             { NULL, 0, NULL, 0 } };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "d:j:l:L:t:r:b:q:D:s:h", options, NULL)) != -1) {
+        switch (opt) {
+            case 'd': impair.config.delayNs = (uint64_t)(atof(optarg) * NSEC_PER_MSEC); break;
+            case 'j': impair.config.jitterNs = (uint64_t)(atof(optarg) * NSEC_PER_MSEC); break;
+            case 'l': impair.config.loss = atof(optarg) / 100.0; break;
+            case 't': impair.config.rtoNs = (uint64_t)(atof(optarg) * NSEC_PER_MSEC); break;
+            case 'r': impair.config.reorder = atof(optarg) / 100.0; break;
+            case 'b': impair.config.rateBps = strtoull(optarg, NULL, 0) * 1000; break;
+            case 'q': impair.config.queueBytes = strtoul(optarg, NULL, 0); break;
+            case 's': impair.config.seed = strtoull(optarg, NULL, 0); break;
+            case 'L': {
+                if (!strcmp(optarg, "drop")) {
+                    impair.config.lossMode = ImpairLossDrop;
+                } else if (!strcmp(optarg, "stall")) {
+                    impair.config.lossMode = ImpairLossStall;
+                } else {
+                    printf("unknown loss mode: %s\n", optarg);
+                    return -1;
+                }
+            } break;
+            case 'D': {
+                bool both                        = !strcmp(optarg, "both");
+                impair.config.impaired[ImpairUp]   = both || !strcmp(optarg, "up");
+                impair.config.impaired[ImpairDown] = both || !strcmp(optarg, "down");
+                if (!impair.config.impaired[ImpairUp] && !impair.config.impaired[ImpairDown]) {
+                    printf("unknown direction: %s\n", optarg);
+                    return -1;
+                }
+            } break;
+            default: {
+                usage();
+                return -1;
+            }
+        }
+    }
+    if ((argc - optind) < 3) {
+        usage();
+        return -1;
+    }
+    if ((impair.config.loss < 0.0) || (impair.config.loss > 1.0) || (impair.config.reorder < 0.0)
+        || (impair.config.reorder > 1.0) || (impair.config.queueBytes == 0)) {
+        printf("invalid impairment parameters\n");
+        return -1;
+    }
+
+    impair.server.sin_family = AF_INET;
+    impair.server.sin_port   = htons(atoi(argv[optind + 2]));
+    if (inet_pton(AF_INET, argv[optind + 1], &impair.server.sin_addr) != 1) {
+        printf("invalid server address: %s\n", argv[optind + 1]);
+        return -1;
+    }
+    impair.listenFd = impair_listen(atoi(argv[optind]));
+    if (impair.listenFd < 0) {
+        return -1;
+    }
+
+    impair.ePollFd = epoll_create1(EPOLL_CLOEXEC);
+    impair.timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    struct epoll_event ev = {};
+    ev.events             = EPOLLIN;
+    ev.data.ptr           = &impairListenKey;
+    epoll_ctl(impair.ePollFd, EPOLL_CTL_ADD, impair.listenFd, &ev);
+    ev.data.ptr = &impairTimerKey;
+    epoll_ctl(impair.ePollFd, EPOLL_CTL_ADD, impair.timerFd, &ev);
+
+    printf("relaying 127.0.0.1:%s to %s:%s: delay %.3fms, jitter %.3fms, loss %.2f%% (%s), reorder %.2f%%, "
+           "rate %llukbit/s, seed %llu, impairing %s\n",
+           argv[optind],
+           argv[optind + 1],
+           argv[optind + 2],
+           (double)impair.config.delayNs / NSEC_PER_MSEC,
+           (double)impair.config.jitterNs / NSEC_PER_MSEC,
+           impair.config.loss * 100.0,
+           (impair.config.lossMode == ImpairLossDrop) ? "drop" : "stall",
+           impair.config.reorder * 100.0,
+           (unsigned long long)(impair.config.rateBps / 1000),
+           (unsigned long long)impair.config.seed,
+           (impair.config.impaired[ImpairUp] && impair.config.impaired[ImpairDown])
+               ? "both directions"
+               : (impair.config.impaired[ImpairUp] ? "client to server" : "server to client"));
+
+    struct epoll_event events[IMPAIR_MAX_EVENTS];
+    while (1) {
+        int nfds = epoll_wait(impair.ePollFd, events, IMPAIR_MAX_EVENTS, -1);
+        if (nfds < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("error on epoll_wait() = %d (%s)\n", errno, strerror(errno));
+            return -1;
+        }
+        for (int i = 0; i < nfds; i++) {
+            if (events[i].data.ptr == &impairListenKey) {
+                impair_on_accept(&impair);
+            } else if (events[i].data.ptr == &impairTimerKey) {
+                uint64_t expirations;
+                (void)!read(impair.timerFd, &expirations, sizeof(expirations));
+            } else {
+                impair_on_endpoint(&impair, (impair_endpoint_t*)events[i].data.ptr, events[i].events);
+            }
+        }
+        // Connections are only freed here, after the batch, so no event can
+        // refer to one that's gone
+        impair_service(&impair);
+    }
+}
@@ -6,6 +6,8 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
 #include <string.h>
 
 #include <fcntl.h>
@@ -15,12 +17,13 @@
 #include <linux/input.h>
 
 //---------------------------------------------------------------------------
-static js_context_t* joystick_create_context(const js_config_t* config_)
+static js_context_t* joystick_create_context(const js_config_t* config_, const js_sink_ops_t* sink_)
 {
     js_context_t* newContext = (js_context_t*)(calloc(1, sizeof(js_context_t)));
 
-    newContext->config = *config_;
-    newContext->fd     = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+    newContext->fd         = -1;
+    newContext->lastReport = (uint8_t*)(calloc(1, joystick_get_report_size(config_) + 1));
+    newContext->sink       = sink_;
 
     return newContext;
 }
@@ -31,69 +34,108 @@ static void joystick_destroy_context(js_context_t* context_)
     if (!context_) {
         return;
     }
+    free(context_->lastReport);
     free(context_);
 }
 
 //---------------------------------------------------------------------------
-static void joystick_add_device(const js_context_t* context_)
+static void joystick_add_device(const js_context_t* context_, const js_config_t* config_)
 {
     struct uinput_setup setup = {};
 
     setup.id.bustype = BUS_VIRTUAL;
-    setup.id.vendor  = context_->config.vid;
-    setup.id.product = context_->config.pid;
-    strncpy(setup.name, context_->config.name, UINPUT_MAX_NAME_SIZE);
+    setup.id.vendor  = config_->vid;
+    setup.id.product = config_->pid;
+    snprintf(setup.name, sizeof(setup.name), "%.*s", (int)sizeof(setup.name) - 1, config_->name);
 
     ioctl(context_->fd, UI_DEV_SETUP, &setup);
     ioctl(context_->fd, UI_DEV_CREATE);
 }
 
 //---------------------------------------------------------------------------
-static void joystick_add_relative_axis(const js_context_t* context_)
+static void joystick_add_relative_axis(const js_context_t* context_, const js_config_t* config_)
 {
-    if (context_->config.relAxisCount <= 0) {
+    if (config_->relAxisCount <= 0) {
         return;
     }
 
     ioctl(context_->fd, UI_SET_EVBIT, EV_REL);
-    for (int i = 0; i < context_->config.relAxisCount; i++) {
-        ioctl(context_->fd, UI_SET_RELBIT, context_->config.relAxis[i]);
+    for (int i = 0; i < config_->relAxisCount; i++) {
+        ioctl(context_->fd, UI_SET_RELBIT, config_->relAxis[i]);
     }
 }
 
 //---------------------------------------------------------------------------
-static void joystick_add_absolute_axis(const js_context_t* context_)
+static void joystick_add_absolute_axis(const js_context_t* context_, const js_config_t* config_)
 {
-    if (context_->config.absAxisCount <= 0) {
+    if (config_->absAxisCount <= 0) {
         return;
     }
 
     ioctl(context_->fd, UI_SET_EVBIT, EV_ABS);
-    for (int i = 0; i < context_->config.absAxisCount; i++) {
+    for (int i = 0; i < config_->absAxisCount; i++) {
         struct uinput_abs_setup setup = {};
 
-        setup.code               = context_->config.absAxis[i];
+        setup.code               = config_->absAxis[i];
         setup.absinfo.value      = 0;
-        setup.absinfo.minimum    = context_->config.absAxisMin[i];
-        setup.absinfo.maximum    = context_->config.absAxisMax[i];
-        setup.absinfo.fuzz       = context_->config.absAxisFuzz[i];
-        setup.absinfo.flat       = context_->config.absAxisFlat[i];
-        setup.absinfo.resolution = context_->config.absAxisResolution[i];
+        setup.absinfo.minimum    = config_->absAxisMin[i];
+        setup.absinfo.maximum    = config_->absAxisMax[i];
+        setup.absinfo.fuzz       = config_->absAxisFuzz[i];
+        setup.absinfo.flat       = config_->absAxisFlat[i];
+        setup.absinfo.resolution = config_->absAxisResolution[i];
 
         ioctl(context_->fd, UI_ABS_SETUP, &setup);
     }
 }
 
 //---------------------------------------------------------------------------
-static void joystick_add_buttons(const js_context_t* context_)
+static void joystick_add_buttons(const js_context_t* context_, const js_config_t* config_)
 {
-    if (context_->config.buttonCount <= 0) {
+    if (config_->buttonCount <= 0) {
         return;
     }
 
     ioctl(context_->fd, UI_SET_EVBIT, EV_KEY);
-    for (int i = 0; i < context_->config.buttonCount; i++) {
-        ioctl(context_->fd, UI_SET_KEYBIT, context_->config.buttons[i]);
+    for (int i = 0; i < config_->buttonCount; i++) {
+        ioctl(context_->fd, UI_SET_KEYBIT, config_->buttons[i]);
+    }
+}
+
+//---------------------------------------------------------------------------
+static void joystick_add_repeat(const js_context_t*        context_,
+                                const js_config_t*         config_,
+                                const js_device_options_t* options_)
+{
+    if (!joystick_local_repeat(config_, options_)) {
+        return;
+    }
+
+    // The input core generates repeats for held keys on any device with EV_REP
+    // set, so the client never has to send them over the network.
+    ioctl(context_->fd, UI_SET_EVBIT, EV_REP);
+}
+
+//---------------------------------------------------------------------------
+static void joystick_set_repeat_rate(const js_context_t*        context_,
+                                     const js_config_t*         config_,
+                                     const js_device_options_t* options_)
+{
+    if (!joystick_local_repeat(config_, options_)) {
+        return;
+    }
+
+    // The repeat delay/period can only be changed once the device exists, by
+    // writing EV_REP events to it.
+    struct input_event ie[2] = {};
+    ie[0].type               = EV_REP;
+    ie[0].code               = REP_DELAY;
+    ie[0].value              = options_->repeatDelayMs;
+    ie[1].type               = EV_REP;
+    ie[1].code               = REP_PERIOD;
+    ie[1].value              = options_->repeatPeriodMs;
+
+    if (write(context_->fd, ie, sizeof(ie)) != sizeof(ie)) {
+        return;
     }
 }
 
@@ -105,24 +147,126 @@ static void joystick_add_force_feedback(const js_context_t* context_)
 }
 
 //---------------------------------------------------------------------------
-js_context_t* joystick_create(const js_config_t* config_)
+static bool joystick_uinput_open(js_context_t*              context_,
+                                 const js_config_t*         config_,
+                                 const js_device_options_t* options_)
+{
+    context_->fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+    if (context_->fd < 0) {
+        printf("unable to open /dev/uinput: %d (%s)\n", errno, strerror(errno));
+        return false;
+    }
+
+    joystick_add_absolute_axis(context_, config_);
+    joystick_add_relative_axis(context_, config_);
+    joystick_add_buttons(context_, config_);
+    joystick_add_repeat(context_, config_, options_);
+    joystick_add_force_feedback(context_);
+    joystick_add_device(context_, config_);
+    joystick_set_repeat_rate(context_, config_, options_);
+    return true;
+}
+
+//---------------------------------------------------------------------------
+static void joystick_uinput_close(js_context_t* context_)
+{
+    ioctl(context_->fd, UI_DEV_DESTROY);
+    close(context_->fd);
+}
+
+//---------------------------------------------------------------------------
+static bool joystick_uinput_write(js_context_t* context_, const struct input_event* events_, size_t count_)
+{
+    ssize_t toWrite = (ssize_t)(sizeof(struct input_event) * count_);
+    return (write(context_->fd, events_, toWrite) == toWrite);
+}
+
+//---------------------------------------------------------------------------
+static bool joystick_null_open(js_context_t* context_, const js_config_t* config_, const js_device_options_t* options_)
 {
-    js_context_t* context = joystick_create_context(config_);
+    return true;
+}
 
-    joystick_add_absolute_axis(context);
-    joystick_add_relative_axis(context);
-    joystick_add_buttons(context);
-    joystick_add_force_feedback(context);
-    joystick_add_device(context);
+//---------------------------------------------------------------------------
+static void joystick_null_close(js_context_t* context_) {}
 
+//---------------------------------------------------------------------------
+static bool joystick_null_write(js_context_t* context_, const struct input_event* events_, size_t count_)
+{
+    return true;
+}
+
+//---------------------------------------------------------------------------
+static bool joystick_record_open(js_context_t*              context_,
+                                 const js_config_t*         config_,
+                                 const js_device_options_t* options_)
+{
+    context_->recorded = (struct input_event*)(calloc(JS_RECORD_CAPACITY, sizeof(struct input_event)));
+    return (context_->recorded != NULL);
+}
+
+//---------------------------------------------------------------------------
+static void joystick_record_close(js_context_t* context_)
+{
+    free(context_->recorded);
+    context_->recorded = NULL;
+}
+
+//---------------------------------------------------------------------------
+// Once the buffer is full, further events are still counted but not kept
+static bool joystick_record_write(js_context_t* context_, const struct input_event* events_, size_t count_)
+{
+    size_t room = JS_RECORD_CAPACITY - context_->recordedCount;
+    size_t kept = (count_ < room) ? count_ : room;
+    memcpy(context_->recorded + context_->recordedCount, events_, kept * sizeof(struct input_event));
+    context_->recordedCount += kept;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+const js_sink_ops_t jsSinkUinput = { "uinput", joystick_uinput_open, joystick_uinput_close, joystick_uinput_write };
+const js_sink_ops_t jsSinkNull   = { "null", joystick_null_open, joystick_null_close, joystick_null_write };
+const js_sink_ops_t jsSinkRecord = { "record", joystick_record_open, joystick_record_close, joystick_record_write };
+
+//---------------------------------------------------------------------------
+static const js_sink_ops_t* const jsSinks[] = { &jsSinkUinput, &jsSinkNull, &jsSinkRecord };
+
+//---------------------------------------------------------------------------
+bool joystick_sink_from_string(const char* name_, const js_sink_ops_t** sink_)
+{
+    for (size_t i = 0; i < sizeof(jsSinks) / sizeof(jsSinks[0]); i++) {
+        if (strcmp(name_, jsSinks[i]->name) == 0) {
+            *sink_ = jsSinks[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+//---------------------------------------------------------------------------
+void joystick_device_options_init(js_device_options_t* options_)
+{
+    options_->autoRepeat     = true;
+    options_->repeatDelayMs  = JS_DEFAULT_REPEAT_DELAY_MS;
+    options_->repeatPeriodMs = JS_DEFAULT_REPEAT_PERIOD_MS;
+    options_->sink           = &jsSinkUinput;
+}
+
+//---------------------------------------------------------------------------
+js_context_t* joystick_create(const js_config_t* config_, const js_device_options_t* options_)
+{
+    js_context_t* context = joystick_create_context(config_, options_->sink);
+    if (!context->sink->open(context, config_, options_)) {
+        joystick_destroy_context(context);
+        return NULL;
+    }
     return context;
 }
 
 //---------------------------------------------------------------------------
 void joystick_destroy(js_context_t* context_)
 {
-    ioctl(context_->fd, UI_DEV_DESTROY);
-    close(context_->fd);
+    context_->sink->close(context_);
     joystick_destroy_context(context_);
 }
 
@@ -134,3 +278,185 @@ size_t joystick_get_report_size(const js_config_t* config)
 
     return reportSize;
 }
+
+//---------------------------------------------------------------------------
+static inline void joystick_set_event(struct input_event* event_, uint16_t type_, uint16_t code_, int32_t value_)
+{
+    /* timestamp values are ignored by uinput */
+    event_->time.tv_sec  = 0;
+    event_->time.tv_usec = 0;
+    event_->type         = type_;
+    event_->code         = code_;
+    event_->value        = value_;
+}
+
+//---------------------------------------------------------------------------
+static bool joystick_axis_rests_at_minimum(uint32_t axis_)
+{
+    return (axis_ == ABS_Z) || (axis_ == ABS_RZ) || (axis_ == ABS_THROTTLE) || (axis_ == ABS_RUDDER)
+           || (axis_ == ABS_GAS) || (axis_ == ABS_BRAKE);
+}
+
+//---------------------------------------------------------------------------
+// Every code of a type must be one the kernel knows, and listed only once
+static bool joystick_codes_valid(const js_config_t* config_, uint16_t type_, int count_, uint32_t limit_)
+{
+    uint8_t seen[(KEY_CNT + 7) / 8] = {};
+    for (int i = 0; i < count_; i++) {
+        uint32_t code = (type_ == EV_ABS) ? config_->absAxis[i]
+                                          : ((type_ == EV_REL) ? config_->relAxis[i] : config_->buttons[i]);
+        if ((code >= limit_) || (seen[code / 8] & (1 << (code % 8)))) {
+            return false;
+        }
+        seen[code / 8] |= (1 << (code % 8));
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+bool joystick_config_valid(const js_config_t* config_)
+{
+    return (config_->absAxisCount >= 0) && (config_->absAxisCount <= ABS_CNT) && (config_->relAxisCount >= 0)
+           && (config_->relAxisCount <= REL_CNT) && (config_->buttonCount >= 0) && (config_->buttonCount <= KEY_CNT)
+           && joystick_codes_valid(config_, EV_ABS, config_->absAxisCount, ABS_CNT)
+           && joystick_codes_valid(config_, EV_REL, config_->relAxisCount, REL_CNT)
+           && joystick_codes_valid(config_, EV_KEY, config_->buttonCount, KEY_CNT);
+}
+
+//---------------------------------------------------------------------------
+size_t joystick_layout_size(const js_config_t* config_)
+{
+    size_t nameLen = strnlen(config_->name, sizeof(config_->name));
+    return sizeof(js_layout_t) + (config_->absAxisCount * (sizeof(int32_t) + sizeof(uint16_t)))
+           + ((config_->relAxisCount + config_->buttonCount) * sizeof(uint16_t)) + nameLen + 1;
+}
+
+//---------------------------------------------------------------------------
+js_layout_t* joystick_layout_init(void* buf_, const js_config_t* config_)
+{
+    js_layout_t* layout   = (js_layout_t*)buf_;
+    layout->absAxisCount  = (uint16_t)config_->absAxisCount;
+    layout->relAxisCount  = (uint16_t)config_->relAxisCount;
+    layout->buttonCount   = (uint16_t)config_->buttonCount;
+    layout->relOffset     = (uint16_t)(sizeof(int32_t) * config_->absAxisCount);
+    layout->buttonsOffset = (uint16_t)(layout->relOffset + (sizeof(int32_t) * config_->relAxisCount));
+    layout->reportSize    = (uint16_t)joystick_get_report_size(config_);
+    layout->keyRepeats    = true;
+
+    // Tables follow the header, widest first to keep them aligned
+    uint8_t* next   = (uint8_t*)(layout + 1);
+    layout->absRest = (int32_t*)next;
+    next += config_->absAxisCount * sizeof(int32_t);
+    layout->absAxis = (uint16_t*)next;
+    next += config_->absAxisCount * sizeof(uint16_t);
+    layout->relAxis = (uint16_t*)next;
+    next += config_->relAxisCount * sizeof(uint16_t);
+    layout->buttons = (uint16_t*)next;
+    next += config_->buttonCount * sizeof(uint16_t);
+
+    for (int i = 0; i < config_->absAxisCount; i++) {
+        layout->absAxis[i] = (uint16_t)config_->absAxis[i];
+        layout->absRest[i] = config_->absAxisMin[i];
+        if (!joystick_axis_rests_at_minimum(config_->absAxis[i])) {
+            layout->absRest[i] = (int32_t)(((int64_t)config_->absAxisMin[i] + (int64_t)config_->absAxisMax[i]) / 2);
+        }
+    }
+    for (int i = 0; i < config_->relAxisCount; i++) {
+        layout->relAxis[i] = (uint16_t)config_->relAxis[i];
+    }
+    for (int i = 0; i < config_->buttonCount; i++) {
+        layout->buttons[i] = (uint16_t)config_->buttons[i];
+    }
+
+    size_t nameLen = strnlen(config_->name, sizeof(config_->name));
+    memcpy(next, config_->name, nameLen);
+    next[nameLen] = '\0';
+    layout->name  = (const char*)next;
+    return layout;
+}
+
+//---------------------------------------------------------------------------
+size_t joystick_layout_max_events(const js_layout_t* layout_)
+{
+    return layout_->absAxisCount + layout_->relAxisCount + layout_->buttonCount;
+}
+
+//---------------------------------------------------------------------------
+size_t joystick_layout_diff(const js_layout_t*  layout_,
+                            uint8_t*            lastReport_,
+                            const uint8_t*      report_,
+                            struct input_event* events_)
+{
+    size_t count = 0;
+    for (int i = 0; i < layout_->absAxisCount; i++) {
+        int32_t value;
+        int32_t last;
+        memcpy(&value, report_ + (i * sizeof(int32_t)), sizeof(int32_t));
+        memcpy(&last, lastReport_ + (i * sizeof(int32_t)), sizeof(int32_t));
+        if (value != last) {
+            joystick_set_event(&events_[count++], EV_ABS, layout_->absAxis[i], value);
+        }
+    }
+    for (int i = 0; i < layout_->relAxisCount; i++) {
+        int32_t value;
+        memcpy(&value, report_ + layout_->relOffset + (i * sizeof(int32_t)), sizeof(int32_t));
+        if (value != 0) {
+            joystick_set_event(&events_[count++], EV_REL, layout_->relAxis[i], value);
+        }
+    }
+    const uint8_t* buttons = report_ + layout_->buttonsOffset;
+    uint8_t*       last    = lastReport_ + layout_->buttonsOffset;
+    for (int i = 0; i < layout_->buttonCount; i++) {
+        if (buttons[i] == last[i]) {
+            continue;
+        }
+        if (!buttons[i] || !last[i]) {
+            joystick_set_event(&events_[count++], EV_KEY, layout_->buttons[i], buttons[i] ? 1 : 0);
+        } else if (layout_->keyRepeats) {
+            joystick_set_event(&events_[count++], EV_KEY, layout_->buttons[i], 2);
+        }
+    }
+
+    memcpy(lastReport_, report_, layout_->reportSize);
+    return count;
+}
+
+//---------------------------------------------------------------------------
+void joystick_layout_neutral(const js_layout_t* layout_, uint8_t* report_)
+{
+    memset(report_, 0, layout_->reportSize);
+    memcpy(report_, layout_->absRest, layout_->absAxisCount * sizeof(int32_t));
+}
+
+//---------------------------------------------------------------------------
+bool joystick_write_events(js_context_t* context_, const struct input_event* events_, size_t count_)
+{
+    if (!context_->sink->write(context_, events_, count_)) {
+        return false;
+    }
+    context_->writes++;
+    context_->eventsWritten += count_;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+bool joystick_is_keyboard(const js_config_t* config_)
+{
+    uint32_t found = 0;
+    for (int i = 0; i < config_->buttonCount; i++) {
+        if ((config_->buttons[i] >= KEY_ESC) && (config_->buttons[i] <= KEY_S)) {
+            found |= (1U << config_->buttons[i]);
+        }
+    }
+
+    uint32_t required = 0;
+    for (int key = KEY_ESC; key <= KEY_S; key++) { required |= (1U << key); }
+
+    return (found == required);
+}
+
+//---------------------------------------------------------------------------
+bool joystick_local_repeat(const js_config_t* config_, const js_device_options_t* options_)
+{
+    return options_->autoRepeat && joystick_is_keyboard(config_);
+}
@@ -47,24 +47,170 @@ typedef struct {
     uint8_t* buttons;
 } js_report_t;
 
+//---------------------------------------------------------------------------
+#define JS_DEFAULT_REPEAT_DELAY_MS (250)    //!< Default delay before a held key starts repeating
+#define JS_DEFAULT_REPEAT_PERIOD_MS (33)    //!< Default interval between repeats of a held key
+#define JS_RECORD_CAPACITY (65536)          //!< Number of events kept by the recording sink
+
+//---------------------------------------------------------------------------
+typedef struct js_context js_context_t;
+typedef struct js_sink_ops js_sink_ops_t;
+
+//---------------------------------------------------------------------------
+// Server-side options used when creating a virtual device
+typedef struct {
+    bool                 autoRepeat;        //!< Generate key repeats locally for keyboard-class devices
+    int                  repeatDelayMs;     //!< Delay before a held key starts repeating
+    int                  repeatPeriodMs;    //!< Interval between repeats of a held key
+    const js_sink_ops_t* sink;              //!< Where the device's events go (default: uinput)
+} js_device_options_t;
+
+//---------------------------------------------------------------------------
+// Output sink: the implementation behind a virtual device
+struct js_sink_ops {
+    const char* name;   //!< Name used to select the sink
+
+    /**
+     * Set up the output for a newly-created context
+     * @return true on success
+     */
+    bool (*open)(js_context_t* context_, const js_config_t* config_, const js_device_options_t* options_);
+
+    /** Release whatever open() set up */
+    void (*close)(js_context_t* context_);
+
+    /**
+     * Deliver a batch of events (ending in EV_SYN)
+     * @return true if every event was delivered
+     */
+    bool (*write)(js_context_t* context_, const struct input_event* events_, size_t count_);
+};
+
+//---------------------------------------------------------------------------
+extern const js_sink_ops_t jsSinkUinput;    //!< Real device, created through /dev/uinput
+extern const js_sink_ops_t jsSinkNull;      //!< Discards events, only counting them
+extern const js_sink_ops_t jsSinkRecord;    //!< Keeps the first JS_RECORD_CAPACITY events in memory
+
 //---------------------------------------------------------------------------
 // Data structure that describes the instance of a joystick
+struct js_context {
+    int fd; //!< uinput device fd (-1 for sinks that don't create a device)
+
+    uint8_t* lastReport; //!< last raw report applied to the device (all-zero when created)
+
+    const js_sink_ops_t* sink;          //!< output implementation
+    uint64_t             writes;        //!< batches of events written
+    uint64_t             eventsWritten; //!< events written
+
+    struct input_event* recorded;       //!< events kept by the recording sink
+    size_t              recordedCount;  //!< number of events in recorded
+};
+
+//---------------------------------------------------------------------------
+// Compact form of a device configuration, for code that keeps one per device:
+// only the populated code tables, the values the absolute axes rest at, and the
+// report layout derived from them.  Built in a single block of memory sized by
+// joystick_layout_size(), typically a few hundred bytes rather than the
+// several kilobytes of a js_config_t.
 typedef struct {
-    int fd; //!< fd corresponding to a server connection
+    const char* name;           //!< Device name
+    uint16_t    absAxisCount;   //!< Number of absolute axes
+    uint16_t    relAxisCount;   //!< Number of relative axes
+    uint16_t    buttonCount;    //!< Number of buttons
+    uint16_t    relOffset;      //!< Offset of the first relative axis in a raw report
+    uint16_t    buttonsOffset;  //!< Offset of the first button in a raw report
+    uint16_t    reportSize;     //!< Size of a raw report
+    uint16_t*   absAxis;        //!< Code of each absolute axis
+    int32_t*    absRest;        //!< Value of each absolute axis when nobody is touching it
+    uint16_t*   relAxis;        //!< Code of each relative axis
+    uint16_t*   buttons;        //!< Code of each button
+    bool        keyRepeats;     //!< Whether a held button changing value is passed on as a key repeat
+} js_layout_t;
 
-    js_config_t config; //!< configuration data for the object
+//---------------------------------------------------------------------------
+/**
+ * @brief joystick_config_valid Check that a configuration received from
+ * elsewhere (a client, a cache file) is safe to build a device from: every
+ * count is in range, and every code is in range and listed only once.
+ * @param config_ device configuration to check
+ * @return true if the configuration is usable
+ */
+bool joystick_config_valid(const js_config_t* config_);
 
-    js_report_t previousReport; //!< previous joystick report data
-    js_report_t currentReport;  //!< current joystick report data
-} js_context_t;
+//---------------------------------------------------------------------------
+/**
+ * @brief joystick_layout_size Return the amount of memory needed to hold the
+ * compact form of a configuration.
+ * @param config_ device configuration (counts must already be validated)
+ * @return size in bytes
+ */
+size_t joystick_layout_size(const js_config_t* config_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief joystick_layout_init Build the compact form of a configuration.
+ * @param buf_ memory of at least joystick_layout_size() bytes, suitably
+ * aligned for a pointer
+ * @param config_ device configuration (counts must already be validated)
+ * @return the layout, at the start of buf_
+ */
+js_layout_t* joystick_layout_init(void* buf_, const js_config_t* config_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief joystick_layout_max_events Return the largest number of input events
+ * that joystick_layout_diff() can produce for a single report (excluding EV_SYN).
+ * @param layout_ device layout
+ * @return maximum number of events per report
+ */
+size_t joystick_layout_max_events(const js_layout_t* layout_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief joystick_layout_diff Convert a raw report into the input events
+ * needed to bring a device up to date.  Absolute axes and buttons only produce
+ * events when they differ from the previous report; non-zero relative axes
+ * always do.  A held button whose value changes (between 1 and 2) is a key
+ * repeat, passed on if the layout's keyRepeats is set.  The previous report is
+ * then updated to match.
+ * @param layout_ device layout
+ * @param lastReport_ [in|out] previous raw report
+ * @param report_ new raw report
+ * @param events_ [out] array of at least joystick_layout_max_events() events
+ * @return number of events written to events_ (not including an EV_SYN)
+ */
+size_t joystick_layout_diff(const js_layout_t*  layout_,
+                            uint8_t*            lastReport_,
+                            const uint8_t*      report_,
+                            struct input_event* events_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief joystick_layout_neutral Build the report of a device nobody is
+ * touching: all buttons released, no relative motion, sticks and hats centered,
+ * and triggers/pedals (ABS_Z, ABS_RZ, ABS_THROTTLE, ABS_RUDDER, ABS_GAS,
+ * ABS_BRAKE) at their minimum.
+ * @param layout_ device layout
+ * @param report_ [out] buffer of layout_->reportSize bytes
+ */
+void joystick_layout_neutral(const js_layout_t* layout_, uint8_t* report_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief joystick_device_options_init initialize device options to their defaults
+ * @param options_ object to initialize
+ */
+void joystick_device_options_init(js_device_options_t* options_);
 
 //---------------------------------------------------------------------------
 /**
  * @brief joystick_create Construct a new joystick object based on the configuration provided
  * @param config_ data that describes the device to create
+ * @param options_ local options for the virtual device
  * @return newly-constructed joystick context, or NULL on error initiatlizing the context
+ * (e.g. /dev/uinput can't be opened)
  */
-js_context_t* joystick_create(const js_config_t* config_);
+js_context_t* joystick_create(const js_config_t* config_, const js_device_options_t* options_);
 
 //---------------------------------------------------------------------------
 /**
@@ -123,6 +269,46 @@ void joystick_update_rel_axis(js_context_t* context_, int axis_, int32_t value_)
  */
 size_t joystick_get_report_size(const js_config_t* context_);
 
+//---------------------------------------------------------------------------
+/**
+ * @brief joystick_write_events Write a batch of input events to the device
+ * in a single operation.
+ * @param context_ device to write to
+ * @param events_ events to write
+ * @param count_ number of events
+ * @return true if all events were written
+ */
+bool joystick_write_events(js_context_t* context_, const struct input_event* events_, size_t count_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief joystick_sink_from_string look up an output sink by name
+ * @param name_ sink name (uinput, null, record)
+ * @param sink_ [out] sink implementation
+ * @return true if the name is valid
+ */
+bool joystick_sink_from_string(const char* name_, const js_sink_ops_t** sink_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief joystick_is_keyboard Determine whether a device configuration
+ * describes a keyboard (as opposed to a gamepad, mouse, etc.), using the same
+ * test as udev: the device must support all of KEY_ESC through KEY_S.
+ * @param config_ device configuration to check
+ * @return true if the device is a keyboard
+ */
+bool joystick_is_keyboard(const js_config_t* config_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief joystick_local_repeat Determine whether a virtual device generates key
+ * repeats itself (autorepeat is enabled, and the device is a keyboard).
+ * @param config_ configuration of the virtual device
+ * @param options_ local options the device is created with
+ * @return true if the device repeats held keys itself
+ */
+bool joystick_local_repeat(const js_config_t* config_, const js_device_options_t* options_);
+
 #if defined(__cplusplus)
 }
 #endif
@@ -0,0 +1,734 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#include "jsproxy.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <limits.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+
+#include "tlvc.h"
+#include "slip.h"
+#include "capture.h"
+#include "latency.h"
+#include "log.h"
+#include "message.h"
+#include "probes.h"
+#include "slab.h"
+#include "timestamp.h"
+
+//---------------------------------------------------------------------------
+#define JSPROXY_PING_INTERVAL_MS (1000)    //!< How often clients are pinged when heartbeats are disabled
+
+//---------------------------------------------------------------------------
+// Everything below is allocated from jsproxyPool, and sized for the device the
+// client describes: a gamepad costs a couple of kilobytes, rather than the
+// tens of kilobytes needed to hold the largest possible configuration.
+typedef struct {
+    int                   clientFd;
+    slip_decode_message_t slipDecode;       //!< frame decoder, sized for the largest message expected next
+    bool                  configSet;
+    js_context_t*         joystickContext;
+    js_layout_t*          layout;           //!< compact form of the configuration reported by the client
+    size_t                layoutSize;       //!< size of layout
+    remap_device_t*       remap;            //!< remapping tables, or NULL to pass reports through
+    struct input_event*   events;           //!< events generated from a single report, plus EV_SYN
+    size_t                maxEvents;        //!< capacity of events, not counting the EV_SYN
+    latency_tracker_t*    latency;          //!< statistics for timed reports, or NULL until the first one arrives
+    heartbeat_t           heartbeat;        //!< ping/pong state used for RTT and dead-peer detection
+    playout_t*            playout;          //!< jitter buffer for timed reports, or NULL to apply them on arrival
+    uint8_t*              lastInput;        //!< last timed report received, used to spot button edges
+    stats_client_t*       stats;            //!< counters exported on the stats endpoint
+    capture_writer_t*     capture;          //!< record of the reports received, or NULL
+} jsproxy_client_context_t;
+
+//---------------------------------------------------------------------------
+// Per-client allocations, shared by every connection handled by the server
+static slab_pool_t* jsproxyPool;
+
+//---------------------------------------------------------------------------
+// Options applied to every client, set by jsproxy_server_create()
+static jsproxy_config_t jsproxyConfig;
+
+//---------------------------------------------------------------------------
+// Number of captures started so far, used to name the next one
+static unsigned int jsproxyCaptureCount;
+
+//---------------------------------------------------------------------------
+// Name of the client's device, once it has been configured
+static const char* jsproxy_name(const jsproxy_client_context_t* context_)
+{
+    return context_->layout ? context_->layout->name : "";
+}
+
+//---------------------------------------------------------------------------
+// Size of the decode buffer needed for the largest frame the client may send
+// next: its configuration, until that's been received, then a timed report or
+// a pong.  Anything bigger is rejected by the decoder as oversized.
+static size_t jsproxy_frame_capacity(const jsproxy_client_context_t* context_)
+{
+    size_t dataSize = sizeof(js_config_t);
+    if (context_->configSet) {
+        dataSize = sizeof(message_report_header_t) + context_->layout->reportSize;
+        if (dataSize < sizeof(message_pong_t)) {
+            dataSize = sizeof(message_pong_t);
+        }
+    }
+    // Plus one, as the decoder needs room to spare to accept the end of a frame
+    return sizeof(tlvc_header_t) + dataSize + sizeof(tlvc_footer_t) + 1;
+}
+
+//---------------------------------------------------------------------------
+// Make the decode buffer fit the next frame.  Must not be called while the
+// last frame decoded is still in use.
+static bool jsproxy_size_decoder(jsproxy_client_context_t* context_)
+{
+    size_t rawSize = jsproxy_frame_capacity(context_);
+    if (rawSize == context_->slipDecode.rawSize) {
+        return true;
+    }
+    uint8_t* raw = (uint8_t*)(slab_alloc(jsproxyPool, rawSize));
+    if (!raw) {
+        LOG_ERROR("unable to allocate a %d byte decode buffer", (int)rawSize);
+        return false;
+    }
+    slab_free(jsproxyPool, context_->slipDecode.raw, context_->slipDecode.rawSize);
+    slip_decode_message_init(&context_->slipDecode, raw, rawSize);
+    return true;
+}
+
+//---------------------------------------------------------------------------
+static void* jsproxy_connect(int clientFd_)
+{
+    LOG_DEBUG("client connected on fd %d", clientFd_);
+    NETSTICK_PROBE1(client_connect, clientFd_);
+
+    jsproxy_client_context_t* newContext =
+        (jsproxy_client_context_t*)(slab_alloc(jsproxyPool, sizeof(jsproxy_client_context_t)));
+    if (!newContext) {
+        LOG_ERROR("unable to allocate client context");
+        return NULL;
+    }
+    if (!jsproxy_size_decoder(newContext)) {
+        slab_free(jsproxyPool, newContext, sizeof(jsproxy_client_context_t));
+        return NULL;
+    }
+
+    transport_apply(clientFd_, &jsproxyConfig.transport);
+    realtime_apply_socket(clientFd_, &jsproxyConfig.realtime);
+
+    newContext->clientFd        = clientFd_;
+    newContext->configSet       = false;
+    newContext->joystickContext = NULL;
+    heartbeat_init(&newContext->heartbeat);
+    newContext->stats = stats_client_acquire(jsproxyConfig.stats, clientFd_);
+    if (!newContext->stats) {
+        LOG_ERROR("unable to allocate client statistics");
+        slab_free(jsproxyPool, newContext->slipDecode.raw, newContext->slipDecode.rawSize);
+        slab_free(jsproxyPool, newContext, sizeof(jsproxy_client_context_t));
+        return NULL;
+    }
+
+    LOG_DEBUG("client pool: %zu bytes in use, %zu reserved",
+              slab_pool_in_use(jsproxyPool),
+              slab_pool_reserved(jsproxyPool));
+    return newContext;
+}
+
+//---------------------------------------------------------------------------
+static void jsproxy_release_inputs(jsproxy_client_context_t* context_);
+
+//---------------------------------------------------------------------------
+static void jsproxy_disconnect(void* clientContext_)
+{
+    jsproxy_client_context_t* context = (jsproxy_client_context_t*)clientContext_;
+    if (!context) {
+        return;
+    }
+    NETSTICK_PROBE1(client_disconnect, context->clientFd);
+    LOG_DEBUG("client on fd %d disconnected", context->clientFd);
+    if (context->latency) {
+        latency_tracker_print(context->latency, jsproxy_name(context));
+    }
+    if (context->playout) {
+        playout_print(context->playout, jsproxy_name(context));
+    }
+
+    const heartbeat_t* heartbeat = &context->heartbeat;
+    if (heartbeat->pongs > 0) {
+        printf("%s: rtt: last=%.1fus smoothed=%.1fus min=%.1fus max=%.1fus\n",
+               jsproxy_name(context),
+               heartbeat->rttNs / 1000.0,
+               heartbeat->srttNs / 1000.0,
+               heartbeat->rttMinNs / 1000.0,
+               heartbeat->rttMaxNs / 1000.0);
+    }
+
+    if (context->configSet && context->joystickContext) {
+        jsproxy_release_inputs(context);
+        printf("%s: output: %llu events in %llu writes (%s)\n",
+               jsproxy_name(context),
+               (unsigned long long)context->joystickContext->eventsWritten,
+               (unsigned long long)context->joystickContext->writes,
+               context->joystickContext->sink->name);
+        joystick_destroy(context->joystickContext);
+    }
+    capture_writer_destroy(context->capture);
+    remap_device_destroy(context->remap);
+    playout_destroy(context->playout);
+    stats_client_release(context->stats);
+    if (context->layout) {
+        slab_free(jsproxyPool, context->lastInput, context->layout->reportSize + 1);
+        slab_free(jsproxyPool, context->layout, context->layoutSize);
+    }
+    slab_free(jsproxyPool, context->events, (context->maxEvents + 1) * sizeof(struct input_event));
+    slab_free(jsproxyPool, context->latency, sizeof(latency_tracker_t));
+    slab_free(jsproxyPool, context->slipDecode.raw, context->slipDecode.rawSize);
+    slab_free(jsproxyPool, context, sizeof(jsproxy_client_context_t));
+
+    LOG_DEBUG("client pool: %zu bytes in use, %zu reserved",
+              slab_pool_in_use(jsproxyPool),
+              slab_pool_reserved(jsproxyPool));
+}
+
+//---------------------------------------------------------------------------
+// Send a small message to the client.  The server sends little, and rarely, so
+// rather than queueing, a message is simply skipped if the socket can't take it
+// right now.  Returns false on a socket error, or if only part of the message
+// went out: the rest can't follow later, and the stream would be left mid-frame.
+static bool jsproxy_send_message(jsproxy_client_context_t* context_, uint16_t tag_, const void* data_, size_t dataLen_)
+{
+    uint8_t frame[64];
+    size_t  frameLen = message_encode(frame, sizeof(frame), tag_, data_, dataLen_);
+    if (frameLen == 0) {
+        return true;
+    }
+
+    int nWritten = send(context_->clientFd, frame, frameLen, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if ((nWritten < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+        return false;
+    }
+    if ((nWritten >= 0) && ((size_t)nWritten != frameLen)) {
+        LOG_WARNING("short write (%d of %zu bytes) to client on fd %d", nWritten, frameLen, context_->clientFd);
+        return false;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Send a clock probe to the client
+static bool jsproxy_send_ping(jsproxy_client_context_t* context_)
+{
+    message_ping_t ping = {};
+    ping.id             = heartbeat_next_ping(&context_->heartbeat);
+    ping.serverTimeNs   = timestamp_now_ns();
+    return jsproxy_send_message(context_, MessageTagPing, &ping, sizeof(ping));
+}
+
+//---------------------------------------------------------------------------
+// Tell the client what the virtual device expects of it.  Clients that never
+// hear of it (or older servers that never send it) don't forward key repeats.
+static bool jsproxy_send_device(jsproxy_client_context_t* context_)
+{
+    message_device_t device = {};
+    if (!context_->remap && context_->layout->keyRepeats) {
+        device.flags |= MESSAGE_DEVICE_FORWARD_REPEATS;
+    }
+    return jsproxy_send_message(context_, MessageTagDevice, &device, sizeof(device));
+}
+
+//---------------------------------------------------------------------------
+// Sample the values that are too expensive to keep up to date on every report
+static void jsproxy_publish_stats(jsproxy_client_context_t* context_)
+{
+    stats_client_t* stats = context_->stats;
+
+    int queued = 0;
+    if (ioctl(context_->clientFd, FIONREAD, &queued) == 0) {
+        stats_set(&stats->socketQueueBytes, (uint64_t)queued);
+    }
+    const playout_t* playout = context_->playout;
+    if (playout) {
+        stats_set(&stats->playoutDepth, (uint64_t)playout->count);
+        stats_set(&stats->playoutQueued, playout->queued);
+        stats_set(&stats->playoutBypassed, playout->bypassed);
+        stats_set(&stats->playoutLate, playout->late);
+        stats_set(&stats->arrivalJitterNs, (uint64_t)playout->arrival.jitterNs);
+        stats_set(&stats->arrivalPeakNs, playout->arrival.peakNs);
+        stats_set(&stats->appliedJitterNs, (uint64_t)playout->output.jitterNs);
+        stats_set(&stats->appliedPeakNs, playout->output.peakNs);
+    }
+    stats_set(&stats->rttNs, context_->heartbeat.srttNs);
+    if (!context_->latency) {
+        return;
+    }
+
+    const histogram_t* latency = &context_->latency->latency;
+    stats_set(&stats->latencyP50Ns, histogram_percentile(latency, 50.0));
+    stats_set(&stats->latencyP99Ns, histogram_percentile(latency, 99.0));
+    stats_set(&stats->latencyP999Ns, histogram_percentile(latency, 99.9));
+    stats_set(&stats->latencyMaxNs, latency->max);
+}
+
+//---------------------------------------------------------------------------
+static bool jsproxy_tick(int clientFd_, void* clientContext_)
+{
+    jsproxy_client_context_t* context = (jsproxy_client_context_t*)clientContext_;
+    if (!context) {
+        return false;
+    }
+    if (!context->configSet) {
+        return true;
+    }
+    jsproxy_publish_stats(context);
+    if (context->capture) {
+        capture_writer_flush(context->capture);
+    }
+    if (heartbeat_is_dead(&context->heartbeat, &jsproxyConfig.heartbeat)) {
+        // Disconnecting releases everything the client was holding down
+        LOG_WARNING(
+            "%s: no answer to %d pings - dropping client", jsproxy_name(context), context->heartbeat.outstanding);
+        return false;
+    }
+    return jsproxy_send_ping(context);
+}
+
+//---------------------------------------------------------------------------
+// Free whatever a failed jsproxy_create_device() left behind, so that a later
+// configuration message starts afresh
+static void jsproxy_abandon_device(jsproxy_client_context_t* context_)
+{
+    if (context_->joystickContext) {
+        joystick_destroy(context_->joystickContext);
+    }
+    remap_device_destroy(context_->remap);
+    slab_free(jsproxyPool, context_->layout, context_->layoutSize);
+    context_->joystickContext = NULL;
+    context_->remap           = NULL;
+    context_->layout          = NULL;
+}
+
+//---------------------------------------------------------------------------
+static bool jsproxy_create_device(jsproxy_client_context_t* context_, const js_config_t* config_)
+{
+    // Only keep what's needed to interpret reports; config_ lives in the decode buffer
+    context_->layoutSize = joystick_layout_size(config_);
+    void* layout         = slab_alloc(jsproxyPool, context_->layoutSize);
+    if (!layout) {
+        LOG_ERROR("unable to allocate device layout");
+        return false;
+    }
+    context_->layout = joystick_layout_init(layout, config_);
+    stats_client_set_name(context_->stats, config_->name);
+
+    size_t maxEvents = joystick_layout_max_events(context_->layout);
+    if (jsproxyConfig.remap && remap_config_matches(jsproxyConfig.remap, config_)) {
+        // The virtual device exposes whatever the remapped device can produce
+        js_config_t* output = (js_config_t*)(slab_alloc(jsproxyPool, sizeof(js_config_t)));
+        if (!output) {
+            LOG_ERROR("unable to allocate remapped device configuration");
+            jsproxy_abandon_device(context_);
+            return false;
+        }
+        context_->remap = remap_device_create(jsproxyConfig.remap, config_, output);
+        if (!context_->remap) {
+            // Passing it through instead would ignore the rules meant for it
+            LOG_WARNING("%s: unable to remap device - rejecting it", config_->name);
+            slab_free(jsproxyPool, output, sizeof(js_config_t));
+            jsproxy_abandon_device(context_);
+            return false;
+        }
+        printf("remapping device: %s\n", config_->name);
+        maxEvents                 = context_->remap->maxEvents;
+        context_->joystickContext = joystick_create(output, &jsproxyConfig.device);
+        slab_free(jsproxyPool, output, sizeof(js_config_t));
+    }
+    if (!context_->remap) {
+        // A virtual keyboard that repeats held keys itself has no use for the client's repeats
+        context_->joystickContext    = joystick_create(config_, &jsproxyConfig.device);
+        context_->layout->keyRepeats = !joystick_local_repeat(config_, &jsproxyConfig.device);
+    }
+
+    // Room for every event a report can produce, plus the closing EV_SYN
+    context_->maxEvents = maxEvents;
+    context_->events =
+        (struct input_event*)(slab_alloc(jsproxyPool, (maxEvents + 1) * sizeof(struct input_event)));
+    if (!context_->events) {
+        LOG_ERROR("unable to allocate event buffer");
+        jsproxy_abandon_device(context_);
+        return false;
+    }
+    context_->configSet = true;
+
+    if (jsproxyConfig.playout.enabled) {
+        context_->playout   = playout_create(&jsproxyConfig.playout, context_->layout->reportSize);
+        context_->lastInput = (uint8_t*)(slab_alloc(jsproxyPool, context_->layout->reportSize + 1));
+        if (!context_->playout || !context_->lastInput) {
+            // Reports are still applied, just on arrival
+            LOG_WARNING("%s: unable to allocate playout buffers - playout disabled", config_->name);
+            playout_destroy(context_->playout);
+            slab_free(jsproxyPool, context_->lastInput, context_->layout->reportSize + 1);
+            context_->playout   = NULL;
+            context_->lastInput = NULL;
+        }
+    }
+
+    if (jsproxyConfig.capture) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s.%u", jsproxyConfig.capture, jsproxyCaptureCount++);
+        context_->capture = capture_writer_create(path, CaptureKindReports, config_);
+        if (context_->capture) {
+            printf("%s: capturing reports to %s\n", config_->name, path);
+        }
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+static void jsproxy_handle_report(jsproxy_client_context_t* context_, const uint8_t* report_)
+{
+    size_t count;
+    if (context_->remap) {
+        count = remap_device_apply(context_->remap, report_, context_->events);
+    } else {
+        count = joystick_layout_diff(
+            context_->layout, context_->joystickContext->lastReport, report_, context_->events);
+    }
+    if (count == 0) {
+        stats_add(&context_->stats->reportsApplied, 1);
+        return;
+    }
+
+    // Emit the whole report, terminated by EV_SYN, in a single write
+    struct input_event* syn = &context_->events[count++];
+    memset(syn, 0, sizeof(*syn));
+    syn->type = EV_SYN;
+    syn->code = SYN_REPORT;
+
+    NETSTICK_PROBE3(uinput_write, context_->clientFd, context_->joystickContext->fd, count);
+    bool written = joystick_write_events(context_->joystickContext, context_->events, count);
+    NETSTICK_PROBE4(uinput_written, context_->clientFd, context_->joystickContext->fd, count, written);
+    if (!written) {
+        stats_add(&context_->stats->writeErrors, 1);
+        if (errno == EAGAIN) {
+            stats_add(&context_->stats->writeAgain, 1);
+        }
+        LOG_ERROR("error writing event to uinput");
+        return;
+    }
+    stats_add(&context_->stats->reportsApplied, 1);
+}
+
+//---------------------------------------------------------------------------
+static void jsproxy_apply_timed_report(jsproxy_client_context_t* context_, uint64_t clientNs_, const uint8_t* report_)
+{
+    jsproxy_handle_report(context_, report_);
+
+    uint64_t now = timestamp_now_ns();
+    latency_tracker_on_applied(context_->latency, clientNs_, now);
+    if (context_->playout) {
+        playout_applied(context_->playout, clientNs_, now);
+    }
+}
+
+//---------------------------------------------------------------------------
+// Apply every queued report that has come due (or all of them, if forced)
+static void jsproxy_playout_drain(jsproxy_client_context_t* context_, uint64_t now_, bool force_)
+{
+    uint64_t       clientNs;
+    const uint8_t* report;
+    while ((report = playout_pop(context_->playout, now_, force_, &clientNs)) != NULL) {
+        jsproxy_apply_timed_report(context_, clientNs, report);
+    }
+}
+
+//---------------------------------------------------------------------------
+// Queue a timed report for playout.  Button edges skip the queue: a late button
+// press costs more than a little irregularity in analog motion.
+static void jsproxy_playout_report(jsproxy_client_context_t* context_, uint64_t clientNs_, const uint8_t* report_)
+{
+    const js_layout_t* layout        = context_->layout;
+    size_t             buttonsOffset = layout->buttonsOffset;
+    bool edge = (memcmp(report_ + buttonsOffset, context_->lastInput + buttonsOffset, layout->buttonCount) != 0);
+    memcpy(context_->lastInput, report_, layout->reportSize);
+
+    uint64_t now = timestamp_now_ns();
+    if (!edge && playout_push(context_->playout, clientNs_, now, report_)) {
+        return;
+    }
+
+    // Whatever is still queued goes out first, to keep reports in order
+    jsproxy_playout_drain(context_, now, true);
+    playout_bypass(context_->playout, clientNs_, now);
+    jsproxy_apply_timed_report(context_, clientNs_, report_);
+}
+
+//---------------------------------------------------------------------------
+static uint64_t jsproxy_timer(int clientFd_, void* clientContext_, uint64_t now_)
+{
+    jsproxy_client_context_t* context = (jsproxy_client_context_t*)clientContext_;
+    if (!context || !context->playout) {
+        return 0;
+    }
+    jsproxy_playout_drain(context, now_, false);
+    return playout_deadline(context->playout);
+}
+
+//---------------------------------------------------------------------------
+// Put the device back at rest, so that nothing is left held down when its
+// client goes away.
+static void jsproxy_release_inputs(jsproxy_client_context_t* context_)
+{
+    size_t   size    = context_->layout->reportSize + 1;
+    uint8_t* neutral = (uint8_t*)(slab_alloc(jsproxyPool, size));
+    if (!neutral) {
+        return;
+    }
+    joystick_layout_neutral(context_->layout, neutral);
+    jsproxy_handle_report(context_, neutral);
+    slab_free(jsproxyPool, neutral, size);
+}
+
+//---------------------------------------------------------------------------
+static void
+jsproxy_handle_message(jsproxy_client_context_t* context_, uint16_t eventType_, void* data_, size_t dataSize_)
+{
+    switch (eventType_) {
+        case MessageTagConfig: {
+            if (context_->configSet) {
+                LOG_WARNING("configuration already set - ignoring");
+                return;
+            }
+
+            if (dataSize_ != sizeof(js_config_t)) {
+                LOG_WARNING("expected configuration size %d, got %d", (int)sizeof(js_config_t), (int)dataSize_);
+                return;
+            }
+
+            js_config_t* config = (js_config_t*)data_;
+            if (!joystick_config_valid(config)) {
+                LOG_WARNING("invalid configuration - ignoring");
+                return;
+            }
+
+            // Okay, so now that we have the configuration, we need to create the
+            // actual joystick object with its details
+            if (!jsproxy_create_device(context_, config)) {
+                return;
+            }
+
+            // Start measuring the clock offset right away, rather than on the first tick
+            jsproxy_send_device(context_);
+            jsproxy_send_ping(context_);
+
+        } break;
+        case MessageTagReport: {
+            if (!context_->configSet || !context_->joystickContext) {
+                LOG_WARNING("joystick hasn't been configured.  Bailing");
+                return;
+            }
+
+            if (dataSize_ != context_->layout->reportSize) {
+                LOG_WARNING("expected report size %d, got %d", (int)context_->layout->reportSize, (int)dataSize_);
+                return;
+            }
+
+            NETSTICK_PROBE5(report_decoded, context_->clientFd, eventType_, dataSize_, 0, 0);
+            if (context_->capture) {
+                capture_write_report(context_->capture, timestamp_now_ns(), eventType_, data_, dataSize_);
+            }
+            jsproxy_handle_report(context_, (const uint8_t*)data_);
+
+        } break;
+        case MessageTagTimedReport: {
+            if (!context_->configSet || !context_->joystickContext) {
+                LOG_WARNING("joystick hasn't been configured.  Bailing");
+                return;
+            }
+
+            if (dataSize_ != sizeof(message_report_header_t) + context_->layout->reportSize) {
+                LOG_WARNING("expected timed report size %d, got %d",
+                            (int)(sizeof(message_report_header_t) + context_->layout->reportSize),
+                            (int)dataSize_);
+                return;
+            }
+
+            if (context_->capture) {
+                capture_write_report(context_->capture, timestamp_now_ns(), eventType_, data_, dataSize_);
+            }
+
+            message_report_header_t header;
+            memcpy(&header, data_, sizeof(header));
+            NETSTICK_PROBE5(
+                report_decoded, context_->clientFd, eventType_, dataSize_, header.sequence, header.timestampNs);
+            if (!context_->latency) {
+                // Only clients that send timed reports need the latency histogram
+                context_->latency = (latency_tracker_t*)(slab_alloc(jsproxyPool, sizeof(latency_tracker_t)));
+                if (!context_->latency) {
+                    LOG_ERROR("unable to allocate latency tracker");
+                    return;
+                }
+                latency_tracker_init(context_->latency);
+                jsproxy_send_ping(context_);
+            }
+            if (!latency_tracker_on_sequence(context_->latency, header.sequence)) {
+                return;
+            }
+
+            const uint8_t* report = (const uint8_t*)data_ + sizeof(header);
+            if (context_->playout) {
+                jsproxy_playout_report(context_, header.timestampNs, report);
+            } else {
+                jsproxy_apply_timed_report(context_, header.timestampNs, report);
+            }
+
+        } break;
+        case MessageTagPong: {
+            if (dataSize_ != sizeof(message_pong_t)) {
+                LOG_WARNING("expected pong size %d, got %d", (int)sizeof(message_pong_t), (int)dataSize_);
+                return;
+            }
+
+            message_pong_t pong;
+            memcpy(&pong, data_, sizeof(pong));
+            uint64_t now = timestamp_now_ns();
+            if (now >= pong.serverTimeNs) {
+                heartbeat_on_pong(&context_->heartbeat, pong.id, now - pong.serverTimeNs);
+            }
+            if (context_->latency) {
+                latency_tracker_on_pong(context_->latency, &pong, now);
+            }
+
+        } break;
+        default: {
+            LOG_WARNING("unknown message %d", eventType_);
+        } break;
+    }
+}
+
+//---------------------------------------------------------------------------
+static bool jsproxy_read(int clientFd_, void* clientContext_)
+{
+    uint8_t buf[256];
+    if (!clientContext_) {
+        return false;
+    }
+
+    int nRead = 0;
+    do {
+        nRead = read(clientFd_, buf, sizeof(buf));
+        if (nRead <= 0) {
+            break;
+        }
+        transport_on_read(clientFd_, &jsproxyConfig.transport);
+
+        jsproxy_client_context_t* context = (jsproxy_client_context_t*)clientContext_;
+        stats_add(&context->stats->bytesReceived, (uint64_t)nRead);
+        for (int i = 0; i < nRead; i++) {
+            slip_decode_return_t rc = slip_decode_byte(&context->slipDecode, buf[i]);
+            if (rc == SlipDecodeEndOfFrame) {
+                // Decoder contains the contents of the message into a TLVC frame, validate
+                // that it's intact.
+                NETSTICK_PROBE2(frame_received, clientFd_, context->slipDecode.index);
+                tlvc_data_t tlvc;
+                if (tlvc_decode_data(&tlvc, context->slipDecode.raw, context->slipDecode.index)) {
+                    // Message is valid and intact, process it.
+                    NETSTICK_PROBE3(tlvc_valid, clientFd_, tlvc.header.tag, tlvc.dataLen);
+                    stats_add(&context->stats->framesReceived, 1);
+                    jsproxy_handle_message(context, tlvc.header.tag, tlvc.data, tlvc.dataLen);
+                    if (!jsproxy_size_decoder(context)) {
+                        return false;
+                    }
+                } else if (context->slipDecode.index > 0) {
+                    NETSTICK_PROBE2(tlvc_rejected, clientFd_, context->slipDecode.index);
+                    stats_add(&context->stats->checksumErrors, 1);
+                }
+                slip_decode_begin(&context->slipDecode);
+            } else if (rc != SlipDecodeOk) {
+                // Error decoding frame -- discard.
+                NETSTICK_PROBE2(slip_rejected, clientFd_, rc);
+                stats_add(&context->stats->slipErrors, 1);
+                slip_decode_begin(&context->slipDecode);
+            }
+        }
+    } while (nRead > 0);
+
+    if (nRead == 0) {
+        return false;
+    }
+    if ((nRead == -1) && ((errno == EINTR) || (errno == EAGAIN))) {
+        return true;
+    }
+
+    return true;
+}
+
+//---------------------------------------------------------------------------
+void jsproxy_config_init(jsproxy_config_t* config_)
+{
+    memset(config_, 0, sizeof(*config_));
+    transport_config_init(&config_->transport);
+    joystick_device_options_init(&config_->device);
+    realtime_config_init(&config_->realtime);
+    server_poll_config_init(&config_->poll);
+    heartbeat_config_init(&config_->heartbeat);
+    playout_config_init(&config_->playout);
+    config_->maxClients = JSPROXY_DEFAULT_MAX_CLIENTS;
+}
+
+//---------------------------------------------------------------------------
+server_context_t* jsproxy_server_create(uint16_t port_, const jsproxy_config_t* config_)
+{
+    jsproxyConfig              = *config_;
+    client_handlers_t handlers = { .onConnect    = jsproxy_connect,
+                                   .onDisconnect = jsproxy_disconnect,
+                                   .onReadData   = jsproxy_read,
+                                   .onTick       = jsproxy_tick,
+                                   .onTimer      = jsproxyConfig.playout.enabled ? jsproxy_timer : NULL };
+
+    jsproxyPool = slab_pool_create();
+    if (!jsproxyPool) {
+        LOG_ERROR("unable to create client pool");
+        return NULL;
+    }
+
+    server_context_t* server = server_create(port_, jsproxyConfig.maxClients, &handlers);
+    if (!server) {
+        slab_pool_destroy(jsproxyPool);
+        jsproxyPool = NULL;
+        return NULL;
+    }
+    server_set_poll_config(server, &jsproxyConfig.poll);
+    if (jsproxyConfig.playout.enabled) {
+        printf("playout: delay target %d-%dus\n", jsproxyConfig.playout.minDelayUs, jsproxyConfig.playout.maxDelayUs);
+    }
+    if (jsproxyConfig.heartbeat.intervalMs > 0) {
+        server_set_tick_interval(server, jsproxyConfig.heartbeat.intervalMs);
+    } else {
+        server_set_tick_interval(server, JSPROXY_PING_INTERVAL_MS);
+    }
+    if (jsproxyConfig.poll.mode != ServerPollBlocking) {
+        printf("poll mode: %s (busy-poll %dus, spin %dus)\n",
+               server_poll_mode_to_string(jsproxyConfig.poll.mode),
+               jsproxyConfig.poll.busyPollUs,
+               jsproxyConfig.poll.spinUs);
+    }
+    return server;
+}
+
+//---------------------------------------------------------------------------
+void jsproxy_server_destroy(server_context_t* server_)
+{
+    server_destroy(server_);
+    slab_pool_destroy(jsproxyPool);
+    jsproxyPool = NULL;
+}
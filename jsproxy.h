@@ -0,0 +1,70 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "heartbeat.h"
+#include "joystick.h"
+#include "playout.h"
+#include "realtime.h"
+#include "remap.h"
+#include "server.h"
+#include "stats.h"
+#include "transport.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+#define JSPROXY_DEFAULT_MAX_CLIENTS (10)    //!< Default maximum number of concurrent client connections
+
+//---------------------------------------------------------------------------
+// Options of netstickd's server side, which turns each client connection into
+// a virtual device fed by the reports the client sends.  Only one server can
+// exist at a time.
+typedef struct {
+    transport_config_t   transport;     //!< Socket policy applied to every client connection
+    js_device_options_t  device;        //!< Local options applied to every virtual device
+    remap_config_t*      remap;         //!< Remapping rules applied to matching devices (NULL == pass everything through)
+    realtime_config_t    realtime;      //!< Real-time scheduling/socket options
+    server_poll_config_t poll;          //!< How the server waits for client data
+    heartbeat_config_t   heartbeat;     //!< How often clients are pinged, and when they're given up on
+    playout_config_t     playout;       //!< Jitter smoothing for timed reports
+    stats_server_t*      stats;         //!< Statistics endpoint (NULL == disabled)
+    const char*          capture;       //!< Reports from each client are recorded to <capture>.<n> (NULL == disabled)
+    int                  maxClients;    //!< Maximum number of concurrent client connections
+} jsproxy_config_t;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief jsproxy_config_init initialize server options to their defaults
+ * @param config_ options to initialize
+ */
+void jsproxy_config_init(jsproxy_config_t* config_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief jsproxy_server_create create the server, ready for server_run()
+ * @param port_ port on which to listen for clients (0 == any free port)
+ * @param config_ options applied to every client; copied, except for the
+ * remap rules and stats endpoint, which must outlive the server
+ * @return newly-created server, or NULL on error
+ */
+server_context_t* jsproxy_server_create(uint16_t port_, const jsproxy_config_t* config_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief jsproxy_server_destroy destroy a server that is no longer running,
+ * and whose clients have all disconnected
+ * NOTE: object must not be used after this is called.
+ * @param server_ server to destroy
+ */
+void jsproxy_server_destroy(server_context_t* server_);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
@@ -0,0 +1,123 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#include "latency.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+//---------------------------------------------------------------------------
+void latency_tracker_init(latency_tracker_t* tracker_)
+{
+    memset(tracker_, 0, sizeof(*tracker_));
+    histogram_init(&tracker_->latency);
+}
+
+//---------------------------------------------------------------------------
+void latency_tracker_on_pong(latency_tracker_t* tracker_, const message_pong_t* pong_, uint64_t now_)
+{
+    if (now_ < pong_->serverTimeNs) {
+        return;
+    }
+
+    // Assume the reply was generated halfway through the round trip
+    latency_offset_sample_t* sample = &tracker_->offsetSamples[tracker_->offsetSampleNext];
+    sample->rttNs                   = now_ - pong_->serverTimeNs;
+    sample->offsetNs = (int64_t)pong_->clientTimeNs - (int64_t)(pong_->serverTimeNs + (sample->rttNs / 2));
+
+    tracker_->offsetSampleNext = (tracker_->offsetSampleNext + 1) % LATENCY_OFFSET_SAMPLES;
+    if (tracker_->offsetSampleCount < LATENCY_OFFSET_SAMPLES) {
+        tracker_->offsetSampleCount++;
+    }
+
+    const latency_offset_sample_t* best = &tracker_->offsetSamples[0];
+    for (int i = 1; i < tracker_->offsetSampleCount; i++) {
+        if (tracker_->offsetSamples[i].rttNs < best->rttNs) {
+            best = &tracker_->offsetSamples[i];
+        }
+    }
+    tracker_->offsetNs    = best->offsetNs;
+    tracker_->offsetRttNs = best->rttNs;
+}
+
+//---------------------------------------------------------------------------
+bool latency_tracker_on_sequence(latency_tracker_t* tracker_, uint32_t sequence_)
+{
+    tracker_->received++;
+
+    if (!tracker_->started) {
+        tracker_->started      = true;
+        tracker_->nextSequence = sequence_ + 1;
+        tracker_->recentMask   = 1;
+        return true;
+    }
+
+    // Sequence numbers wrap, so compare them by signed distance
+    int32_t distance = (int32_t)(sequence_ - tracker_->nextSequence);
+    if (distance >= 0) {
+        tracker_->gaps += (uint64_t)distance;
+        tracker_->nextSequence = sequence_ + 1;
+        tracker_->recentMask   = (distance >= 63) ? 1 : ((tracker_->recentMask << (distance + 1)) | 1);
+        return true;
+    }
+
+    // An older report: either one we've seen, or one that was counted as missing
+    int age = -distance - 1;
+    if (age < 64) {
+        uint64_t bit = 1ULL << age;
+        if (tracker_->recentMask & bit) {
+            tracker_->duplicates++;
+            return false;
+        }
+        tracker_->recentMask |= bit;
+        if (tracker_->gaps > 0) {
+            tracker_->gaps--;
+        }
+    }
+    tracker_->reorders++;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+void latency_tracker_on_applied(latency_tracker_t* tracker_, uint64_t clientTimeNs_, uint64_t now_)
+{
+    if (tracker_->offsetSampleCount == 0) {
+        tracker_->unsynced++;
+        return;
+    }
+
+    // Convert the client's timestamp to server time; small negative results can
+    // come from error in the offset estimate, and are counted as zero.
+    int64_t latency = (int64_t)now_ - ((int64_t)clientTimeNs_ - tracker_->offsetNs);
+    histogram_record(&tracker_->latency, (latency > 0) ? (uint64_t)latency : 0);
+}
+
+//---------------------------------------------------------------------------
+void latency_tracker_print(const latency_tracker_t* tracker_, const char* name_)
+{
+    if (!tracker_->started) {
+        return;
+    }
+
+    const histogram_t* latency = &tracker_->latency;
+    printf("%s: timed reports: %llu, gaps: %llu, reorders: %llu, duplicates: %llu, unsynced: %llu\n",
+           name_,
+           (unsigned long long)tracker_->received,
+           (unsigned long long)tracker_->gaps,
+           (unsigned long long)tracker_->reorders,
+           (unsigned long long)tracker_->duplicates,
+           (unsigned long long)tracker_->unsynced);
+    printf("%s: clock offset: %.1fus (rtt %.1fus), latency: mean=%.1fus p50=%.1fus p90=%.1fus p99=%.1fus "
+           "p99.9=%.1fus max=%.1fus\n",
+           name_,
+           tracker_->offsetNs / 1000.0,
+           tracker_->offsetRttNs / 1000.0,
+           histogram_mean(latency) / 1000.0,
+           histogram_percentile(latency, 50.0) / 1000.0,
+           histogram_percentile(latency, 90.0) / 1000.0,
+           histogram_percentile(latency, 99.0) / 1000.0,
+           histogram_percentile(latency, 99.9) / 1000.0,
+           latency->max / 1000.0);
+}
@@ -0,0 +1,95 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "histogram.h"
+#include "message.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+#define LATENCY_OFFSET_SAMPLES (8)  //!< Number of recent pings used to estimate the clock offset
+
+//---------------------------------------------------------------------------
+// Single clock offset measurement from a ping/pong exchange
+typedef struct {
+    int64_t  offsetNs;  //!< Client clock minus server clock
+    uint64_t rttNs;     //!< Round-trip time of the exchange
+} latency_offset_sample_t;
+
+//---------------------------------------------------------------------------
+// Server-side view of the timed reports arriving from a single device
+typedef struct {
+    bool     started;           //!< Whether any timed report has been seen
+    uint32_t nextSequence;      //!< Sequence number expected next
+    uint64_t recentMask;        //!< Bit n set if sequence (nextSequence - 1 - n) has been seen
+
+    uint64_t received;          //!< Timed reports received
+    uint64_t gaps;              //!< Reports missing from the sequence (i.e. coalesced on the client)
+    uint64_t reorders;          //!< Reports arriving after a later report
+    uint64_t duplicates;        //!< Reports received more than once
+    uint64_t unsynced;          //!< Reports received before the clock offset was known
+
+    latency_offset_sample_t offsetSamples[LATENCY_OFFSET_SAMPLES];  //!< Recent offset measurements
+    int                     offsetSampleCount;                      //!< Number of valid samples
+    int                     offsetSampleNext;                       //!< Slot for the next sample
+    int64_t                 offsetNs;                               //!< Current estimate of client - server clock
+    uint64_t                offsetRttNs;                            //!< Round-trip time of the sample used
+
+    histogram_t latency;    //!< Time from the client's input event until the report was applied
+} latency_tracker_t;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief latency_tracker_init reset a tracker
+ * @param tracker_ object to initialize
+ */
+void latency_tracker_init(latency_tracker_t* tracker_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief latency_tracker_on_pong update the clock offset estimate from a ping
+ * reply.  The estimate uses the exchange with the smallest round-trip time
+ * among recent pings, which is least affected by queueing delays.
+ * @param tracker_ tracker to update
+ * @param pong_ reply received from the client
+ * @param now_ server time (CLOCK_MONOTONIC ns) at which the reply arrived
+ */
+void latency_tracker_on_pong(latency_tracker_t* tracker_, const message_pong_t* pong_, uint64_t now_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief latency_tracker_on_sequence account for a timed report's sequence number
+ * @param tracker_ tracker to update
+ * @param sequence_ sequence number of the report
+ * @return true if the report is new, false if it is a duplicate
+ */
+bool latency_tracker_on_sequence(latency_tracker_t* tracker_, uint32_t sequence_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief latency_tracker_on_applied record the end-to-end latency of a report
+ * once it has been applied to the virtual device
+ * @param tracker_ tracker to update
+ * @param clientTimeNs_ client timestamp carried in the report header
+ * @param now_ server time (CLOCK_MONOTONIC ns) at which the report was applied
+ */
+void latency_tracker_on_applied(latency_tracker_t* tracker_, uint64_t clientTimeNs_, uint64_t now_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief latency_tracker_print print a summary of a tracker's statistics
+ * @param tracker_ tracker to summarize
+ * @param name_ name of the device
+ */
+void latency_tracker_print(const latency_tracker_t* tracker_, const char* name_);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
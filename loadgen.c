@@ -0,0 +1,962 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+//
+// Load generator for netstickd.  Many client connections are driven from a
+// single epoll loop: each registers a synthetic device (gamepad, keyboard or
+// mouse, as made by netstick's "generate:" source) and sends timed reports at a fixed rate, optionally in bursts, and
+// optionally reconnecting now and then.  At the end of the run it reports the
+// report rate achieved, the server's CPU use and, from the server's stats
+// endpoint, the latency distribution seen by its clients.
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <linux/input.h>
+
+#include "histogram.h"
+#include "joystick.h"
+#include "message.h"
+#include "slip.h"
+#include "source.h"
+#include "timestamp.h"
+#include "tlvc.h"
+
+//---------------------------------------------------------------------------
+#define LOADGEN_DEFAULT_CLIENTS (100)       //!< Default number of concurrent connections
+#define LOADGEN_DEFAULT_RATE_HZ (250)       //!< Default reports per second, per client
+#define LOADGEN_DEFAULT_DURATION_S (10)     //!< Default length of the measurement
+#define LOADGEN_TICK_US (250)               //!< Interval at which clients are checked for reports coming due
+#define LOADGEN_OUT_BUFFER_SIZE (2048)      //!< Encoded messages a client can have waiting for the socket
+#define LOADGEN_RETRY_MS (100)              //!< Delay before a failed connection is retried
+#define LOADGEN_CONNECT_TIMEOUT_S (10)      //!< Longest wait for every client to connect before measuring anyway
+#define LOADGEN_MAX_LAG_MS (1000)           //!< Reports overdue by more than this are skipped, not caught up
+#define LOADGEN_MAX_EVENTS (256)            //!< Socket events handled per epoll_wait() call
+#define LOADGEN_TICK_KEY (UINT32_MAX)       //!< epoll data of the tick timer (clients use their index)
+
+//---------------------------------------------------------------------------
+// Kinds of synthetic device
+typedef enum {
+    LoadgenDeviceGamepad = 0,
+    LoadgenDeviceKeyboard,
+    LoadgenDeviceMouse,
+    LoadgenDevices
+} loadgen_device_kind_t;
+
+//---------------------------------------------------------------------------
+typedef struct {
+    const char* name;           //!< Kind of device
+    char        spec[64];       //!< Generator spec of the device
+    js_config_t config;         //!< Configuration registered by each client
+    size_t      reportSize;     //!< Size of a report of the device
+    int         maxEvents;      //!< Most events one update of the device produces
+    uint8_t*    configFrame;    //!< Configuration message, encoded once and shared by every client
+    size_t      configFrameLen; //!< Size of configFrame
+    int         weight;         //!< Share of the clients given this device
+} loadgen_device_t;
+
+//---------------------------------------------------------------------------
+typedef enum {
+    LoadgenClientIdle = 0,      //!< Not connected; (re)connects at nextNs
+    LoadgenClientConnecting,    //!< Waiting for a non-blocking connect to finish
+    LoadgenClientConnected      //!< Sending reports
+} loadgen_client_state_t;
+
+//---------------------------------------------------------------------------
+typedef struct {
+    int                    fd;          //!< Socket (-1 when idle)
+    loadgen_client_state_t state;       //!< Connection state
+    loadgen_device_t*      device;      //!< Device the client registers
+    slip_decode_message_t* slipDecode;  //!< Frames from the server (pings)
+    input_generator_t*     generator;   //!< Drives the changes made to the device
+    uint8_t*               report;      //!< Current state of the device
+    uint32_t               sequence;    //!< Sequence number of the next timed report
+    uint32_t               seed;        //!< Spreads the client's sends and reconnects
+    uint64_t               nextNs;      //!< When the next burst is due (or, when idle, the next connect)
+    uint64_t               closeNs;     //!< When to hang up and reconnect (0 == never)
+    size_t                 configSent;  //!< Bytes of the device's configuration message written
+    size_t                 outLen;      //!< Bytes in out
+    bool                   watchWrites; //!< Whether EPOLLOUT is registered
+    uint8_t                out[LOADGEN_OUT_BUFFER_SIZE];    //!< Encoded messages waiting for the socket
+} loadgen_client_t;
+
+//---------------------------------------------------------------------------
+typedef struct {
+    // Options
+    struct sockaddr_in addr;        //!< Server address
+    int                clientCount; //!< Number of concurrent connections
+    int                rateHz;      //!< Reports per second, per client
+    int                burst;       //!< Reports sent back to back each time
+    int                churnMs;     //!< Mean connection lifetime (0 == connect once)
+    int                durationS;   //!< Length of the measurement
+    const char*        statsPath;   //!< Server's stats endpoint (NULL == none)
+    int                serverPid;   //!< Server process, for its CPU use (0 == unknown)
+
+    loadgen_device_t    devices[LoadgenDevices];
+    loadgen_client_t*   clients;
+    int                 ePollFd;
+    uint64_t            burstNs;    //!< Interval between bursts
+    uint8_t*            payload;    //!< Timed report being encoded
+    struct input_event* events;     //!< Events of the update being turned into a report
+
+    // Counters, reset when the measurement starts
+    uint64_t    reportsSent;        //!< Reports queued for the socket
+    uint64_t    reportsSkipped;     //!< Reports dropped: socket backed up, or overdue
+    uint64_t    pongs;              //!< Pings answered
+    uint64_t    connects;           //!< Connections established
+    uint64_t    churns;             //!< Connections closed by us to churn
+    uint64_t    drops;              //!< Connections closed by the server
+    uint64_t    connectErrors;      //!< Failed connection attempts
+    histogram_t lag;                //!< How late each burst was sent
+} loadgen_t;
+
+//---------------------------------------------------------------------------
+static uint32_t loadgen_random(uint32_t* seed_)
+{
+    *seed_ = (*seed_ * 1103515245) + 12345;
+    return *seed_ >> 8;
+}
+
+//---------------------------------------------------------------------------
+// Describe one kind of device, as netstick's generator would make it
+static bool loadgen_device_init(loadgen_device_t* device_, loadgen_device_kind_t kind_, int rateHz_)
+{
+    static const char* names[LoadgenDevices] = { "gamepad", "keyboard", "mouse" };
+
+    js_config_t* config = &device_->config;
+    memset(config, 0, sizeof(*config));
+    device_->name = names[kind_];
+    snprintf(device_->spec, sizeof(device_->spec), "%s,rate=%d", device_->name, rateHz_);
+    input_generator_t* generator = input_generator_create(device_->spec, config);
+    if (!generator) {
+        printf("unable to generate a %s at %d Hz\n", device_->name, rateHz_);
+        return false;
+    }
+    device_->maxEvents = input_generator_max_events(generator);
+    input_generator_destroy(generator);
+
+    config->vid = 0x1209;
+    snprintf(config->name, sizeof(config->name), "netstick loadgen %s", device_->name);
+    device_->reportSize = joystick_get_report_size(config);
+
+    size_t maxLen           = message_encoded_size_max(sizeof(*config));
+    device_->configFrame    = (uint8_t*)malloc(maxLen);
+    device_->configFrameLen = message_encode(device_->configFrame, maxLen, MessageTagConfig, config, sizeof(*config));
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Move the device along one update.  Absolute axes and buttons hold their
+// state; relative axes report only this update's motion.
+static void loadgen_client_update(loadgen_t* loadgen_, loadgen_client_t* client_, uint64_t now_)
+{
+    const js_config_t* config = &client_->device->config;
+    int                count  = input_generator_update(client_->generator, config, loadgen_->events, now_);
+
+    uint8_t* rel     = client_->report + (config->absAxisCount * sizeof(int32_t));
+    uint8_t* buttons = rel + (config->relAxisCount * sizeof(int32_t));
+    input_generator_get_state(client_->generator, config, buttons, (int32_t*)client_->report);
+    memset(rel, 0, config->relAxisCount * sizeof(int32_t));
+    for (int i = 0; i < count; i++) {
+        if (loadgen_->events[i].type != EV_REL) {
+            continue;
+        }
+        for (int j = 0; j < config->relAxisCount; j++) {
+            if (config->relAxis[j] == loadgen_->events[i].code) {
+                memcpy(rel + (j * sizeof(int32_t)), &loadgen_->events[i].value, sizeof(int32_t));
+            }
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+// Queue a message behind whatever the client has waiting
+static bool loadgen_client_queue(loadgen_client_t* client_, uint16_t tag_, const void* data_, size_t dataLen_)
+{
+    size_t len = message_encode(
+        client_->out + client_->outLen, sizeof(client_->out) - client_->outLen, tag_, data_, dataLen_);
+    client_->outLen += len;
+    return (len > 0);
+}
+
+//---------------------------------------------------------------------------
+// Only ask for EPOLLOUT while something is waiting for room in the socket, so
+// that the acknowledgement of every report doesn't wake us up
+static void loadgen_client_watch_writes(loadgen_t* loadgen_, int index_, bool watch_)
+{
+    loadgen_client_t* client = &loadgen_->clients[index_];
+    if (client->watchWrites == watch_) {
+        return;
+    }
+    struct epoll_event ev = {};
+    ev.events             = EPOLLIN | EPOLLRDHUP | (watch_ ? EPOLLOUT : 0);
+    ev.data.u32           = (uint32_t)index_;
+    if (epoll_ctl(loadgen_->ePollFd, EPOLL_CTL_MOD, client->fd, &ev) == 0) {
+        client->watchWrites = watch_;
+    }
+}
+
+//---------------------------------------------------------------------------
+// Write out the configuration message, then anything queued; false if the
+// connection died
+static bool loadgen_client_flush(loadgen_t* loadgen_, int index_)
+{
+    loadgen_client_t*       client = &loadgen_->clients[index_];
+    const loadgen_device_t* device = client->device;
+    bool                    full   = false;
+    while (!full && (client->configSent < device->configFrameLen)) {
+        ssize_t rc = send(client->fd,
+                          device->configFrame + client->configSent,
+                          device->configFrameLen - client->configSent,
+                          MSG_NOSIGNAL);
+        if (rc < 0) {
+            if ((errno != EAGAIN) && (errno != EINTR)) {
+                return false;
+            }
+            full = true;
+            break;
+        }
+        client->configSent += rc;
+    }
+    size_t written = 0;
+    while (!full && (written < client->outLen)) {
+        ssize_t rc = send(client->fd, client->out + written, client->outLen - written, MSG_NOSIGNAL);
+        if (rc < 0) {
+            if ((errno != EAGAIN) && (errno != EINTR)) {
+                return false;
+            }
+            full = true;
+            break;
+        }
+        written += rc;
+    }
+    memmove(client->out, client->out + written, client->outLen - written);
+    client->outLen -= written;
+    loadgen_client_watch_writes(loadgen_, index_, full);
+    return true;
+}
+
+//---------------------------------------------------------------------------
+static void loadgen_client_close(loadgen_client_t* client_, uint64_t reconnectNs_)
+{
+    if (client_->fd >= 0) {
+        close(client_->fd);
+    }
+    client_->fd     = -1;
+    client_->state  = LoadgenClientIdle;
+    client_->nextNs = reconnectNs_;
+}
+
+//---------------------------------------------------------------------------
+static void loadgen_client_connect(loadgen_t* loadgen_, int index_, uint64_t now_)
+{
+    loadgen_client_t* client = &loadgen_->clients[index_];
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        loadgen_->connectErrors++;
+        client->nextNs = now_ + (LOADGEN_RETRY_MS * NSEC_PER_MSEC);
+        return;
+    }
+    int enable = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    int rc = connect(fd, (const struct sockaddr*)&loadgen_->addr, sizeof(loadgen_->addr));
+    if ((rc < 0) && (errno != EINPROGRESS)) {
+        close(fd);
+        loadgen_->connectErrors++;
+        client->nextNs = now_ + (LOADGEN_RETRY_MS * NSEC_PER_MSEC);
+        return;
+    }
+
+    // EPOLLOUT reports the end of the connect
+    struct epoll_event ev = {};
+    ev.events             = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+    ev.data.u32           = (uint32_t)index_;
+    if (epoll_ctl(loadgen_->ePollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        printf("error registering client fd=%d: %d (%s)\n", fd, errno, strerror(errno));
+        close(fd);
+        loadgen_->connectErrors++;
+        client->nextNs = now_ + (LOADGEN_RETRY_MS * NSEC_PER_MSEC);
+        return;
+    }
+
+    client->fd          = fd;
+    client->state       = LoadgenClientConnecting;
+    client->watchWrites = true;
+    client->configSent  = 0;
+    client->outLen     = 0;
+    client->sequence   = 0;
+    memset(client->report, 0, client->device->reportSize);
+    slip_decode_begin(client->slipDecode);
+}
+
+//---------------------------------------------------------------------------
+static void loadgen_client_established(loadgen_t* loadgen_, loadgen_client_t* client_, uint64_t now_)
+{
+    int       error = 0;
+    socklen_t len   = sizeof(error);
+    if ((getsockopt(client_->fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0) || (error != 0)) {
+        loadgen_->connectErrors++;
+        loadgen_client_close(client_, now_ + (LOADGEN_RETRY_MS * NSEC_PER_MSEC));
+        return;
+    }
+
+    loadgen_->connects++;
+    client_->state = LoadgenClientConnected;
+
+    // Spread the clients' bursts over the interval, rather than sending them
+    // all at once; a churned client carries on with its old schedule
+    if (client_->nextNs < now_) {
+        client_->nextNs = now_ + (loadgen_random(&client_->seed) % loadgen_->burstNs);
+    }
+    client_->closeNs = 0;
+    if (loadgen_->churnMs > 0) {
+        uint64_t churnNs = (uint64_t)loadgen_->churnMs * NSEC_PER_MSEC;
+        client_->closeNs = now_ + (churnNs / 2) + (loadgen_random(&client_->seed) % churnNs);
+    }
+}
+
+//---------------------------------------------------------------------------
+// Read what the server sent; pings are answered, anything else is ignored
+static bool loadgen_client_read(loadgen_t* loadgen_, loadgen_client_t* client_)
+{
+    uint8_t buf[256];
+    while (1) {
+        ssize_t nRead = read(client_->fd, buf, sizeof(buf));
+        if (nRead == 0) {
+            return false;
+        }
+        if (nRead < 0) {
+            return (errno == EAGAIN) || (errno == EINTR);
+        }
+        for (ssize_t i = 0; i < nRead; i++) {
+            slip_decode_return_t rc = slip_decode_byte(client_->slipDecode, buf[i]);
+            if (rc == SlipDecodeEndOfFrame) {
+                tlvc_data_t tlvc;
+                if (tlvc_decode_data(&tlvc, client_->slipDecode->raw, client_->slipDecode->index)
+                    && (tlvc.header.tag == MessageTagPing) && (tlvc.dataLen == sizeof(message_ping_t))) {
+                    message_ping_t ping;
+                    memcpy(&ping, tlvc.data, sizeof(ping));
+
+                    message_pong_t pong = {};
+                    pong.id             = ping.id;
+                    pong.serverTimeNs   = ping.serverTimeNs;
+                    pong.clientTimeNs   = timestamp_now_ns();
+                    if (loadgen_client_queue(client_, MessageTagPong, &pong, sizeof(pong))) {
+                        loadgen_->pongs++;
+                    }
+                }
+                slip_decode_begin(client_->slipDecode);
+            } else if (rc != SlipDecodeOk) {
+                slip_decode_begin(client_->slipDecode);
+            }
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+static void loadgen_on_event(loadgen_t* loadgen_, const struct epoll_event* ev_, uint64_t now_)
+{
+    loadgen_client_t* client = &loadgen_->clients[ev_->data.u32];
+    if (client->state == LoadgenClientIdle) {
+        // Closed earlier in the same batch
+        return;
+    }
+    if (client->state == LoadgenClientConnecting) {
+        if (!(ev_->events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+            return;
+        }
+        loadgen_client_established(loadgen_, client, now_);
+        if (client->state != LoadgenClientConnected) {
+            return;
+        }
+    }
+
+    bool alive = true;
+    if (ev_->events & EPOLLIN) {
+        alive = loadgen_client_read(loadgen_, client);
+    }
+    if (ev_->events & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) {
+        alive = false;
+    }
+    if (alive) {
+        alive = loadgen_client_flush(loadgen_, (int)ev_->data.u32);
+    }
+    if (!alive) {
+        loadgen_->drops++;
+        loadgen_client_close(client, now_ + (LOADGEN_RETRY_MS * NSEC_PER_MSEC));
+    }
+}
+
+//---------------------------------------------------------------------------
+// Send the bursts that have come due
+static bool loadgen_client_send(loadgen_t* loadgen_, loadgen_client_t* client_, uint64_t now_)
+{
+    const loadgen_device_t* device = client_->device;
+    bool                    queued = false;
+
+    if ((now_ > client_->nextNs) && ((now_ - client_->nextNs) > (LOADGEN_MAX_LAG_MS * NSEC_PER_MSEC))) {
+        uint64_t missed = (now_ - client_->nextNs) / loadgen_->burstNs;
+        loadgen_->reportsSkipped += missed * loadgen_->burst;
+        client_->nextNs += missed * loadgen_->burstNs;
+    }
+
+    while (client_->nextNs <= now_) {
+        histogram_record(&loadgen_->lag, now_ - client_->nextNs);
+        for (int i = 0; i < loadgen_->burst; i++) {
+            loadgen_client_update(loadgen_, client_, now_);
+
+            message_report_header_t header;
+            header.sequence    = client_->sequence;
+            header.timestampNs = timestamp_now_ns();
+            memcpy(loadgen_->payload, &header, sizeof(header));
+            memcpy(loadgen_->payload + sizeof(header), client_->report, device->reportSize);
+            if (loadgen_client_queue(
+                    client_, MessageTagTimedReport, loadgen_->payload, sizeof(header) + device->reportSize)) {
+                client_->sequence++;
+                loadgen_->reportsSent++;
+                queued = true;
+            } else {
+                // The server isn't keeping up; the report is lost, as it would
+                // be if a real client's send queue overflowed
+                loadgen_->reportsSkipped++;
+            }
+        }
+        client_->nextNs += loadgen_->burstNs;
+    }
+    return queued;
+}
+
+//---------------------------------------------------------------------------
+static void loadgen_tick(loadgen_t* loadgen_, uint64_t now_)
+{
+    for (int i = 0; i < loadgen_->clientCount; i++) {
+        loadgen_client_t* client = &loadgen_->clients[i];
+        switch (client->state) {
+            case LoadgenClientIdle: {
+                if (now_ >= client->nextNs) {
+                    loadgen_client_connect(loadgen_, i, now_);
+                }
+            } break;
+            case LoadgenClientConnected: {
+                if ((client->closeNs != 0) && (now_ >= client->closeNs)) {
+                    loadgen_->churns++;
+                    loadgen_client_close(client, client->nextNs);
+                    loadgen_client_connect(loadgen_, i, now_);
+                } else if (loadgen_client_send(loadgen_, client, now_) && !loadgen_client_flush(loadgen_, i)) {
+                    loadgen_->drops++;
+                    loadgen_client_close(client, now_ + (LOADGEN_RETRY_MS * NSEC_PER_MSEC));
+                }
+            } break;
+            default: break;
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+static int loadgen_connected(const loadgen_t* loadgen_)
+{
+    int connected = 0;
+    for (int i = 0; i < loadgen_->clientCount; i++) {
+        const loadgen_client_t* client = &loadgen_->clients[i];
+        if ((client->state == LoadgenClientConnected) && (client->configSent == client->device->configFrameLen)) {
+            connected++;
+        }
+    }
+    return connected;
+}
+
+//---------------------------------------------------------------------------
+static void loadgen_reset_counters(loadgen_t* loadgen_)
+{
+    loadgen_->reportsSent    = 0;
+    loadgen_->reportsSkipped = 0;
+    loadgen_->pongs          = 0;
+    loadgen_->connects       = 0;
+    loadgen_->churns         = 0;
+    loadgen_->drops          = 0;
+    loadgen_->connectErrors  = 0;
+    histogram_init(&loadgen_->lag);
+}
+
+//---------------------------------------------------------------------------
+// Run the event loop until endNs, or until stop_() says so
+static void loadgen_run(loadgen_t* loadgen_, int tickFd_, uint64_t endNs_, bool (*stop_)(const loadgen_t*))
+{
+    struct epoll_event events[LOADGEN_MAX_EVENTS];
+    while (timestamp_now_ns() < endNs_) {
+        int nfds = epoll_wait(loadgen_->ePollFd, events, LOADGEN_MAX_EVENTS, -1);
+        if (nfds < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("error on epoll_wait() = %d (%s)\n", errno, strerror(errno));
+            return;
+        }
+        uint64_t now  = timestamp_now_ns();
+        bool     tick = false;
+        for (int i = 0; i < nfds; i++) {
+            if (events[i].data.u32 == LOADGEN_TICK_KEY) {
+                uint64_t expirations;
+                tick = (read(tickFd_, &expirations, sizeof(expirations)) == sizeof(expirations));
+            } else {
+                loadgen_on_event(loadgen_, &events[i], now);
+            }
+        }
+        // Clients are only (re)connected here, after the batch, so a stale
+        // event can't be taken for one belonging to a new connection
+        if (tick) {
+            loadgen_tick(loadgen_, now);
+            if (stop_ && stop_(loadgen_)) {
+                return;
+            }
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+static bool loadgen_all_connected(const loadgen_t* loadgen_)
+{
+    return loadgen_connected(loadgen_) == loadgen_->clientCount;
+}
+
+//---------------------------------------------------------------------------
+// Fetch a JSON snapshot from the server's stats endpoint; the server's pid
+// comes with it.  Returns a malloc()'d string, or NULL on error.
+static char* loadgen_fetch_stats(const char* path_, int* pid_)
+{
+    struct sockaddr_un addr = {};
+    addr.sun_family         = AF_UNIX;
+    if (strlen(path_) >= sizeof(addr.sun_path)) {
+        printf("stats socket path too long: %s\n", path_);
+        return NULL;
+    }
+    strcpy(addr.sun_path, path_);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if ((fd < 0) || (connect(fd, (const struct sockaddr*)&addr, sizeof(addr)) != 0)) {
+        printf("error connecting to %s: %d (%s)\n", path_, errno, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    struct ucred cred;
+    socklen_t    credLen = sizeof(cred);
+    if (pid_ && (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &credLen) == 0)) {
+        *pid_ = cred.pid;
+    }
+
+    char*  response = NULL;
+    size_t size     = 0;
+    size_t capacity = 0;
+    if (send(fd, "json\n", 5, MSG_NOSIGNAL) == 5) {
+        while (1) {
+            if ((capacity - size) < 4096) {
+                capacity += 65536;
+                response = (char*)realloc(response, capacity);
+            }
+            ssize_t nRead = read(fd, response + size, capacity - size - 1);
+            if (nRead <= 0) {
+                break;
+            }
+            size += nRead;
+        }
+    }
+    close(fd);
+    if (response) {
+        response[size] = '\0';
+    }
+    return response;
+}
+
+//---------------------------------------------------------------------------
+// Read a numeric value from a client's object in the stats JSON
+static double loadgen_stats_value(const char* client_, const char* end_, const char* key_)
+{
+    char quoted[64];
+    int  len = snprintf(quoted, sizeof(quoted), "\"%s\":", key_);
+    if ((len < 0) || ((size_t)len >= sizeof(quoted))) {
+        return 0.0;
+    }
+    const char* value = strstr(client_, quoted);
+    if (!value || (end_ && (value > end_))) {
+        return 0.0;
+    }
+    return atof(value + strlen(quoted));
+}
+
+//---------------------------------------------------------------------------
+static int loadgen_compare_double(const void* a_, const void* b_)
+{
+    double a = *(const double*)a_;
+    double b = *(const double*)b_;
+    return (a < b) ? -1 : (a > b);
+}
+
+//---------------------------------------------------------------------------
+static void loadgen_print_spread(const char* name_, double* values_, int count_)
+{
+    qsort(values_, count_, sizeof(double), loadgen_compare_double);
+    printf("server: latency %-4s across clients: min=%.1fus median=%.1fus p99=%.1fus max=%.1fus\n",
+           name_,
+           values_[0] * 1e6,
+           values_[count_ / 2] * 1e6,
+           values_[(count_ * 99) / 100] * 1e6,
+           values_[count_ - 1] * 1e6);
+}
+
+//---------------------------------------------------------------------------
+// Report how reports were applied by the server, per its stats endpoint: each
+// client has its own latency percentiles, so the spread of each is shown
+static void loadgen_report_server_stats(const char* stats_)
+{
+    static const char* percentiles[] = { "p50", "p99", "p999", "max" };
+    static const int   percentileCount = sizeof(percentiles) / sizeof(percentiles[0]);
+
+    int count = 0;
+    for (const char* c = strstr(stats_, "{\"fd\":"); c; c = strstr(c + 1, "{\"fd\":")) { count++; }
+    if (count == 0) {
+        printf("server: no clients in stats\n");
+        return;
+    }
+
+    double* values  = (double*)(calloc(count * percentileCount, sizeof(double)));
+    int     latency = 0;
+    double  applied = 0.0;
+    for (const char* c = strstr(stats_, "{\"fd\":"); c;) {
+        const char* next = strstr(c + 1, "{\"fd\":");
+        applied += loadgen_stats_value(c, next, "reports_applied_total");
+
+        double max = loadgen_stats_value(c, next, "latency_max_seconds");
+        if (max > 0.0) {
+            for (int p = 0; p < percentileCount; p++) {
+                char key[64];
+                snprintf(key, sizeof(key), "latency_%s_seconds", percentiles[p]);
+                values[(p * count) + latency] = loadgen_stats_value(c, next, key);
+            }
+            latency++;
+        }
+        c = next;
+    }
+
+    printf("server: %d clients, %.0f reports applied over their lifetime\n", count, applied);
+    for (int p = 0; (latency > 0) && (p < percentileCount); p++) {
+        loadgen_print_spread(percentiles[p], &values[p * count], latency);
+    }
+    free(values);
+}
+
+//---------------------------------------------------------------------------
+// CPU time used by a process so far, in seconds; false if it can't be read
+static bool loadgen_process_cpu(int pid_, double* userS_, double* systemS_)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid_);
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return false;
+    }
+    unsigned long long user   = 0;
+    unsigned long long system = 0;
+    char               line[1024];
+    bool               ok   = (fgets(line, sizeof(line), file) != NULL);
+    char*              comm = ok ? strrchr(line, ')') : NULL;
+    // utime and stime are the 12th and 13th fields after the command name
+    ok = comm && (sscanf(comm + 1, " %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %llu %llu", &user, &system) == 2);
+    fclose(file);
+
+    long ticks = sysconf(_SC_CLK_TCK);
+    *userS_    = (double)user / ticks;
+    *systemS_  = (double)system / ticks;
+    return ok;
+}
+
+//---------------------------------------------------------------------------
+static double loadgen_self_cpu(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + (usage.ru_utime.tv_usec / 1e6) + usage.ru_stime.tv_sec
+         + (usage.ru_stime.tv_usec / 1e6);
+}
+
+//---------------------------------------------------------------------------
+// Raise the soft limit on open files to cover every connection
+static void loadgen_reserve_fds(int clientCount_)
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        return;
+    }
+    rlim_t needed = (rlim_t)clientCount_ + 64;
+    if (limit.rlim_cur >= needed) {
+        return;
+    }
+    limit.rlim_cur = (limit.rlim_max < needed) ? limit.rlim_max : needed;
+    if ((setrlimit(RLIMIT_NOFILE, &limit) != 0) || (limit.rlim_cur < needed)) {
+        printf("warning: open file limit (%llu) is too low for %d clients\n",
+               (unsigned long long)limit.rlim_cur,
+               clientCount_);
+    }
+}
+
+//---------------------------------------------------------------------------
+static bool loadgen_parse_mix(loadgen_t* loadgen_, const char* str_)
+{
+    int weights[LoadgenDevices];
+    if ((sscanf(str_, "%d:%d:%d", &weights[0], &weights[1], &weights[2]) != LoadgenDevices)) {
+        return false;
+    }
+    int total = 0;
+    for (int i = 0; i < LoadgenDevices; i++) {
+        if (weights[i] < 0) {
+            return false;
+        }
+        loadgen_->devices[i].weight = weights[i];
+        total += weights[i];
+    }
+    return (total > 0);
+}
+
+//---------------------------------------------------------------------------
+static void usage(void)
+{
+    printf("usage: netstick-loadgen [options] [server address] [server port]\n"
+           "options:\n"
+           "  -n, --clients <n>          concurrent connections (default: %d)\n"
+           "  -r, --rate <Hz>            timed reports per second, per client (default: %d)\n"
+           "  -b, --burst <n>            send reports n at a time, rate/n times a second (default: 1)\n"
+           "  -m, --mix <g:k:m>          relative numbers of gamepads, keyboards and mice (default: 1:1:1)\n"
+           "  -c, --churn-ms <ms>        reconnect each client after 0.5-1.5x this long; 0 = never (default: 0)\n"
+           "  -d, --duration <s>         length of the measurement (default: %d)\n"
+           "  -S, --stats <path>         netstickd's stats socket: its pid and client latency are read from it\n"
+           "  -p, --pid <pid>            netstickd's pid, to measure its CPU use without --stats\n",
+           LOADGEN_DEFAULT_CLIENTS,
+           LOADGEN_DEFAULT_RATE_HZ,
+           LOADGEN_DEFAULT_DURATION_S);
+}
+
+//---------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+    loadgen_t loadgen   = {};
+    loadgen.clientCount = LOADGEN_DEFAULT_CLIENTS;
+    loadgen.rateHz      = LOADGEN_DEFAULT_RATE_HZ;
+    loadgen.burst       = 1;
+    loadgen.durationS   = LOADGEN_DEFAULT_DURATION_S;
+    for (int i = 0; i < LoadgenDevices; i++) { loadgen.devices[i].weight = 1; }
+
+    static const struct option options[] = { { "clients", required_argument, NULL, 'n' },
+                                             { "rate", required_argument, NULL, 'r' },
+                                             { "burst", required_argument, NULL, 'b' },
+                                             { "mix", required_argument, NULL, 'm' },
+                                             { "churn-ms", required_argument, NULL, 'c' },
+                                             { "duration", required_argument, NULL, 'd' },
+                                             { "stats", required_argument, NULL, 'S' },
+                                             { "pid", required_argument, NULL, 'p' },
+                                             { "help", no_argument, NULL, 'h' },
+                                             { NULL, 0, NULL, 0 } };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:r:b:m:c:d:S:p:h", options, NULL)) != -1) {
+        switch (opt) {
+            case 'n': loadgen.clientCount = atoi(optarg); break;
+            case 'r': loadgen.rateHz = atoi(optarg); break;
+            case 'b': loadgen.burst = atoi(optarg); break;
+            case 'c': loadgen.churnMs = atoi(optarg); break;
+            case 'd': loadgen.durationS = atoi(optarg); break;
+            case 'S': loadgen.statsPath = optarg; break;
+            case 'p': loadgen.serverPid = atoi(optarg); break;
+            case 'm': {
+                if (!loadgen_parse_mix(&loadgen, optarg)) {
+                    printf("invalid device mix: %s\n", optarg);
+                    return -1;
+                }
+            } break;
+            default: {
+                usage();
+                return -1;
+            }
+        }
+    }
+    if ((argc - optind) < 2) {
+        usage();
+        return -1;
+    }
+    if ((loadgen.clientCount <= 0) || (loadgen.rateHz <= 0) || (loadgen.burst <= 0) || (loadgen.churnMs < 0)
+        || (loadgen.durationS <= 0)) {
+        printf("invalid load parameters\n");
+        return -1;
+    }
+
+    loadgen.addr.sin_family = AF_INET;
+    loadgen.addr.sin_port   = htons(atoi(argv[optind + 1]));
+    if (inet_pton(AF_INET, argv[optind], &loadgen.addr.sin_addr) != 1) {
+        printf("invalid server address: %s\n", argv[optind]);
+        return -1;
+    }
+    loadgen.burstNs = ((uint64_t)loadgen.burst * NSEC_PER_SEC) / loadgen.rateHz;
+
+    char* stats = NULL;
+    if (loadgen.statsPath) {
+        stats = loadgen_fetch_stats(loadgen.statsPath, &loadgen.serverPid);
+        if (!stats) {
+            return -1;
+        }
+        free(stats);
+    }
+    loadgen_reserve_fds(loadgen.clientCount);
+
+    // Hand out devices in proportion to their weights, interleaved
+    size_t maxReportSize = 0;
+    int    maxEvents     = 0;
+    int    totalWeight   = 0;
+    int    counts[LoadgenDevices];
+    for (int i = 0; i < LoadgenDevices; i++) {
+        if (!loadgen_device_init(&loadgen.devices[i], (loadgen_device_kind_t)i, loadgen.rateHz)) {
+            return -1;
+        }
+        if (loadgen.devices[i].reportSize > maxReportSize) {
+            maxReportSize = loadgen.devices[i].reportSize;
+        }
+        if (loadgen.devices[i].maxEvents > maxEvents) {
+            maxEvents = loadgen.devices[i].maxEvents;
+        }
+        totalWeight += loadgen.devices[i].weight;
+        counts[i] = 0;
+    }
+    loadgen.payload = (uint8_t*)malloc(sizeof(message_report_header_t) + maxReportSize);
+    loadgen.events  = (struct input_event*)malloc(maxEvents * sizeof(struct input_event));
+    loadgen.clients = (loadgen_client_t*)(calloc(loadgen.clientCount, sizeof(loadgen_client_t)));
+    js_config_t scratch;    // Clients share their device's description, not their generator's copy
+    for (int i = 0; i < loadgen.clientCount; i++) {
+        loadgen_client_t* client = &loadgen.clients[i];
+        int               slot   = i % totalWeight;
+        int               kind   = 0;
+        while (slot >= loadgen.devices[kind].weight) {
+            slot -= loadgen.devices[kind].weight;
+            kind++;
+        }
+        counts[kind]++;
+        client->fd         = -1;
+        client->device     = &loadgen.devices[kind];
+        client->generator  = input_generator_create(client->device->spec, &scratch);
+        client->report     = (uint8_t*)(calloc(1, client->device->reportSize));
+        client->slipDecode = slip_decode_message_create(256);
+        client->seed       = (uint32_t)i * 2654435761U;
+    }
+
+    loadgen.ePollFd = epoll_create1(EPOLL_CLOEXEC);
+    int               tickFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct itimerspec spec   = {};
+    spec.it_interval         = timestamp_to_timespec(LOADGEN_TICK_US * NSEC_PER_USEC);
+    spec.it_value            = spec.it_interval;
+    timerfd_settime(tickFd, 0, &spec, NULL);
+    struct epoll_event ev = {};
+    ev.events             = EPOLLIN;
+    ev.data.u32           = LOADGEN_TICK_KEY;
+    epoll_ctl(loadgen.ePollFd, EPOLL_CTL_ADD, tickFd, &ev);
+
+    printf("loadgen: %d clients (%d gamepads, %d keyboards, %d mice), %d reports/s each in bursts of %d, churn: ",
+           loadgen.clientCount,
+           counts[LoadgenDeviceGamepad],
+           counts[LoadgenDeviceKeyboard],
+           counts[LoadgenDeviceMouse],
+           loadgen.rateHz,
+           loadgen.burst);
+    if (loadgen.churnMs > 0) {
+        printf("every ~%dms\n", loadgen.churnMs);
+    } else {
+        printf("none\n");
+    }
+
+    // Connect everyone, then measure
+    uint64_t start = timestamp_now_ns();
+    loadgen_run(&loadgen, tickFd, start + (LOADGEN_CONNECT_TIMEOUT_S * NSEC_PER_SEC), loadgen_all_connected);
+    uint64_t measureStart = timestamp_now_ns();
+    int      connected    = loadgen_connected(&loadgen);
+    printf("loadgen: %d/%d clients connected in %.3fs (%llu connect errors)\n",
+           connected,
+           loadgen.clientCount,
+           (double)(measureStart - start) / NSEC_PER_SEC,
+           (unsigned long long)loadgen.connectErrors);
+
+    double serverUser  = 0.0;
+    double serverSys   = 0.0;
+    bool   serverCpu   = (loadgen.serverPid > 0) && loadgen_process_cpu(loadgen.serverPid, &serverUser, &serverSys);
+    double selfCpu     = loadgen_self_cpu();
+    loadgen_reset_counters(&loadgen);
+
+    loadgen_run(&loadgen, tickFd, measureStart + ((uint64_t)loadgen.durationS * NSEC_PER_SEC), NULL);
+    double elapsed = (double)(timestamp_now_ns() - measureStart) / NSEC_PER_SEC;
+
+    double serverUserEnd = 0.0;
+    double serverSysEnd  = 0.0;
+    serverCpu = serverCpu && loadgen_process_cpu(loadgen.serverPid, &serverUserEnd, &serverSysEnd);
+    selfCpu   = loadgen_self_cpu() - selfCpu;
+
+    printf("loadgen: %llu reports in %.2fs = %.0f reports/s (target %.0f), %llu skipped, %llu pongs\n",
+           (unsigned long long)loadgen.reportsSent,
+           elapsed,
+           loadgen.reportsSent / elapsed,
+           (double)loadgen.clientCount * loadgen.rateHz,
+           (unsigned long long)loadgen.reportsSkipped,
+           (unsigned long long)loadgen.pongs);
+    printf("loadgen: connections during the run: %llu made, %llu churned, %llu dropped by the server, %llu failed\n",
+           (unsigned long long)loadgen.connects,
+           (unsigned long long)loadgen.churns,
+           (unsigned long long)loadgen.drops,
+           (unsigned long long)loadgen.connectErrors);
+    printf("loadgen: send lag p50=%.1fus p99=%.1fus max=%.1fus, cpu %.1f%%\n",
+           histogram_percentile(&loadgen.lag, 50.0) / 1e3,
+           histogram_percentile(&loadgen.lag, 99.0) / 1e3,
+           loadgen.lag.max / 1e3,
+           (selfCpu * 100.0) / elapsed);
+    if (serverCpu) {
+        printf("server: pid %d cpu %.1f%% (user %.1f%%, system %.1f%%)\n",
+               loadgen.serverPid,
+               ((serverUserEnd - serverUser + serverSysEnd - serverSys) * 100.0) / elapsed,
+               ((serverUserEnd - serverUser) * 100.0) / elapsed,
+               ((serverSysEnd - serverSys) * 100.0) / elapsed);
+    }
+
+    // The server forgets a client's statistics when it disconnects, so read them first
+    if (loadgen.statsPath) {
+        stats = loadgen_fetch_stats(loadgen.statsPath, NULL);
+        if (stats) {
+            loadgen_report_server_stats(stats);
+            free(stats);
+        }
+    }
+
+    for (int i = 0; i < loadgen.clientCount; i++) {
+        loadgen_client_close(&loadgen.clients[i], 0);
+        slip_decode_message_destroy(loadgen.clients[i].slipDecode);
+        input_generator_destroy(loadgen.clients[i].generator);
+        free(loadgen.clients[i].report);
+    }
+    for (int i = 0; i < LoadgenDevices; i++) { free(loadgen.devices[i].configFrame); }
+    free(loadgen.clients);
+    free(loadgen.payload);
+    free(loadgen.events);
+    close(tickFd);
+    close(loadgen.ePollFd);
+    return 0;
+}
@@ -0,0 +1,205 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#include "log.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "timestamp.h"
+
+//---------------------------------------------------------------------------
+// A message waiting to be printed.  The sequence number tells producers and the
+// consumer whose turn it is: a slot at ring position n is free for the producer
+// claiming position n while sequence == n, and holds a finished message while
+// sequence == n + 1.
+typedef struct {
+    uint32_t sequence;
+    char     text[LOG_MESSAGE_SIZE];
+} log_entry_t;
+
+//---------------------------------------------------------------------------
+log_level_t logLevel = LogLevelInfo;
+
+//---------------------------------------------------------------------------
+static log_entry_t     logRing[LOG_RING_DEPTH];
+static uint32_t        logTail;         //!< Next position to be claimed by a producer
+static uint32_t        logHead;         //!< Next position to be printed (consumer only)
+static uint32_t        logDropped;      //!< Messages lost because the ring was full
+static bool            logStarted;      //!< Whether messages go through the ring
+static pthread_mutex_t logConsumer = PTHREAD_MUTEX_INITIALIZER;
+
+//---------------------------------------------------------------------------
+static const char* logLevelNames[LogLevels] = { "error", "warning", "info", "debug" };
+
+//---------------------------------------------------------------------------
+// Allow up to LOG_RATE_BURST messages per interval from each call site.  Sites
+// are normally only hit from a single thread; a race here can only let an
+// extra message through or miscount the suppressed ones.
+static bool log_site_allow(log_site_t* site_)
+{
+    uint64_t now = timestamp_now_ns();
+    if ((now - site_->windowStartNs) >= (LOG_RATE_INTERVAL_MS * NSEC_PER_MSEC)) {
+        site_->windowStartNs = now;
+        site_->count         = 0;
+    }
+    if (site_->count >= LOG_RATE_BURST) {
+        site_->suppressed++;
+        return false;
+    }
+    site_->count++;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Format a message, plus a note of how many were suppressed before it
+static void log_format(char* text_, log_site_t* site_, const char* format_, va_list args_)
+{
+    int len = vsnprintf(text_, LOG_MESSAGE_SIZE, format_, args_);
+    if (len < 0) {
+        len = 0;
+    } else if (len >= LOG_MESSAGE_SIZE) {
+        len = LOG_MESSAGE_SIZE - 1;
+    }
+    if (site_->suppressed > 0) {
+        snprintf(text_ + len, LOG_MESSAGE_SIZE - len, " (%u similar suppressed)", site_->suppressed);
+        site_->suppressed = 0;
+    }
+}
+
+//---------------------------------------------------------------------------
+void log_write(log_site_t* site_, const char* format_, ...)
+{
+    if (!log_site_allow(site_)) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format_);
+    if (!__atomic_load_n(&logStarted, __ATOMIC_ACQUIRE)) {
+        char text[LOG_MESSAGE_SIZE];
+        log_format(text, site_, format_, args);
+        va_end(args);
+        puts(text);
+        return;
+    }
+
+    // Claim a slot (bounded multi-producer queue); never wait for the consumer
+    log_entry_t* entry;
+    uint32_t     pos = __atomic_load_n(&logTail, __ATOMIC_RELAXED);
+    while (1) {
+        entry        = &logRing[pos % LOG_RING_DEPTH];
+        int32_t diff = (int32_t)(__atomic_load_n(&entry->sequence, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&logTail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            __atomic_fetch_add(&logDropped, 1, __ATOMIC_RELAXED);
+            va_end(args);
+            return;
+        } else {
+            pos = __atomic_load_n(&logTail, __ATOMIC_RELAXED);
+        }
+    }
+
+    log_format(entry->text, site_, format_, args);
+    va_end(args);
+    __atomic_store_n(&entry->sequence, pos + 1, __ATOMIC_RELEASE);
+}
+
+//---------------------------------------------------------------------------
+// Print everything queued; return the number of messages printed
+static int log_drain(void)
+{
+    int printed = 0;
+    pthread_mutex_lock(&logConsumer);
+    while (1) {
+        log_entry_t* entry = &logRing[logHead % LOG_RING_DEPTH];
+        if (__atomic_load_n(&entry->sequence, __ATOMIC_ACQUIRE) != (logHead + 1)) {
+            break;
+        }
+        puts(entry->text);
+        __atomic_store_n(&entry->sequence, logHead + LOG_RING_DEPTH, __ATOMIC_RELEASE);
+        logHead++;
+        printed++;
+    }
+
+    uint32_t dropped = __atomic_exchange_n(&logDropped, 0, __ATOMIC_RELAXED);
+    if (dropped > 0) {
+        printf("log: %u messages dropped\n", dropped);
+        printed++;
+    }
+    if (printed > 0) {
+        fflush(stdout);
+    }
+    pthread_mutex_unlock(&logConsumer);
+    return printed;
+}
+
+//---------------------------------------------------------------------------
+void log_flush(void)
+{
+    log_drain();
+}
+
+//---------------------------------------------------------------------------
+static void* log_thread(void* arg_)
+{
+    struct timespec interval = { 0, LOG_FLUSH_INTERVAL_MS * NSEC_PER_MSEC };
+    while (1) {
+        if (log_drain() == 0) {
+            nanosleep(&interval, NULL);
+        }
+    }
+    return NULL;
+}
+
+//---------------------------------------------------------------------------
+bool log_start(void)
+{
+    if (logStarted) {
+        return true;
+    }
+    for (uint32_t i = 0; i < LOG_RING_DEPTH; i++) { logRing[i].sequence = i; }
+
+    // Printing must never compete with input, even in real-time mode
+    pthread_t          thread;
+    pthread_attr_t     attr;
+    struct sched_param param = {};
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    pthread_attr_setschedparam(&attr, &param);
+    int rc = pthread_create(&thread, &attr, log_thread, NULL);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        printf("log: error starting thread: %d (%s)\n", rc, strerror(rc));
+        return false;
+    }
+    pthread_detach(thread);
+
+    atexit(log_flush);
+    __atomic_store_n(&logStarted, true, __ATOMIC_RELEASE);
+    return true;
+}
+
+//---------------------------------------------------------------------------
+bool log_level_from_string(const char* name_, log_level_t* level_)
+{
+    for (int i = 0; i < LogLevels; i++) {
+        if (strcmp(name_, logLevelNames[i]) == 0) {
+            *level_ = (log_level_t)i;
+            return true;
+        }
+    }
+    return false;
+}
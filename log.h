@@ -0,0 +1,94 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+#define LOG_RING_DEPTH (256)        //!< Number of messages that can be waiting to be printed
+#define LOG_MESSAGE_SIZE (192)      //!< Maximum length of a message, including the terminator
+#define LOG_RATE_BURST (10)         //!< Messages a single call site may log per interval
+#define LOG_RATE_INTERVAL_MS (1000) //!< Interval over which messages from a call site are counted
+#define LOG_FLUSH_INTERVAL_MS (20)  //!< How often the background thread checks for messages
+
+//---------------------------------------------------------------------------
+typedef enum {
+    LogLevelError = 0,  //!< Something failed
+    LogLevelWarning,    //!< Something unexpected, but handled
+    LogLevelInfo,       //!< Normal events (connections, device setup)
+    LogLevelDebug,      //!< Detailed diagnostics
+    LogLevels
+} log_level_t;
+
+//---------------------------------------------------------------------------
+// Rate limiting state for a single call site (see LOG())
+typedef struct {
+    uint64_t windowStartNs; //!< Start of the current counting interval
+    uint32_t count;         //!< Messages logged in the current interval
+    uint32_t suppressed;    //!< Messages dropped since the last one that was logged
+} log_site_t;
+
+//---------------------------------------------------------------------------
+// Most verbose level that is printed (default: LogLevelInfo)
+extern log_level_t logLevel;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief log_start move printing off the calling threads: from here on,
+ * messages are queued in a lock-free ring and printed by a (non-realtime)
+ * background thread.  Until this is called, messages are printed directly.
+ * Anything still queued at exit is printed by an atexit handler.
+ * @return true on success, false if the thread couldn't be started
+ */
+bool log_start(void);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief log_flush print every queued message
+ */
+void log_flush(void);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief log_write log a message, unless its call site has used up its rate
+ * limit.  Use the LOG() macros rather than calling this directly.
+ * @param site_ rate limiting state of the call site
+ * @param format_ printf-style format string (a newline is added)
+ */
+void log_write(log_site_t* site_, const char* format_, ...) __attribute__((format(printf, 2, 3)));
+
+//---------------------------------------------------------------------------
+/**
+ * @brief log_level_from_string convert a level name to its value
+ * @param name_ level name (error, warning, info, debug)
+ * @param level_ [out] level
+ * @return true if the name is valid
+ */
+bool log_level_from_string(const char* name_, log_level_t* level_);
+
+//---------------------------------------------------------------------------
+// Log a message at the given level.  Each use of the macro gets its own rate
+// limit, so a call site that fires on every event can't flood the output, and
+// messages below the current level cost a single comparison.
+#define LOG(level_, ...)                                                                                         \
+    do {                                                                                                         \
+        static log_site_t logSite;                                                                               \
+        if ((level_) <= logLevel) {                                                                              \
+            log_write(&logSite, __VA_ARGS__);                                                                    \
+        }                                                                                                        \
+    } while (0)
+
+#define LOG_ERROR(...) LOG(LogLevelError, __VA_ARGS__)
+#define LOG_WARNING(...) LOG(LogLevelWarning, __VA_ARGS__)
+#define LOG_INFO(...) LOG(LogLevelInfo, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG(LogLevelDebug, __VA_ARGS__)
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
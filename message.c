@@ -0,0 +1,100 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#include "message.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "slip.h"
+#include "tlvc.h"
+
+//---------------------------------------------------------------------------
+size_t message_encoded_size_max(size_t dataLen_)
+{
+    return ((sizeof(tlvc_header_t) + dataLen_ + sizeof(tlvc_footer_t)) * 2) + 2;
+}
+
+//---------------------------------------------------------------------------
+size_t message_encode(uint8_t* buf_, size_t bufSize_, uint16_t tag_, const void* data_, size_t dataLen_)
+{
+    if (bufSize_ < 2) {
+        return 0;
+    }
+
+    tlvc_data_t tlvc = {};
+    tlvc_encode_data(&tlvc, tag_, dataLen_, (void*)data_);
+
+    // Encode directly into the caller's buffer rather than allocating a new
+    // slip_encode_message_t for every frame.
+    slip_encode_message_t encode = {};
+    encode.encoded               = buf_;
+    encode.encodedSize           = bufSize_;
+    slip_encode_begin(&encode);
+
+    uint8_t* raw = (uint8_t*)&tlvc.header;
+    for (size_t i = 0; i < sizeof(tlvc.header); i++) {
+        if (slip_encode_byte(&encode, *raw++) != SlipEncodeOk) {
+            return 0;
+        }
+    }
+
+    raw = (uint8_t*)tlvc.data;
+    for (size_t i = 0; i < tlvc.dataLen; i++) {
+        if (slip_encode_byte(&encode, *raw++) != SlipEncodeOk) {
+            return 0;
+        }
+    }
+
+    raw = (uint8_t*)&tlvc.footer;
+    for (size_t i = 0; i < sizeof(tlvc.footer); i++) {
+        if (slip_encode_byte(&encode, *raw++) != SlipEncodeOk) {
+            return 0;
+        }
+    }
+
+    if (slip_encode_finish(&encode) != SlipEncodeOk) {
+        return 0;
+    }
+
+    return encode.index;
+}
+
+//---------------------------------------------------------------------------
+bool message_transmit(int fd_, uint16_t tag_, const void* data_, size_t dataLen_)
+{
+    size_t   encodedSize = message_encoded_size_max(dataLen_);
+    uint8_t* encoded     = (uint8_t*)malloc(encodedSize);
+
+    int toWrite  = message_encode(encoded, encodedSize, tag_, data_, dataLen_);
+    int nWritten = 0;
+
+    uint8_t* raw = encoded;
+
+    bool died = false;
+    while (toWrite > 0) {
+        nWritten = write(fd_, raw, toWrite);
+        if ((nWritten == 0) || ((nWritten == -1) && !((errno == EINTR) || (errno == EAGAIN)))) {
+            died = true;
+            break;
+        }
+        if (nWritten < 0) {
+            continue;
+        }
+        toWrite -= nWritten;
+        raw += nWritten;
+    }
+
+    free(encoded);
+
+    if (died) {
+        printf("socket died during write\n");
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,92 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+// Tag values used for messages exchanged between netstick and netstickd
+typedef enum {
+    MessageTagConfig      = 0,  //!< Device configuration (js_config_t), sent once per connection
+    MessageTagReport      = 1,  //!< Device report, sent whenever the device state changes
+    MessageTagTimedReport = 2,  //!< message_report_header_t followed by a device report
+    MessageTagPing        = 3,  //!< message_ping_t, sent periodically by the server
+    MessageTagPong        = 4,  //!< message_pong_t, the client's reply to a ping
+    MessageTagDevice      = 5   //!< message_device_t, sent by the server once the virtual device exists
+} message_tag_t;
+
+//---------------------------------------------------------------------------
+// Header prepended to reports when the client is sending timestamps
+typedef struct __attribute__((packed)) {
+    uint32_t sequence;      //!< Incremented for every report the client generates
+    uint64_t timestampNs;   //!< Client CLOCK_MONOTONIC time of the input event that completed the report
+} message_report_header_t;
+
+//---------------------------------------------------------------------------
+// Clock probe sent by the server
+typedef struct __attribute__((packed)) {
+    uint32_t id;            //!< Identifies the ping
+    uint64_t serverTimeNs;  //!< Server CLOCK_MONOTONIC time at which the ping was sent
+} message_ping_t;
+
+//---------------------------------------------------------------------------
+// Client's reply to a ping
+typedef struct __attribute__((packed)) {
+    uint32_t id;            //!< Copied from the ping
+    uint64_t serverTimeNs;  //!< Copied from the ping
+    uint64_t clientTimeNs;  //!< Client CLOCK_MONOTONIC time at which the ping was answered
+} message_pong_t;
+
+//---------------------------------------------------------------------------
+#define MESSAGE_DEVICE_FORWARD_REPEATS (0x01)  //!< Send key repeats; the virtual device doesn't make its own
+
+//---------------------------------------------------------------------------
+// What the server's virtual device expects from the client
+typedef struct __attribute__((packed)) {
+    uint8_t flags;          //!< MESSAGE_DEVICE_* flags
+} message_device_t;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief message_encoded_size_max Return the worst-case size of a slip-encoded
+ * tlvc frame carrying a payload of the given size (i.e. every byte escaped).
+ * @param dataLen_ size of the payload in bytes
+ * @return size of the buffer required to hold the encoded frame
+ */
+size_t message_encoded_size_max(size_t dataLen_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief message_encode Wrap a payload in a tlvc message, and slip-encode the
+ * result into a caller-provided buffer, ready to be written to a socket.
+ * @param buf_ buffer that receives the encoded frame
+ * @param bufSize_ size of buf_ in bytes
+ * @param tag_ message tag
+ * @param data_ payload data to encode
+ * @param dataLen_ size of the payload in bytes
+ * @return size of the encoded frame in bytes, or 0 if buf_ was too small
+ */
+size_t message_encode(uint8_t* buf_, size_t bufSize_, uint16_t tag_, const void* data_, size_t dataLen_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief message_transmit Encode a message and write all of it to a file
+ * descriptor, retrying until it's out.  Used for the configuration message,
+ * before the connection switches to the non-blocking send queue.
+ * @param fd_ descriptor to write to
+ * @param tag_ message tag
+ * @param data_ payload data to encode
+ * @param dataLen_ size of the payload in bytes
+ * @return true on success, false if the descriptor died during the write
+ */
+bool message_transmit(int fd_, uint16_t tag_, const void* data_, size_t dataLen_);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
@@ -5,10 +5,13 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <limits.h>
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <getopt.h>
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -21,308 +24,878 @@
 #include "tlvc.h"
 #include "slip.h"
 #include "joystick.h"
+#include "capture.h"
+#include "log.h"
+#include "message.h"
+#include "probes.h"
+#include "realtime.h"
+#include "report_builder.h"
+#include "sendqueue.h"
+#include "source.h"
+#include "timestamp.h"
+#include "transport.h"
 
 //---------------------------------------------------------------------------
-typedef struct __attribute__((packed)) {
-    uint16_t bus;
-    uint16_t vid;
-    uint16_t pid;
-    uint16_t version;
-} input_dev_info_t;
+// map linux button/axis IDs to indexes in the config + report structures.
+typedef struct {
+    int16_t absAxis[ABS_CNT];
+    int16_t relAxis[REL_CNT];
+    int16_t buttons[KEY_CNT];
+} js_index_map_t;
 
 //---------------------------------------------------------------------------
-typedef struct __attribute__((packed)) {
-    int32_t value;
-    int32_t minimum;
-    int32_t maximum;
-    int32_t flat;
-    int32_t fuzz;
-} abs_axis_info_t;
+// Maximum number of messages that can be waiting on a slow link
+#define SEND_QUEUE_DEPTH (16)
 
 //---------------------------------------------------------------------------
-// map linux button/axis IDs to indexes in the config + report structures.
+// Longest time spent handing the server what's left when input ends
+#define CLIENT_LINGER_MS (1000)
+
+//---------------------------------------------------------------------------
+// Maximum number of servers a single device can be forwarded to
+#define CLIENT_MAX_SERVERS (8)
+
+//---------------------------------------------------------------------------
+// Address of a server, as given on the command line
 typedef struct {
-    int absAxis[KEY_MAX];
-    int relAxis[KEY_MAX];
-    int buttons[KEY_MAX];
-} js_index_map_t;
+    const char* addr;   //!< IPv4 address
+    uint16_t    port;   //!< TCP port
+} jsproxy_server_addr_t;
 
 //---------------------------------------------------------------------------
-static bool encode_and_transmit(int sockFd_, uint16_t messageType_, void* data_, size_t dataLen_)
-{
-    tlvc_data_t tlvc = {};
-    tlvc_encode_data(&tlvc, messageType_, dataLen_, data_);
+// Connection to one of the servers the device is forwarded to.  Each has its
+// own queue, so a server that can't keep up only merges (or, eventually, loses)
+// its own reports, while the others carry on at full rate.
+typedef struct {
+    const jsproxy_server_addr_t* server;        //!< where the connection goes
+    int                          sockFd;        //!< fd of the connection (-1 once dropped)
+    send_queue_t*                sendQueue;     //!< messages waiting on the socket
+    transport_sender_t           sender;        //!< policy used to drain the send queue onto the socket
+    slip_decode_message_t*       slipDecode;    //!< messages arriving from the server
+    bool                         wantsRepeats;  //!< whether the server asked for key repeats (message_device_t)
+} jsproxy_destination_t;
 
-    slip_encode_message_t* encode = slip_encode_message_create(dataLen_);
-    slip_encode_begin(encode);
+//---------------------------------------------------------------------------
+// State for a single device's connections to its servers
+typedef struct {
+    input_source_t*       source;                           //!< device being forwarded
+    jsproxy_destination_t destinations[CLIENT_MAX_SERVERS]; //!< connections to the servers
+    int                   destinationCount;                 //!< number of entries in destinations
+    int                   liveCount;                        //!< number of destinations still connected
+    js_config_t*          config;                           //!< configuration of the input device
+    js_index_map_t        indexMap;                         //!< map of event codes to report indexes
+    report_builder_t*     builder;                          //!< report being built from the device's events
+    bool                  inSync;                           //!< false while discarding events after SYN_DROPPED
+
+    bool              timestamps;   //!< send reports with a sequence number and event timestamp
+    uint32_t          sequence;     //!< sequence number of the next report
+    uint64_t          eventNs;      //!< time of the oldest input event not yet sent (0 == none)
+    uint8_t*          timedReport;  //!< scratch buffer holding a header + report
+    uint8_t*          frame;        //!< each report, encoded once for every destination
+    size_t            frameSize;    //!< size of frame
+    capture_writer_t* capture;      //!< record of the events read, or NULL
+    uint64_t          startNs;      //!< when startup began, until the first report is sent (0 == sent)
+} jsproxy_client_t;
 
-    uint8_t* raw = (uint8_t*)&tlvc.header;
-    for (size_t i = 0; i < sizeof(tlvc.header); i++) { slip_encode_byte(encode, *raw++); }
+//---------------------------------------------------------------------------
+// Command-line options for the client
+typedef struct {
+    transport_config_t      transport;  //!< socket policy
+    report_builder_config_t reports;    //!< report send policy
+    realtime_config_t       realtime;   //!< real-time scheduling/socket options
+    bool                    timestamps; //!< send timed reports for end-to-end latency measurement
+    const char*             capture;    //!< record the events read to <capture>.<connection> (NULL == don't)
+} jsproxy_client_options_t;
 
-    raw = (uint8_t*)tlvc.data;
-    for (size_t i = 0; i < tlvc.dataLen; i++) { slip_encode_byte(encode, *raw++); }
+//---------------------------------------------------------------------------
+static void js_index_map_init(js_index_map_t* indexMap_)
+{
+    memset(indexMap_, 0xFF, sizeof(*indexMap_));
+}
 
-    raw = (uint8_t*)&tlvc.footer;
-    for (size_t i = 0; i < sizeof(tlvc.footer); i++) { slip_encode_byte(encode, *raw++); }
+//---------------------------------------------------------------------------
+static void js_index_map_set(js_index_map_t* indexMap_, int eventType_, int eventId_, int index_)
+{
+    if ((eventType_ == EV_ABS) && (eventId_ < ABS_CNT)) {
+        indexMap_->absAxis[eventId_] = index_;
+    } else if ((eventType_ == EV_REL) && (eventId_ < REL_CNT)) {
+        indexMap_->relAxis[eventId_] = index_;
+    } else if ((eventType_ == EV_KEY) && (eventId_ < KEY_CNT)) {
+        indexMap_->buttons[eventId_] = index_;
+    }
+}
 
-    slip_encode_finish(encode);
+//---------------------------------------------------------------------------
+static int js_index_map_get_index(const js_index_map_t* indexMap_, int eventType_, int eventId_)
+{
+    if ((eventType_ == EV_ABS) && (eventId_ < ABS_CNT)) {
+        return indexMap_->absAxis[eventId_];
+    } else if ((eventType_ == EV_REL) && (eventId_ < REL_CNT)) {
+        return indexMap_->relAxis[eventId_];
+    } else if ((eventType_ == EV_KEY) && (eventId_ < KEY_CNT)) {
+        return indexMap_->buttons[eventId_];
+    }
+    return -1;
+}
 
-    int toWrite  = encode->index;
-    int nWritten = 0;
-    raw          = encode->encoded;
+//---------------------------------------------------------------------------
+static void js_index_map_from_config(js_index_map_t* indexMap_, const js_config_t* config_)
+{
+    js_index_map_init(indexMap_);
+    for (int i = 0; i < config_->absAxisCount; i++) { js_index_map_set(indexMap_, EV_ABS, config_->absAxis[i], i); }
+    for (int i = 0; i < config_->relAxisCount; i++) { js_index_map_set(indexMap_, EV_REL, config_->relAxis[i], i); }
+    for (int i = 0; i < config_->buttonCount; i++) { js_index_map_set(indexMap_, EV_KEY, config_->buttons[i], i); }
+}
 
-    bool died = false;
-    while (toWrite > 0) {
-        nWritten = write(sockFd_, raw, toWrite);
-        if ((nWritten == 0) || ((nWritten == -1) && !((errno == EINTR) || (errno == EAGAIN)))) {
-            died = true;
-            break;
-        }
-        toWrite -= nWritten;
-        raw += nWritten;
+//---------------------------------------------------------------------------
+// Re-read the complete device state after the kernel dropped events on us
+static void jsproxy_client_resync(jsproxy_client_t* client_)
+{
+    js_config_t* config = client_->config;
+
+    uint8_t buttons[KEY_CNT];
+    int32_t absValues[ABS_CNT];
+    if (!input_source_get_state(client_->source, buttons, absValues)) {
+        return;
     }
+    for (int i = 0; i < config->buttonCount; i++) { report_builder_set_button(client_->builder, i, buttons[i]); }
+    for (int i = 0; i < config->absAxisCount; i++) { report_builder_set_abs(client_->builder, i, absValues[i]); }
+}
 
-    slip_encode_message_destroy(encode);
+//---------------------------------------------------------------------------
+// Merge function for timed reports.  The report itself is merged as usual; the
+// merged message carries the newer sequence number (the older one is reported
+// as a gap) but keeps the older timestamp, so that latency is measured from the
+// first input event it carries.
+static bool jsproxy_client_merge_timed(void* pending_, const void* newest_, size_t dataLen_, void* arg_)
+{
+    jsproxy_client_t* client  = (jsproxy_client_t*)arg_;
+    uint8_t*          pending = (uint8_t*)pending_;
+    const uint8_t*    newest  = (const uint8_t*)newest_;
+    size_t            header  = sizeof(message_report_header_t);
 
-    if (died) {
-        printf("socket died during write\n");
+    if (!report_builder_merge(pending + header, newest + header, dataLen_ - header, client->builder)) {
         return false;
     }
-
+    memcpy(pending + offsetof(message_report_header_t, sequence),
+           newest + offsetof(message_report_header_t, sequence),
+           sizeof(uint32_t));
     return true;
 }
 
 //---------------------------------------------------------------------------
-static void js_index_map_init(js_index_map_t* indexMap_)
+// Give up on a server; the remaining ones are unaffected.
+static void jsproxy_client_drop(jsproxy_client_t* client_, jsproxy_destination_t* destination_, const char* why_)
 {
-    for (int i = 0; i < KEY_MAX; i++) {
-        indexMap_->absAxis[i] = -1;
-        indexMap_->relAxis[i] = -1;
-        indexMap_->buttons[i] = -1;
-    }
+    printf("%s:%u: %s\n", destination_->server->addr, destination_->server->port, why_);
+    close(destination_->sockFd);
+    destination_->sockFd = -1;
+    client_->liveCount--;
 }
 
 //---------------------------------------------------------------------------
-static void js_index_map_set(js_index_map_t* indexMap_, int eventType_, int eventId_, int index_)
+// Check the result of queueing a message on a destination, dropping it if it failed
+static void
+jsproxy_client_check_send(jsproxy_client_t* client_, jsproxy_destination_t* destination_, send_queue_return_t rc_)
 {
-    if (eventType_ == EV_ABS) {
-        indexMap_->absAxis[eventId_] = index_;
-    } else if (eventType_ == EV_REL) {
-        indexMap_->relAxis[eventId_] = index_;
-    } else if (eventType_ == EV_KEY) {
-        indexMap_->buttons[eventId_] = index_;
+    if (rc_ == SendQueueErrorSocket) {
+        jsproxy_client_drop(client_, destination_, "socket died during write");
+    } else if ((rc_ != SendQueueOk) && (rc_ != SendQueueWouldBlock)) {
+        jsproxy_client_drop(client_, destination_, "send queue overflow - link stalled");
     }
 }
 
 //---------------------------------------------------------------------------
-static int js_index_map_get_index(js_index_map_t* indexMap_, int eventType_, int eventId_)
+// Encode the current report once, and queue the frame on every live connection
+static bool jsproxy_client_send_report(jsproxy_client_t* client_, uint64_t now_)
 {
-    if (eventType_ == EV_ABS) {
-        return indexMap_->absAxis[eventId_];
-    } else if (eventType_ == EV_REL) {
-        return indexMap_->relAxis[eventId_];
-    } else if (eventType_ == EV_KEY) {
-        return indexMap_->buttons[eventId_];
+    report_builder_t*       builder = client_->builder;
+    message_report_header_t header  = {};
+    uint16_t                tag     = MessageTagReport;
+    const uint8_t*          data    = builder->rawReport;
+    size_t                  dataLen = builder->rawReportSize;
+    if (client_->timestamps) {
+        header.sequence    = client_->sequence++;
+        header.timestampNs = client_->eventNs ? client_->eventNs : now_;
+        memcpy(client_->timedReport, &header, sizeof(header));
+        memcpy(client_->timedReport + sizeof(header), builder->rawReport, builder->rawReportSize);
+        tag  = MessageTagTimedReport;
+        data = client_->timedReport;
+        dataLen += sizeof(header);
     }
-    return -1;
+
+    size_t frameLen = message_encode(client_->frame, client_->frameSize, tag, data, dataLen);
+    for (int i = 0; i < client_->destinationCount; i++) {
+        jsproxy_destination_t* destination = &client_->destinations[i];
+        if (destination->sockFd < 0) {
+            continue;
+        }
+        send_queue_return_t rc = transport_sender_send_encoded(
+            &destination->sender, tag, data, dataLen, client_->frame, frameLen, true, now_);
+        NETSTICK_PROBE5(report_sent, destination->sockFd, tag, dataLen, header.sequence, header.timestampNs);
+        jsproxy_client_check_send(client_, destination, rc);
+    }
+
+    client_->eventNs = 0;
+    report_builder_sent(builder, now_);
+    if (client_->startNs) {
+        LOG_INFO("first report sent %.1f ms after startup", (now_ - client_->startNs) / (double)NSEC_PER_MSEC);
+        client_->startNs = 0;
+    }
+    return (client_->liveCount > 0);
 }
 
 //---------------------------------------------------------------------------
-static inline int byte_offset(int bitIndex_)
+// Whether any connected server asked for key repeats.  Those that didn't make
+// their own, and ignore any they're sent.
+static bool jsproxy_client_forward_repeats(const jsproxy_client_t* client_)
 {
-    return bitIndex_ / 8;
+    for (int i = 0; i < client_->destinationCount; i++) {
+        const jsproxy_destination_t* destination = &client_->destinations[i];
+        if ((destination->sockFd >= 0) && destination->wantsRepeats) {
+            return true;
+        }
+    }
+    return false;
 }
 
 //---------------------------------------------------------------------------
-static inline int bit_offset(int bitIndex_)
+// Drain all pending events from the (non-blocking) input device, updating the
+// report and sending it whenever the device signals a complete update.
+static bool jsproxy_client_read_input(jsproxy_client_t* client_)
 {
-    return bitIndex_ % 8;
+    while (1) {
+        struct input_event events[128];
+        int                numEvents = input_source_read(client_->source, events, 128);
+        if (numEvents == 0) {
+            return true;
+        }
+        if (numEvents < 0) {
+            printf("input device died\n");
+            return false;
+        }
+        NETSTICK_PROBE2(evdev_read, client_->source->fd, numEvents);
+        if (client_->capture) {
+            for (int i = 0; i < numEvents; i++) { capture_write_event(client_->capture, &events[i]); }
+        }
+        for (int i = 0; i < numEvents; i++) {
+            if (events[i].type == EV_SYN) {
+                if (events[i].code == SYN_DROPPED) {
+                    // Events were lost in the kernel's buffer.  Ignore everything
+                    // up to the next SYN_REPORT, then query the device for its state.
+                    client_->inSync = false;
+                    continue;
+                }
+                if (events[i].code != SYN_REPORT) {
+                    continue;
+                }
+                if (!client_->inSync) {
+                    jsproxy_client_resync(client_);
+                    client_->inSync = true;
+                }
+                if (client_->eventNs == 0) {
+                    client_->eventNs = ((uint64_t)events[i].input_event_sec * NSEC_PER_SEC)
+                                       + ((uint64_t)events[i].input_event_usec * NSEC_PER_USEC);
+                }
+                // Whenever we get a sync event, flush the current report (unless
+                // the builder decides to hold on to it a little longer)
+                uint64_t now = timestamp_now_ns();
+                if (report_builder_sync(client_->builder, now)) {
+                    if (!jsproxy_client_send_report(client_, now)) {
+                        return false;
+                    }
+                } else if (!client_->builder->pending) {
+                    // Dropped as a duplicate; the next report starts a new measurement
+                    client_->eventNs = 0;
+                }
+                continue;
+            }
+
+            if (!client_->inSync) {
+                continue;
+            }
+
+            if (events[i].type == EV_KEY) {
+                int index = js_index_map_get_index(&client_->indexMap, events[i].type, events[i].code);
+                if (index < 0) {
+                    LOG_WARNING("invalid key index %d", events[i].code);
+                    continue;
+                }
+                // Autorepeat is normally generated by the server's virtual device, so
+                // holding a key doesn't cost any network traffic; repeats are only sent
+                // to servers that asked for them.
+                if (events[i].value == 2) {
+                    if (jsproxy_client_forward_repeats(client_)) {
+                        report_builder_repeat_button(client_->builder, index);
+                    }
+                    continue;
+                }
+                report_builder_set_button(client_->builder, index, events[i].value);
+            } else if (events[i].type == EV_ABS) {
+                int index = js_index_map_get_index(&client_->indexMap, events[i].type, events[i].code);
+                if (index < 0) {
+                    LOG_WARNING("invalid absAxis index %d", events[i].code);
+                    continue;
+                }
+                report_builder_set_abs(client_->builder, index, events[i].value);
+            } else if (events[i].type == EV_REL) {
+                int index = js_index_map_get_index(&client_->indexMap, events[i].type, events[i].code);
+                if (index < 0) {
+                    LOG_WARNING("invalid relAxis index %d", events[i].code);
+                    continue;
+                }
+                report_builder_add_rel(client_->builder, index, events[i].value);
+            }
+        }
+    }
 }
 
 //---------------------------------------------------------------------------
-static inline bool is_bit_set(uint8_t* array_, int bitIndex_)
+static bool jsproxy_client_handle_message(jsproxy_destination_t* destination_,
+                                          uint16_t               tag_,
+                                          const void*            data_,
+                                          size_t                 dataLen_)
 {
-    if (array_[byte_offset(bitIndex_)] & (1 << bit_offset(bitIndex_))) {
+    if ((tag_ == MessageTagDevice) && (dataLen_ == sizeof(message_device_t))) {
+        message_device_t device;
+        memcpy(&device, data_, sizeof(device));
+        destination_->wantsRepeats = ((device.flags & MESSAGE_DEVICE_FORWARD_REPEATS) != 0);
+        LOG_DEBUG("%s:%u: key repeats %s",
+                  destination_->server->addr,
+                  destination_->server->port,
+                  destination_->wantsRepeats ? "forwarded" : "generated by the server");
         return true;
     }
-    return false;
+    if ((tag_ != MessageTagPing) || (dataLen_ != sizeof(message_ping_t))) {
+        return true;
+    }
+
+    // Answer clock probes right away, ahead of anything we generate ourselves
+    message_ping_t ping;
+    memcpy(&ping, data_, sizeof(ping));
+
+    message_pong_t pong = {};
+    pong.id             = ping.id;
+    pong.serverTimeNs   = ping.serverTimeNs;
+    pong.clientTimeNs   = timestamp_now_ns();
+
+    send_queue_return_t rc
+        = transport_sender_send(&destination_->sender, MessageTagPong, &pong, sizeof(pong), false, pong.clientTimeNs);
+    return (rc != SendQueueErrorSocket);
 }
 
 //---------------------------------------------------------------------------
-static void jsproxy_client_uinput(const char* ioPath_, const char* serverAddr_, uint16_t serverPort_)
+// Handle messages from a server (pings), and notice when its connection closes.
+static bool jsproxy_client_read_socket(jsproxy_destination_t* destination_)
 {
-    // Open the input device requested by the user
-    int fd = open(ioPath_, O_RDONLY);
-    if (fd < 0) {
-        printf("Unable to open device %s for input\n", ioPath_);
-        return;
+    slip_decode_message_t* slipDecode = destination_->slipDecode;
+    while (1) {
+        uint8_t buf[256];
+        int     nRead = read(destination_->sockFd, buf, sizeof(buf));
+        if (nRead > 0) {
+            transport_on_read(destination_->sockFd, &destination_->sender.config);
+            for (int i = 0; i < nRead; i++) {
+                slip_decode_return_t rc = slip_decode_byte(slipDecode, buf[i]);
+                if (rc == SlipDecodeEndOfFrame) {
+                    tlvc_data_t tlvc;
+                    if (tlvc_decode_data(&tlvc, slipDecode->raw, slipDecode->index)
+                        && !jsproxy_client_handle_message(destination_, tlvc.header.tag, tlvc.data, tlvc.dataLen)) {
+                        return false;
+                    }
+                    slip_decode_begin(slipDecode);
+                } else if (rc != SlipDecodeOk) {
+                    slip_decode_begin(slipDecode);
+                }
+            }
+            continue;
+        }
+        if ((nRead < 0) && (errno == EINTR)) {
+            continue;
+        }
+        if ((nRead < 0) && (errno == EAGAIN)) {
+            return true;
+        }
+        return false;
     }
+}
 
-    // Create objects used to store the input device's configuration that we report
-    // to the server, enabling it to recreate a "virtual" version of it.
-    js_index_map_t* indexMap = (js_index_map_t*)malloc(sizeof(js_index_map_t));
-    js_index_map_init(indexMap);
+//---------------------------------------------------------------------------
+// Write out whatever each live connection has queued and is allowed to send now
+static void jsproxy_client_service(jsproxy_client_t* client_, uint64_t now_)
+{
+    for (int i = 0; i < client_->destinationCount; i++) {
+        jsproxy_destination_t* destination = &client_->destinations[i];
+        if ((destination->sockFd >= 0)
+            && (transport_sender_service(&destination->sender, now_) == SendQueueErrorSocket)) {
+            jsproxy_client_drop(client_, destination, "socket died during write");
+        }
+    }
+}
 
-    js_config_t config = {};
+//---------------------------------------------------------------------------
+// Wait for activity on the input device and the server connections.  Only ask
+// for socket writability while there's data ready to go out, and wake up when
+// a batching window closes or a deferred report comes due.  Runs for as long
+// as the input lasts and at least one server is still connected.
+static void jsproxy_client_run(jsproxy_client_t* client_)
+{
+    while (client_->liveCount > 0) {
+        struct pollfd          fds[1 + CLIENT_MAX_SERVERS] = {};
+        jsproxy_destination_t* polled[1 + CLIENT_MAX_SERVERS];
+        int                    nfds = 1;
+        fds[0].fd                   = client_->source->fd;
+        fds[0].events               = POLLIN;
+
+        uint64_t now       = timestamp_now_ns();
+        int64_t  timeoutNs = report_builder_timeout(client_->builder, now);
+        for (int i = 0; i < client_->destinationCount; i++) {
+            jsproxy_destination_t* destination = &client_->destinations[i];
+            if (destination->sockFd < 0) {
+                continue;
+            }
+            polled[nfds]     = destination;
+            fds[nfds].fd     = destination->sockFd;
+            fds[nfds].events = POLLIN;
+            if (transport_sender_wants_write(&destination->sender)) {
+                fds[nfds].events |= POLLOUT;
+            }
+            nfds++;
 
-    // Get the basic information for the device at the path specified (USB vid/pid, etc.)
-    input_dev_info_t info = {};
-    ioctl(fd, EVIOCGID, &info);
-    config.pid = info.pid;
-    config.vid = info.vid;
+            int64_t senderNs = transport_sender_timeout(&destination->sender, now);
+            if ((senderNs >= 0) && ((timeoutNs < 0) || (senderNs < timeoutNs))) {
+                timeoutNs = senderNs;
+            }
+        }
+
+        struct timespec  timeout;
+        struct timespec* timeoutPtr = NULL;
+        if (timeoutNs >= 0) {
+            timeout    = timestamp_to_timespec(timeoutNs);
+            timeoutPtr = &timeout;
+        }
 
-    // Get the device's name
-    char devName[256];
-    ioctl(fd, EVIOCGNAME(sizeof(devName)), devName);
+        int rc = ppoll(fds, nfds, timeoutPtr, NULL);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("error on poll() = %d (%s)\n", errno, strerror(errno));
+            return;
+        }
 
-    // Query the device for its supported event types
-    uint8_t bit[EV_MAX][(KEY_MAX + 7) / 8] = {};
-    ioctl(fd, EVIOCGBIT(0, EV_MAX), bit[0]);
-    strncpy(config.name, devName, sizeof(config.name));
+        if (rc == 0) {
+            now = timestamp_now_ns();
+            if (report_builder_expire(client_->builder, now) && !jsproxy_client_send_report(client_, now)) {
+                return;
+            }
+            jsproxy_client_service(client_, now);
+            continue;
+        }
 
-    // Go through all the different r
-    for (int i = 0; i < EV_MAX; i++) {
-        if (is_bit_set(bit[0], i)) {
-            if (i == EV_SYN) {
+        for (int i = 1; i < nfds; i++) {
+            jsproxy_destination_t* destination = polled[i];
+            if (fds[i].revents & (POLLERR | POLLHUP)) {
+                jsproxy_client_drop(client_, destination, "client socket died");
+                continue;
+            }
+            if ((fds[i].revents & POLLIN) && !jsproxy_client_read_socket(destination)) {
+                jsproxy_client_drop(client_, destination, "client socket died");
                 continue;
             }
+            if ((fds[i].revents & POLLOUT)
+                && (transport_sender_service(&destination->sender, timestamp_now_ns()) == SendQueueErrorSocket)) {
+                jsproxy_client_drop(client_, destination, "socket died during write");
+            }
+        }
 
-            ioctl(fd, EVIOCGBIT(i, KEY_MAX), bit[i]);
-
-            for (int j = 0; j < KEY_MAX; j++) {
-                if (is_bit_set(bit[i], j)) {
-                    if (i == EV_ABS) {
-                        abs_axis_info_t absAxis = {};
-                        ioctl(fd, EVIOCGABS(j), &absAxis);
-                        config.absAxisMin[config.absAxisCount]        = absAxis.minimum;
-                        config.absAxisMax[config.absAxisCount]        = absAxis.maximum;
-                        config.absAxisFuzz[config.absAxisCount]       = absAxis.fuzz;
-                        config.absAxisFlat[config.absAxisCount]       = absAxis.flat;
-                        config.absAxisResolution[config.absAxisCount] = 0;
-
-                        config.absAxis[config.absAxisCount] = j;
-
-                        js_index_map_set(indexMap, i, j, config.absAxisCount);
-                        config.absAxisCount++;
-                    } else if (i == EV_REL) {
-                        js_index_map_set(indexMap, i, j, config.relAxisCount);
-                        config.relAxis[config.relAxisCount++] = j;
-                    } else if (i == EV_KEY) {
-                        js_index_map_set(indexMap, i, j, config.buttonCount);
-                        config.buttons[config.buttonCount++] = j;
-                    }
+        if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            printf("input device died\n");
+            return;
+        }
+        if ((fds[0].revents & POLLIN) && !jsproxy_client_read_input(client_)) {
+            return;
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+// Hand each server whatever is still queued, then close our half of the
+// connection and wait for it to close its own.  Closing with pings still unread
+// resets the connection, which can take reports already sent down with it
+// (replayed input ends with a burst of them).  All connections share a single
+// deadline, so a stalled server doesn't hold up the others' shutdown.
+static void jsproxy_client_finish(jsproxy_client_t* client_)
+{
+    bool     shut[CLIENT_MAX_SERVERS] = {};
+    uint64_t deadline                 = timestamp_now_ns() + (CLIENT_LINGER_MS * NSEC_PER_MSEC);
+    while ((client_->liveCount > 0) && (timestamp_now_ns() < deadline)) {
+        struct pollfd fds[CLIENT_MAX_SERVERS] = {};
+        for (int i = 0; i < client_->destinationCount; i++) {
+            jsproxy_destination_t* destination = &client_->destinations[i];
+            fds[i].fd                          = destination->sockFd;
+            if (destination->sockFd < 0) {
+                continue;
+            }
+            if (!shut[i]) {
+                if (transport_sender_service(&destination->sender, timestamp_now_ns()) == SendQueueErrorSocket) {
+                    jsproxy_client_drop(client_, destination, "socket died during write");
+                    fds[i].fd = -1;
+                    continue;
+                }
+                if (send_queue_is_empty(destination->sendQueue)) {
+                    shutdown(destination->sockFd, SHUT_WR);
+                    shut[i] = true;
                 }
             }
+            fds[i].events = POLLIN | (shut[i] ? 0 : POLLOUT);
+        }
+
+        struct timespec timeout = timestamp_to_timespec(NSEC_PER_MSEC);
+        if ((ppoll(fds, client_->destinationCount, &timeout, NULL) < 0) && (errno != EINTR)) {
+            return;
+        }
+        for (int i = 0; i < client_->destinationCount; i++) {
+            jsproxy_destination_t* destination = &client_->destinations[i];
+            if ((fds[i].fd < 0) || !(fds[i].revents & (POLLIN | POLLERR | POLLHUP))) {
+                continue;
+            }
+            uint8_t buf[256];
+            int     nRead;
+            while ((nRead = read(destination->sockFd, buf, sizeof(buf))) > 0) {}
+            if ((nRead == 0) || (errno != EAGAIN)) {
+                close(destination->sockFd);
+                destination->sockFd = -1;
+                client_->liveCount--;
+            }
         }
     }
+}
 
+//---------------------------------------------------------------------------
+// Start recording the events read on this connection, beginning with the
+// device's current state
+static capture_writer_t* jsproxy_client_capture(const char* prefix_, input_source_t* source_)
+{
+    static unsigned int connection = 0;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s.%u", prefix_, connection++);
+    capture_writer_t* capture = capture_writer_create(path, CaptureKindEvents, &source_->config);
+    if (!capture) {
+        return NULL;
+    }
+    printf("capturing input events to %s\n", path);
+
+    uint8_t buttons[KEY_CNT];
+    int32_t absValues[ABS_CNT];
+    if (input_source_get_state(source_, buttons, absValues)) {
+        capture_write_state(capture, &source_->config, timestamp_now_ns(), buttons, absValues);
+    }
+    return capture;
+}
+
+//---------------------------------------------------------------------------
+// Connect to a server and send it the device's configuration.  Everything else
+// goes through a non-blocking socket and a bounded send queue, so a stalled
+// link never stops us from draining the input device.
+static int jsproxy_client_connect(const jsproxy_server_addr_t*    server_,
+                                  const js_config_t*              config_,
+                                  const jsproxy_client_options_t* options_)
+{
     // Create the client socket address
     int sockFd = socket(AF_INET, SOCK_STREAM, 0);
     if (sockFd < 0) {
         printf("error connecting socket: %d (%s)\n", errno, strerror(errno));
-        close(fd);
-        free(indexMap);
-        return;
+        return -1;
     }
+    realtime_apply_socket(sockFd, &options_->realtime);
 
     // Connect to the server
     struct sockaddr_in addr = {};
 
     addr.sin_family = AF_INET;
-    inet_pton(AF_INET, serverAddr_, &(addr.sin_addr));
-    addr.sin_port = htons(serverPort_);
+    inet_pton(AF_INET, server_->addr, &(addr.sin_addr));
+    addr.sin_port = htons(server_->port);
 
     int rc = connect(sockFd, (struct sockaddr*)&addr, sizeof(addr));
     if (rc < 0) {
-        printf("error connecting to server: %d (%s)\n", errno, strerror(errno));
+        printf("error connecting to server %s:%u: %d (%s)\n", server_->addr, server_->port, errno, strerror(errno));
         close(sockFd);
-        close(fd);
-        free(indexMap);
-        return;
+        return -1;
     }
 
     // Send the joystick configuration message to the server
-    if (!encode_and_transmit(sockFd, 0, &config, sizeof(config))) {
+    if (!message_transmit(sockFd, MessageTagConfig, config_, sizeof(*config_))) {
         close(sockFd);
-        close(fd);
-        free(indexMap);
-        return;
+        return -1;
     }
 
-    // Wait for input on the open file descriptor.  Update local report
-    // structure when new events come in, and send report to server when
-    // we get a SYN.
-    js_report_t report        = {};
-    size_t      rawReportSize = joystick_get_report_size(&config);
-    uint8_t*    rawReport     = (uint8_t*)calloc(1, rawReportSize);
+    transport_apply(sockFd, &options_->transport);
 
-    report.absAxis = (int32_t*)rawReport;
-    report.relAxis = (int32_t*)(rawReport + (sizeof(int32_t) * config.absAxisCount));
-    report.buttons
-        = (uint8_t*)(rawReport + (sizeof(int32_t) * config.absAxisCount) + (sizeof(int32_t) * config.relAxisCount));
-    while (1) {
-        // Blocking read on the HID device
-        struct input_event events[128];
-        int                nRead = read(fd, events, sizeof(events));
-        if ((nRead == 0) || ((nRead == -1) && !((errno == EAGAIN) || (errno == EINTR)))) {
-            printf("client socket died\n");
-            break;
+    int flags = fcntl(sockFd, F_GETFL);
+    fcntl(sockFd, F_SETFL, flags | O_NONBLOCK);
+    return sockFd;
+}
+
+//---------------------------------------------------------------------------
+// Allocate the report builder, and each destination's queue and decoder.  On
+// failure, whatever was allocated is left for the caller to free.
+static bool jsproxy_client_alloc(jsproxy_client_t* client_, const jsproxy_client_options_t* options_)
+{
+    client_->builder = report_builder_create(client_->config, &options_->reports);
+    if (!client_->builder) {
+        return false;
+    }
+
+    // The queues also carry replies to the servers' pings
+    size_t             maxDataLen = client_->builder->rawReportSize;
+    send_queue_merge_t merge      = report_builder_merge;
+    void*              mergeArg   = client_->builder;
+    if (client_->timestamps) {
+        maxDataLen += sizeof(message_report_header_t);
+        client_->timedReport = (uint8_t*)(calloc(1, maxDataLen));
+        if (!client_->timedReport) {
+            return false;
         }
+        merge    = jsproxy_client_merge_timed;
+        mergeArg = client_;
+    }
+    if (maxDataLen < sizeof(message_pong_t)) {
+        maxDataLen = sizeof(message_pong_t);
+    }
+    client_->frameSize = message_encoded_size_max(maxDataLen);
+    client_->frame     = (uint8_t*)(calloc(1, client_->frameSize));
+    if (!client_->frame) {
+        return false;
+    }
+    for (int i = 0; i < client_->destinationCount; i++) {
+        jsproxy_destination_t* destination = &client_->destinations[i];
+        destination->sendQueue             = send_queue_create(SEND_QUEUE_DEPTH, maxDataLen, merge, mergeArg);
+        destination->slipDecode            = slip_decode_message_create(256);
+        if (!destination->sendQueue || !destination->slipDecode) {
+            return false;
+        }
+        slip_decode_begin(destination->slipDecode);
+        transport_sender_init(&destination->sender, destination->sockFd, &options_->transport, destination->sendQueue);
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Forward a device to one or more servers.  The device is read, and each report
+// encoded, only once however many servers there are.
+static void jsproxy_client_uinput(const char*                     ioPath_,
+                                  const jsproxy_server_addr_t*    servers_,
+                                  int                             serverCount_,
+                                  const jsproxy_client_options_t* options_,
+                                  uint64_t                        startNs_)
+{
+    // Open the input device requested by the user; its configuration is what
+    // we report to the server, enabling it to recreate a "virtual" version of it.
+    input_source_t* source = input_source_open(ioPath_, options_->timestamps);
+    if (!source) {
+        return;
+    }
+    js_config_t* config = &source->config;
 
-        if (nRead < (int)sizeof(struct input_event)) {
-            printf("unexpected event size read %d\n", nRead);
+    jsproxy_client_t client = {};
+    for (int i = 0; i < serverCount_; i++) {
+        int sockFd = jsproxy_client_connect(&servers_[i], config, options_);
+        if (sockFd < 0) {
+            continue;
         }
+        jsproxy_destination_t* destination = &client.destinations[client.destinationCount++];
+        destination->server                = &servers_[i];
+        destination->sockFd                = sockFd;
+    }
+    if (client.destinationCount == 0) {
+        input_source_close(source);
+        return;
+    }
+    client.liveCount = client.destinationCount;
+    LOG_INFO("device described in %.1f us%s, configuration sent to %d of %d servers %.1f ms after startup",
+             source->openNs / (double)NSEC_PER_USEC,
+             source->cached ? " (cached)" : "",
+             client.destinationCount,
+             serverCount_,
+             (timestamp_now_ns() - startNs_) / (double)NSEC_PER_MSEC);
+
+    client.source     = source;
+    client.config     = config;
+    client.inSync     = true;
+    client.timestamps = options_->timestamps;
+    client.startNs    = startNs_;
+    js_index_map_from_config(&client.indexMap, config);
+    if (options_->capture) {
+        client.capture = jsproxy_client_capture(options_->capture, source);
+    }
 
-        // Data read into buffer;  parase out events
-        size_t numEvents = (nRead / sizeof(struct input_event));
-        for (size_t i = 0; i < numEvents; i++) {
-            // Whenever we get a sync event, flush the current report
-            if (events[i].type == EV_SYN) {
-                if (!encode_and_transmit(sockFd, 1, rawReport, rawReportSize)) {
-                    return;
-                }
-            } else if (events[i].type == EV_KEY) {
-                int index = js_index_map_get_index(indexMap, events[i].type, events[i].code);
-                if (index < 0) {
-                    printf("invalid key index \n");
-                    continue;
-                }
-                report.buttons[index] = !!events[i].value;
-            } else if (events[i].type == EV_ABS) {
-                int index = js_index_map_get_index(indexMap, events[i].type, events[i].code);
-                if (index < 0) {
-                    printf("invalid absAxis index \n");
-                    continue;
-                }
-                report.absAxis[index] = events[i].value;
-            } else if (events[i].type == EV_REL) {
-                int index = js_index_map_get_index(indexMap, events[i].type, events[i].code);
-                if (index < 0) {
-                    printf("invalid relAxis index \n");
-                    continue;
-                }
-                report.relAxis[index] = events[i].value;
-            }
+    bool ready = jsproxy_client_alloc(&client, options_);
+    if (!ready) {
+        LOG_ERROR("unable to allocate client buffers");
+    } else {
+        // Start from the device's actual state.  The virtual device on the server
+        // starts out all-zero, so this is only sent if the state differs from that.
+        jsproxy_client_resync(&client);
+        uint64_t now = timestamp_now_ns();
+        if (!report_builder_sync(client.builder, now) || jsproxy_client_send_report(&client, now)) {
+            jsproxy_client_run(&client);
+            jsproxy_client_finish(&client);
         }
+
+        report_builder_stats_t* stats = &client.builder->stats;
+        printf("updates: %llu, reports sent: %llu, duplicates: %llu, filtered axis events: %llu, suppressed: %.1f%%\n",
+               (unsigned long long)stats->syncs,
+               (unsigned long long)stats->sent,
+               (unsigned long long)stats->duplicates,
+               (unsigned long long)stats->filtered,
+               report_builder_suppression_ratio(client.builder) * 100.0);
     }
 
-    close(sockFd);
-    close(fd);
-    free(rawReport);
-    free(indexMap);
+    for (int i = 0; i < client.destinationCount; i++) {
+        jsproxy_destination_t* destination = &client.destinations[i];
+        if (ready && (serverCount_ > 1)) {
+            printf("%s:%u: reports merged in the send queue: %llu\n",
+                   destination->server->addr,
+                   destination->server->port,
+                   (unsigned long long)destination->sendQueue->merged);
+        }
+        if (destination->sockFd >= 0) {
+            close(destination->sockFd);
+        }
+        send_queue_destroy(destination->sendQueue);
+        if (destination->slipDecode) {
+            slip_decode_message_destroy(destination->slipDecode);
+        }
+    }
+    capture_writer_destroy(client.capture);
+    free(client.frame);
+    free(client.timedReport);
+    report_builder_destroy(client.builder);
+    input_source_close(source);
+}
+
+//---------------------------------------------------------------------------
+static void usage(void)
+{
+    printf("usage: netstick [options] [input source] [server address] [server port] [[server address] [server port]...]\n"
+           "input source:\n"
+           "  [evdev:]<path>                             input device to forward (/dev/input/eventX)\n"
+           "  generate:<gamepad|keyboard|mouse>[,rate=<Hz>][,axes=<n>][,buttons=<n>]\n"
+           "                                             synthetic input (default rate: %d Hz)\n"
+           "  replay:<file>[,speed=<x>]                  events recorded with --capture; speed 0 = as fast as possible\n"
+           "options:\n"
+           "  -p, --policy <default|latency|throughput>  socket policy (default: default)\n"
+           "  -b, --batch-us <usec>                      throughput policy batching window (default: %d)\n"
+           "  -s, --sndbuf <bytes>                       latency policy socket send buffer (default: %d)\n"
+           "  -a, --abs-rate <Hz>                        max rate of absolute-axis-only reports; 0 = no limit (default: 0)\n"
+           "  -m, --rel-rate <Hz>                        max rate of motion-only reports; 0 = no limit (default: 0)\n"
+           "  -f, --filter                               apply axis fuzz/deadzone before reporting\n"
+           "  -t, --realtime                             real-time mode: rt scheduling, locked memory, socket priority/DSCP EF\n"
+           "  -T, --rt-policy <fifo|rr>                  real-time scheduling policy (default: fifo)\n"
+           "  -P, --rt-priority <1-99>                   real-time scheduling priority (default: %d)\n"
+           "  -c, --cpu <n>                              real-time mode: pin to the given CPU\n"
+           "  -S, --timestamps                           send sequence numbers and event timestamps for latency measurement\n"
+           "  -l, --log-level <error|warning|info|debug> most verbose messages to print (default: info)\n"
+           "  -C, --capture <prefix>                     record the events read on each connection to <prefix>.<n>\n"
+           "  -D, --device-cache <dir|none>              where device capabilities are cached (default: ~/.cache/netstick)\n",
+           INPUT_SOURCE_DEFAULT_RATE_HZ,
+           TRANSPORT_DEFAULT_BATCH_US,
+           TRANSPORT_DEFAULT_SNDBUF,
+           REALTIME_DEFAULT_PRIORITY);
 }
 
 //---------------------------------------------------------------------------
 int main(int argc, char** argv)
 {
-    if (argc < 4) {
-        printf("usage: netstick [path to input device] [server address] [server port]\n");
+    uint64_t startNs = timestamp_now_ns();
+
+    jsproxy_client_options_t clientOptions;
+    transport_config_init(&clientOptions.transport);
+    report_builder_config_init(&clientOptions.reports);
+    realtime_config_init(&clientOptions.realtime);
+    clientOptions.timestamps = false;
+    clientOptions.capture    = NULL;
+
+    static const struct option options[] = { { "policy", required_argument, NULL, 'p' },
+                                             { "batch-us", required_argument, NULL, 'b' },
+                                             { "sndbuf", required_argument, NULL, 's' },
+                                             { "abs-rate", required_argument, NULL, 'a' },
+                                             { "rel-rate", required_argument, NULL, 'm' },
+                                             { "filter", no_argument, NULL, 'f' },
+                                             { "realtime", no_argument, NULL, 't' },
+                                             { "rt-policy", required_argument, NULL, 'T' },
+                                             { "rt-priority", required_argument, NULL, 'P' },
+                                             { "cpu", required_argument, NULL, 'c' },
+                                             { "timestamps", no_argument, NULL, 'S' },
+                                             { "log-level", required_argument, NULL, 'l' },
+                                             { "capture", required_argument, NULL, 'C' },
+                                             { "device-cache", required_argument, NULL, 'D' },
+                                             { "help", no_argument, NULL, 'h' },
+                                             { NULL, 0, NULL, 0 } };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "p:b:s:a:m:ftT:P:c:Sl:C:D:h", options, NULL)) != -1) {
+        switch (opt) {
+            case 'p': {
+                if (!transport_policy_from_string(optarg, &clientOptions.transport.policy)) {
+                    printf("unknown socket policy: %s\n", optarg);
+                    return -1;
+                }
+            } break;
+            case 'b': clientOptions.transport.batchWindowUs = atoi(optarg); break;
+            case 's': clientOptions.transport.sendBufferSize = atoi(optarg); break;
+            case 'a': clientOptions.reports.absRateHz = atoi(optarg); break;
+            case 'm': clientOptions.reports.relRateHz = atoi(optarg); break;
+            case 'f': clientOptions.reports.filterAxes = true; break;
+            case 't': clientOptions.realtime.enabled = true; break;
+            case 'T': {
+                if (!realtime_policy_from_string(optarg, &clientOptions.realtime.policy)) {
+                    printf("unknown scheduling policy: %s\n", optarg);
+                    return -1;
+                }
+            } break;
+            case 'P': clientOptions.realtime.priority = atoi(optarg); break;
+            case 'c': clientOptions.realtime.cpu = atoi(optarg); break;
+            case 'S': clientOptions.timestamps = true; break;
+            case 'C': clientOptions.capture = optarg; break;
+            case 'D': input_source_set_cache_dir(strcmp(optarg, "none") ? optarg : NULL); break;
+            case 'l': {
+                if (!log_level_from_string(optarg, &logLevel)) {
+                    printf("unknown log level: %s\n", optarg);
+                    return -1;
+                }
+            } break;
+            default: {
+                usage();
+                return -1;
+            }
+        }
+    }
+
+    // Any number of servers (up to CLIENT_MAX_SERVERS) may follow the source
+    int serverArgs = argc - optind - 1;
+    if ((serverArgs < 2) || ((serverArgs % 2) != 0) || ((serverArgs / 2) > CLIENT_MAX_SERVERS)) {
+        usage();
         return -1;
     }
+    jsproxy_server_addr_t servers[CLIENT_MAX_SERVERS];
+    int                   serverCount = serverArgs / 2;
+    for (int i = 0; i < serverCount; i++) {
+        servers[i].addr = argv[optind + 1 + (i * 2)];
+        servers[i].port = atoi(argv[optind + 2 + (i * 2)]);
+    }
+
+    // Keep printing out of the input path
+    log_start();
+    realtime_apply(&clientOptions.realtime);
 
+    // Startup is timed from process start the first time, and from each
+    // reconnection attempt after that
     while (true) {
-        jsproxy_client_uinput(argv[1], argv[2], atoi(argv[3]));
+        jsproxy_client_uinput(argv[optind], servers, serverCount, &clientOptions, startNs);
         sleep(4);
+        startNs = timestamp_now_ns();
     }
     return 0;
 }
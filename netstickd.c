@@ -5,205 +5,183 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <errno.h>
 #include <string.h>
-#include <unistd.h>
-#include <fcntl.h>
+#include <getopt.h>
 
-#include <arpa/inet.h>
-#include <netinet/in.h>
-#include <sys/socket.h>
-#include <sys/epoll.h>
-#include <sys/uio.h>
-#include <linux/uinput.h>
-#include <linux/input.h>
+#include "jsproxy.h"
+#include "log.h"
 
-#include "tlvc.h"
-#include "slip.h"
-#include "joystick.h"
-#include "server.h"
-
-//---------------------------------------------------------------------------
-// SERVER CODE
 //---------------------------------------------------------------------------
-typedef struct {
-    slip_decode_message_t* slipDecode;
-    bool                   configSet;
-    js_context_t*          joystickContext;
-} jsproxy_client_context_t;
-
-//---------------------------------------------------------------------------
-void* jsproxy_connect(int clientFd_)
+static void usage(void)
 {
-    printf("enter:%s, %d\n", __func__, clientFd_);
-    (void)clientFd_;
-
-    jsproxy_client_context_t* newContext = (jsproxy_client_context_t*)(calloc(1, sizeof(jsproxy_client_context_t)));
-    newContext->slipDecode               = slip_decode_message_create(32768);
-    slip_decode_begin(newContext->slipDecode);
-    newContext->configSet       = false;
-    newContext->joystickContext = NULL;
-
-    return newContext;
+    printf("usage: netstickd [options] [server port]\n"
+           "options:\n"
+           "  -p, --policy <default|latency|throughput>  socket policy (default: default)\n"
+           "  -s, --sndbuf <bytes>                       latency policy socket send buffer (default: %d)\n"
+           "  -d, --repeat-delay <ms>                    keyboard autorepeat delay (default: %d)\n"
+           "  -r, --repeat-rate <Hz>                     keyboard autorepeat rate (default: %d)\n"
+           "  -R, --no-repeat                            disable keyboard autorepeat\n"
+           "  -m, --remap <file>                         remap buttons and axes using the rules in <file>\n"
+           "  -t, --realtime                             real-time mode: rt scheduling, locked memory, socket priority/DSCP EF\n"
+           "  -T, --rt-policy <fifo|rr>                  real-time scheduling policy (default: fifo)\n"
+           "  -P, --rt-priority <1-99>                   real-time scheduling priority (default: %d)\n"
+           "  -c, --cpu <n>                              real-time mode: pin to the given CPU\n"
+           "  -w, --poll <blocking|busy|spin>            how to wait for client data (default: blocking)\n"
+           "  -u, --spin-us <usec>                       busy mode: time to spin after each event (default: %d)\n"
+           "  -y, --busy-poll-us <usec>                  busy/spin modes: SO_BUSY_POLL for client sockets (default: %d)\n"
+           "  -i, --heartbeat-ms <ms>                    interval between heartbeat pings; 0 = disable (default: %d)\n"
+           "  -x, --heartbeat-misses <n>                 drop a client after n unanswered pings; 0 = never (default: %d)\n"
+           "  -j, --playout                              smooth out network jitter in timed reports (netstick -S)\n"
+           "  -k, --playout-min-us <usec>                minimum playout delay (default: %d)\n"
+           "  -K, --playout-max-us <usec>                maximum playout delay (default: %d)\n"
+           "  -S, --stats <path>                         serve live statistics on a unix socket at <path>\n"
+           "  -l, --log-level <error|warning|info|debug> most verbose messages to print (default: info)\n"
+           "  -o, --output <uinput|null|record>          where device events go; null/record need no uinput (default: uinput)\n"
+           "  -C, --capture <prefix>                     record the reports received from each client to <prefix>.<n>\n"
+           "  -M, --max-clients <n>                      maximum number of concurrent clients (default: %d)\n",
+           TRANSPORT_DEFAULT_SNDBUF,
+           JS_DEFAULT_REPEAT_DELAY_MS,
+           1000 / JS_DEFAULT_REPEAT_PERIOD_MS,
+           REALTIME_DEFAULT_PRIORITY,
+           SERVER_DEFAULT_SPIN_US,
+           SERVER_DEFAULT_BUSY_POLL_US,
+           HEARTBEAT_DEFAULT_INTERVAL_MS,
+           HEARTBEAT_DEFAULT_MISS_LIMIT,
+           PLAYOUT_DEFAULT_MIN_DELAY_US,
+           PLAYOUT_DEFAULT_MAX_DELAY_US,
+           JSPROXY_DEFAULT_MAX_CLIENTS);
 }
 
 //---------------------------------------------------------------------------
-void jsproxy_disconnect(void* clientContext_)
-{
-    jsproxy_client_context_t* context = (jsproxy_client_context_t*)clientContext_;
-    slip_decode_message_destroy(context->slipDecode);
-    printf("enter:%s, %d\n", __func__, context->joystickContext->fd);
-
-    if (context->configSet && context->joystickContext) {
-        joystick_destroy(context->joystickContext);
-    }
-}
-
-//---------------------------------------------------------------------------
-static bool emit(int fd, int type, int code, int val)
-{
-    struct input_event ie;
-
-    ie.type  = type;
-    ie.code  = code;
-    ie.value = val;
-    /* timestamp values below are ignored */
-    ie.time.tv_sec  = 0;
-    ie.time.tv_usec = 0;
-
-    int rc = write(fd, &ie, sizeof(ie));
-    if (rc != sizeof(ie)) {
-        return false;
-    }
-    return true;
-}
-
-//---------------------------------------------------------------------------
-static void
-jsproxy_handle_message(jsproxy_client_context_t* context_, uint16_t eventType_, void* data_, size_t dataSize_)
+int main(int argc, char** argv)
 {
-    switch (eventType_) {
-        case 0: {
-            if (context_->configSet) {
-                printf("configuration already set - ignoring\n");
-                return;
-            }
-
-            if (dataSize_ != sizeof(js_config_t)) {
-                printf("expected configuration size %d, got %d\n", (int)sizeof(js_config_t), (int)dataSize_);
-                return;
-            }
-
-            js_config_t* config = (js_config_t*)data_;
-
-            // Okay, so now that we have the configuration, we need to create the
-            // actual joystick object with its details
-            context_->joystickContext = joystick_create(config);
-            context_->configSet       = true;
-
-        } break;
-        case 1: {
-            if (!context_->configSet || !context_->joystickContext) {
-                printf("joystick hasn't been configured.  Bailing\n");
-                return;
-            }
-
-            js_report_t  report;
-            js_config_t* config = &context_->joystickContext->config;
-            int          fd     = context_->joystickContext->fd;
-
-            uint8_t* rawReport = data_;
-
-            report.absAxis = (int32_t*)rawReport;
-            report.relAxis = (int32_t*)(rawReport + (sizeof(int32_t) * config->absAxisCount));
-            report.buttons = (uint8_t*)(rawReport + (sizeof(int32_t) * config->absAxisCount)
-                                        + (sizeof(int32_t) * config->relAxisCount));
-
-            for (int i = 0; i < config->absAxisCount; i++) {
-                if (!emit(fd, EV_ABS, config->absAxis[i], report.absAxis[i])) {
-                    printf("error writing event to uinput\n");
+    jsproxy_config_t config;
+    jsproxy_config_init(&config);
+    const char* statsPath = NULL;
+
+    static const struct option options[] = { { "policy", required_argument, NULL, 'p' },
+                                             { "sndbuf", required_argument, NULL, 's' },
+                                             { "repeat-delay", required_argument, NULL, 'd' },
+                                             { "repeat-rate", required_argument, NULL, 'r' },
+                                             { "no-repeat", no_argument, NULL, 'R' },
+                                             { "remap", required_argument, NULL, 'm' },
+                                             { "realtime", no_argument, NULL, 't' },
+                                             { "rt-policy", required_argument, NULL, 'T' },
+                                             { "rt-priority", required_argument, NULL, 'P' },
+                                             { "cpu", required_argument, NULL, 'c' },
+                                             { "poll", required_argument, NULL, 'w' },
+                                             { "spin-us", required_argument, NULL, 'u' },
+                                             { "busy-poll-us", required_argument, NULL, 'y' },
+                                             { "heartbeat-ms", required_argument, NULL, 'i' },
+                                             { "heartbeat-misses", required_argument, NULL, 'x' },
+                                             { "playout", no_argument, NULL, 'j' },
+                                             { "playout-min-us", required_argument, NULL, 'k' },
+                                             { "playout-max-us", required_argument, NULL, 'K' },
+                                             { "stats", required_argument, NULL, 'S' },
+                                             { "log-level", required_argument, NULL, 'l' },
+                                             { "output", required_argument, NULL, 'o' },
+                                             { "capture", required_argument, NULL, 'C' },
+                                             { "max-clients", required_argument, NULL, 'M' },
+                                             { "help", no_argument, NULL, 'h' },
+                                             { NULL, 0, NULL, 0 } };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "p:s:d:r:Rm:tT:P:c:w:u:y:i:x:jk:K:S:l:o:C:M:h", options, NULL)) != -1) {
+        switch (opt) {
+            case 'p': {
+                if (!transport_policy_from_string(optarg, &config.transport.policy)) {
+                    printf("unknown socket policy: %s\n", optarg);
+                    return -1;
                 }
-            }
-            for (int i = 0; i < config->relAxisCount; i++) {
-                if (!emit(fd, EV_REL, config->relAxis[i], report.relAxis[i])) {
-                    printf("error writing event to uinput\n");
+            } break;
+            case 's': config.transport.sendBufferSize = atoi(optarg); break;
+            case 'd': config.device.repeatDelayMs = atoi(optarg); break;
+            case 'r': {
+                int rateHz = atoi(optarg);
+                if (rateHz <= 0) {
+                    printf("invalid repeat rate: %s\n", optarg);
+                    return -1;
                 }
-            }
-            for (int i = 0; i < config->buttonCount; i++) {
-                if (!emit(fd, EV_KEY, config->buttons[i], report.buttons[i])) {
-                    printf("error writing event to uinput\n");
+                config.device.repeatPeriodMs = 1000 / rateHz;
+            } break;
+            case 'R': config.device.autoRepeat = false; break;
+            case 't': config.realtime.enabled = true; break;
+            case 'T': {
+                if (!realtime_policy_from_string(optarg, &config.realtime.policy)) {
+                    printf("unknown scheduling policy: %s\n", optarg);
+                    return -1;
                 }
-            }
-            if (!emit(fd, EV_SYN, 0, 0)) {
-                printf("error writing event to uinput\n");
-            }
-
-        } break;
-        default: {
-            printf("unknown message %d\n", eventType_);
-        } break;
-    }
-}
-
-//---------------------------------------------------------------------------
-bool jsproxy_read(int clientFd_, void* clientContext_)
-{
-    uint8_t buf[256];
-
-    int nRead = 0;
-    do {
-        nRead = read(clientFd_, buf, sizeof(buf));
-        if (nRead <= 0) {
-            break;
-        }
-
-        jsproxy_client_context_t* context = (jsproxy_client_context_t*)clientContext_;
-        for (int i = 0; i < nRead; i++) {
-            slip_decode_return_t rc = slip_decode_byte(context->slipDecode, buf[i]);
-            if (rc == SlipDecodeEndOfFrame) {
-                // Decoder contains the contents of the message into a TLVC frame, validate
-                // that it's intact.
-                tlvc_data_t tlvc;
-                if (tlvc_decode_data(&tlvc, context->slipDecode->raw, context->slipDecode->index)) {
-                    // Message is valid and intact, process it.
-                    jsproxy_handle_message(context, tlvc.header.tag, tlvc.data, tlvc.dataLen);
+            } break;
+            case 'P': config.realtime.priority = atoi(optarg); break;
+            case 'c': config.realtime.cpu = atoi(optarg); break;
+            case 'w': {
+                if (!server_poll_mode_from_string(optarg, &config.poll.mode)) {
+                    printf("unknown poll mode: %s\n", optarg);
+                    return -1;
+                }
+            } break;
+            case 'u': config.poll.spinUs = atoi(optarg); break;
+            case 'y': config.poll.busyPollUs = atoi(optarg); break;
+            case 'i': config.heartbeat.intervalMs = atoi(optarg); break;
+            case 'x': config.heartbeat.missLimit = atoi(optarg); break;
+            case 'j': config.playout.enabled = true; break;
+            case 'k': config.playout.minDelayUs = atoi(optarg); break;
+            case 'K': config.playout.maxDelayUs = atoi(optarg); break;
+            case 'S': statsPath = optarg; break;
+            case 'C': config.capture = optarg; break;
+            case 'M': {
+                config.maxClients = atoi(optarg);
+                if (config.maxClients <= 0) {
+                    printf("invalid client limit: %s\n", optarg);
+                    return -1;
                 }
-                slip_decode_begin(context->slipDecode);
-            } else if (rc != SlipDecodeOk) {
-                // Error decoding frame -- discard.
-                slip_decode_begin(context->slipDecode);
+            } break;
+            case 'o': {
+                if (!joystick_sink_from_string(optarg, &config.device.sink)) {
+                    printf("unknown output: %s\n", optarg);
+                    return -1;
+                }
+            } break;
+            case 'l': {
+                if (!log_level_from_string(optarg, &logLevel)) {
+                    printf("unknown log level: %s\n", optarg);
+                    return -1;
+                }
+            } break;
+            case 'm': {
+                remap_config_destroy(config.remap);
+                config.remap = remap_config_load(optarg);
+                if (!config.remap) {
+                    return -1;
+                }
+            } break;
+            default: {
+                usage();
+                return -1;
             }
         }
-    } while (nRead > 0);
-
-    if (nRead == 0) {
-        return false;
     }
-    if ((nRead == -1) && ((errno == EINTR) || (errno == EAGAIN))) {
-        return true;
-    }
-
-    return true;
-}
 
-//---------------------------------------------------------------------------
-static void jsproxy_server(uint16_t port_)
-{
-    client_handlers_t handlers
-        = { .onConnect = jsproxy_connect, .onDisconnect = jsproxy_disconnect, .onReadData = jsproxy_read };
+    if ((argc - optind) < 1) {
+        usage();
+        return -1;
+    }
 
-    server_context_t* server = server_create(port_, 10, &handlers);
+    if (statsPath) {
+        config.stats = stats_server_create(statsPath, config.maxClients);
+        if (!config.stats) {
+            return -1;
+        }
+        printf("serving statistics on %s\n", statsPath);
+    }
 
-    server_run(server);
-}
+    // Keep printing out of the event loop
+    log_start();
+    realtime_apply(&config.realtime);
 
-//---------------------------------------------------------------------------
-int main(int argc, char** argv)
-{
-    if (argc < 2) {
-        printf("usage: netstickd [server port]\n");
+    server_context_t* server = jsproxy_server_create(atoi(argv[optind]), &config);
+    if (!server) {
         return -1;
     }
-
-    jsproxy_server(atoi(argv[1]));
+    server_run(server);
 }
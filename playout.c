@@ -0,0 +1,197 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#include "playout.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "timestamp.h"
+
+//---------------------------------------------------------------------------
+void playout_config_init(playout_config_t* config_)
+{
+    config_->enabled    = false;
+    config_->minDelayUs = PLAYOUT_DEFAULT_MIN_DELAY_US;
+    config_->maxDelayUs = PLAYOUT_DEFAULT_MAX_DELAY_US;
+}
+
+//---------------------------------------------------------------------------
+playout_t* playout_create(const playout_config_t* config_, size_t reportSize_)
+{
+    playout_t* newPlayout = (playout_t*)(calloc(1, sizeof(playout_t)));
+    if (!newPlayout) {
+        return NULL;
+    }
+    newPlayout->config     = *config_;
+    newPlayout->reportSize = reportSize_;
+    newPlayout->targetNs   = (uint64_t)config_->minDelayUs * NSEC_PER_USEC;
+
+    // One allocation holds the report data for every slot
+    uint8_t* data = (uint8_t*)(calloc(PLAYOUT_QUEUE_DEPTH, reportSize_ + 1));
+    if (!data) {
+        free(newPlayout);
+        return NULL;
+    }
+    for (int i = 0; i < PLAYOUT_QUEUE_DEPTH; i++) { newPlayout->entries[i].report = data + (i * (reportSize_ + 1)); }
+    return newPlayout;
+}
+
+//---------------------------------------------------------------------------
+void playout_destroy(playout_t* playout_)
+{
+    if (!playout_) {
+        return;
+    }
+    free(playout_->entries[0].report);
+    free(playout_);
+}
+
+//---------------------------------------------------------------------------
+static void playout_jitter_update(playout_jitter_t* jitter_, uint64_t sentNs_, uint64_t seenNs_)
+{
+    if (jitter_->started) {
+        int64_t  deviation = ((int64_t)seenNs_ - (int64_t)jitter_->lastSeenNs)
+                             - ((int64_t)sentNs_ - (int64_t)jitter_->lastSentNs);
+        uint64_t magnitude = (deviation < 0) ? (uint64_t)(-deviation) : (uint64_t)deviation;
+        jitter_->jitterNs += ((double)magnitude - jitter_->jitterNs) / 16.0;
+        if (magnitude > jitter_->peakNs) {
+            jitter_->peakNs = magnitude;
+        }
+    }
+    jitter_->started    = true;
+    jitter_->lastSentNs = sentNs_;
+    jitter_->lastSeenNs = seenNs_;
+}
+
+//---------------------------------------------------------------------------
+// Track the smallest transit time (local time minus client time) over the last
+// one to two windows.  Reports that took the fastest path through the network
+// define the schedule; anything slower is delayed less to stay on it.  Letting
+// old minimums expire follows drift between the two clocks.
+static void playout_update_transit(playout_t* playout_, uint64_t clientNs_, uint64_t now_)
+{
+    int64_t transit = (int64_t)now_ - (int64_t)clientNs_;
+    if (playout_->windowEndNs == 0) {
+        playout_->windowTransitNs = transit;
+        playout_->prevTransitNs   = transit;
+        playout_->windowEndNs     = now_ + (PLAYOUT_BASE_WINDOW_MS * NSEC_PER_MSEC);
+    } else if (now_ >= playout_->windowEndNs) {
+        playout_->prevTransitNs   = playout_->windowTransitNs;
+        playout_->windowTransitNs = transit;
+        playout_->windowEndNs     = now_ + (PLAYOUT_BASE_WINDOW_MS * NSEC_PER_MSEC);
+    } else if (transit < playout_->windowTransitNs) {
+        playout_->windowTransitNs = transit;
+    }
+
+    playout_->baseTransitNs = (playout_->prevTransitNs < playout_->windowTransitNs) ? playout_->prevTransitNs
+                                                                                     : playout_->windowTransitNs;
+}
+
+//---------------------------------------------------------------------------
+static void playout_on_arrival(playout_t* playout_, uint64_t clientNs_, uint64_t now_)
+{
+    playout_jitter_update(&playout_->arrival, clientNs_, now_);
+    playout_update_transit(playout_, clientNs_, now_);
+
+    uint64_t target = (uint64_t)(playout_->arrival.jitterNs * PLAYOUT_JITTER_MULTIPLE);
+    uint64_t minNs  = (uint64_t)playout_->config.minDelayUs * NSEC_PER_USEC;
+    uint64_t maxNs  = (uint64_t)playout_->config.maxDelayUs * NSEC_PER_USEC;
+    if (target < minNs) {
+        target = minNs;
+    }
+    if (target > maxNs) {
+        target = maxNs;
+    }
+    playout_->targetNs = target;
+}
+
+//---------------------------------------------------------------------------
+void playout_bypass(playout_t* playout_, uint64_t clientNs_, uint64_t now_)
+{
+    playout_on_arrival(playout_, clientNs_, now_);
+    playout_->bypassed++;
+}
+
+//---------------------------------------------------------------------------
+bool playout_push(playout_t* playout_, uint64_t clientNs_, uint64_t now_, const uint8_t* report_)
+{
+    if (playout_->count == PLAYOUT_QUEUE_DEPTH) {
+        return false;
+    }
+    playout_on_arrival(playout_, clientNs_, now_);
+
+    // Reports always leave in the order they arrived, even if the target shrank
+    uint64_t due = (uint64_t)((int64_t)clientNs_ + playout_->baseTransitNs) + playout_->targetNs;
+    if ((playout_->count > 0) && (due < playout_->lastDueNs)) {
+        due = playout_->lastDueNs;
+    }
+    if (due <= now_) {
+        playout_->late++;
+    }
+
+    playout_entry_t* entry = &playout_->entries[(playout_->head + playout_->count) % PLAYOUT_QUEUE_DEPTH];
+    entry->clientNs        = clientNs_;
+    entry->dueNs           = due;
+    memcpy(entry->report, report_, playout_->reportSize);
+
+    playout_->lastDueNs = due;
+    playout_->count++;
+    playout_->queued++;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+const uint8_t* playout_pop(playout_t* playout_, uint64_t now_, bool force_, uint64_t* clientNs_)
+{
+    if (playout_->count == 0) {
+        return NULL;
+    }
+    playout_entry_t* entry = &playout_->entries[playout_->head];
+    if (!force_ && (entry->dueNs > now_)) {
+        return NULL;
+    }
+
+    playout_->head = (playout_->head + 1) % PLAYOUT_QUEUE_DEPTH;
+    playout_->count--;
+    *clientNs_ = entry->clientNs;
+    return entry->report;
+}
+
+//---------------------------------------------------------------------------
+void playout_applied(playout_t* playout_, uint64_t clientNs_, uint64_t now_)
+{
+    playout_jitter_update(&playout_->output, clientNs_, now_);
+}
+
+//---------------------------------------------------------------------------
+uint64_t playout_deadline(const playout_t* playout_)
+{
+    if (playout_->count == 0) {
+        return 0;
+    }
+    return playout_->entries[playout_->head].dueNs;
+}
+
+//---------------------------------------------------------------------------
+void playout_print(const playout_t* playout_, const char* name_)
+{
+    if (!playout_->arrival.started) {
+        return;
+    }
+    printf("%s: playout: queued: %llu, bypassed: %llu, late: %llu, target: %.1fus\n",
+           name_,
+           (unsigned long long)playout_->queued,
+           (unsigned long long)playout_->bypassed,
+           (unsigned long long)playout_->late,
+           playout_->targetNs / 1000.0);
+    printf("%s: jitter: arrival=%.1fus (peak %.1fus), applied=%.1fus (peak %.1fus)\n",
+           name_,
+           playout_->arrival.jitterNs / 1000.0,
+           playout_->arrival.peakNs / 1000.0,
+           playout_->output.jitterNs / 1000.0,
+           playout_->output.peakNs / 1000.0);
+}
@@ -0,0 +1,157 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+#define PLAYOUT_DEFAULT_MIN_DELAY_US (0)        //!< Default lower bound for the playout delay
+#define PLAYOUT_DEFAULT_MAX_DELAY_US (20000)    //!< Default upper bound for the playout delay
+#define PLAYOUT_JITTER_MULTIPLE (3)             //!< Playout delay target, in multiples of the measured jitter
+#define PLAYOUT_QUEUE_DEPTH (64)                //!< Maximum number of reports held back at once
+#define PLAYOUT_BASE_WINDOW_MS (2000)           //!< Interval over which the minimum transit time is tracked
+
+//---------------------------------------------------------------------------
+// Playout options
+typedef struct {
+    bool enabled;       //!< Whether to smooth out timed reports at all
+    int  minDelayUs;    //!< Lower bound for the adaptive delay target
+    int  maxDelayUs;    //!< Upper bound for the adaptive delay target
+} playout_config_t;
+
+//---------------------------------------------------------------------------
+// Interarrival jitter estimate, as defined by RFC 3550 (section 6.4.1)
+typedef struct {
+    bool     started;       //!< Whether a previous sample exists
+    uint64_t lastSentNs;    //!< Client timestamp of the previous sample
+    uint64_t lastSeenNs;    //!< Local time of the previous sample
+    double   jitterNs;      //!< Smoothed jitter estimate
+    uint64_t peakNs;        //!< Largest single deviation seen
+} playout_jitter_t;
+
+//---------------------------------------------------------------------------
+// A report waiting for its playout time
+typedef struct {
+    uint64_t clientNs;  //!< Client timestamp of the report
+    uint64_t dueNs;     //!< Local time at which the report is to be applied
+    uint8_t* report;    //!< Report data
+} playout_entry_t;
+
+//---------------------------------------------------------------------------
+// Jitter buffer for one device's reports
+typedef struct {
+    playout_config_t config;        //!< Options
+    size_t           reportSize;    //!< Size of a report in bytes
+
+    playout_entry_t entries[PLAYOUT_QUEUE_DEPTH];  //!< Ring of queued reports
+    int             head;                           //!< Oldest queued report
+    int             count;                          //!< Number of queued reports
+
+    int64_t  baseTransitNs;     //!< Smallest (local time - client time) seen recently
+    int64_t  windowTransitNs;   //!< Smallest transit in the current window
+    int64_t  prevTransitNs;     //!< Smallest transit in the previous window
+    uint64_t windowEndNs;       //!< End of the current window
+    uint64_t lastDueNs;         //!< Playout time of the newest queued report
+    uint64_t targetNs;          //!< Current delay target
+
+    playout_jitter_t arrival;   //!< Jitter of reports as received
+    playout_jitter_t output;    //!< Jitter of reports as applied
+
+    uint64_t queued;            //!< Reports that went through the buffer
+    uint64_t bypassed;          //!< Reports applied immediately (button edges, overflow)
+    uint64_t late;              //!< Reports that arrived after their playout time
+} playout_t;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief playout_config_init initialize playout options to their defaults (disabled)
+ * @param config_ object to initialize
+ */
+void playout_config_init(playout_config_t* config_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief playout_create construct a jitter buffer for a device
+ * @param config_ playout options
+ * @param reportSize_ size of the device's reports
+ * @return newly-constructed buffer, or NULL on allocation error
+ */
+playout_t* playout_create(const playout_config_t* config_, size_t reportSize_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief playout_destroy destruct a previously-constructed buffer
+ * NOTE: object must not be used after this is called.
+ * @param playout_ buffer to destroy
+ */
+void playout_destroy(playout_t* playout_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief playout_push queue a report to be applied at the same spacing it was
+ * generated with, plus the current delay target.
+ * @param playout_ buffer to add the report to
+ * @param clientNs_ client timestamp of the report
+ * @param now_ local time (CLOCK_MONOTONIC ns) at which the report arrived
+ * @param report_ report data (copied)
+ * @return true if the report was queued, false if the buffer is full
+ */
+bool playout_push(playout_t* playout_, uint64_t clientNs_, uint64_t now_, const uint8_t* report_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief playout_bypass account for a report that arrived and is being applied
+ * immediately instead of being queued.  Anything still queued must be applied
+ * first, to keep reports in order.
+ * @param playout_ buffer to update
+ * @param clientNs_ client timestamp of the report
+ * @param now_ local time at which the report arrived
+ */
+void playout_bypass(playout_t* playout_, uint64_t clientNs_, uint64_t now_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief playout_pop remove the oldest queued report if it is due.
+ * @param playout_ buffer to take the report from
+ * @param now_ current local time
+ * @param force_ take the oldest report even if it isn't due yet
+ * @param clientNs_ [out] client timestamp of the report
+ * @return report data (valid until the next push), or NULL if nothing is due
+ */
+const uint8_t* playout_pop(playout_t* playout_, uint64_t now_, bool force_, uint64_t* clientNs_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief playout_applied record when a report was actually applied, for the
+ * output jitter measurement
+ * @param playout_ buffer to update
+ * @param clientNs_ client timestamp of the report
+ * @param now_ local time at which it was applied
+ */
+void playout_applied(playout_t* playout_, uint64_t clientNs_, uint64_t now_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief playout_deadline return the time at which the oldest queued report is due
+ * @param playout_ buffer to check
+ * @return CLOCK_MONOTONIC deadline in ns, or 0 if the buffer is empty
+ */
+uint64_t playout_deadline(const playout_t* playout_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief playout_print print a summary of a buffer's statistics
+ * @param playout_ buffer to summarize
+ * @param name_ name of the device
+ */
+void playout_print(const playout_t* playout_, const char* name_);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
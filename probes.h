@@ -0,0 +1,113 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#pragma once
+
+#include <stdint.h>
+
+//---------------------------------------------------------------------------
+// Statically-defined tracing probes (USDT), compatible with the notes emitted
+// by SystemTap's <sys/sdt.h>, so that bpftrace, bcc, perf and SystemTap can all
+// attach to them.  A probe is a single nop in the instruction stream, plus an
+// ELF note (in .note.stapsdt, never loaded at runtime) recording the nop's
+// address and where to find each argument.  Attaching a tracer replaces the
+// nop with a breakpoint; until then a probe costs next to nothing.
+//
+// All probes belong to the "netstick" provider.  Every argument is passed as a
+// signed 64-bit value.  Arguments should be values the code has at hand anyway,
+// since they're evaluated whether or not anything is attached.
+//
+// Define NETSTICK_NO_PROBES to compile every probe out.
+//---------------------------------------------------------------------------
+
+#if !defined(NETSTICK_NO_PROBES) && defined(__GNUC__) && defined(__ELF__)                                       \
+    && (defined(__x86_64__) || defined(__i386__) || defined(__aarch64__) || defined(__arm__))
+
+//---------------------------------------------------------------------------
+#if __SIZEOF_POINTER__ == 8
+#define NETSTICK_PROBE_ADDR ".8byte"
+#else
+#define NETSTICK_PROBE_ADDR ".4byte"
+#endif
+
+//---------------------------------------------------------------------------
+// Note layout (stapsdt version 3): probe address, address of .stapsdt.base
+// (lets tools detect prelink adjustments), semaphore address (unused - always
+// 0), then the provider, probe name and argument description strings.
+#define NETSTICK_PROBE_ASM(name_, args_)                                                                         \
+    "990: nop\n"                                                                                                 \
+    ".pushsection .note.stapsdt,\"\",\"note\"\n"                                                                 \
+    ".balign 4\n"                                                                                                \
+    ".4byte 992f-991f, 994f-993f, 3\n"                                                                           \
+    "991: .asciz \"stapsdt\"\n"                                                                                  \
+    "992: .balign 4\n"                                                                                           \
+    "993: " NETSTICK_PROBE_ADDR " 990b\n"                                                                        \
+    NETSTICK_PROBE_ADDR " _.stapsdt.base\n"                                                                      \
+    NETSTICK_PROBE_ADDR " 0\n"                                                                                   \
+    ".asciz \"netstick\"\n"                                                                                      \
+    ".asciz \"" #name_ "\"\n"                                                                                    \
+    ".asciz \"" args_ "\"\n"                                                                                     \
+    "994: .balign 4\n"                                                                                           \
+    ".popsection\n"                                                                                              \
+    ".ifndef _.stapsdt.base\n"                                                                                   \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"                                      \
+    ".weak _.stapsdt.base\n"                                                                                     \
+    ".hidden _.stapsdt.base\n"                                                                                   \
+    "_.stapsdt.base: .space 1\n"                                                                                 \
+    ".size _.stapsdt.base, 1\n"                                                                                  \
+    ".popsection\n"                                                                                              \
+    ".endif\n"
+
+//---------------------------------------------------------------------------
+// Each argument is described as "<size>@<operand>"; the compiler is free to
+// leave it in a register, on the stack, or as an immediate.
+#define NETSTICK_PROBE_ARG(n_) "-8@%[a" #n_ "]"
+#define NETSTICK_PROBE_OPERAND(n_, x_) [a##n_] "nor"((int64_t)(x_))
+
+//---------------------------------------------------------------------------
+#define NETSTICK_PROBE_ARGS(args_, ...) __asm__ __volatile__(args_ : : __VA_ARGS__)
+
+//---------------------------------------------------------------------------
+#define NETSTICK_PROBE0(name_) __asm__ __volatile__(NETSTICK_PROBE_ASM(name_, ""))
+#define NETSTICK_PROBE1(name_, a1_)                                                                              \
+    NETSTICK_PROBE_ARGS(NETSTICK_PROBE_ASM(name_, NETSTICK_PROBE_ARG(1)), NETSTICK_PROBE_OPERAND(1, a1_))
+#define NETSTICK_PROBE2(name_, a1_, a2_)                                                                         \
+    NETSTICK_PROBE_ARGS(NETSTICK_PROBE_ASM(name_, NETSTICK_PROBE_ARG(1) " " NETSTICK_PROBE_ARG(2)),              \
+                        NETSTICK_PROBE_OPERAND(1, a1_),                                                          \
+                        NETSTICK_PROBE_OPERAND(2, a2_))
+#define NETSTICK_PROBE3(name_, a1_, a2_, a3_)                                                                    \
+    NETSTICK_PROBE_ARGS(                                                                                         \
+        NETSTICK_PROBE_ASM(name_, NETSTICK_PROBE_ARG(1) " " NETSTICK_PROBE_ARG(2) " " NETSTICK_PROBE_ARG(3)),    \
+        NETSTICK_PROBE_OPERAND(1, a1_),                                                                          \
+        NETSTICK_PROBE_OPERAND(2, a2_),                                                                          \
+        NETSTICK_PROBE_OPERAND(3, a3_))
+#define NETSTICK_PROBE4(name_, a1_, a2_, a3_, a4_)                                                               \
+    NETSTICK_PROBE_ARGS(NETSTICK_PROBE_ASM(name_,                                                                \
+                                           NETSTICK_PROBE_ARG(1) " " NETSTICK_PROBE_ARG(2) " "                   \
+                                           NETSTICK_PROBE_ARG(3) " " NETSTICK_PROBE_ARG(4)),                     \
+                        NETSTICK_PROBE_OPERAND(1, a1_),                                                          \
+                        NETSTICK_PROBE_OPERAND(2, a2_),                                                          \
+                        NETSTICK_PROBE_OPERAND(3, a3_),                                                          \
+                        NETSTICK_PROBE_OPERAND(4, a4_))
+#define NETSTICK_PROBE5(name_, a1_, a2_, a3_, a4_, a5_)                                                          \
+    NETSTICK_PROBE_ARGS(NETSTICK_PROBE_ASM(name_,                                                                \
+                                           NETSTICK_PROBE_ARG(1) " " NETSTICK_PROBE_ARG(2) " "                   \
+                                           NETSTICK_PROBE_ARG(3) " " NETSTICK_PROBE_ARG(4) " "                   \
+                                           NETSTICK_PROBE_ARG(5)),                                               \
+                        NETSTICK_PROBE_OPERAND(1, a1_),                                                          \
+                        NETSTICK_PROBE_OPERAND(2, a2_),                                                          \
+                        NETSTICK_PROBE_OPERAND(3, a3_),                                                          \
+                        NETSTICK_PROBE_OPERAND(4, a4_),                                                          \
+                        NETSTICK_PROBE_OPERAND(5, a5_))
+
+#else
+
+//---------------------------------------------------------------------------
+#define NETSTICK_PROBE0(name_) do {} while (0)
+#define NETSTICK_PROBE1(name_, a1_) do { (void)(a1_); } while (0)
+#define NETSTICK_PROBE2(name_, a1_, a2_) do { (void)(a1_); (void)(a2_); } while (0)
+#define NETSTICK_PROBE3(name_, a1_, a2_, a3_) do { (void)(a1_); (void)(a2_); (void)(a3_); } while (0)
+#define NETSTICK_PROBE4(name_, a1_, a2_, a3_, a4_) do { (void)(a1_); (void)(a2_); (void)(a3_); (void)(a4_); } while (0)
+#define NETSTICK_PROBE5(name_, a1_, a2_, a3_, a4_, a5_)                                                          \
+    do { (void)(a1_); (void)(a2_); (void)(a3_); (void)(a4_); (void)(a5_); } while (0)
+
+#endif
@@ -0,0 +1,149 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#include "realtime.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+//---------------------------------------------------------------------------
+void realtime_config_init(realtime_config_t* config_)
+{
+    config_->enabled        = false;
+    config_->policy         = SCHED_FIFO;
+    config_->priority       = REALTIME_DEFAULT_PRIORITY;
+    config_->cpu            = -1;
+    config_->socketPriority = REALTIME_DEFAULT_SOCKET_PRIORITY;
+    config_->tos            = REALTIME_DEFAULT_TOS;
+}
+
+//---------------------------------------------------------------------------
+bool realtime_policy_from_string(const char* str_, int* policy_)
+{
+    if (!strcmp(str_, "fifo")) {
+        *policy_ = SCHED_FIFO;
+        return true;
+    }
+    if (!strcmp(str_, "rr")) {
+        *policy_ = SCHED_RR;
+        return true;
+    }
+    return false;
+}
+
+//---------------------------------------------------------------------------
+static void realtime_report(const char* setting_, int rc_)
+{
+    if (rc_ == 0) {
+        printf("realtime: %s: ok\n", setting_);
+    } else {
+        printf("realtime: %s: failed (%s)\n", setting_, strerror(rc_));
+    }
+}
+
+//---------------------------------------------------------------------------
+static int realtime_scheduler(const realtime_config_t* config_)
+{
+    struct sched_param param = {};
+    param.sched_priority     = config_->priority;
+    return pthread_setschedparam(pthread_self(), config_->policy, &param);
+}
+
+//---------------------------------------------------------------------------
+bool realtime_set_scheduler(const realtime_config_t* config_)
+{
+    return (realtime_scheduler(config_) == 0);
+}
+
+//---------------------------------------------------------------------------
+// Touch the stack and a block of heap so that every page we're likely to use is
+// resident before mlockall(), and keep the allocator from handing heap back.
+static void realtime_prefault(void)
+{
+    volatile uint8_t stack[REALTIME_PREFAULT_STACK];
+    for (size_t i = 0; i < sizeof(stack); i += 4096) {
+        stack[i] = 0;
+    }
+
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    uint8_t* heap = (uint8_t*)(malloc(REALTIME_PREFAULT_HEAP));
+    if (heap) {
+        for (size_t i = 0; i < REALTIME_PREFAULT_HEAP; i += 4096) {
+            heap[i] = 0;
+        }
+        free(heap);
+    }
+}
+
+//---------------------------------------------------------------------------
+bool realtime_apply(const realtime_config_t* config_)
+{
+    if (!config_->enabled) {
+        return true;
+    }
+
+    char setting[64];
+    bool ok = true;
+
+    int rc = realtime_scheduler(config_);
+    snprintf(setting,
+             sizeof(setting),
+             "%s priority %d",
+             (config_->policy == SCHED_RR) ? "SCHED_RR" : "SCHED_FIFO",
+             config_->priority);
+    realtime_report(setting, rc);
+    ok &= (rc == 0);
+
+    if (config_->cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(config_->cpu, &cpus);
+        rc = (sched_setaffinity(0, sizeof(cpus), &cpus) == 0) ? 0 : errno;
+        snprintf(setting, sizeof(setting), "pinned to cpu %d", config_->cpu);
+        realtime_report(setting, rc);
+        ok &= (rc == 0);
+    }
+
+    realtime_prefault();
+    rc = (mlockall(MCL_CURRENT | MCL_FUTURE) == 0) ? 0 : errno;
+    realtime_report("memory locked (mlockall)", rc);
+    ok &= (rc == 0);
+
+    return ok;
+}
+
+//---------------------------------------------------------------------------
+bool realtime_apply_socket(int fd_, const realtime_config_t* config_)
+{
+    if (!config_->enabled) {
+        return true;
+    }
+
+    char setting[64];
+    bool ok = true;
+
+    int rc = setsockopt(fd_, SOL_SOCKET, SO_PRIORITY, &config_->socketPriority, sizeof(config_->socketPriority));
+    snprintf(setting, sizeof(setting), "fd=%d SO_PRIORITY %d", fd_, config_->socketPriority);
+    realtime_report(setting, (rc == 0) ? 0 : errno);
+    ok &= (rc == 0);
+
+    rc = setsockopt(fd_, IPPROTO_IP, IP_TOS, &config_->tos, sizeof(config_->tos));
+    snprintf(setting, sizeof(setting), "fd=%d IP_TOS 0x%02x", fd_, config_->tos);
+    realtime_report(setting, (rc == 0) ? 0 : errno);
+    ok &= (rc == 0);
+
+    return ok;
+}
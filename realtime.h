@@ -0,0 +1,80 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+#define REALTIME_DEFAULT_PRIORITY (50)          //!< Default SCHED_FIFO/SCHED_RR priority
+#define REALTIME_DEFAULT_SOCKET_PRIORITY (6)    //!< Default SO_PRIORITY (TC_PRIO_INTERACTIVE)
+#define REALTIME_DEFAULT_TOS (0xB8)             //!< Default IP_TOS (DSCP EF, expedited forwarding)
+#define REALTIME_PREFAULT_STACK (256 * 1024)    //!< Stack touched up-front so it is resident when locked
+#define REALTIME_PREFAULT_HEAP (1024 * 1024)    //!< Heap touched up-front and kept by the allocator
+
+//---------------------------------------------------------------------------
+// Options for running with real-time scheduling, so that input handling isn't
+// held up by other work on a busy machine.
+typedef struct {
+    bool enabled;           //!< Apply real-time settings at all
+    int  policy;            //!< Scheduling policy (SCHED_FIFO or SCHED_RR)
+    int  priority;          //!< Scheduling priority
+    int  cpu;               //!< CPU to pin the process to (-1 == no pinning)
+    int  socketPriority;    //!< SO_PRIORITY applied to sockets
+    int  tos;               //!< IP_TOS applied to sockets
+} realtime_config_t;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief realtime_config_init initialize real-time options to their defaults (disabled)
+ * @param config_ object to initialize
+ */
+void realtime_config_init(realtime_config_t* config_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief realtime_policy_from_string parse a scheduling policy name ("fifo", "rr")
+ * @param str_ string to parse
+ * @param policy_ [out] SCHED_FIFO or SCHED_RR
+ * @return true on success, false if the string does not name a policy
+ */
+bool realtime_policy_from_string(const char* str_, int* policy_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief realtime_set_scheduler apply the real-time scheduling policy and
+ * priority to the calling thread
+ * @param config_ real-time options
+ * @return true on success
+ */
+bool realtime_set_scheduler(const realtime_config_t* config_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief realtime_apply apply the real-time options to the process: scheduling
+ * policy, CPU affinity, and locked, prefaulted memory.  Prints which of the
+ * settings took effect.  Does nothing if real-time mode is disabled.
+ * @param config_ real-time options
+ * @return true if every setting took effect
+ */
+bool realtime_apply(const realtime_config_t* config_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief realtime_apply_socket set the socket priority and IP type-of-service
+ * on a socket.  Prints which of the settings took effect.  Does nothing if
+ * real-time mode is disabled.
+ * @param fd_ socket to configure
+ * @param config_ real-time options
+ * @return true if every setting took effect
+ */
+bool realtime_apply_socket(int fd_, const realtime_config_t* config_);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
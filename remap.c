@@ -0,0 +1,576 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#include "remap.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <linux/input.h>
+
+#include "evcodes.h"
+
+//---------------------------------------------------------------------------
+#define REMAP_MAX_LINE (512)
+
+//---------------------------------------------------------------------------
+static remap_section_t* remap_config_add_section(remap_config_t* config_)
+{
+    remap_section_t* sections
+        = (remap_section_t*)(realloc(config_->sections, sizeof(remap_section_t) * (config_->sectionCount + 1)));
+    if (!sections) {
+        return NULL;
+    }
+    config_->sections = sections;
+
+    remap_section_t* section = &sections[config_->sectionCount++];
+    memset(section, 0, sizeof(*section));
+    return section;
+}
+
+//---------------------------------------------------------------------------
+static bool remap_section_add_rule(remap_section_t* section_, const remap_rule_t* rule_)
+{
+    remap_rule_t* rules = (remap_rule_t*)(realloc(section_->rules, sizeof(remap_rule_t) * (section_->ruleCount + 1)));
+    if (!rules) {
+        return false;
+    }
+    section_->rules                        = rules;
+    section_->rules[section_->ruleCount++] = *rule_;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+static bool remap_parse_section(remap_section_t* section_, const char* line_)
+{
+    unsigned int vid;
+    unsigned int pid;
+    char         close;
+
+    if (!strcmp(line_, "[*]")) {
+        section_->match = RemapMatchAny;
+        return true;
+    }
+    if (sscanf(line_, "[name \"%255[^\"]\"%c", section_->name, &close) == 2 && (close == ']')) {
+        section_->match = RemapMatchName;
+        return true;
+    }
+    if (sscanf(line_, "[id %x:%x%c", &vid, &pid, &close) == 3 && (close == ']') && (vid <= 0xFFFF)
+        && (pid <= 0xFFFF)) {
+        section_->match = RemapMatchId;
+        section_->vid   = (uint16_t)vid;
+        section_->pid   = (uint16_t)pid;
+        return true;
+    }
+    return false;
+}
+
+//---------------------------------------------------------------------------
+static bool remap_parse_int(const char* token_, int32_t* value_)
+{
+    char* end;
+    long  value = strtol(token_, &end, 0);
+    if ((end == token_) || (*end != '\0')) {
+        return false;
+    }
+    *value_ = (int32_t)value;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// <input> [< or > <threshold>] -> <output|none> [<rel value>]
+static bool remap_parse_rule(remap_rule_t* rule_, char* line_)
+{
+    char* tokens[8];
+    int   count = 0;
+    char* save;
+    for (char* token = strtok_r(line_, " \t", &save); token; token = strtok_r(NULL, " \t", &save)) {
+        if (count == (int)(sizeof(tokens) / sizeof(tokens[0]))) {
+            return false;
+        }
+        tokens[count++] = token;
+    }
+
+    memset(rule_, 0, sizeof(*rule_));
+    if ((count < 3) || !evcodes_lookup(tokens[0], &rule_->inType, &rule_->inCode)) {
+        return false;
+    }
+
+    int next = 1;
+    if (!strcmp(tokens[next], "<") || !strcmp(tokens[next], ">")) {
+        if ((rule_->inType != EV_ABS) || (count < 5) || !remap_parse_int(tokens[next + 1], &rule_->threshold)) {
+            return false;
+        }
+        rule_->compare = (tokens[next][0] == '<') ? RemapCompareBelow : RemapCompareAbove;
+        next += 2;
+    }
+    if (strcmp(tokens[next++], "->")) {
+        return false;
+    }
+
+    if (strcmp(tokens[next], "none") && !evcodes_lookup(tokens[next], &rule_->outType, &rule_->outCode)) {
+        return false;
+    }
+    next++;
+
+    // Relative outputs may be given the value emitted per activation (default 1)
+    if (rule_->outType == EV_REL) {
+        rule_->outValue = 1;
+        if ((next < count) && !remap_parse_int(tokens[next++], &rule_->outValue)) {
+            return false;
+        }
+    }
+    if (next != count) {
+        return false;
+    }
+
+    // Only conversions that have a sensible meaning are allowed: axis values
+    // can't be turned into buttons without a threshold, nor buttons into axes.
+    bool digital = (rule_->inType == EV_KEY) || (rule_->compare != RemapCompareNone);
+    switch (rule_->outType) {
+        case 0: return (rule_->compare == RemapCompareNone);
+        case EV_KEY: return digital;
+        case EV_REL: return digital || (rule_->inType == EV_REL);
+        case EV_ABS: return !digital && (rule_->inType == EV_ABS);
+        default: return false;
+    }
+}
+
+//---------------------------------------------------------------------------
+remap_config_t* remap_config_parse(const char* text_, const char* source_)
+{
+    remap_config_t*  config  = (remap_config_t*)(calloc(1, sizeof(remap_config_t)));
+    remap_section_t* section = NULL;
+    int              lineNum = 0;
+
+    const char* cursor = text_;
+    while (*cursor) {
+        const char* end = strchr(cursor, '\n');
+        size_t      len = end ? (size_t)(end - cursor) : strlen(cursor);
+        lineNum++;
+
+        char line[REMAP_MAX_LINE];
+        if (len >= sizeof(line)) {
+            printf("%s:%d: line too long\n", source_, lineNum);
+            remap_config_destroy(config);
+            return NULL;
+        }
+        memcpy(line, cursor, len);
+        line[len] = '\0';
+        cursor += len + (end ? 1 : 0);
+
+        // Strip comments and surrounding whitespace
+        char* comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+        char* start = line;
+        while ((*start == ' ') || (*start == '\t')) {
+            start++;
+        }
+        for (char* last = start + strlen(start); (last > start) && strchr(" \t\r", last[-1]); last--) {
+            last[-1] = '\0';
+        }
+        if (*start == '\0') {
+            continue;
+        }
+
+        if (*start == '[') {
+            section = remap_config_add_section(config);
+            if (!section || !remap_parse_section(section, start)) {
+                printf("%s:%d: invalid section: %s\n", source_, lineNum, start);
+                remap_config_destroy(config);
+                return NULL;
+            }
+            continue;
+        }
+
+        char         copy[REMAP_MAX_LINE];
+        remap_rule_t rule;
+        strcpy(copy, start);
+        if (!section) {
+            printf("%s:%d: rule outside of a section\n", source_, lineNum);
+            remap_config_destroy(config);
+            return NULL;
+        }
+        if (!remap_parse_rule(&rule, copy) || !remap_section_add_rule(section, &rule)) {
+            printf("%s:%d: invalid rule: %s\n", source_, lineNum, start);
+            remap_config_destroy(config);
+            return NULL;
+        }
+    }
+
+    return config;
+}
+
+//---------------------------------------------------------------------------
+remap_config_t* remap_config_load(const char* path_)
+{
+    FILE* file = fopen(path_, "r");
+    if (!file) {
+        printf("unable to open remap file %s\n", path_);
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char* text = (char*)(calloc(1, (size > 0 ? size : 0) + 1));
+    if ((size > 0) && (fread(text, 1, size, file) != (size_t)size)) {
+        printf("unable to read remap file %s\n", path_);
+        free(text);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+
+    remap_config_t* config = remap_config_parse(text, path_);
+    free(text);
+    return config;
+}
+
+//---------------------------------------------------------------------------
+void remap_config_destroy(remap_config_t* config_)
+{
+    if (!config_) {
+        return;
+    }
+    for (int i = 0; i < config_->sectionCount; i++) {
+        free(config_->sections[i].rules);
+    }
+    free(config_->sections);
+    free(config_);
+}
+
+//---------------------------------------------------------------------------
+static const remap_section_t* remap_find_section(const remap_config_t* remap_, const js_config_t* input_)
+{
+    for (int i = 0; i < remap_->sectionCount; i++) {
+        const remap_section_t* section = &remap_->sections[i];
+        switch (section->match) {
+            case RemapMatchAny: return section;
+            case RemapMatchName: {
+                if (!strncmp(section->name, input_->name, sizeof(input_->name))) {
+                    return section;
+                }
+            } break;
+            case RemapMatchId: {
+                if ((section->vid == input_->vid) && (section->pid == input_->pid)) {
+                    return section;
+                }
+            } break;
+        }
+    }
+    return NULL;
+}
+
+//---------------------------------------------------------------------------
+// Last direct (non-threshold) rule for an input wins, so later lines override earlier ones
+static const remap_rule_t* remap_find_rule(const remap_section_t* section_, uint16_t type_, uint16_t code_)
+{
+    const remap_rule_t* found = NULL;
+    for (int i = 0; i < section_->ruleCount; i++) {
+        const remap_rule_t* rule = &section_->rules[i];
+        if ((rule->inType == type_) && (rule->inCode == code_) && (rule->compare == RemapCompareNone)) {
+            found = rule;
+        }
+    }
+    return found;
+}
+
+//---------------------------------------------------------------------------
+// Add a key to the output device (once), returning its reference-count index,
+// or -1 if the device already has as many keys as it can hold
+static int32_t remap_output_key(js_config_t* output_, uint16_t code_)
+{
+    for (int i = 0; i < output_->buttonCount; i++) {
+        if (output_->buttons[i] == code_) {
+            return i;
+        }
+    }
+    if (output_->buttonCount >= KEY_CNT) {
+        return -1;
+    }
+    output_->buttons[output_->buttonCount] = code_;
+    return output_->buttonCount++;
+}
+
+//---------------------------------------------------------------------------
+static bool remap_output_rel(js_config_t* output_, uint16_t code_)
+{
+    for (int i = 0; i < output_->relAxisCount; i++) {
+        if (output_->relAxis[i] == code_) {
+            return true;
+        }
+    }
+    if (output_->relAxisCount >= REL_CNT) {
+        return false;
+    }
+    output_->relAxis[output_->relAxisCount++] = code_;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+static bool remap_output_abs(js_config_t* output_, const js_config_t* input_, int index_, uint16_t code_)
+{
+    for (int i = 0; i < output_->absAxisCount; i++) {
+        if (output_->absAxis[i] == code_) {
+            return true;
+        }
+    }
+    if (output_->absAxisCount >= ABS_CNT) {
+        return false;
+    }
+    int i                         = output_->absAxisCount++;
+    output_->absAxis[i]           = code_;
+    output_->absAxisMin[i]        = input_->absAxisMin[index_];
+    output_->absAxisMax[i]        = input_->absAxisMax[index_];
+    output_->absAxisFuzz[i]       = input_->absAxisFuzz[index_];
+    output_->absAxisFlat[i]       = input_->absAxisFlat[index_];
+    output_->absAxisResolution[i] = input_->absAxisResolution[index_];
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Build the action for an input from its rule (or pass it through if there is
+// none), and register the action's output with the virtual device.  Returns
+// false if the virtual device has no room left for the output.
+static bool remap_compile_action(remap_action_t*     action_,
+                                 const remap_rule_t* rule_,
+                                 uint16_t            type_,
+                                 uint16_t            code_,
+                                 js_config_t*        output_,
+                                 const js_config_t*  input_,
+                                 int                 index_)
+{
+    action_->type  = rule_ ? rule_->outType : type_;
+    action_->code  = rule_ ? rule_->outCode : code_;
+    action_->value = rule_ ? rule_->outValue : 0;
+
+    switch (action_->type) {
+        case EV_KEY: {
+            action_->keyIndex = remap_output_key(output_, action_->code);
+            return (action_->keyIndex >= 0);
+        }
+        case EV_REL: return remap_output_rel(output_, action_->code);
+        case EV_ABS: return remap_output_abs(output_, input_, index_, action_->code);
+        default: return true;
+    }
+}
+
+//---------------------------------------------------------------------------
+bool remap_config_matches(const remap_config_t* remap_, const js_config_t* input_)
+{
+    return (remap_find_section(remap_, input_) != NULL);
+}
+
+//---------------------------------------------------------------------------
+remap_device_t* remap_device_create(const remap_config_t* remap_, const js_config_t* input_, js_config_t* output_)
+{
+    const remap_section_t* section = remap_find_section(remap_, input_);
+    if (!section) {
+        return NULL;
+    }
+
+    remap_device_t* device = (remap_device_t*)(calloc(1, sizeof(remap_device_t)));
+    if (!device) {
+        return NULL;
+    }
+
+    device->absAxisCount  = input_->absAxisCount;
+    device->relAxisCount  = input_->relAxisCount;
+    device->buttonCount   = input_->buttonCount;
+    device->relOffset     = sizeof(int32_t) * input_->absAxisCount;
+    device->buttonsOffset = device->relOffset + (sizeof(int32_t) * input_->relAxisCount);
+    device->reportSize    = joystick_get_report_size(input_);
+
+    memset(output_, 0, sizeof(*output_));
+    memcpy(output_->name, input_->name, sizeof(output_->name));
+    output_->vid = input_->vid;
+    output_->pid = input_->pid;
+
+    // Allocate at least one element per table so that empty devices still get valid pointers
+    device->buttonActions  = (remap_action_t*)(calloc(input_->buttonCount + 1, sizeof(remap_action_t)));
+    device->absActions     = (remap_action_t*)(calloc(input_->absAxisCount + 1, sizeof(remap_action_t)));
+    device->relActions     = (remap_action_t*)(calloc(input_->relAxisCount + 1, sizeof(remap_action_t)));
+    device->thresholdStart = (int*)(calloc(input_->absAxisCount + 1, sizeof(int)));
+    device->thresholds     = (remap_threshold_t*)(calloc(section->ruleCount + 1, sizeof(remap_threshold_t)));
+    device->lastReport     = (uint8_t*)(calloc(1, device->reportSize + 1));
+    if (!device->buttonActions || !device->absActions || !device->relActions || !device->thresholdStart
+        || !device->thresholds || !device->lastReport) {
+        remap_device_destroy(device);
+        return NULL;
+    }
+
+    // Inputs can be turned into other kinds of output, so a device with full
+    // tables (each input code once) could overflow the virtual device's
+    bool fits = true;
+    for (int i = 0; (i < input_->absAxisCount) && fits; i++) {
+        uint16_t code = input_->absAxis[i];
+        fits          = remap_compile_action(
+            &device->absActions[i], remap_find_rule(section, EV_ABS, code), EV_ABS, code, output_, input_, i);
+
+        // Thresholds are grouped by axis so each axis only visits its own
+        device->thresholdStart[i] = device->thresholdCount;
+        for (int j = 0; (j < section->ruleCount) && fits; j++) {
+            const remap_rule_t* rule = &section->rules[j];
+            if ((rule->inType != EV_ABS) || (rule->inCode != code) || (rule->compare == RemapCompareNone)) {
+                continue;
+            }
+            if (device->thresholdCount >= section->ruleCount) {
+                fits = false;   // the same axis listed twice
+                break;
+            }
+            remap_threshold_t* threshold = &device->thresholds[device->thresholdCount++];
+            threshold->threshold         = rule->threshold;
+            threshold->above             = (rule->compare == RemapCompareAbove);
+            fits = remap_compile_action(&threshold->action, rule, EV_ABS, code, output_, input_, i);
+        }
+    }
+    device->thresholdStart[input_->absAxisCount] = device->thresholdCount;
+
+    for (int i = 0; (i < input_->relAxisCount) && fits; i++) {
+        uint16_t code = input_->relAxis[i];
+        fits          = remap_compile_action(
+            &device->relActions[i], remap_find_rule(section, EV_REL, code), EV_REL, code, output_, input_, i);
+    }
+    for (int i = 0; (i < input_->buttonCount) && fits; i++) {
+        uint16_t code = input_->buttons[i];
+        fits          = remap_compile_action(
+            &device->buttonActions[i], remap_find_rule(section, EV_KEY, code), EV_KEY, code, output_, input_, i);
+    }
+    if (!fits) {
+        printf("remapped device has too many outputs\n");
+        remap_device_destroy(device);
+        return NULL;
+    }
+
+    device->thresholdActive = (uint8_t*)(calloc(device->thresholdCount + 1, sizeof(uint8_t)));
+    device->keyCount        = output_->buttonCount;
+    device->keyRefs         = (uint16_t*)(calloc(device->keyCount + 1, sizeof(uint16_t)));
+    if (!device->thresholdActive || !device->keyRefs) {
+        remap_device_destroy(device);
+        return NULL;
+    }
+    device->maxEvents = input_->absAxisCount + input_->relAxisCount + input_->buttonCount + device->thresholdCount;
+
+    // Every threshold starts out inactive, with no key held; the first report
+    // decides which are active, and presses their keys on the virtual device.
+    return device;
+}
+
+//---------------------------------------------------------------------------
+void remap_device_destroy(remap_device_t* device_)
+{
+    if (!device_) {
+        return;
+    }
+    free(device_->buttonActions);
+    free(device_->absActions);
+    free(device_->relActions);
+    free(device_->thresholdStart);
+    free(device_->thresholds);
+    free(device_->thresholdActive);
+    free(device_->keyRefs);
+    free(device_->lastReport);
+    free(device_);
+}
+
+//---------------------------------------------------------------------------
+static inline size_t
+remap_emit(struct input_event* events_, size_t count_, uint16_t type_, uint16_t code_, int32_t value_)
+{
+    /* timestamp values are ignored by uinput */
+    events_[count_].time.tv_sec  = 0;
+    events_[count_].time.tv_usec = 0;
+    events_[count_].type         = type_;
+    events_[count_].code         = code_;
+    events_[count_].value        = value_;
+    return count_ + 1;
+}
+
+//---------------------------------------------------------------------------
+// Apply a digital (on/off) input edge.  Several inputs may drive the same key;
+// it is held down for as long as any of them is active.
+static inline size_t remap_digital(remap_device_t*       device_,
+                                   const remap_action_t* action_,
+                                   bool                  active_,
+                                   struct input_event*   events_,
+                                   size_t                count_)
+{
+    switch (action_->type) {
+        case EV_KEY: {
+            uint16_t* refs = &device_->keyRefs[action_->keyIndex];
+            if (active_) {
+                if ((*refs)++ == 0) {
+                    count_ = remap_emit(events_, count_, EV_KEY, action_->code, 1);
+                }
+            } else if (*refs > 0) {
+                if (--(*refs) == 0) {
+                    count_ = remap_emit(events_, count_, EV_KEY, action_->code, 0);
+                }
+            }
+        } break;
+        case EV_REL: {
+            if (active_) {
+                count_ = remap_emit(events_, count_, EV_REL, action_->code, action_->value);
+            }
+        } break;
+        default: break;
+    }
+    return count_;
+}
+
+//---------------------------------------------------------------------------
+size_t remap_device_apply(remap_device_t* device_, const uint8_t* report_, struct input_event* events_)
+{
+    size_t count = 0;
+
+    for (int i = 0; i < device_->absAxisCount; i++) {
+        int32_t value;
+        int32_t last;
+        memcpy(&value, report_ + (i * sizeof(int32_t)), sizeof(int32_t));
+        memcpy(&last, device_->lastReport + (i * sizeof(int32_t)), sizeof(int32_t));
+        if ((value == last) && device_->primed) {
+            continue;
+        }
+
+        const remap_action_t* action = &device_->absActions[i];
+        if ((action->type == EV_ABS) && (value != last)) {
+            count = remap_emit(events_, count, EV_ABS, action->code, value);
+        }
+        for (int t = device_->thresholdStart[i]; t < device_->thresholdStart[i + 1]; t++) {
+            const remap_threshold_t* threshold = &device_->thresholds[t];
+            bool active = threshold->above ? (value > threshold->threshold) : (value < threshold->threshold);
+            if (active != (bool)device_->thresholdActive[t]) {
+                device_->thresholdActive[t] = active;
+                count                       = remap_digital(device_, &threshold->action, active, events_, count);
+            }
+        }
+    }
+
+    for (int i = 0; i < device_->relAxisCount; i++) {
+        int32_t value;
+        memcpy(&value, report_ + device_->relOffset + (i * sizeof(int32_t)), sizeof(int32_t));
+        if ((value != 0) && (device_->relActions[i].type == EV_REL)) {
+            count = remap_emit(events_, count, EV_REL, device_->relActions[i].code, value);
+        }
+    }
+
+    const uint8_t* buttons     = report_ + device_->buttonsOffset;
+    const uint8_t* lastButtons = device_->lastReport + device_->buttonsOffset;
+    for (int i = 0; i < device_->buttonCount; i++) {
+        // Key repeats (a held button changing value) aren't remapped
+        if ((buttons[i] != 0) != (lastButtons[i] != 0)) {
+            count = remap_digital(device_, &device_->buttonActions[i], buttons[i] != 0, events_, count);
+        }
+    }
+
+    memcpy(device_->lastReport, report_, device_->reportSize);
+    device_->primed = true;
+    return count;
+}
@@ -0,0 +1,195 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <linux/input.h>
+
+#include "joystick.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+// Remapping turns the buttons and axes of a remote device into different
+// events on the server's virtual device; for example, driving a keyboard from a
+// gamepad.  Rules are read from a text file of sections and rules:
+//
+//   # comment
+//   [*]                     -- rules for any device
+//   [name "Pad Name"]       -- rules for devices with the given name
+//   [id 045e:028e]          -- rules for devices with the given USB vid:pid
+//
+//   BTN_SOUTH -> KEY_ENTER          button to key/button
+//   BTN_MODE -> none                drop a button or axis
+//   BTN_TL -> REL_WHEEL 1           button to a single step of relative motion
+//   ABS_Z -> ABS_BRAKE              move an axis to a different axis code
+//   REL_HWHEEL -> none              drop a relative axis
+//   ABS_HAT0X < 0 -> KEY_LEFT       key held while the axis is below a threshold
+//   ABS_HAT0X > 0 -> KEY_RIGHT      key held while the axis is above a threshold
+//
+// The first section matching a device is used.  Inputs with no rule are passed
+// through unchanged; threshold rules do not stop an axis from passing through.
+//
+// When a device registers, its section is compiled into flat lookup tables
+// indexed by the device's report layout, so applying a report only touches
+// the fields that changed.
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+// Comparison used by threshold rules
+typedef enum {
+    RemapCompareNone = 0,   //!< Rule applies to the input directly
+    RemapCompareBelow,      //!< Rule is active while the axis is below the threshold
+    RemapCompareAbove       //!< Rule is active while the axis is above the threshold
+} remap_compare_t;
+
+//---------------------------------------------------------------------------
+// Single parsed rule
+typedef struct {
+    uint16_t        inType;     //!< Input event type (EV_KEY, EV_ABS or EV_REL)
+    uint16_t        inCode;     //!< Input event code
+    remap_compare_t compare;    //!< Threshold comparison (absolute axes only)
+    int32_t         threshold;  //!< Threshold value
+    uint16_t        outType;    //!< Output event type (0 == drop the input)
+    uint16_t        outCode;    //!< Output event code
+    int32_t         outValue;   //!< Value emitted for EV_REL outputs
+} remap_rule_t;
+
+//---------------------------------------------------------------------------
+// How a section decides which devices it applies to
+typedef enum { RemapMatchAny = 0, RemapMatchName, RemapMatchId } remap_match_t;
+
+//---------------------------------------------------------------------------
+// A group of rules for a set of devices
+typedef struct {
+    remap_match_t match;        //!< How to match devices
+    char          name[256];    //!< Device name (RemapMatchName)
+    uint16_t      vid;          //!< USB vendor ID (RemapMatchId)
+    uint16_t      pid;          //!< USB product ID (RemapMatchId)
+    remap_rule_t* rules;        //!< Rules in the section
+    int           ruleCount;    //!< Number of rules in the section
+} remap_section_t;
+
+//---------------------------------------------------------------------------
+// A parsed remapping file
+typedef struct {
+    remap_section_t* sections;      //!< Sections, in file order
+    int              sectionCount;  //!< Number of sections
+} remap_config_t;
+
+//---------------------------------------------------------------------------
+// Compiled action for a single input (or threshold)
+typedef struct {
+    uint16_t type;      //!< Output event type (0 == drop)
+    uint16_t code;      //!< Output event code
+    int32_t  value;     //!< EV_REL: motion emitted when the input activates
+    int32_t  keyIndex;  //!< EV_KEY: index of the output key's reference count
+} remap_action_t;
+
+//---------------------------------------------------------------------------
+// Compiled threshold on an absolute axis
+typedef struct {
+    int32_t        threshold;   //!< Threshold value
+    bool           above;       //!< Active above (true) or below (false) the threshold
+    remap_action_t action;      //!< Action taken while active
+} remap_threshold_t;
+
+//---------------------------------------------------------------------------
+// Per-device remapping tables and state, built from a remap_config_t section
+typedef struct {
+    int    absAxisCount;    //!< Number of absolute axes in the input report
+    int    relAxisCount;    //!< Number of relative axes in the input report
+    int    buttonCount;     //!< Number of buttons in the input report
+    size_t relOffset;       //!< Offset of the relative axes in the input report
+    size_t buttonsOffset;   //!< Offset of the buttons in the input report
+    size_t reportSize;      //!< Size of the input report
+
+    remap_action_t*    buttonActions;       //!< [buttonCount] action for each button
+    remap_action_t*    absActions;          //!< [absAxisCount] action for each absolute axis
+    remap_action_t*    relActions;          //!< [relAxisCount] action for each relative axis
+    int*               thresholdStart;      //!< [absAxisCount + 1] first threshold for each absolute axis
+    remap_threshold_t* thresholds;          //!< Thresholds, grouped by axis
+    uint8_t*           thresholdActive;     //!< Whether each threshold is currently active
+    int                thresholdCount;      //!< Number of thresholds
+    uint16_t*          keyRefs;             //!< Number of active inputs holding each output key down
+    int                keyCount;            //!< Number of output keys
+    size_t             maxEvents;           //!< Largest number of events a single report can produce
+    bool               primed;              //!< Whether a report has been applied (and thresholds evaluated)
+
+    uint8_t* lastReport;    //!< Previous input report
+} remap_device_t;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief remap_config_parse parse remapping rules from a string
+ * @param text_ NUL-terminated rules text
+ * @param source_ name used in error messages (i.e. the file name)
+ * @return newly-constructed configuration, or NULL on a syntax error
+ */
+remap_config_t* remap_config_parse(const char* text_, const char* source_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief remap_config_load read and parse a remapping file
+ * @param path_ path to the file
+ * @return newly-constructed configuration, or NULL on error
+ */
+remap_config_t* remap_config_load(const char* path_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief remap_config_destroy destruct a previously-constructed configuration
+ * NOTE: object must not be used after this is called.
+ * @param config_ configuration to destroy
+ */
+void remap_config_destroy(remap_config_t* config_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief remap_device_create compile the rules that apply to a device
+ * @param remap_ remapping configuration
+ * @param input_ configuration of the remote device
+ * @param output_ [out] configuration for the virtual device, which supports
+ * every event the remapped device can produce
+ * @return newly-constructed remapping tables, or NULL if no section applies to
+ * the device (see remap_config_matches()), if the remapped device would have
+ * more keys or axes than a device can, or on allocation error
+ */
+remap_device_t* remap_device_create(const remap_config_t* remap_, const js_config_t* input_, js_config_t* output_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief remap_config_matches check whether any section applies to a device;
+ * devices that match none are passed through unchanged
+ * @param remap_ remapping configuration
+ * @param input_ configuration of the remote device
+ * @return true if the device is to be remapped
+ */
+bool remap_config_matches(const remap_config_t* remap_, const js_config_t* input_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief remap_device_destroy destruct previously-constructed remapping tables
+ * NOTE: object must not be used after this is called.
+ * @param device_ object to destroy
+ */
+void remap_device_destroy(remap_device_t* device_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief remap_device_apply convert a raw input report into remapped events
+ * @param device_ remapping tables for the device
+ * @param report_ raw input report
+ * @param events_ [out] array of at least device_->maxEvents events
+ * @return number of events written (not including an EV_SYN)
+ */
+size_t remap_device_apply(remap_device_t* device_, const uint8_t* report_, struct input_event* events_);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
@@ -0,0 +1,263 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#include "report_builder.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timestamp.h"
+
+//---------------------------------------------------------------------------
+void report_builder_config_init(report_builder_config_t* config_)
+{
+    config_->absRateHz  = 0;
+    config_->relRateHz  = 0;
+    config_->filterAxes = false;
+}
+
+//---------------------------------------------------------------------------
+report_builder_t* report_builder_create(const js_config_t* config_, const report_builder_config_t* options_)
+{
+    report_builder_t* newBuilder = (report_builder_t*)(calloc(1, sizeof(report_builder_t)));
+    if (!newBuilder) {
+        return NULL;
+    }
+
+    newBuilder->config        = config_;
+    newBuilder->options       = *options_;
+    newBuilder->rawReportSize = joystick_get_report_size(config_);
+    newBuilder->relOffset     = sizeof(int32_t) * config_->absAxisCount;
+    newBuilder->buttonsOffset = newBuilder->relOffset + (sizeof(int32_t) * config_->relAxisCount);
+
+    // Allocate room for at least one byte so that empty devices still get valid pointers
+    size_t allocSize       = newBuilder->rawReportSize ? newBuilder->rawReportSize : 1;
+    newBuilder->rawReport  = (uint8_t*)(calloc(1, allocSize));
+    newBuilder->sentReport = (uint8_t*)(calloc(1, allocSize));
+    if (!newBuilder->rawReport || !newBuilder->sentReport) {
+        report_builder_destroy(newBuilder);
+        return NULL;
+    }
+
+    newBuilder->report.absAxis = (int32_t*)newBuilder->rawReport;
+    newBuilder->report.relAxis = (int32_t*)(newBuilder->rawReport + newBuilder->relOffset);
+    newBuilder->report.buttons = (uint8_t*)(newBuilder->rawReport + newBuilder->buttonsOffset);
+
+    return newBuilder;
+}
+
+//---------------------------------------------------------------------------
+void report_builder_destroy(report_builder_t* builder_)
+{
+    if (!builder_) {
+        return;
+    }
+    free(builder_->rawReport);
+    free(builder_->sentReport);
+    free(builder_);
+}
+
+//---------------------------------------------------------------------------
+void report_builder_set_button(report_builder_t* builder_, int index_, int32_t value_)
+{
+    // A held button keeps its repeat phase
+    if (!value_ || !builder_->report.buttons[index_]) {
+        builder_->report.buttons[index_] = !!value_;
+    }
+}
+
+//---------------------------------------------------------------------------
+void report_builder_repeat_button(report_builder_t* builder_, int index_)
+{
+    if (builder_->report.buttons[index_]) {
+        builder_->report.buttons[index_] ^= 3;
+    }
+}
+
+//---------------------------------------------------------------------------
+// Same smoothing the kernel's input core applies for an axis' fuzz value
+static int32_t report_builder_defuzz(int32_t value_, int32_t old_, int32_t fuzz_)
+{
+    if (fuzz_ > 0) {
+        if ((value_ > old_ - fuzz_ / 2) && (value_ < old_ + fuzz_ / 2)) {
+            return old_;
+        }
+        if ((value_ > old_ - fuzz_) && (value_ < old_ + fuzz_)) {
+            return (old_ * 3 + value_) / 4;
+        }
+        if ((value_ > old_ - fuzz_ * 2) && (value_ < old_ + fuzz_ * 2)) {
+            return (old_ + value_) / 2;
+        }
+    }
+    return value_;
+}
+
+//---------------------------------------------------------------------------
+void report_builder_set_abs(report_builder_t* builder_, int index_, int32_t value_)
+{
+    if (builder_->options.filterAxes) {
+        const js_config_t* config = builder_->config;
+
+        int32_t flat   = config->absAxisFlat[index_];
+        int32_t center = config->absAxisMin[index_] + ((config->absAxisMax[index_] - config->absAxisMin[index_]) / 2);
+        if ((flat > 0) && (value_ >= center - flat) && (value_ <= center + flat)) {
+            value_ = center;
+        }
+
+        int32_t old = builder_->report.absAxis[index_];
+        value_      = report_builder_defuzz(value_, old, config->absAxisFuzz[index_]);
+        if (value_ == old) {
+            builder_->stats.filtered++;
+        }
+    }
+    builder_->report.absAxis[index_] = value_;
+}
+
+//---------------------------------------------------------------------------
+void report_builder_add_rel(report_builder_t* builder_, int index_, int32_t delta_)
+{
+    builder_->report.relAxis[index_] += delta_;
+}
+
+//---------------------------------------------------------------------------
+static bool report_builder_has_motion(const report_builder_t* builder_)
+{
+    for (int i = 0; i < builder_->config->relAxisCount; i++) {
+        if (builder_->report.relAxis[i] != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//---------------------------------------------------------------------------
+// Absolute axes and buttons hold state; compare them against what was last sent.
+static bool report_builder_abs_changed(const report_builder_t* builder_)
+{
+    return (memcmp(builder_->rawReport, builder_->sentReport, builder_->relOffset) != 0);
+}
+
+//---------------------------------------------------------------------------
+static bool report_builder_buttons_changed(const report_builder_t* builder_)
+{
+    return (memcmp(builder_->rawReport + builder_->buttonsOffset,
+                   builder_->sentReport + builder_->buttonsOffset,
+                   builder_->rawReportSize - builder_->buttonsOffset)
+            != 0);
+}
+
+//---------------------------------------------------------------------------
+// Earliest time at which a report with this class of change may be sent
+static uint64_t report_builder_class_deadline(const report_builder_t* builder_, int rateHz_, uint64_t now_)
+{
+    if (rateHz_ <= 0) {
+        return now_;
+    }
+    return builder_->lastSent + (NSEC_PER_SEC / rateHz_);
+}
+
+//---------------------------------------------------------------------------
+bool report_builder_sync(report_builder_t* builder_, uint64_t now_)
+{
+    builder_->stats.syncs++;
+
+    // Button edges always go out immediately, carrying any axis state with them.
+    if (report_builder_buttons_changed(builder_)) {
+        return true;
+    }
+
+    // Nothing the server would notice has changed since the last report; drop
+    // it, along with any report waiting on a rate limit (the axes it was
+    // holding have returned to the values the server already has).
+    bool absChanged = report_builder_abs_changed(builder_);
+    bool hasMotion  = report_builder_has_motion(builder_);
+    if (!absChanged && !hasMotion) {
+        builder_->stats.duplicates++;
+        builder_->pending = false;
+        return false;
+    }
+
+    // Axis-only changes wait for the next slot allowed by the rate limits of
+    // the classes that changed.  When both did, the earlier slot wins (the
+    // loosest limit): one report carries both, and holding motion back to the
+    // absolute-axis rate (or vice versa) would only add latency.  The latest
+    // absolute values and the sum of all relative motion are carried forward,
+    // so nothing is lost by waiting.
+    uint64_t deadline = UINT64_MAX;
+    if (absChanged) {
+        uint64_t absDeadline = report_builder_class_deadline(builder_, builder_->options.absRateHz, now_);
+        deadline             = (absDeadline < deadline) ? absDeadline : deadline;
+    }
+    if (hasMotion) {
+        uint64_t relDeadline = report_builder_class_deadline(builder_, builder_->options.relRateHz, now_);
+        deadline             = (relDeadline < deadline) ? relDeadline : deadline;
+    }
+
+    builder_->pending  = true;
+    builder_->deadline = deadline;
+    return (now_ >= builder_->deadline);
+}
+
+//---------------------------------------------------------------------------
+int64_t report_builder_timeout(const report_builder_t* builder_, uint64_t now_)
+{
+    if (!builder_->pending) {
+        return -1;
+    }
+    if (now_ >= builder_->deadline) {
+        return 0;
+    }
+    return (int64_t)(builder_->deadline - now_);
+}
+
+//---------------------------------------------------------------------------
+bool report_builder_expire(const report_builder_t* builder_, uint64_t now_)
+{
+    return builder_->pending && (now_ >= builder_->deadline);
+}
+
+//---------------------------------------------------------------------------
+void report_builder_sent(report_builder_t* builder_, uint64_t now_)
+{
+    memcpy(builder_->sentReport, builder_->rawReport, builder_->rawReportSize);
+    memset(builder_->report.relAxis, 0, builder_->buttonsOffset - builder_->relOffset);
+
+    builder_->pending  = false;
+    builder_->lastSent = now_;
+    builder_->stats.sent++;
+}
+
+//---------------------------------------------------------------------------
+bool report_builder_merge(void* pending_, const void* newest_, size_t dataLen_, void* arg_)
+{
+    report_builder_t* builder = (report_builder_t*)arg_;
+    uint8_t*          pending = (uint8_t*)pending_;
+    const uint8_t*    newest  = (const uint8_t*)newest_;
+
+    if (memcmp(pending + builder->buttonsOffset, newest + builder->buttonsOffset, dataLen_ - builder->buttonsOffset)
+        != 0) {
+        return false;
+    }
+
+    memcpy(pending, newest, builder->relOffset);
+    for (int i = 0; i < builder->config->relAxisCount; i++) {
+        int32_t pendingRel;
+        int32_t newestRel;
+        memcpy(&pendingRel, pending + builder->relOffset + (i * sizeof(int32_t)), sizeof(int32_t));
+        memcpy(&newestRel, newest + builder->relOffset + (i * sizeof(int32_t)), sizeof(int32_t));
+        pendingRel += newestRel;
+        memcpy(pending + builder->relOffset + (i * sizeof(int32_t)), &pendingRel, sizeof(int32_t));
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+double report_builder_suppression_ratio(const report_builder_t* builder_)
+{
+    if ((builder_->stats.syncs == 0) || (builder_->stats.sent >= builder_->stats.syncs)) {
+        return 0.0;
+    }
+    return (double)(builder_->stats.syncs - builder_->stats.sent) / (double)builder_->stats.syncs;
+}
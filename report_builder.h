@@ -0,0 +1,182 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "joystick.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+// Options controlling when the report builder decides a report is worth sending.
+// Reports are prioritized by what changed in them: button changes are always
+// sent immediately, while axis-only changes may be held back and coalesced.
+// Reports identical to the last one sent are never sent.
+typedef struct {
+    int  absRateHz;     //!< Maximum rate for reports that only carry absolute axis changes (0 == no limit)
+    int  relRateHz;     //!< Maximum rate for reports that only carry relative motion (0 == no limit)
+    bool filterAxes;    //!< Apply each absolute axis' fuzz and flat (deadzone) values before reporting
+} report_builder_config_t;
+
+//---------------------------------------------------------------------------
+// Counters describing how much traffic the builder avoided sending
+typedef struct {
+    uint64_t syncs;         //!< Complete updates received from the device
+    uint64_t duplicates;    //!< Updates dropped because they matched the last report sent
+    uint64_t filtered;      //!< Absolute axis events absorbed by fuzz/deadzone filtering
+    uint64_t sent;          //!< Reports handed to the transport
+} report_builder_stats_t;
+
+//---------------------------------------------------------------------------
+// Client-side state used to turn a stream of input events into reports
+typedef struct {
+    const js_config_t*      config;         //!< Configuration of the device being reported
+    report_builder_config_t options;        //!< Send policy
+
+    js_report_t report;         //!< Fields of the report being built, pointing into rawReport
+    uint8_t*    rawReport;      //!< Report being built, in wire format
+    uint8_t*    sentReport;     //!< Last report handed to the transport, in wire format
+    size_t      rawReportSize;  //!< Size of a report in bytes
+    size_t      relOffset;      //!< Offset of the relative axis values within a report
+    size_t      buttonsOffset;  //!< Offset of the button values within a report
+
+    bool     pending;   //!< A complete report is being held back by a rate limit
+    uint64_t deadline;  //!< Time (CLOCK_MONOTONIC ns) at which the held report must be sent
+    uint64_t lastSent;  //!< Time (CLOCK_MONOTONIC ns) at which the last report was sent
+
+    report_builder_stats_t stats;   //!< Suppression counters
+} report_builder_t;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief report_builder_config_init initialize report builder options to their defaults
+ * @param config_ object to initialize
+ */
+void report_builder_config_init(report_builder_config_t* config_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief report_builder_create construct a report builder for a device
+ * @param config_ configuration of the device; must outlive the builder
+ * @param options_ send policy for the builder
+ * @return newly-constructed builder, or NULL on allocation error
+ */
+report_builder_t* report_builder_create(const js_config_t* config_, const report_builder_config_t* options_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief report_builder_destroy destruct a previously-constructed builder
+ * NOTE: object must not be used after this is called.
+ * @param builder_ builder to destroy
+ */
+void report_builder_destroy(report_builder_t* builder_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief report_builder_set_button update the state of a button
+ * @param builder_ builder to update
+ * @param index_ index of the button in the device configuration
+ * @param value_ evdev key value
+ */
+void report_builder_set_button(report_builder_t* builder_, int index_, int32_t value_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief report_builder_repeat_button record a key repeat of a held button.  A
+ * held button's value alternates between 1 and 2 with each repeat, so that
+ * every repeat changes the report; the server turns each change into a repeat.
+ * @param builder_ builder to update
+ * @param index_ index of the button in the device configuration
+ */
+void report_builder_repeat_button(report_builder_t* builder_, int index_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief report_builder_set_abs update the value of an absolute axis.  If axis
+ * filtering is enabled, jitter within the axis' fuzz is smoothed away and values
+ * within its flat region are snapped to the center.
+ * @param builder_ builder to update
+ * @param index_ index of the axis in the device configuration
+ * @param value_ new axis value
+ */
+void report_builder_set_abs(report_builder_t* builder_, int index_, int32_t value_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief report_builder_add_rel accumulate motion on a relative axis.  Motion
+ * is summed until a report carrying it is sent.
+ * @param builder_ builder to update
+ * @param index_ index of the axis in the device configuration
+ * @param delta_ relative motion
+ */
+void report_builder_add_rel(report_builder_t* builder_, int index_, int32_t delta_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief report_builder_sync indicate that the device has finished reporting
+ * a complete update (EV_SYN/SYN_REPORT).
+ * @param builder_ builder to update
+ * @param now_ current time (CLOCK_MONOTONIC ns)
+ * @return true if the report should be sent now; false if it is deferred or
+ * is identical to the last report sent
+ */
+bool report_builder_sync(report_builder_t* builder_, uint64_t now_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief report_builder_timeout return the time until a deferred report is due
+ * @param builder_ builder to query
+ * @param now_ current time (CLOCK_MONOTONIC ns)
+ * @return time in ns until report_builder_expire() returns true, or -1 if nothing is deferred
+ */
+int64_t report_builder_timeout(const report_builder_t* builder_, uint64_t now_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief report_builder_expire check whether a deferred report is now due
+ * @param builder_ builder to query
+ * @param now_ current time (CLOCK_MONOTONIC ns)
+ * @return true if the report should be sent now
+ */
+bool report_builder_expire(const report_builder_t* builder_, uint64_t now_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief report_builder_sent indicate that the current report has been handed
+ * to the transport.  Clears accumulated relative motion.
+ * @param builder_ builder to update
+ * @param now_ current time (CLOCK_MONOTONIC ns)
+ */
+void report_builder_sent(report_builder_t* builder_, uint64_t now_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief report_builder_merge send_queue_merge_t implementation for reports.
+ * Absolute axes take the newer value, relative motion is summed, and reports
+ * with differing button states are never merged so no button edge is lost.
+ * @param pending_ unsent report, updated in place on success
+ * @param newest_ report to merge into pending_
+ * @param dataLen_ report size in bytes
+ * @param arg_ report_builder_t that produced the reports
+ * @return true if the reports were merged
+ */
+bool report_builder_merge(void* pending_, const void* newest_, size_t dataLen_, void* arg_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief report_builder_suppression_ratio fraction of device updates that did
+ * not result in a report of their own (duplicates, and updates coalesced by a
+ * rate limit).
+ * @param builder_ builder to query
+ * @return ratio from 0.0 (every update sent) to 1.0
+ */
+double report_builder_suppression_ratio(const report_builder_t* builder_);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
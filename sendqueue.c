@@ -0,0 +1,190 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#include "sendqueue.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+
+#include "message.h"
+
+//---------------------------------------------------------------------------
+send_queue_t* send_queue_create(int capacity_, size_t maxDataLen_, send_queue_merge_t merge_, void* mergeArg_)
+{
+    send_queue_t* newQueue = (send_queue_t*)(calloc(1, sizeof(send_queue_t)));
+    if (!newQueue) {
+        return NULL;
+    }
+
+    newQueue->entries = (send_queue_entry_t*)(calloc(capacity_, sizeof(send_queue_entry_t)));
+    if (!newQueue->entries) {
+        free(newQueue);
+        return NULL;
+    }
+    newQueue->capacity   = capacity_;
+    newQueue->maxDataLen = maxDataLen_;
+    newQueue->merge      = merge_;
+    newQueue->mergeArg   = mergeArg_;
+
+    // Each slot gets a single allocation holding both the raw payload and the
+    // worst-case encoded frame, so the queue never allocates after creation.
+    size_t frameSize = message_encoded_size_max(maxDataLen_);
+    for (int i = 0; i < capacity_; i++) {
+        uint8_t* slot = (uint8_t*)(calloc(1, maxDataLen_ + frameSize));
+        if (!slot) {
+            send_queue_destroy(newQueue);
+            return NULL;
+        }
+        newQueue->entries[i].data  = slot;
+        newQueue->entries[i].frame = slot + maxDataLen_;
+    }
+
+    return newQueue;
+}
+
+//---------------------------------------------------------------------------
+void send_queue_destroy(send_queue_t* queue_)
+{
+    if (!queue_) {
+        return;
+    }
+    for (int i = 0; i < queue_->capacity; i++) { free(queue_->entries[i].data); }
+    free(queue_->entries);
+    free(queue_);
+}
+
+//---------------------------------------------------------------------------
+static send_queue_entry_t* send_queue_tail(send_queue_t* queue_)
+{
+    if (queue_->count == 0) {
+        return NULL;
+    }
+    return &queue_->entries[(queue_->head + queue_->count - 1) % queue_->capacity];
+}
+
+//---------------------------------------------------------------------------
+static bool send_queue_encode_entry(send_queue_t* queue_, send_queue_entry_t* entry_)
+{
+    entry_->frameLen = message_encode(
+        entry_->frame, message_encoded_size_max(queue_->maxDataLen), entry_->tag, entry_->data, entry_->dataLen);
+    return (entry_->frameLen != 0);
+}
+
+//---------------------------------------------------------------------------
+// Queue a message, copying its frame if it has already been encoded (frame_ != NULL)
+static send_queue_return_t send_queue_add(send_queue_t*  queue_,
+                                          uint16_t       tag_,
+                                          const void*    data_,
+                                          size_t         dataLen_,
+                                          const uint8_t* frame_,
+                                          size_t         frameLen_,
+                                          bool           mergeable_)
+{
+    if (dataLen_ > queue_->maxDataLen) {
+        return SendQueueErrorTooBig;
+    }
+
+    // Try to fold the message into the newest pending message.  The head of the
+    // queue can only be modified if none of its bytes have hit the socket yet.
+    // A merged message is new content, so it's always re-encoded.
+    send_queue_entry_t* tail = send_queue_tail(queue_);
+    if (mergeable_ && tail && tail->mergeable && queue_->merge && (tail->tag == tag_) && (tail->dataLen == dataLen_)
+        && !((queue_->count == 1) && (queue_->sentOffset != 0))) {
+        if (queue_->merge(tail->data, data_, dataLen_, queue_->mergeArg)) {
+            queue_->merged++;
+            return send_queue_encode_entry(queue_, tail) ? SendQueueOk : SendQueueErrorTooBig;
+        }
+    }
+
+    if (queue_->count == queue_->capacity) {
+        return SendQueueErrorFull;
+    }
+
+    send_queue_entry_t* entry = &queue_->entries[(queue_->head + queue_->count) % queue_->capacity];
+    entry->tag                = tag_;
+    entry->mergeable          = mergeable_;
+    entry->dataLen            = dataLen_;
+    memcpy(entry->data, data_, dataLen_);
+    if (frame_) {
+        if (frameLen_ > message_encoded_size_max(queue_->maxDataLen)) {
+            return SendQueueErrorTooBig;
+        }
+        memcpy(entry->frame, frame_, frameLen_);
+        entry->frameLen = frameLen_;
+    } else if (!send_queue_encode_entry(queue_, entry)) {
+        return SendQueueErrorTooBig;
+    }
+
+    queue_->count++;
+    return SendQueueOk;
+}
+
+//---------------------------------------------------------------------------
+send_queue_return_t
+send_queue_push(send_queue_t* queue_, uint16_t tag_, const void* data_, size_t dataLen_, bool mergeable_)
+{
+    return send_queue_add(queue_, tag_, data_, dataLen_, NULL, 0, mergeable_);
+}
+
+//---------------------------------------------------------------------------
+send_queue_return_t send_queue_push_encoded(send_queue_t*  queue_,
+                                            uint16_t       tag_,
+                                            const void*    data_,
+                                            size_t         dataLen_,
+                                            const uint8_t* frame_,
+                                            size_t         frameLen_,
+                                            bool           mergeable_)
+{
+    return send_queue_add(queue_, tag_, data_, dataLen_, frame_, frameLen_, mergeable_);
+}
+
+//---------------------------------------------------------------------------
+send_queue_return_t send_queue_flush(send_queue_t* queue_, int fd_)
+{
+    while (queue_->count > 0) {
+        send_queue_entry_t* entry = &queue_->entries[queue_->head];
+
+        int nWritten
+            = send(fd_, entry->frame + queue_->sentOffset, entry->frameLen - queue_->sentOffset, MSG_NOSIGNAL);
+        if (nWritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                return SendQueueWouldBlock;
+            }
+            return SendQueueErrorSocket;
+        }
+        if (nWritten == 0) {
+            return SendQueueErrorSocket;
+        }
+
+        queue_->sentOffset += nWritten;
+        if (queue_->sentOffset == entry->frameLen) {
+            queue_->sentOffset = 0;
+            queue_->head       = (queue_->head + 1) % queue_->capacity;
+            queue_->count--;
+        }
+    }
+    return SendQueueOk;
+}
+
+//---------------------------------------------------------------------------
+bool send_queue_is_empty(const send_queue_t* queue_)
+{
+    return (queue_->count == 0);
+}
+
+//---------------------------------------------------------------------------
+void send_queue_clear(send_queue_t* queue_)
+{
+    queue_->head       = 0;
+    queue_->count      = 0;
+    queue_->sentOffset = 0;
+}
@@ -0,0 +1,146 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+/**
+ * Function used to fold a newer message into an older one that is still waiting
+ * to be sent.  Returns true if the two were merged (in which case pending_ holds
+ * the result), or false if the newer message must be queued separately.
+ */
+typedef bool (*send_queue_merge_t)(void* pending_, const void* newest_, size_t dataLen_, void* arg_);
+
+//---------------------------------------------------------------------------
+// Return values for send queue operations
+typedef enum {
+    SendQueueOk = 0,        //!< Operation completed successfully
+    SendQueueWouldBlock,    //!< Socket could not accept all queued data; try again when writable
+    SendQueueErrorFull,     //!< Message could neither be queued nor merged into a pending message
+    SendQueueErrorTooBig,   //!< Message is larger than the queue's maximum payload size
+    SendQueueErrorSocket    //!< Socket was closed or returned an unrecoverable error
+} send_queue_return_t;
+
+//---------------------------------------------------------------------------
+// A single message held by the queue, both as a raw payload and as an encoded frame
+typedef struct {
+    uint16_t tag;       //!< Message tag
+    bool     mergeable; //!< Whether or not newer messages may be merged into this one
+    size_t   dataLen;   //!< Size of the raw payload
+    size_t   frameLen;  //!< Size of the encoded frame
+    uint8_t* data;      //!< Raw payload (used when merging)
+    uint8_t* frame;     //!< slip-encoded tlvc frame, as written to the socket
+} send_queue_entry_t;
+
+//---------------------------------------------------------------------------
+// Bounded FIFO of outbound messages for a non-blocking socket
+typedef struct {
+    send_queue_entry_t* entries;    //!< Ring-buffer of message slots
+    int                 capacity;   //!< Number of slots in the ring
+    int                 head;       //!< Index of the oldest queued message
+    int                 count;      //!< Number of queued messages
+    size_t              maxDataLen; //!< Largest payload the queue can hold
+    size_t              sentOffset; //!< Number of bytes of the head frame already written
+
+    send_queue_merge_t merge;       //!< Merge function used for mergeable messages
+    void*              mergeArg;    //!< Argument passed to the merge function
+
+    uint64_t merged;                //!< Number of messages folded into a pending message
+} send_queue_t;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief send_queue_create construct a new outbound message queue
+ * @param capacity_ maximum number of messages that can be queued at once
+ * @param maxDataLen_ largest message payload that will be queued
+ * @param merge_ function used to merge mergeable messages (may be NULL)
+ * @param mergeArg_ user-defined argument passed to merge_
+ * @return newly-constructed queue, or NULL on allocation error
+ */
+send_queue_t* send_queue_create(int capacity_, size_t maxDataLen_, send_queue_merge_t merge_, void* mergeArg_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief send_queue_destroy destruct a previously-constructed queue, discarding
+ * any messages that have not been sent.
+ * NOTE: object must not be used after this is called.
+ * @param queue_ queue to destroy
+ */
+void send_queue_destroy(send_queue_t* queue_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief send_queue_push encode a message and add it to the tail of the queue.
+ * If the message is mergeable and the tail of the queue holds a mergeable
+ * message with the same tag that has not started transmission, the merge
+ * function is given the opportunity to fold the new message into it instead.
+ * @param queue_ queue to add the message to
+ * @param tag_ message tag
+ * @param data_ message payload
+ * @param dataLen_ size of the message payload
+ * @param mergeable_ whether or not the message may be merged with others
+ * @return SendQueueOk on success, others on error
+ */
+send_queue_return_t
+send_queue_push(send_queue_t* queue_, uint16_t tag_, const void* data_, size_t dataLen_, bool mergeable_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief send_queue_push_encoded same as send_queue_push(), for a message that
+ * has already been encoded with message_encode().  The frame is copied as-is,
+ * so a message sent to several queues is only encoded once; it is re-encoded
+ * only if a newer message is merged into it.
+ * @param queue_ queue to add the message to
+ * @param tag_ message tag
+ * @param data_ message payload (kept for merging)
+ * @param dataLen_ size of the message payload
+ * @param frame_ encoded frame carrying tag_ and data_
+ * @param frameLen_ size of the encoded frame
+ * @param mergeable_ whether or not the message may be merged with others
+ * @return SendQueueOk on success, others on error
+ */
+send_queue_return_t send_queue_push_encoded(send_queue_t*  queue_,
+                                            uint16_t       tag_,
+                                            const void*    data_,
+                                            size_t         dataLen_,
+                                            const uint8_t* frame_,
+                                            size_t         frameLen_,
+                                            bool           mergeable_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief send_queue_flush write as much queued data as the socket will accept
+ * without blocking.
+ * @param queue_ queue to flush
+ * @param fd_ non-blocking socket to write to
+ * @return SendQueueOk if the queue was drained, SendQueueWouldBlock if data
+ * remains, SendQueueErrorSocket if the socket failed.
+ */
+send_queue_return_t send_queue_flush(send_queue_t* queue_, int fd_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief send_queue_is_empty check whether the queue has data waiting to be sent
+ * @param queue_ queue to check
+ * @return true if there is no pending data
+ */
+bool send_queue_is_empty(const send_queue_t* queue_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief send_queue_clear discard all queued messages, including any partially
+ * sent frame.  Only useful when the connection is being torn down.
+ * @param queue_ queue to clear
+ */
+void send_queue_clear(send_queue_t* queue_);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
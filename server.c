@@ -17,10 +17,94 @@
 #include <netinet/tcp.h>
 #include <sys/socket.h>
 #include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+
+#include "log.h"
+#include "timestamp.h"
+
+//---------------------------------------------------------------------------
+static const char* serverPollModeNames[] = { "blocking", "busy", "spin" };
+
+//---------------------------------------------------------------------------
+// What an epoll event is for.  Each registered descriptor carries its kind in
+// the low bits of the event data, the client slot it belongs to above that, and
+// the slot's generation in the top half: the owner of an event is found without
+// searching, and events still queued for a client that has since disconnected
+// can't be mistaken for ones belonging to the slot's next connection.
+typedef enum {
+    ServerEventListen = 0,  //!< Listening socket
+    ServerEventTick,        //!< Periodic tick timer
+    ServerEventClient,      //!< Client socket
+    ServerEventClientTimer  //!< Client's onTimer timerfd
+} server_event_kind_t;
+
+#define SERVER_RESERVED_FDS (64)   //!< Descriptors set aside for everything other than clients
+
+#define SERVER_EVENT_KIND_BITS (2)
+#define SERVER_EVENT_KIND_MASK ((1U << SERVER_EVENT_KIND_BITS) - 1)
+
+//---------------------------------------------------------------------------
+static uint64_t server_event_key(server_event_kind_t kind_, int index_, uint32_t generation_)
+{
+    return ((uint64_t)generation_ << 32) | ((uint64_t)index_ << SERVER_EVENT_KIND_BITS) | kind_;
+}
+
+//---------------------------------------------------------------------------
+void server_poll_config_init(server_poll_config_t* config_)
+{
+    config_->mode       = ServerPollBlocking;
+    config_->busyPollUs = SERVER_DEFAULT_BUSY_POLL_US;
+    config_->spinUs     = SERVER_DEFAULT_SPIN_US;
+}
+
+//---------------------------------------------------------------------------
+bool server_poll_mode_from_string(const char* str_, server_poll_mode_t* mode_)
+{
+    for (size_t i = 0; i < sizeof(serverPollModeNames) / sizeof(serverPollModeNames[0]); i++) {
+        if (!strcmp(str_, serverPollModeNames[i])) {
+            *mode_ = (server_poll_mode_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+//---------------------------------------------------------------------------
+const char* server_poll_mode_to_string(server_poll_mode_t mode_)
+{
+    if ((size_t)mode_ >= sizeof(serverPollModeNames) / sizeof(serverPollModeNames[0])) {
+        return "unknown";
+    }
+    return serverPollModeNames[mode_];
+}
+
+//---------------------------------------------------------------------------
+// Each client needs a socket and possibly a timerfd; raise the soft limit on
+// open files as far as the hard limit allows to make room for them all.
+static void server_reserve_fds(int maxClients_)
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        return;
+    }
+    rlim_t needed = ((rlim_t)maxClients_ * 2) + SERVER_RESERVED_FDS;
+    if (limit.rlim_cur >= needed) {
+        return;
+    }
+    limit.rlim_cur = (limit.rlim_max < needed) ? limit.rlim_max : needed;
+    if ((setrlimit(RLIMIT_NOFILE, &limit) != 0) || (limit.rlim_cur < needed)) {
+        printf("warning: open file limit (%llu) is too low for %d clients\n",
+               (unsigned long long)limit.rlim_cur,
+               maxClients_);
+    }
+}
 
 //---------------------------------------------------------------------------
 server_context_t* server_create(uint16_t port_, int maxClients_, client_handlers_t* clientHandlers_)
 {
+    server_reserve_fds(maxClients_);
+
     int rc = socket(AF_INET, SOCK_STREAM, 0);
     if (rc < 0) {
         printf("error creating socket: %d (%s)\n", errno, strerror(errno));
@@ -48,7 +132,16 @@ server_context_t* server_create(uint16_t port_, int maxClients_, client_handlers
         return NULL;
     }
 
-    rc = listen(fd, 4);
+    // Port 0 lets the kernel pick a free port; find out which
+    socklen_t addrLen = sizeof(addr);
+    if (getsockname(fd, (struct sockaddr*)&addr, &addrLen) == 0) {
+        port_ = ntohs(addr.sin_port);
+    }
+
+    // Accepted until EAGAIN, so a burst of connections is taken in one wakeup
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    rc = listen(fd, SOMAXCONN);
     if (rc < 0) {
         printf("error listening on socket: %d (%s)\n", errno, strerror(errno));
         close(fd);
@@ -62,22 +155,79 @@ server_context_t* server_create(uint16_t port_, int maxClients_, client_handlers
     context->maxClients       = maxClients_;
     context->handlers         = *clientHandlers_;
     context->clientContext    = (client_context_t**)(calloc(1, sizeof(client_context_t*) * maxClients_));
+    context->running          = true;
+    server_poll_config_init(&context->poll);
 
     for (int i = 0; i < maxClients_; i++) {
         context->clientContext[i]              = (client_context_t*)(calloc(1, sizeof(client_context_t)));
         context->clientContext[i]->inUse       = false;
         context->clientContext[i]->clientFd    = -1;
+        context->clientContext[i]->timerFd     = -1;
         context->clientContext[i]->contextData = NULL;
     }
     return context;
 }
 
 //---------------------------------------------------------------------------
-static void server_register_client_fd(int ePollFd_, int clientFd_)
+void server_destroy(server_context_t* context_)
+{
+    if (!context_) {
+        return;
+    }
+    close(context_->serverFd);
+    for (int i = 0; i < context_->maxClients; i++) {
+        free(context_->clientContext[i]);
+    }
+    free(context_->clientContext);
+    free(context_);
+}
+
+//---------------------------------------------------------------------------
+void server_set_poll_config(server_context_t* context_, const server_poll_config_t* config_)
+{
+    context_->poll = *config_;
+}
+
+//---------------------------------------------------------------------------
+void server_set_tick_interval(server_context_t* context_, int tickMs_)
+{
+    context_->tickMs = tickMs_;
+}
+
+//---------------------------------------------------------------------------
+void server_stop(server_context_t* context_)
+{
+    __atomic_store_n(&context_->running, false, __ATOMIC_RELAXED);
+}
+
+//---------------------------------------------------------------------------
+// Ask the kernel to poll the device queue for client data instead of waiting on
+// an interrupt, when the NIC driver supports it.  Has no effect over loopback.
+static void server_set_busy_poll(const server_context_t* context_, int clientFd_)
+{
+    if ((context_->poll.mode == ServerPollBlocking) || (context_->poll.busyPollUs <= 0)) {
+        return;
+    }
+
+    int rc = setsockopt(clientFd_, SOL_SOCKET, SO_BUSY_POLL, &context_->poll.busyPollUs, sizeof(int));
+    if (rc != 0) {
+        printf("error setting SO_BUSY_POLL on fd=%d: %d (%s)\n", clientFd_, errno, strerror(errno));
+    }
+#if defined(SO_PREFER_BUSY_POLL)
+    int enable = 1;
+    rc         = setsockopt(clientFd_, SOL_SOCKET, SO_PREFER_BUSY_POLL, &enable, sizeof(enable));
+    if (rc != 0) {
+        printf("error setting SO_PREFER_BUSY_POLL on fd=%d: %d (%s)\n", clientFd_, errno, strerror(errno));
+    }
+#endif
+}
+
+//---------------------------------------------------------------------------
+static void server_register_client_fd(int ePollFd_, int clientFd_, uint64_t key_)
 {
     struct epoll_event ev = {};
     ev.events             = EPOLLIN | EPOLLERR | EPOLLHUP | EPOLLRDHUP | EPOLLET;
-    ev.data.fd            = clientFd_;
+    ev.data.u64           = key_;
     if (epoll_ctl(ePollFd_, EPOLL_CTL_ADD, clientFd_, &ev) < 0) {
         printf("error registering client fd=%d: %d (%s)\n", clientFd_, errno, strerror(errno));
         exit(-1);
@@ -97,18 +247,44 @@ static void server_deregister_client_fd(int ePollFd_, int clientFd_)
 static void server_on_client_connect(server_context_t* context_, int ePollFd_, int clientFd_)
 {
     bool noRoom = true;
+    int  index  = 0;
     for (int i = 0; i < context_->maxClients; i++) {
         if (!context_->clientContext[i]->inUse) {
+            // The handler may refuse the client (e.g. out of memory)
+            void* contextData = context_->handlers.onConnect(clientFd_);
+            if (!contextData) {
+                close(clientFd_);
+                LOG_WARNING("client refused by the connect handler");
+                return;
+            }
+
             noRoom                                  = false;
+            index                                   = i;
             context_->clientContext[i]->inUse       = true;
+            context_->clientContext[i]->generation++;
             context_->clientContext[i]->clientFd    = clientFd_;
-            context_->clientContext[i]->contextData = context_->handlers.onConnect(clientFd_);
+            context_->clientContext[i]->contextData = contextData;
 
             // Make non-blocking.
             int flags = fcntl(clientFd_, F_GETFL);
             flags |= O_NONBLOCK;
             fcntl(clientFd_, F_SETFL, flags);
 
+            server_set_busy_poll(context_, clientFd_);
+
+            if (context_->handlers.onTimer) {
+                int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+                if (timerFd < 0) {
+                    printf("error creating client timer: %d (%s)\n", errno, strerror(errno));
+                } else {
+                    context_->clientContext[i]->timerFd = timerFd;
+                    server_register_client_fd(
+                        ePollFd_,
+                        timerFd,
+                        server_event_key(ServerEventClientTimer, i, context_->clientContext[i]->generation));
+                }
+            }
+
             // Enable TCP keepalives on the socket
             int rc;
             int enable = 1;
@@ -146,11 +322,48 @@ static void server_on_client_connect(server_context_t* context_, int ePollFd_, i
 
     if (noRoom) {
         close(clientFd_);
-        printf("can't accept socket - too many clients connected\n");
+        LOG_WARNING("can't accept socket - too many clients connected");
         return;
     }
 
-    server_register_client_fd(ePollFd_, clientFd_);
+    server_register_client_fd(
+        ePollFd_, clientFd_, server_event_key(ServerEventClient, index, context_->clientContext[index]->generation));
+}
+
+//---------------------------------------------------------------------------
+// Take every pending connection; the listening socket is edge-triggered
+static bool server_on_accept(server_context_t* context_, int ePollFd_)
+{
+    while (1) {
+        struct sockaddr_in addr;
+        socklen_t          socklen  = sizeof(addr);
+        int                clientFd = accept(context_->serverFd, (struct sockaddr*)(&addr), &socklen);
+        if (clientFd >= 0) {
+            server_on_client_connect(context_, ePollFd_, clientFd);
+            continue;
+        }
+        switch (errno) {
+            case EAGAIN: {
+                context_->acceptStalled = false;
+                return true;
+            }
+            case EINTR:
+            case ECONNABORTED: continue;
+            case EMFILE:
+            case ENFILE: {
+                // Leave the rest queued until a client goes away.  The listening
+                // socket is edge-triggered and won't signal them again, so the
+                // next disconnect picks them up.
+                LOG_WARNING("can't accept socket - out of file descriptors");
+                context_->acceptStalled = true;
+                return true;
+            }
+            default: {
+                printf("error accepting socket %d (%s)\n", errno, strerror(errno));
+                return false;
+            }
+        }
+    }
 }
 
 //---------------------------------------------------------------------------
@@ -159,8 +372,124 @@ static void server_on_client_disconnect(server_context_t* context_, int ePollFd_
     context_->handlers.onDisconnect(context_->clientContext[index_]->contextData);
     server_deregister_client_fd(ePollFd_, context_->clientContext[index_]->clientFd);
     close(context_->clientContext[index_]->clientFd);
+    if (context_->clientContext[index_]->timerFd >= 0) {
+        server_deregister_client_fd(ePollFd_, context_->clientContext[index_]->timerFd);
+        close(context_->clientContext[index_]->timerFd);
+    }
     context_->clientContext[index_]->clientFd = -1;
+    context_->clientContext[index_]->timerFd  = -1;
     context_->clientContext[index_]->inUse    = false;
+
+    if (context_->acceptStalled) {
+        server_on_accept(context_, ePollFd_);
+    }
+}
+
+//---------------------------------------------------------------------------
+// Let the client handle anything that has come due, and arm its timer for
+// whatever is due next.
+static void server_on_client_timer(server_context_t* context_, client_context_t* client_)
+{
+    if (client_->timerFd < 0) {
+        return;
+    }
+
+    uint64_t          now      = timestamp_now_ns();
+    uint64_t          deadline = context_->handlers.onTimer(client_->clientFd, client_->contextData, now);
+    struct itimerspec spec     = {};
+    if (deadline != 0) {
+        // A zero it_value would disarm the timer rather than fire it right away
+        spec.it_value = timestamp_to_timespec(deadline);
+        if ((spec.it_value.tv_sec == 0) && (spec.it_value.tv_nsec == 0)) {
+            spec.it_value.tv_nsec = 1;
+        }
+    }
+    timerfd_settime(client_->timerFd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+//---------------------------------------------------------------------------
+static void server_on_tick(server_context_t* context_, int ePollFd_)
+{
+    for (int i = 0; i < context_->maxClients; i++) {
+        client_context_t* client = context_->clientContext[i];
+        if (client->inUse && !context_->handlers.onTick(client->clientFd, client->contextData)) {
+            server_on_client_disconnect(context_, ePollFd_, i);
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+static int server_create_tick_timer(int tickMs_)
+{
+    int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timerFd < 0) {
+        printf("error creating tick timer: %d (%s)\n", errno, strerror(errno));
+        return -1;
+    }
+
+    struct itimerspec spec = {};
+    spec.it_interval       = timestamp_to_timespec((uint64_t)tickMs_ * NSEC_PER_MSEC);
+    spec.it_value          = spec.it_interval;
+    if (timerfd_settime(timerFd, 0, &spec, NULL) != 0) {
+        printf("error starting tick timer: %d (%s)\n", errno, strerror(errno));
+        close(timerFd);
+        return -1;
+    }
+    return timerFd;
+}
+
+//---------------------------------------------------------------------------
+// Handle one epoll event; returns false if the server can't carry on
+static bool server_on_event(server_context_t* context_, int ePollFd_, int tickTimerFd_, const struct epoll_event* ev_)
+{
+    server_event_kind_t kind       = (server_event_kind_t)(ev_->data.u64 & SERVER_EVENT_KIND_MASK);
+    int                 index      = (int)((uint32_t)ev_->data.u64 >> SERVER_EVENT_KIND_BITS);
+    uint32_t            generation = (uint32_t)(ev_->data.u64 >> 32);
+
+    if (kind == ServerEventListen) {
+        return server_on_accept(context_, ePollFd_);
+    }
+    if (kind == ServerEventTick) {
+        // Ticks missed while we were busy are not made up; one call covers them all
+        uint64_t expirations;
+        if (read(tickTimerFd_, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+            server_on_tick(context_, ePollFd_);
+        }
+        return true;
+    }
+
+    client_context_t* client = context_->clientContext[index];
+    if (!client->inUse || (client->generation != generation)) {
+        // Left over from a connection dropped earlier in the same batch
+        return true;
+    }
+
+    if (kind == ServerEventClientTimer) {
+        uint64_t expirations;
+        if (read(client->timerFd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+            server_on_client_timer(context_, client);
+        }
+        return true;
+    }
+
+    // A client that sends its last reports and hangs up can have both
+    // reported at once; read what it sent before dropping it
+    bool error = false;
+    if (ev_->events & EPOLLIN) {
+        if (!context_->handlers.onReadData(client->clientFd, client->contextData)) {
+            error = true;
+        }
+    }
+    if ((ev_->events & EPOLLHUP) || (ev_->events & EPOLLERR) || (ev_->events & EPOLLRDHUP)) {
+        error = true;
+    }
+
+    if (error) {
+        server_on_client_disconnect(context_, ePollFd_, index);
+    } else {
+        server_on_client_timer(context_, client);
+    }
+    return true;
 }
 
 //---------------------------------------------------------------------------
@@ -168,45 +497,54 @@ void server_run(server_context_t* context_)
 {
     int ePollFd = epoll_create1(0);
 
-    server_register_client_fd(ePollFd, context_->serverFd);
+    server_register_client_fd(ePollFd, context_->serverFd, server_event_key(ServerEventListen, 0, 0));
 
-    while (1) {
-        struct epoll_event ev;
-        int                nfds = epoll_wait(ePollFd, &ev, 1, -1);
+    // In the busy-poll modes, epoll_wait() is called without a timeout for as
+    // long as we're spinning, so an event is picked up without waiting for the
+    // scheduler to wake us.
+    // Periodic client ticks are driven by a timerfd in the same epoll set, so
+    // they fire on schedule whether we're sleeping or spinning.
+    int timerFd = -1;
+    if ((context_->tickMs > 0) && context_->handlers.onTick) {
+        timerFd = server_create_tick_timer(context_->tickMs);
+        if (timerFd >= 0) {
+            server_register_client_fd(ePollFd, timerFd, server_event_key(ServerEventTick, 0, 0));
+        }
+    }
+
+    uint64_t spinUntil = 0;
+    while (__atomic_load_n(&context_->running, __ATOMIC_RELAXED)) {
+        int timeoutMs = -1;
+        if ((context_->poll.mode == ServerPollSpin)
+            || ((context_->poll.mode == ServerPollBusy) && (timestamp_now_ns() < spinUntil))) {
+            timeoutMs = 0;
+        }
+
+        struct epoll_event events[SERVER_MAX_EVENTS];
+        int                nfds = epoll_wait(ePollFd, events, SERVER_MAX_EVENTS, timeoutMs);
+        if (nfds == 0) {
+            continue;
+        }
         if (nfds < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
             printf("error on epoll_wait() = %d (%s)\n", errno, strerror(errno));
             return;
         }
+        if (context_->poll.mode == ServerPollBusy) {
+            spinUntil = timestamp_now_ns() + ((uint64_t)context_->poll.spinUs * NSEC_PER_USEC);
+        }
 
-        // Handle incoming connections on the registered socket.
-        if (ev.data.fd == context_->serverFd) {
-            struct sockaddr_in addr;
-            socklen_t          socklen  = sizeof(addr);
-            int                clientFd = accept(context_->serverFd, (struct sockaddr*)(&addr), &socklen);
-            if (clientFd < 0) {
-                printf("error accepting socket %d (%s)\n", errno, strerror(errno));
-                return;
-            }
-            server_on_client_connect(context_, ePollFd, clientFd);
-        } else {
-            // Handle all other events...
-            for (int i = 0; i < context_->maxClients; i++) {
-                if (context_->clientContext[i]->clientFd == ev.data.fd) {
-                    bool error = false;
-                    if ((ev.events & EPOLLHUP) || (ev.events & EPOLLERR) || (ev.events & EPOLLRDHUP)) {
-                        error = true;
-                    } else if (ev.events & EPOLLIN) {
-                        if (!context_->handlers.onReadData(ev.data.fd, context_->clientContext[i]->contextData)) {
-                            error = true;
-                        }
-                    }
-
-                    if (error) {
-                        server_on_client_disconnect(context_, ePollFd, i);
-                    }
-                    break;
-                }
+        for (int e = 0; e < nfds; e++) {
+            if (!server_on_event(context_, ePollFd, timerFd, &events[e])) {
+                server_stop(context_);
+                break;
             }
         }
     }
+    if (timerFd >= 0) {
+        close(timerFd);
+    }
+    close(ePollFd);
 }
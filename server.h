@@ -16,49 +16,142 @@ extern "C" {
 typedef void* (*client_connect_handler_t)(int clientFd_);
 typedef void (*client_disconnect_handler_t)(void* clientContext_);
 typedef bool (*client_read_data_t)(int clientFd_, void* clientContext_);
+typedef bool (*client_tick_handler_t)(int clientFd_, void* clientContext_);
+typedef uint64_t (*client_timer_handler_t)(int clientFd_, void* clientContext_, uint64_t now_);
 
 //---------------------------------------------------------------------------
 // Struct containing the handler functions for client events
 typedef struct {
-    client_connect_handler_t    onConnect;      //!< Action called when socket is connected
+    client_connect_handler_t    onConnect;      //!< Action called when socket is connected (NULL == refuse the client)
     client_disconnect_handler_t onDisconnect;   //!< Action called when the socket is disconnected
     client_read_data_t          onReadData;     //!< Action called when there is data to read on the socket
+    client_tick_handler_t       onTick;         //!< Optional action called periodically (false == disconnect)
+    client_timer_handler_t      onTimer;        //!< Optional action called after each read and when the client's timer
+                                                //!< expires; returns the next CLOCK_MONOTONIC deadline (0 == none)
 } client_handlers_t;
 
+//---------------------------------------------------------------------------
+#define SERVER_DEFAULT_BUSY_POLL_US (50)   //!< Default SO_BUSY_POLL time for client sockets in busy-poll mode
+#define SERVER_DEFAULT_SPIN_US (2000)      //!< Default time to keep spinning after an event in busy-poll mode
+#define SERVER_MAX_EVENTS (64)             //!< Most socket events handled per epoll_wait() call
+
+//---------------------------------------------------------------------------
+// How the server waits for socket events
+typedef enum {
+    ServerPollBlocking = 0, //!< Sleep in epoll_wait() until an event arrives
+    ServerPollBusy,         //!< Busy-poll client sockets, and spin for a while after each event before sleeping
+    ServerPollSpin          //!< Never sleep; spin on epoll_wait() (dedicate a CPU core to the server)
+} server_poll_mode_t;
+
+//---------------------------------------------------------------------------
+// Options trading CPU time for lower wakeup latency
+typedef struct {
+    server_poll_mode_t mode;        //!< How to wait for events
+    int                busyPollUs;  //!< SO_BUSY_POLL applied to client sockets in busy/spin modes (0 == don't set)
+    int                spinUs;      //!< ServerPollBusy: how long to keep spinning after the last event
+} server_poll_config_t;
+
 //---------------------------------------------------------------------------
 // Struct describing the data
 typedef struct {
-    bool  inUse;        //!< Whether or not the context object is idle or active
-    int   clientFd;     //!< FD corresponding to the socket
-    void* contextData;  //!< Connection-specific pointer to application-specific data
+    bool     inUse;         //!< Whether or not the context object is idle or active
+    int      clientFd;      //!< FD corresponding to the socket
+    int      timerFd;       //!< timerfd driving the onTimer handler (-1 if unused)
+    uint32_t generation;    //!< Incremented each time the slot is given to a new connection
+    void*    contextData;   //!< Connection-specific pointer to application-specific data
 } client_context_t;
 
 //---------------------------------------------------------------------------
 // Struct describing the server's complete context
 typedef struct {
-    uint16_t           port;            //!< port that the server is registered for
-    int                serverFd;        //!< file descriptor of the active server
-    int                maxClients;      //!< maximum number of concurrent connections allowed in the server
-    client_handlers_t  handlers;        //!< event handler actions for the clients
-    client_context_t** clientContext;   //!< array of context pointers, used to hold instance-specific application data
+    uint16_t             port;          //!< port that the server is registered for
+    int                  serverFd;      //!< file descriptor of the active server
+    int                  maxClients;    //!< maximum number of concurrent connections allowed in the server
+    client_handlers_t    handlers;      //!< event handler actions for the clients
+    client_context_t**   clientContext; //!< array of context pointers, used to hold instance-specific application data
+    server_poll_config_t poll;          //!< how the server waits for events
+    bool                 running;       //!< cleared by server_stop() to make server_run() return
+    int                  tickMs;        //!< interval between calls to the clients' onTick handler (0 == disabled)
+    bool                 acceptStalled; //!< connections were left queued for lack of file descriptors
 } server_context_t;
 
 //---------------------------------------------------------------------------
 /**
  * @brief server_create create a server that listens for incoming connections
  * on a given port.
- * @param port_ Port on which to listen for incoming connections
+ * @param port_ Port on which to listen for incoming connections (0 == any free
+ * port; the one chosen is left in the context's port field)
  * @param maxClients_ Maximum number of concurrent client connections
  * @param clientHandlers_ Pointer to an array of function pointers describing
  * @return pointer to a newly-constructed active server_context_t on success, NULL on error
  */
 server_context_t* server_create(uint16_t port_, int maxClients_, client_handlers_t* clientHandlers_);
 
+//---------------------------------------------------------------------------
+/**
+ * @brief server_destroy close the listening socket and free a server that is
+ * no longer running.  Connected clients are not disconnected.
+ * NOTE: object must not be used after this is called.
+ * @param context_ server to destroy
+ */
+void server_destroy(server_context_t* context_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief server_poll_config_init initialize polling options to their defaults (blocking)
+ * @param config_ object to initialize
+ */
+void server_poll_config_init(server_poll_config_t* config_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief server_poll_mode_from_string parse a poll mode name ("blocking", "busy", "spin")
+ * @param str_ string to parse
+ * @param mode_ [out] parsed mode
+ * @return true on success, false if the string does not name a mode
+ */
+bool server_poll_mode_from_string(const char* str_, server_poll_mode_t* mode_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief server_poll_mode_to_string return the name of a poll mode
+ * @param mode_ mode to name
+ * @return mode name
+ */
+const char* server_poll_mode_to_string(server_poll_mode_t mode_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief server_set_poll_config select how the server waits for events.  Must
+ * be called before server_run(); socket options only apply to clients that
+ * connect afterwards.
+ * @param context_ server to configure
+ * @param config_ polling options
+ */
+void server_set_poll_config(server_context_t* context_, const server_poll_config_t* config_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief server_set_tick_interval set how often the onTick handler is called
+ * for each connected client.  Must be called before server_run().
+ * @param context_ server to configure
+ * @param tickMs_ interval in milliseconds (0 == never)
+ */
+void server_set_tick_interval(server_context_t* context_, int tickMs_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief server_stop ask a running server to return from server_run().  The
+ * server notices the request the next time it wakes up for an event.
+ * @param context_ server to stop
+ */
+void server_stop(server_context_t* context_);
+
 //---------------------------------------------------------------------------
 /**
  * @brief server_run Run the server's activities.  This effectively takes over
  * the caller's thread and will not return unless some catastrophic error has
- * occurred that results in our server dying.
+ * occurred that results in our server dying, or server_stop() is called.
  * @param context_ pointer to the server_context_t object that describes the
  * behavior of a server.
  */
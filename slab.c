@@ -0,0 +1,143 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#include "slab.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+//---------------------------------------------------------------------------
+#define SLAB_CLASSES (10)           //!< SLAB_MIN_OBJECT << n, for n in [0, SLAB_CLASSES)
+#define SLAB_BLOCK_HEADER (16)      //!< Room taken by the block list link, keeping objects 16-byte aligned
+
+//---------------------------------------------------------------------------
+// A free object holds the link to the next one
+typedef struct slab_free_object {
+    struct slab_free_object* next;
+} slab_free_object_t;
+
+//---------------------------------------------------------------------------
+typedef struct slab_block {
+    struct slab_block* next;    //!< Next block owned by the pool
+} slab_block_t;
+
+//---------------------------------------------------------------------------
+struct slab_pool {
+    slab_free_object_t* freeLists[SLAB_CLASSES];    //!< Free objects of each size class
+    slab_block_t*       blocks;                     //!< Every block obtained from the system
+    size_t              inUse;                      //!< Bytes allocated, rounded up to the size class
+    size_t              reserved;                   //!< Bytes obtained from the system
+};
+
+//---------------------------------------------------------------------------
+static int slab_class(size_t size_)
+{
+    int    index     = 0;
+    size_t classSize = SLAB_MIN_OBJECT;
+    while (classSize < size_) {
+        classSize <<= 1;
+        index++;
+    }
+    return index;
+}
+
+//---------------------------------------------------------------------------
+// Carve a new block into objects of the given class
+static bool slab_grow(slab_pool_t* pool_, int class_)
+{
+    slab_block_t* block = (slab_block_t*)(malloc(SLAB_BLOCK_SIZE));
+    if (!block) {
+        return false;
+    }
+    block->next   = pool_->blocks;
+    pool_->blocks = block;
+    pool_->reserved += SLAB_BLOCK_SIZE;
+
+    size_t   objectSize = (size_t)SLAB_MIN_OBJECT << class_;
+    uint8_t* object     = (uint8_t*)block + SLAB_BLOCK_HEADER;
+    uint8_t* end        = (uint8_t*)block + SLAB_BLOCK_SIZE;
+    for (; (object + objectSize) <= end; object += objectSize) {
+        slab_free_object_t* item = (slab_free_object_t*)object;
+        item->next               = pool_->freeLists[class_];
+        pool_->freeLists[class_] = item;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+slab_pool_t* slab_pool_create(void)
+{
+    return (slab_pool_t*)(calloc(1, sizeof(slab_pool_t)));
+}
+
+//---------------------------------------------------------------------------
+void slab_pool_destroy(slab_pool_t* pool_)
+{
+    if (!pool_) {
+        return;
+    }
+    while (pool_->blocks) {
+        slab_block_t* next = pool_->blocks->next;
+        free(pool_->blocks);
+        pool_->blocks = next;
+    }
+    free(pool_);
+}
+
+//---------------------------------------------------------------------------
+void* slab_alloc(slab_pool_t* pool_, size_t size_)
+{
+    if (size_ > SLAB_MAX_OBJECT) {
+        void* object = calloc(1, size_);
+        if (object) {
+            pool_->inUse += size_;
+            pool_->reserved += size_;
+        }
+        return object;
+    }
+
+    int sizeClass = slab_class(size_);
+    if (!pool_->freeLists[sizeClass] && !slab_grow(pool_, sizeClass)) {
+        return NULL;
+    }
+    slab_free_object_t* object  = pool_->freeLists[sizeClass];
+    pool_->freeLists[sizeClass] = object->next;
+    pool_->inUse += (size_t)SLAB_MIN_OBJECT << sizeClass;
+
+    memset(object, 0, (size_t)SLAB_MIN_OBJECT << sizeClass);
+    return object;
+}
+
+//---------------------------------------------------------------------------
+void slab_free(slab_pool_t* pool_, void* object_, size_t size_)
+{
+    if (!object_) {
+        return;
+    }
+    if (size_ > SLAB_MAX_OBJECT) {
+        free(object_);
+        pool_->inUse -= size_;
+        pool_->reserved -= size_;
+        return;
+    }
+
+    int                 sizeClass = slab_class(size_);
+    slab_free_object_t* object    = (slab_free_object_t*)object_;
+    object->next                  = pool_->freeLists[sizeClass];
+    pool_->freeLists[sizeClass]   = object;
+    pool_->inUse -= (size_t)SLAB_MIN_OBJECT << sizeClass;
+}
+
+//---------------------------------------------------------------------------
+size_t slab_pool_in_use(const slab_pool_t* pool_)
+{
+    return pool_->inUse;
+}
+
+//---------------------------------------------------------------------------
+size_t slab_pool_reserved(const slab_pool_t* pool_)
+{
+    return pool_->reserved;
+}
@@ -0,0 +1,79 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+#define SLAB_MIN_OBJECT (16)            //!< Smallest size class, in bytes
+#define SLAB_MAX_OBJECT (8192)          //!< Largest size class; bigger requests go to malloc()
+#define SLAB_BLOCK_SIZE (65536)         //!< Memory obtained from the system at a time
+
+//---------------------------------------------------------------------------
+// Allocator for the many small objects owned by client connections.  Requests
+// are rounded up to a power-of-two size class, and carved out of large blocks
+// shared by all objects of that class; freed objects go on a per-class free
+// list, to be handed out again by the next allocation of that size.  Blocks
+// are only returned to the system when the pool is destroyed, so a server
+// whose clients come and go reaches a steady state instead of fragmenting the
+// heap.  Not thread-safe: a pool belongs to a single event loop.
+typedef struct slab_pool slab_pool_t;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief slab_pool_create construct an empty pool
+ * @return newly-constructed pool, or NULL on allocation error
+ */
+slab_pool_t* slab_pool_create(void);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief slab_pool_destroy release every block held by the pool.
+ * NOTE: no object allocated from the pool may be used after this is called.
+ * @param pool_ pool to destroy
+ */
+void slab_pool_destroy(slab_pool_t* pool_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief slab_alloc allocate a zero-filled object
+ * @param pool_ pool to allocate from
+ * @param size_ size of the object, in bytes
+ * @return new object (aligned for any type), or NULL on allocation error
+ */
+void* slab_alloc(slab_pool_t* pool_, size_t size_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief slab_free return an object to its pool
+ * @param pool_ pool the object was allocated from
+ * @param object_ object to free (may be NULL)
+ * @param size_ size the object was allocated with
+ */
+void slab_free(slab_pool_t* pool_, void* object_, size_t size_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief slab_pool_in_use return the number of bytes currently allocated from
+ * the pool, after rounding each object up to its size class
+ * @param pool_ pool to query
+ */
+size_t slab_pool_in_use(const slab_pool_t* pool_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief slab_pool_reserved return the number of bytes the pool has obtained
+ * from the system, including objects too big for a size class
+ * @param pool_ pool to query
+ */
+size_t slab_pool_reserved(const slab_pool_t* pool_);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
@@ -95,6 +95,15 @@ void slip_decode_message_destroy(slip_decode_message_t* context_)
     free(context_);
 }
 
+//---------------------------------------------------------------------------
+void slip_decode_message_init(slip_decode_message_t* msg_, uint8_t* raw_, size_t rawSize_)
+{
+    msg_->raw      = raw_;
+    msg_->rawSize  = rawSize_;
+    msg_->inEscape = false;
+    msg_->index    = 0;
+}
+
 //---------------------------------------------------------------------------
 void slip_decode_begin(slip_decode_message_t* msg_)
 {
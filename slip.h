@@ -119,6 +119,17 @@ slip_decode_message_t* slip_decode_message_create(size_t rawSize_);
  */
 void slip_decode_message_destroy(slip_decode_message_t* context_);
 
+//---------------------------------------------------------------------------
+/**
+ * @brief slip_decode_message_init prepare a decoder that works in memory owned
+ * by the caller, for objects embedded in other structures.  Nothing needs to
+ * be destroyed afterwards.
+ * @param msg_ object to initialize
+ * @param raw_ buffer that will hold decoded frames
+ * @param rawSize_ size of raw_; frames must be at least one byte smaller
+ */
+void slip_decode_message_init(slip_decode_message_t* msg_, uint8_t* raw_, size_t rawSize_);
+
 //---------------------------------------------------------------------------
 /**
  * @brief slip_decode_begin reset the message frame object, indicating it
@@ -0,0 +1,875 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#include "source.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <linux/input.h>
+
+#include "capture.h"
+#include "log.h"
+#include "timestamp.h"
+
+//---------------------------------------------------------------------------
+typedef struct __attribute__((packed)) {
+    uint16_t bus;
+    uint16_t vid;
+    uint16_t pid;
+    uint16_t version;
+} input_dev_info_t;
+
+//---------------------------------------------------------------------------
+typedef struct __attribute__((packed)) {
+    int32_t value;
+    int32_t minimum;
+    int32_t maximum;
+    int32_t flat;
+    int32_t fuzz;
+    int32_t resolution;
+} abs_axis_info_t;
+
+//---------------------------------------------------------------------------
+static inline bool is_bit_set(const uint8_t* array_, int bitIndex_)
+{
+    return (array_[bitIndex_ / 8] & (1 << (bitIndex_ % 8))) != 0;
+}
+
+//---------------------------------------------------------------------------
+// EVDEV SOURCE
+//---------------------------------------------------------------------------
+#define INPUT_BITS_PER_LONG (sizeof(unsigned long) * 8)
+#define INPUT_BITS_TO_LONGS(bits_) (((bits_) + INPUT_BITS_PER_LONG - 1) / INPUT_BITS_PER_LONG)
+
+//---------------------------------------------------------------------------
+#define INPUT_CACHE_MAGIC (0x4344534EU)     //!< "NSDC", little-endian
+#define INPUT_CACHE_VERSION (1)             //!< Format version written by this code
+
+//---------------------------------------------------------------------------
+// Capability cache file: this header, then the device's js_config_t.  The
+// file is named after the device's ID and a hash of its name; the header
+// repeats both so that a hash collision is never mistaken for a hit.
+typedef struct __attribute__((packed)) {
+    uint32_t         magic;         //!< INPUT_CACHE_MAGIC
+    uint16_t         version;       //!< INPUT_CACHE_VERSION
+    uint16_t         configSize;    //!< sizeof(js_config_t) when written
+    input_dev_info_t info;          //!< Device ID
+    char             name[256];     //!< Device name
+} input_cache_header_t;
+
+//---------------------------------------------------------------------------
+static bool inputCacheConfigured = false;
+static char inputCacheDir[PATH_MAX - 64];   //!< Capability cache location ("" == disabled)
+
+//---------------------------------------------------------------------------
+void input_source_set_cache_dir(const char* dir_)
+{
+    snprintf(inputCacheDir, sizeof(inputCacheDir), "%s", dir_ ? dir_ : "");
+    inputCacheConfigured = true;
+}
+
+//---------------------------------------------------------------------------
+// Path of the cache file for a device, creating the cache directory if needed.
+// Returns false if caching is disabled or there's nowhere to put the cache.
+static bool input_cache_path(const input_dev_info_t* info_, const char* name_, char* path_, size_t size_)
+{
+    if (!inputCacheConfigured) {
+        const char* xdg  = getenv("XDG_CACHE_HOME");
+        const char* home = getenv("HOME");
+        if (xdg && xdg[0]) {
+            snprintf(inputCacheDir, sizeof(inputCacheDir), "%s/netstick", xdg);
+        } else if (home && home[0]) {
+            snprintf(inputCacheDir, sizeof(inputCacheDir), "%s/.cache/netstick", home);
+        }
+        inputCacheConfigured = true;
+    }
+    if (!inputCacheDir[0]) {
+        return false;
+    }
+
+    // Create each missing component of the directory
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", inputCacheDir);
+    for (char* slash = strchr(dir + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(dir, 0755);
+        *slash = '/';
+    }
+    if ((mkdir(dir, 0755) != 0) && (errno != EEXIST)) {
+        return false;
+    }
+
+    // FNV-1a
+    uint32_t hash = 2166136261U;
+    for (const char* c = name_; *c; c++) { hash = (hash ^ (uint8_t)*c) * 16777619U; }
+    snprintf(path_,
+             size_,
+             "%s/%04x-%04x-%04x-%04x-%08x.caps",
+             inputCacheDir,
+             info_->bus,
+             info_->vid,
+             info_->pid,
+             info_->version,
+             hash);
+    return true;
+}
+
+//---------------------------------------------------------------------------
+static bool input_cache_load(const char* path_, const input_dev_info_t* info_, const char* name_, js_config_t* config_)
+{
+    int fd = open(path_, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    input_cache_header_t header = {};
+    bool                 ok     = (read(fd, &header, sizeof(header)) == sizeof(header))
+                && (header.magic == INPUT_CACHE_MAGIC) && (header.version == INPUT_CACHE_VERSION)
+                && (header.configSize == sizeof(js_config_t)) && !memcmp(&header.info, info_, sizeof(*info_))
+                && !strncmp(header.name, name_, sizeof(header.name))
+                && (read(fd, config_, sizeof(*config_)) == sizeof(*config_));
+    close(fd);
+    // The file is only a hint; anything damaged or stale means asking the device again
+    if (ok && !joystick_config_valid(config_)) {
+        LOG_DEBUG("ignoring invalid device cache %s", path_);
+        ok = false;
+    }
+    return ok;
+}
+
+//---------------------------------------------------------------------------
+// Write the cache file under a temporary name and rename it into place, so a
+// concurrent reader never sees a partial file
+static void input_cache_store(const char*             path_,
+                              const input_dev_info_t* info_,
+                              const char*             name_,
+                              const js_config_t*      config_)
+{
+    char tmpPath[PATH_MAX + 16];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.%d", path_, (int)getpid());
+    int fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOG_DEBUG("can't write capability cache %s: %s", tmpPath, strerror(errno));
+        return;
+    }
+
+    input_cache_header_t header = {};
+    header.magic                = INPUT_CACHE_MAGIC;
+    header.version              = INPUT_CACHE_VERSION;
+    header.configSize           = sizeof(js_config_t);
+    header.info                 = *info_;
+    snprintf(header.name, sizeof(header.name), "%.*s", (int)sizeof(header.name) - 1, name_);
+
+    bool ok = (write(fd, &header, sizeof(header)) == sizeof(header))
+              && (write(fd, config_, sizeof(*config_)) == sizeof(*config_));
+    close(fd);
+    if (!ok || (rename(tmpPath, path_) != 0)) {
+        unlink(tmpPath);
+    }
+}
+
+//---------------------------------------------------------------------------
+// Read the capability bitmap of one event type; the kernel fills in at most
+// the number of bytes we ask for
+static void input_evdev_get_bits(int fd_, int type_, unsigned long* bits_, size_t words_)
+{
+    memset(bits_, 0, words_ * sizeof(unsigned long));
+    if (ioctl(fd_, EVIOCGBIT(type_, words_ * sizeof(unsigned long)), bits_) < 0) {
+        memset(bits_, 0, words_ * sizeof(unsigned long));
+    }
+}
+
+//---------------------------------------------------------------------------
+// Collect the codes set in a capability bitmap, lowest first, skipping over
+// clear bits a word at a time
+static int input_evdev_collect(const unsigned long* bits_, size_t words_, uint32_t* codes_, int maxCodes_)
+{
+    int count = 0;
+    for (size_t i = 0; i < words_; i++) {
+        unsigned long word = bits_[i];
+        while (word && (count < maxCodes_)) {
+            codes_[count++] = (uint32_t)((i * INPUT_BITS_PER_LONG) + __builtin_ctzl(word));
+            word &= word - 1;
+        }
+    }
+    return count;
+}
+
+//---------------------------------------------------------------------------
+// Describe the device's axes and buttons, in ascending code order
+static void input_evdev_describe(int fd_, js_config_t* config_)
+{
+    unsigned long evBits[INPUT_BITS_TO_LONGS(EV_CNT)];
+    input_evdev_get_bits(fd_, 0, evBits, INPUT_BITS_TO_LONGS(EV_CNT));
+
+    uint32_t codes[KEY_CNT];
+    if (evBits[EV_KEY / INPUT_BITS_PER_LONG] & (1UL << (EV_KEY % INPUT_BITS_PER_LONG))) {
+        unsigned long keyBits[INPUT_BITS_TO_LONGS(KEY_CNT)];
+        input_evdev_get_bits(fd_, EV_KEY, keyBits, INPUT_BITS_TO_LONGS(KEY_CNT));
+        config_->buttonCount = input_evdev_collect(keyBits, INPUT_BITS_TO_LONGS(KEY_CNT), codes, KEY_CNT);
+        memcpy(config_->buttons, codes, config_->buttonCount * sizeof(uint32_t));
+    }
+    if (evBits[EV_REL / INPUT_BITS_PER_LONG] & (1UL << (EV_REL % INPUT_BITS_PER_LONG))) {
+        unsigned long relBits[INPUT_BITS_TO_LONGS(REL_CNT)];
+        input_evdev_get_bits(fd_, EV_REL, relBits, INPUT_BITS_TO_LONGS(REL_CNT));
+        config_->relAxisCount = input_evdev_collect(relBits, INPUT_BITS_TO_LONGS(REL_CNT), codes, REL_CNT);
+        memcpy(config_->relAxis, codes, config_->relAxisCount * sizeof(uint32_t));
+    }
+    if (evBits[EV_ABS / INPUT_BITS_PER_LONG] & (1UL << (EV_ABS % INPUT_BITS_PER_LONG))) {
+        unsigned long absBits[INPUT_BITS_TO_LONGS(ABS_CNT)];
+        input_evdev_get_bits(fd_, EV_ABS, absBits, INPUT_BITS_TO_LONGS(ABS_CNT));
+        config_->absAxisCount = input_evdev_collect(absBits, INPUT_BITS_TO_LONGS(ABS_CNT), codes, ABS_CNT);
+        for (int i = 0; i < config_->absAxisCount; i++) {
+            abs_axis_info_t absAxis = {};
+            ioctl(fd_, EVIOCGABS(codes[i]), &absAxis);
+            config_->absAxis[i]           = codes[i];
+            config_->absAxisMin[i]        = absAxis.minimum;
+            config_->absAxisMax[i]        = absAxis.maximum;
+            config_->absAxisFuzz[i]       = absAxis.fuzz;
+            config_->absAxisFlat[i]       = absAxis.flat;
+            config_->absAxisResolution[i] = 0;
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+static bool input_evdev_open(input_source_t* source_, const char* spec_, bool monotonic_)
+{
+    int fd = open(spec_, O_RDONLY | O_NONBLOCK);
+    if (fd < 0) {
+        printf("Unable to open device %s for input\n", spec_);
+        return false;
+    }
+    source_->fd = fd;
+
+    // Timed reports carry the kernel's event timestamps, which must come from
+    // the same clock as our own timestamps
+    if (monotonic_) {
+        int clockId = CLOCK_MONOTONIC;
+        if (ioctl(fd, EVIOCSCLOCKID, &clockId) != 0) {
+            printf("error selecting monotonic event timestamps: %d (%s)\n", errno, strerror(errno));
+        }
+    }
+
+    // Get the basic information for the device at the path specified (USB vid/pid, etc.)
+    input_dev_info_t info = {};
+    ioctl(fd, EVIOCGID, &info);
+
+    // Get the device's name
+    char devName[256] = {};
+    ioctl(fd, EVIOCGNAME(sizeof(devName) - 1), devName);
+
+    // The ID and name identify the device well enough to reuse what we learned
+    // about its capabilities the last time it was opened
+    js_config_t* config = &source_->config;
+    char         cachePath[PATH_MAX];
+    bool         cacheable = input_cache_path(&info, devName, cachePath, sizeof(cachePath));
+    source_->cached        = cacheable && input_cache_load(cachePath, &info, devName, config);
+    if (!source_->cached) {
+        memset(config, 0, sizeof(*config));
+        input_evdev_describe(fd, config);
+        if (cacheable) {
+            input_cache_store(cachePath, &info, devName, config);
+        }
+    }
+
+    config->pid = info.pid;
+    config->vid = info.vid;
+    strncpy(config->name, devName, sizeof(config->name));
+    return true;
+}
+
+//---------------------------------------------------------------------------
+static void input_evdev_close(input_source_t* source_)
+{
+    if (source_->fd >= 0) {
+        close(source_->fd);
+    }
+}
+
+//---------------------------------------------------------------------------
+static int input_evdev_read(input_source_t* source_, struct input_event* events_, int maxEvents_)
+{
+    while (1) {
+        int nRead = read(source_->fd, events_, maxEvents_ * sizeof(struct input_event));
+        if (nRead > 0) {
+            if ((nRead % sizeof(struct input_event)) != 0) {
+                LOG_WARNING("unexpected event size read %d", nRead);
+            }
+            return nRead / sizeof(struct input_event);
+        }
+        if ((nRead < 0) && (errno == EINTR)) {
+            continue;
+        }
+        if ((nRead < 0) && (errno == EAGAIN)) {
+            return 0;
+        }
+        return -1;
+    }
+}
+
+//---------------------------------------------------------------------------
+static bool input_evdev_get_state(input_source_t* source_, uint8_t* buttons_, int32_t* absValues_)
+{
+    const js_config_t* config = &source_->config;
+
+    uint8_t keys[(KEY_MAX + 7) / 8] = {};
+    if ((config->buttonCount > 0) && (ioctl(source_->fd, EVIOCGKEY(sizeof(keys)), keys) < 0)) {
+        return false;
+    }
+    for (int i = 0; i < config->buttonCount; i++) {
+        buttons_[i] = is_bit_set(keys, config->buttons[i]);
+    }
+
+    for (int i = 0; i < config->absAxisCount; i++) {
+        abs_axis_info_t absAxis = {};
+        if (ioctl(source_->fd, EVIOCGABS(config->absAxis[i]), &absAxis) != 0) {
+            return false;
+        }
+        absValues_[i] = absAxis.value;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+static const input_source_ops_t inputSourceEvdev
+    = { "evdev", input_evdev_open, input_evdev_close, input_evdev_read, input_evdev_get_state };
+
+//---------------------------------------------------------------------------
+// GENERATOR SOURCE
+//---------------------------------------------------------------------------
+typedef enum { GeneratorGamepad = 0, GeneratorKeyboard, GeneratorMouse } input_generator_pattern_t;
+
+//---------------------------------------------------------------------------
+// State of a synthetic device.  Every timer expiry produces one update (a
+// group of events closed by EV_SYN).
+struct input_generator {
+    input_generator_pattern_t pattern;
+    int                       rateHz;       //!< Updates per second
+    uint64_t                  tick;         //!< Updates generated so far
+    uint64_t                  pending;      //!< Timer expirations not yet turned into updates
+    int                       maxEvents;    //!< Most events a single update can produce (including EV_SYN)
+    uint8_t                   buttons[KEY_CNT];
+    int32_t                   absValues[ABS_CNT];
+};
+
+//---------------------------------------------------------------------------
+static const uint32_t generatorPadAxes[]    = { ABS_X, ABS_Y, ABS_Z, ABS_RX, ABS_RY, ABS_RZ, ABS_HAT0X, ABS_HAT0Y };
+static const uint32_t generatorPadButtons[] = { BTN_SOUTH, BTN_EAST,  BTN_NORTH, BTN_WEST,   BTN_TL,
+                                                BTN_TR,    BTN_TL2,   BTN_TR2,   BTN_SELECT, BTN_START,
+                                                BTN_MODE,  BTN_THUMBL, BTN_THUMBR };
+static const uint32_t generatorMouseAxes[]  = { REL_X, REL_Y, REL_WHEEL, REL_HWHEEL };
+static const int32_t  generatorMouseMoves[8][2]
+    = { { 4, 0 }, { 3, 3 }, { 0, 4 }, { -3, 3 }, { -4, 0 }, { -3, -3 }, { 0, -4 }, { 3, -3 } };
+
+//---------------------------------------------------------------------------
+#define GENERATOR_COUNT(array_) ((int)(sizeof(array_) / sizeof(array_[0])))
+
+//---------------------------------------------------------------------------
+// Describe the synthetic device.  Returns false if the shape isn't possible.
+static bool input_generator_configure(input_generator_t* generator_, js_config_t* config_, int axes_, int buttons_)
+{
+    switch (generator_->pattern) {
+        case GeneratorGamepad: {
+            axes_    = (axes_ < 0) ? GENERATOR_COUNT(generatorPadAxes) : axes_;
+            buttons_ = (buttons_ < 0) ? 11 : buttons_;
+            int maxButtons = GENERATOR_COUNT(generatorPadButtons) + (BTN_TRIGGER_HAPPY40 - BTN_TRIGGER_HAPPY1 + 1);
+            if ((axes_ > GENERATOR_COUNT(generatorPadAxes)) || (buttons_ > maxButtons)) {
+                return false;
+            }
+            snprintf(config_->name, sizeof(config_->name), "netstick generated gamepad");
+            for (int i = 0; i < axes_; i++) {
+                uint32_t axis             = generatorPadAxes[i];
+                bool     hat              = (axis == ABS_HAT0X) || (axis == ABS_HAT0Y);
+                bool     trigger          = (axis == ABS_Z) || (axis == ABS_RZ);
+                config_->absAxis[i]       = axis;
+                config_->absAxisMin[i]    = hat ? -1 : (trigger ? 0 : -32768);
+                config_->absAxisMax[i]    = hat ? 1 : (trigger ? 1023 : 32767);
+                config_->absAxisFuzz[i]   = (hat || trigger) ? 0 : 16;
+                config_->absAxisFlat[i]   = (hat || trigger) ? 0 : 128;
+                generator_->absValues[i]  = trigger ? 0 : ((config_->absAxisMin[i] + config_->absAxisMax[i]) / 2);
+            }
+            for (int i = 0; i < buttons_; i++) {
+                config_->buttons[i] = (i < GENERATOR_COUNT(generatorPadButtons))
+                                          ? generatorPadButtons[i]
+                                          : (BTN_TRIGGER_HAPPY1 + (i - GENERATOR_COUNT(generatorPadButtons)));
+            }
+            config_->absAxisCount = axes_;
+            config_->buttonCount  = buttons_;
+        } break;
+        case GeneratorKeyboard: {
+            // KEY_ESC onwards, so that anything with at least 31 keys looks like a keyboard.
+            // Typing is all a keyboard does, so it needs at least one key.
+            buttons_ = (buttons_ < 0) ? 84 : buttons_;
+            if ((axes_ > 0) || (buttons_ < 1) || (buttons_ > KEY_MICMUTE)) {
+                return false;
+            }
+            snprintf(config_->name, sizeof(config_->name), "netstick generated keyboard");
+            for (int i = 0; i < buttons_; i++) { config_->buttons[i] = KEY_ESC + i; }
+            config_->buttonCount = buttons_;
+        } break;
+        case GeneratorMouse: {
+            axes_    = (axes_ < 0) ? 3 : axes_;
+            buttons_ = (buttons_ < 0) ? 3 : buttons_;
+            int maxButtons = BTN_TASK - BTN_LEFT + 1;
+            if ((axes_ < 2) || (axes_ > GENERATOR_COUNT(generatorMouseAxes)) || (buttons_ > maxButtons)) {
+                return false;
+            }
+            snprintf(config_->name, sizeof(config_->name), "netstick generated mouse");
+            for (int i = 0; i < axes_; i++) { config_->relAxis[i] = generatorMouseAxes[i]; }
+            for (int i = 0; i < buttons_; i++) { config_->buttons[i] = BTN_LEFT + i; }
+            config_->relAxisCount = axes_;
+            config_->buttonCount  = buttons_;
+        } break;
+    }
+
+    generator_->maxEvents = config_->absAxisCount + config_->relAxisCount + 2;
+    return true;
+}
+
+//---------------------------------------------------------------------------
+input_generator_t* input_generator_create(const char* spec_, js_config_t* config_)
+{
+    input_generator_t* generator = (input_generator_t*)(calloc(1, sizeof(input_generator_t)));
+    if (!generator) {
+        return NULL;
+    }
+    generator->rateHz = INPUT_SOURCE_DEFAULT_RATE_HZ;
+
+    char* spec = strdup(spec_);
+    char* save = NULL;
+    int   axes = -1;
+    int   btns = -1;
+    bool  ok   = true;
+    for (char* tok = strtok_r(spec, ",", &save); tok && ok; tok = strtok_r(NULL, ",", &save)) {
+        if (strcmp(tok, "gamepad") == 0) {
+            generator->pattern = GeneratorGamepad;
+        } else if (strcmp(tok, "keyboard") == 0) {
+            generator->pattern = GeneratorKeyboard;
+        } else if (strcmp(tok, "mouse") == 0) {
+            generator->pattern = GeneratorMouse;
+        } else if (strncmp(tok, "rate=", 5) == 0) {
+            generator->rateHz = atoi(tok + 5);
+        } else if (strncmp(tok, "axes=", 5) == 0) {
+            axes = atoi(tok + 5);
+        } else if (strncmp(tok, "buttons=", 8) == 0) {
+            btns = atoi(tok + 8);
+        } else {
+            ok = false;
+        }
+    }
+    free(spec);
+
+    if (!ok || (generator->rateHz <= 0) || (generator->rateHz > 1000000)
+        || !input_generator_configure(generator, config_, axes, btns)) {
+        free(generator);
+        return NULL;
+    }
+    return generator;
+}
+
+//---------------------------------------------------------------------------
+void input_generator_destroy(input_generator_t* generator_)
+{
+    free(generator_);
+}
+
+//---------------------------------------------------------------------------
+int input_generator_max_events(const input_generator_t* generator_)
+{
+    return generator_->maxEvents;
+}
+
+//---------------------------------------------------------------------------
+static bool input_generator_open(input_source_t* source_, const char* spec_, bool monotonic_)
+{
+    input_generator_t* generator = input_generator_create(spec_, &source_->config);
+    source_->state               = generator;
+    if (!generator) {
+        printf("invalid generator: %s\n", spec_);
+        return false;
+    }
+
+    // Updates are paced by a timer, which also gives the client an fd to poll
+    source_->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (source_->fd < 0) {
+        printf("error creating generator timer: %d (%s)\n", errno, strerror(errno));
+        return false;
+    }
+    struct itimerspec period = {};
+    period.it_interval       = timestamp_to_timespec(NSEC_PER_SEC / generator->rateHz);
+    period.it_value          = period.it_interval;
+    timerfd_settime(source_->fd, 0, &period, NULL);
+
+    printf("generating %s input: %d abs axes, %d rel axes, %d buttons at %d Hz\n",
+           source_->config.name,
+           source_->config.absAxisCount,
+           source_->config.relAxisCount,
+           source_->config.buttonCount,
+           generator->rateHz);
+    return true;
+}
+
+//---------------------------------------------------------------------------
+static void input_generator_close(input_source_t* source_)
+{
+    if (source_->fd >= 0) {
+        close(source_->fd);
+    }
+    input_generator_destroy((input_generator_t*)source_->state);
+}
+
+//---------------------------------------------------------------------------
+static int
+input_generator_add(struct input_event* events_, int count_, uint64_t now_, int type_, int code_, int value_)
+{
+    struct input_event* event = &events_[count_];
+    event->input_event_sec    = now_ / NSEC_PER_SEC;
+    event->input_event_usec   = (now_ % NSEC_PER_SEC) / NSEC_PER_USEC;
+    event->type               = type_;
+    event->code               = code_;
+    event->value              = value_;
+    return count_ + 1;
+}
+
+//---------------------------------------------------------------------------
+static int input_generator_toggle(input_generator_t*  generator_,
+                                  const js_config_t*  config_,
+                                  int                 button_,
+                                  struct input_event* events_,
+                                  int                 count_,
+                                  uint64_t            now_)
+{
+    generator_->buttons[button_] ^= 1;
+    return input_generator_add(
+        events_, count_, now_, EV_KEY, config_->buttons[button_], generator_->buttons[button_]);
+}
+
+//---------------------------------------------------------------------------
+// Sticks sweep back and forth once a second, hats step around, and a button is
+// pressed or released ten times a second.
+int input_generator_update(input_generator_t*  generator_,
+                           const js_config_t*  config_,
+                           struct input_event* events_,
+                           uint64_t            now_)
+{
+    uint64_t period = (generator_->rateHz < 4) ? 4 : generator_->rateHz;
+    uint64_t tick   = generator_->tick++;
+    int      count  = 0;
+
+    switch (generator_->pattern) {
+        case GeneratorGamepad: {
+            for (int i = 0; i < config_->absAxisCount; i++) {
+                int32_t value;
+                if ((config_->absAxis[i] == ABS_HAT0X) || (config_->absAxis[i] == ABS_HAT0Y)) {
+                    static const int32_t steps[4] = { 0, 1, 0, -1 };
+                    value                         = steps[((tick / (period / 4)) + i) % 4];
+                } else {
+                    uint64_t t     = (tick + (i * period / 4)) % period;
+                    uint64_t sweep = ((t * 2) < period) ? t : (period - t);
+                    int64_t  range = (int64_t)config_->absAxisMax[i] - config_->absAxisMin[i];
+                    value          = (int32_t)(config_->absAxisMin[i] + ((range * 2 * (int64_t)sweep) / period));
+                }
+                if (value != generator_->absValues[i]) {
+                    generator_->absValues[i] = value;
+                    count = input_generator_add(events_, count, now_, EV_ABS, config_->absAxis[i], value);
+                }
+            }
+            uint64_t step = (period / 10) ? (period / 10) : 1;
+            if ((config_->buttonCount > 0) && ((tick % step) == 0)) {
+                int button = (tick / step / 2) % config_->buttonCount;
+                count      = input_generator_toggle(generator_, config_, button, events_, count, now_);
+            }
+        } break;
+        case GeneratorKeyboard: {
+            // Type: press a key on one update, release it on the next
+            int key = (tick / 2) % config_->buttonCount;
+            count   = input_generator_toggle(generator_, config_, key, events_, count, now_);
+        } break;
+        case GeneratorMouse: {
+            // Move in a circle once a second, scrolling and clicking now and then
+            const int32_t* move = generatorMouseMoves[(tick * 8 / period) % 8];
+            count               = input_generator_add(events_, count, now_, EV_REL, REL_X, move[0]);
+            count               = input_generator_add(events_, count, now_, EV_REL, REL_Y, move[1]);
+            int32_t scroll = ((tick / (period / 4)) & 1) ? 1 : -1;
+            for (int i = 2; (i < config_->relAxisCount) && ((tick % (period / 4)) == 0); i++) {
+                count = input_generator_add(events_, count, now_, EV_REL, config_->relAxis[i], scroll);
+            }
+            uint64_t step = (period / 2) ? (period / 2) : 1;
+            if ((config_->buttonCount > 0) && ((tick % step) == 0)) {
+                int button = (tick / step / 2) % config_->buttonCount;
+                count      = input_generator_toggle(generator_, config_, button, events_, count, now_);
+            }
+        } break;
+    }
+
+    return input_generator_add(events_, count, now_, EV_SYN, SYN_REPORT, 0);
+}
+
+//---------------------------------------------------------------------------
+static int input_generator_read(input_source_t* source_, struct input_event* events_, int maxEvents_)
+{
+    input_generator_t* generator = (input_generator_t*)source_->state;
+    if (generator->pending == 0) {
+        uint64_t expirations;
+        if (read(source_->fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+            return 0;
+        }
+        generator->pending = expirations;
+    }
+
+    // Catch up on every expiry, in as many reads as it takes
+    int      count = 0;
+    uint64_t now   = timestamp_now_ns();
+    while ((generator->pending > 0) && ((count + generator->maxEvents) <= maxEvents_)) {
+        count += input_generator_update(generator, &source_->config, events_ + count, now);
+        generator->pending--;
+    }
+    return count;
+}
+
+//---------------------------------------------------------------------------
+void input_generator_get_state(const input_generator_t* generator_,
+                               const js_config_t*       config_,
+                               uint8_t*                 buttons_,
+                               int32_t*                 absValues_)
+{
+    memcpy(buttons_, generator_->buttons, config_->buttonCount);
+    memcpy(absValues_, generator_->absValues, config_->absAxisCount * sizeof(int32_t));
+}
+
+//---------------------------------------------------------------------------
+static bool input_generator_source_state(input_source_t* source_, uint8_t* buttons_, int32_t* absValues_)
+{
+    input_generator_get_state((input_generator_t*)source_->state, &source_->config, buttons_, absValues_);
+    return true;
+}
+
+//---------------------------------------------------------------------------
+static const input_source_ops_t inputSourceGenerator = {
+    "generate", input_generator_open, input_generator_close, input_generator_read, input_generator_source_state
+};
+
+//---------------------------------------------------------------------------
+// REPLAY SOURCE
+//---------------------------------------------------------------------------
+typedef struct {
+    capture_reader_t* reader;
+    double            speed;            //!< Playback speed (0 == as fast as possible)
+    uint64_t          startNs;          //!< CLOCK_MONOTONIC time at which replay started
+    bool              yield;            //!< Whether the next read returns nothing (full speed only)
+    uint8_t           keys[KEY_CNT];    //!< State of every key, by code
+    int32_t           abs[ABS_CNT];     //!< Value of every absolute axis, by code
+} input_replay_t;
+
+//---------------------------------------------------------------------------
+// Make the timer fd readable at the given CLOCK_MONOTONIC time (0 == right away)
+static void input_replay_arm(input_source_t* source_, uint64_t dueNs_)
+{
+    struct itimerspec due = {};
+    due.it_value          = timestamp_to_timespec(dueNs_ ? dueNs_ : 1);
+    timerfd_settime(source_->fd, TFD_TIMER_ABSTIME, &due, NULL);
+}
+
+//---------------------------------------------------------------------------
+static bool input_replay_open(input_source_t* source_, const char* spec_, bool monotonic_)
+{
+    input_replay_t* replay = (input_replay_t*)(calloc(1, sizeof(input_replay_t)));
+    source_->state         = replay;
+    replay->speed          = 1.0;
+
+    char* spec = strdup(spec_);
+    char* save = NULL;
+    char* path = strtok_r(spec, ",", &save);
+    bool  ok   = (path != NULL);
+    for (char* tok = strtok_r(NULL, ",", &save); tok && ok; tok = strtok_r(NULL, ",", &save)) {
+        if (strncmp(tok, "speed=", 6) == 0) {
+            replay->speed = atof(tok + 6);
+        } else {
+            ok = false;
+        }
+    }
+    if (ok) {
+        replay->reader = capture_reader_open(path);
+    }
+    free(spec);
+
+    if (!ok || (replay->speed < 0.0)) {
+        printf("invalid replay: %s\n", spec_);
+        return false;
+    }
+    if (!replay->reader) {
+        return false;
+    }
+    if (replay->reader->header->kind != CaptureKindEvents) {
+        printf("%s holds reports, not input events; replay it with netstick_bench replay\n", spec_);
+        return false;
+    }
+    source_->config = replay->reader->header->config;
+
+    source_->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (source_->fd < 0) {
+        printf("error creating replay timer: %d (%s)\n", errno, strerror(errno));
+        return false;
+    }
+    replay->startNs = timestamp_now_ns();
+    input_replay_arm(source_, 0);
+
+    char pace[32] = "full speed";
+    if (replay->speed > 0.0) {
+        snprintf(pace, sizeof(pace), "%.2fx speed", replay->speed);
+    }
+    printf("replaying %s: %zu bytes of events at %s\n",
+           source_->config.name,
+           replay->reader->size - sizeof(capture_header_t),
+           pace);
+    return true;
+}
+
+//---------------------------------------------------------------------------
+static void input_replay_close(input_source_t* source_)
+{
+    input_replay_t* replay = (input_replay_t*)source_->state;
+    if (source_->fd >= 0) {
+        close(source_->fd);
+    }
+    if (replay) {
+        capture_reader_close(replay->reader);
+    }
+    free(replay);
+}
+
+//---------------------------------------------------------------------------
+// Hand out every record that has come due, straight from the mapped capture.
+// Events are stamped with the time they're replayed, not the time they were
+// recorded.
+static int input_replay_read(input_source_t* source_, struct input_event* events_, int maxEvents_)
+{
+    // Drain the timer; whether it fired or not, the capture says what's due
+    input_replay_t* replay = (input_replay_t*)source_->state;
+    uint64_t        expirations;
+    (void)!read(source_->fd, &expirations, sizeof(expirations));
+    if (replay->yield) {
+        replay->yield = false;
+        input_replay_arm(source_, 0);
+        return 0;
+    }
+
+    int                    count  = 0;
+    uint64_t               now    = timestamp_now_ns();
+    const capture_event_t* record = NULL;
+    while (count < maxEvents_) {
+        uint64_t timeNs;
+        record = capture_reader_peek_event(replay->reader, &timeNs);
+        if (!record) {
+            break;
+        }
+        uint64_t due = capture_replay_due_ns(replay->startNs, timeNs, replay->speed);
+        if (due > now) {
+            input_replay_arm(source_, due);
+            break;
+        }
+
+        struct input_event* event = &events_[count++];
+        event->input_event_sec    = now / NSEC_PER_SEC;
+        event->input_event_usec   = (now % NSEC_PER_SEC) / NSEC_PER_USEC;
+        event->type               = record->type;
+        event->code               = record->code;
+        event->value              = record->value;
+        if ((event->type == EV_KEY) && (event->code < KEY_CNT)) {
+            replay->keys[event->code] = (event->value != 0);
+        } else if ((event->type == EV_ABS) && (event->code < ABS_CNT)) {
+            replay->abs[event->code] = event->value;
+        }
+        capture_reader_advance(replay->reader);
+    }
+
+    if (!record && (count == 0)) {
+        printf("replay finished: %llu events\n", (unsigned long long)replay->reader->records);
+        return -1;
+    }
+
+    // At full speed there's always more to read; come back to it after the
+    // client has had a chance to look at its socket
+    if ((replay->speed <= 0.0) && (count > 0)) {
+        replay->yield = true;
+    }
+    return count;
+}
+
+//---------------------------------------------------------------------------
+static bool input_replay_get_state(input_source_t* source_, uint8_t* buttons_, int32_t* absValues_)
+{
+    input_replay_t*    replay = (input_replay_t*)source_->state;
+    const js_config_t* config = &source_->config;
+    for (int i = 0; i < config->buttonCount; i++) { buttons_[i] = replay->keys[config->buttons[i]]; }
+    for (int i = 0; i < config->absAxisCount; i++) { absValues_[i] = replay->abs[config->absAxis[i]]; }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+static const input_source_ops_t inputSourceReplay
+    = { "replay", input_replay_open, input_replay_close, input_replay_read, input_replay_get_state };
+
+//---------------------------------------------------------------------------
+static const input_source_ops_t* const inputSources[]
+    = { &inputSourceEvdev, &inputSourceGenerator, &inputSourceReplay };
+
+//---------------------------------------------------------------------------
+input_source_t* input_source_open(const char* spec_, bool monotonic_)
+{
+    // "<name>:<spec>" selects a source; anything else is a device path
+    const input_source_ops_t* ops  = &inputSourceEvdev;
+    const char*               spec = spec_;
+    for (size_t i = 0; i < sizeof(inputSources) / sizeof(inputSources[0]); i++) {
+        size_t len = strlen(inputSources[i]->name);
+        if ((strncmp(spec_, inputSources[i]->name, len) == 0) && (spec_[len] == ':')) {
+            ops  = inputSources[i];
+            spec = spec_ + len + 1;
+            break;
+        }
+    }
+
+    uint64_t        start  = timestamp_now_ns();
+    input_source_t* source = (input_source_t*)(calloc(1, sizeof(input_source_t)));
+    source->ops            = ops;
+    source->fd             = -1;
+    if (!ops->open(source, spec, monotonic_)) {
+        input_source_close(source);
+        return NULL;
+    }
+    source->openNs = timestamp_now_ns() - start;
+    return source;
+}
+
+//---------------------------------------------------------------------------
+void input_source_close(input_source_t* source_)
+{
+    if (!source_) {
+        return;
+    }
+    source_->ops->close(source_);
+    free(source_);
+}
+
+//---------------------------------------------------------------------------
+int input_source_read(input_source_t* source_, struct input_event* events_, int maxEvents_)
+{
+    return source_->ops->read(source_, events_, maxEvents_);
+}
+
+//---------------------------------------------------------------------------
+bool input_source_get_state(input_source_t* source_, uint8_t* buttons_, int32_t* absValues_)
+{
+    return source_->ops->get_state(source_, buttons_, absValues_);
+}
@@ -0,0 +1,172 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <linux/input.h>
+
+#include "joystick.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+#define INPUT_SOURCE_DEFAULT_RATE_HZ (250)  //!< Default update rate of generated input
+
+//---------------------------------------------------------------------------
+typedef struct input_source input_source_t;
+
+//---------------------------------------------------------------------------
+// Implementation of an input source
+typedef struct {
+    const char* name;   //!< Prefix used to select the source ("evdev" is also the default)
+
+    /**
+     * Open the source described by spec_ (everything after the "name:" prefix),
+     * filling in source_->config and source_->fd.
+     * @return true on success
+     */
+    bool (*open)(input_source_t* source_, const char* spec_, bool monotonic_);
+
+    /** Release whatever open() set up */
+    void (*close)(input_source_t* source_);
+
+    /**
+     * Read pending events without blocking.
+     * @return number of events read, 0 if none are ready, -1 if the source is gone
+     */
+    int (*read)(input_source_t* source_, struct input_event* events_, int maxEvents_);
+
+    /**
+     * Query the complete current state: buttons_[i] for config.buttons[i] and
+     * absValues_[i] for config.absAxis[i].
+     * @return true on success
+     */
+    bool (*get_state)(input_source_t* source_, uint8_t* buttons_, int32_t* absValues_);
+} input_source_ops_t;
+
+//---------------------------------------------------------------------------
+// A device (real or not) whose events the client forwards
+struct input_source {
+    const input_source_ops_t* ops;      //!< Implementation
+    int                       fd;       //!< Readable whenever events are pending (poll()-able)
+    js_config_t               config;   //!< Shape of the device
+    void*                     state;    //!< Implementation-specific state
+    uint64_t                  openNs;   //!< Time taken to open and describe the device
+    bool                      cached;   //!< Description came from the capability cache
+};
+
+//---------------------------------------------------------------------------
+/**
+ * @brief input_source_open open an input source.  The spec selects the source:
+ *  - <path> or evdev:<path>: a real device (/dev/input/eventX)
+ *  - generate:<gamepad|keyboard|mouse>[,rate=<Hz>][,axes=<n>][,buttons=<n>]:
+ *    synthetic input of the given shape, with an update every 1/rate seconds
+ *  - replay:<file>[,speed=<x>]: events from a capture made with netstick
+ *    --capture, at x times the recorded pace (default 1); 0 == as fast as possible
+ * @param spec_ source specification
+ * @param monotonic_ whether event timestamps must come from CLOCK_MONOTONIC
+ * @return newly-opened source, or NULL on error
+ */
+input_source_t* input_source_open(const char* spec_, bool monotonic_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief input_source_set_cache_dir set where the capabilities of evdev devices
+ * are cached between runs, keyed by the device's ID and name.  By default the
+ * cache is kept in $XDG_CACHE_HOME/netstick (or ~/.cache/netstick).
+ * @param dir_ cache directory, or NULL to always query the device
+ */
+void input_source_set_cache_dir(const char* dir_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief input_source_close close a previously-opened source
+ * NOTE: object must not be used after this is called.
+ * @param source_ source to close
+ */
+void input_source_close(input_source_t* source_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief input_source_read read pending events without blocking
+ * @param source_ source to read from
+ * @param events_ [out] events read
+ * @param maxEvents_ capacity of events_
+ * @return number of events read, 0 if none are ready, -1 if the source is gone
+ */
+int input_source_read(input_source_t* source_, struct input_event* events_, int maxEvents_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief input_source_get_state query the complete state of a source
+ * @param source_ source to query
+ * @param buttons_ [out] state of each of config.buttonCount buttons
+ * @param absValues_ [out] value of each of config.absAxisCount absolute axes
+ * @return true on success
+ */
+bool input_source_get_state(input_source_t* source_, uint8_t* buttons_, int32_t* absValues_);
+
+//---------------------------------------------------------------------------
+// The synthetic input behind "generate:" sources, usable on its own
+typedef struct input_generator input_generator_t;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief input_generator_create create a generator of synthetic input
+ * @param spec_ <gamepad|keyboard|mouse>[,rate=<Hz>][,axes=<n>][,buttons=<n>]
+ * @param config_ [out] shape of the synthetic device
+ * @return newly-created generator, or NULL if the spec is invalid
+ */
+input_generator_t* input_generator_create(const char* spec_, js_config_t* config_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief input_generator_destroy destroy a generator
+ * @param generator_ generator to destroy
+ */
+void input_generator_destroy(input_generator_t* generator_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief input_generator_max_events get the most events a single update can produce
+ * @param generator_ generator to query
+ * @return number of events, including the closing EV_SYN
+ */
+int input_generator_max_events(const input_generator_t* generator_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief input_generator_update produce the events of the generator's next update,
+ * as if 1/rate seconds had passed since the last one
+ * @param generator_ generator to advance
+ * @param config_ shape of the device, as filled in by input_generator_create()
+ * @param events_ [out] events, closed by EV_SYN; room for input_generator_max_events()
+ * @param now_ timestamp given to the events
+ * @return number of events produced
+ */
+int input_generator_update(input_generator_t*  generator_,
+                           const js_config_t*  config_,
+                           struct input_event* events_,
+                           uint64_t            now_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief input_generator_get_state get the current state of a generator's device
+ * @param generator_ generator to query
+ * @param config_ shape of the device, as filled in by input_generator_create()
+ * @param buttons_ [out] state of each of config_->buttonCount buttons
+ * @param absValues_ [out] value of each of config_->absAxisCount absolute axes
+ */
+void input_generator_get_state(const input_generator_t* generator_,
+                               const js_config_t*       config_,
+                               uint8_t*                 buttons_,
+                               int32_t*                 absValues_);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
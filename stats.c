@@ -0,0 +1,365 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#include "stats.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "timestamp.h"
+
+//---------------------------------------------------------------------------
+typedef enum {
+    StatsCounter = 0,   //!< Monotonically increasing count
+    StatsGauge,         //!< Sampled value
+    StatsGaugeNs        //!< Sampled duration in ns, exported in seconds
+} stats_kind_t;
+
+//---------------------------------------------------------------------------
+// Description of an exported per-client value
+typedef struct {
+    const char*  name;      //!< Metric name (Prometheus) / key (JSON)
+    const char*  help;      //!< Description
+    stats_kind_t kind;      //!< How the value is exported
+    size_t       offset;    //!< Offset of the value in stats_client_t
+} stats_metric_t;
+
+//---------------------------------------------------------------------------
+#define STATS_METRIC(name_, help_, kind_, field_) { name_, help_, kind_, offsetof(stats_client_t, field_) }
+
+static const stats_metric_t statsMetrics[] = {
+    STATS_METRIC("bytes_received_total", "Bytes read from the client socket", StatsCounter, bytesReceived),
+    STATS_METRIC("frames_received_total", "Intact messages received", StatsCounter, framesReceived),
+    STATS_METRIC("checksum_errors_total", "Frames dropped for a bad checksum", StatsCounter, checksumErrors),
+    STATS_METRIC("slip_errors_total", "Frames dropped for a slip decoding error", StatsCounter, slipErrors),
+    STATS_METRIC("reports_applied_total", "Reports written to the virtual device", StatsCounter, reportsApplied),
+    STATS_METRIC("uinput_write_errors_total", "Failed writes to the virtual device", StatsCounter, writeErrors),
+    STATS_METRIC("uinput_write_eagain_total", "Writes to the virtual device that hit EAGAIN", StatsCounter, writeAgain),
+    STATS_METRIC("socket_queue_bytes", "Bytes waiting in the client's receive queue", StatsGauge, socketQueueBytes),
+    STATS_METRIC("playout_queue_depth", "Reports waiting in the playout buffer", StatsGauge, playoutDepth),
+    STATS_METRIC("playout_queued_total", "Reports that went through the playout buffer", StatsCounter, playoutQueued),
+    STATS_METRIC("playout_bypassed_total", "Reports that skipped the playout buffer", StatsCounter, playoutBypassed),
+    STATS_METRIC("playout_late_total", "Reports that arrived after their playout time", StatsCounter, playoutLate),
+    STATS_METRIC("arrival_jitter_seconds", "Smoothed jitter of reports as received", StatsGaugeNs, arrivalJitterNs),
+    STATS_METRIC("arrival_jitter_peak_seconds", "Largest deviation as received", StatsGaugeNs, arrivalPeakNs),
+    STATS_METRIC("applied_jitter_seconds", "Smoothed jitter of reports as applied", StatsGaugeNs, appliedJitterNs),
+    STATS_METRIC("applied_jitter_peak_seconds", "Largest deviation as applied", StatsGaugeNs, appliedPeakNs),
+    STATS_METRIC("rtt_seconds", "Smoothed heartbeat round-trip time", StatsGaugeNs, rttNs),
+    STATS_METRIC("latency_p50_seconds", "Median end-to-end report latency", StatsGaugeNs, latencyP50Ns),
+    STATS_METRIC("latency_p99_seconds", "99th percentile end-to-end report latency", StatsGaugeNs, latencyP99Ns),
+    STATS_METRIC("latency_p999_seconds", "99.9th percentile end-to-end report latency", StatsGaugeNs, latencyP999Ns),
+    STATS_METRIC("latency_max_seconds", "Largest end-to-end report latency", StatsGaugeNs, latencyMaxNs),
+};
+
+#define STATS_METRIC_COUNT (sizeof(statsMetrics) / sizeof(statsMetrics[0]))
+
+//---------------------------------------------------------------------------
+// Consistent copy of a slot, taken by the stats thread
+typedef struct {
+    int      clientFd;
+    char     name[64];
+    uint64_t ageNs;
+    uint64_t values[STATS_METRIC_COUNT];
+} stats_snapshot_t;
+
+//---------------------------------------------------------------------------
+static void stats_begin_write(stats_client_t* client_)
+{
+    __atomic_store_n(&client_->generation, client_->generation + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+//---------------------------------------------------------------------------
+static void stats_end_write(stats_client_t* client_)
+{
+    __atomic_store_n(&client_->generation, client_->generation + 1, __ATOMIC_RELEASE);
+}
+
+//---------------------------------------------------------------------------
+stats_client_t* stats_client_acquire(stats_server_t* server_, int clientFd_)
+{
+    stats_client_t* client = NULL;
+    for (int i = 0; server_ && (i < server_->maxSlots); i++) {
+        if (!server_->slots[i].active) {
+            client = &server_->slots[i];
+            break;
+        }
+    }
+    if (!client) {
+        client = (stats_client_t*)(calloc(1, sizeof(stats_client_t)));
+        if (!client) {
+            return NULL;
+        }
+        client->active      = true;
+        client->clientFd    = clientFd_;
+        client->connectedNs = timestamp_now_ns();
+        return client;
+    }
+
+    // Reset the slot's counters while readers know to ignore it
+    stats_begin_write(client);
+    memset(&client->active, 0, sizeof(*client) - offsetof(stats_client_t, active));
+    client->published   = true;
+    client->clientFd    = clientFd_;
+    client->connectedNs = timestamp_now_ns();
+    __atomic_store_n(&client->active, true, __ATOMIC_RELAXED);
+    stats_end_write(client);
+    return client;
+}
+
+//---------------------------------------------------------------------------
+void stats_client_release(stats_client_t* client_)
+{
+    if (!client_->published) {
+        free(client_);
+        return;
+    }
+    stats_begin_write(client_);
+    __atomic_store_n(&client_->active, false, __ATOMIC_RELAXED);
+    stats_end_write(client_);
+}
+
+//---------------------------------------------------------------------------
+void stats_client_set_name(stats_client_t* client_, const char* name_)
+{
+    stats_begin_write(client_);
+    snprintf(client_->name, sizeof(client_->name), "%s", name_);
+    stats_end_write(client_);
+}
+
+//---------------------------------------------------------------------------
+// Copy a slot, seqlock-style: retry if its identity changed while copying.
+static bool stats_snapshot(stats_client_t* client_, stats_snapshot_t* snapshot_, uint64_t now_)
+{
+    for (int attempt = 0; attempt < 4; attempt++) {
+        uint32_t before = __atomic_load_n(&client_->generation, __ATOMIC_ACQUIRE);
+        if (before & 1) {
+            continue;
+        }
+        if (!__atomic_load_n(&client_->active, __ATOMIC_RELAXED)) {
+            return false;
+        }
+
+        uint64_t connected  = client_->connectedNs;
+        snapshot_->clientFd = client_->clientFd;
+        snapshot_->ageNs    = (now_ > connected) ? (now_ - connected) : 0;
+        memcpy(snapshot_->name, client_->name, sizeof(snapshot_->name));
+        snapshot_->name[sizeof(snapshot_->name) - 1] = '\0';
+        for (size_t i = 0; i < STATS_METRIC_COUNT; i++) {
+            uint64_t* value      = (uint64_t*)((uint8_t*)client_ + statsMetrics[i].offset);
+            snapshot_->values[i] = __atomic_load_n(value, __ATOMIC_RELAXED);
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&client_->generation, __ATOMIC_RELAXED) == before) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//---------------------------------------------------------------------------
+// Write a string with the given characters backslash-escaped
+static void stats_write_escaped(FILE* out_, const char* str_, bool json_)
+{
+    for (const char* c = str_; *c; c++) {
+        if ((*c == '"') || (*c == '\\')) {
+            fprintf(out_, "\\%c", *c);
+        } else if (*c == '\n') {
+            fputs("\\n", out_);
+        } else if (json_ && ((unsigned char)*c < 0x20)) {
+            fprintf(out_, "\\u%04x", (unsigned char)*c);
+        } else {
+            fputc(*c, out_);
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+static void stats_write_value(FILE* out_, stats_kind_t kind_, uint64_t value_)
+{
+    if (kind_ == StatsGaugeNs) {
+        fprintf(out_, "%.9f", (double)value_ / NSEC_PER_SEC);
+    } else {
+        fprintf(out_, "%llu", (unsigned long long)value_);
+    }
+}
+
+//---------------------------------------------------------------------------
+static void stats_write_prometheus(FILE* out_, const stats_snapshot_t* snapshots_, int count_)
+{
+    fprintf(out_,
+            "# HELP netstick_clients Connected clients\n"
+            "# TYPE netstick_clients gauge\n"
+            "netstick_clients %d\n",
+            count_);
+
+    fprintf(out_,
+            "# HELP netstick_connection_age_seconds Time since the client connected\n"
+            "# TYPE netstick_connection_age_seconds gauge\n");
+    for (int i = 0; i < count_; i++) {
+        fprintf(out_, "netstick_connection_age_seconds{fd=\"%d\",device=\"", snapshots_[i].clientFd);
+        stats_write_escaped(out_, snapshots_[i].name, false);
+        fprintf(out_, "\"} ");
+        stats_write_value(out_, StatsGaugeNs, snapshots_[i].ageNs);
+        fputc('\n', out_);
+    }
+
+    for (size_t m = 0; m < STATS_METRIC_COUNT; m++) {
+        const stats_metric_t* metric = &statsMetrics[m];
+        fprintf(out_,
+                "# HELP netstick_%s %s\n# TYPE netstick_%s %s\n",
+                metric->name,
+                metric->help,
+                metric->name,
+                (metric->kind == StatsCounter) ? "counter" : "gauge");
+        for (int i = 0; i < count_; i++) {
+            fprintf(out_, "netstick_%s{fd=\"%d\",device=\"", metric->name, snapshots_[i].clientFd);
+            stats_write_escaped(out_, snapshots_[i].name, false);
+            fprintf(out_, "\"} ");
+            stats_write_value(out_, metric->kind, snapshots_[i].values[m]);
+            fputc('\n', out_);
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+static void stats_write_json(FILE* out_, const stats_snapshot_t* snapshots_, int count_)
+{
+    fprintf(out_, "{\"clients\":[");
+    for (int i = 0; i < count_; i++) {
+        fprintf(out_, "%s{\"fd\":%d,\"device\":\"", (i > 0) ? "," : "", snapshots_[i].clientFd);
+        stats_write_escaped(out_, snapshots_[i].name, true);
+        fprintf(out_, "\",\"connection_age_seconds\":");
+        stats_write_value(out_, StatsGaugeNs, snapshots_[i].ageNs);
+        for (size_t m = 0; m < STATS_METRIC_COUNT; m++) {
+            fprintf(out_, ",\"%s\":", statsMetrics[m].name);
+            stats_write_value(out_, statsMetrics[m].kind, snapshots_[i].values[m]);
+        }
+        fputc('}', out_);
+    }
+    fprintf(out_, "]}\n");
+}
+
+//---------------------------------------------------------------------------
+static void stats_serve_request(stats_server_t* server_, int fd_)
+{
+    // Wait briefly for a request line; a client that sends nothing gets Prometheus text
+    struct timeval timeout = { .tv_sec = 0, .tv_usec = 200000 };
+    setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    char    request[64] = {};
+    ssize_t nRead       = read(fd_, request, sizeof(request) - 1);
+    bool    json        = (nRead >= 4) && !strncmp(request, "json", 4);
+
+    stats_snapshot_t* snapshots = (stats_snapshot_t*)(calloc(server_->maxSlots, sizeof(stats_snapshot_t)));
+    int               count     = 0;
+    uint64_t          now       = timestamp_now_ns();
+    for (int i = 0; i < server_->maxSlots; i++) {
+        if (stats_snapshot(&server_->slots[i], &snapshots[count], now)) {
+            count++;
+        }
+    }
+
+    char*  response     = NULL;
+    size_t responseSize = 0;
+    FILE*  out          = open_memstream(&response, &responseSize);
+    if (out) {
+        if (json) {
+            stats_write_json(out, snapshots, count);
+        } else {
+            stats_write_prometheus(out, snapshots, count);
+        }
+        fclose(out);
+
+        size_t written = 0;
+        while (written < responseSize) {
+            ssize_t rc = send(fd_, response + written, responseSize - written, MSG_NOSIGNAL);
+            if (rc <= 0) {
+                break;
+            }
+            written += rc;
+        }
+    }
+    free(response);
+    free(snapshots);
+}
+
+//---------------------------------------------------------------------------
+static void* stats_thread(void* arg_)
+{
+    stats_server_t* server = (stats_server_t*)arg_;
+    while (1) {
+        int fd = accept(server->listenFd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("stats: error accepting connection: %d (%s)\n", errno, strerror(errno));
+            return NULL;
+        }
+        stats_serve_request(server, fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+//---------------------------------------------------------------------------
+stats_server_t* stats_server_create(const char* path_, int maxSlots_)
+{
+    struct sockaddr_un addr = {};
+    addr.sun_family         = AF_UNIX;
+    if (strlen(path_) >= sizeof(addr.sun_path)) {
+        printf("stats: socket path too long: %s\n", path_);
+        return NULL;
+    }
+    strcpy(addr.sun_path, path_);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        printf("stats: error creating socket: %d (%s)\n", errno, strerror(errno));
+        return NULL;
+    }
+    unlink(path_);
+    if ((bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) || (listen(fd, 4) != 0)) {
+        printf("stats: error binding %s: %d (%s)\n", path_, errno, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    stats_server_t* server = (stats_server_t*)(calloc(1, sizeof(stats_server_t)));
+    server->slots          = (stats_client_t*)(calloc(maxSlots_, sizeof(stats_client_t)));
+    server->maxSlots       = maxSlots_;
+    server->listenFd       = fd;
+    strcpy(server->path, path_);
+
+    // Serving stats must never compete with input, even in real-time mode
+    pthread_attr_t     attr;
+    struct sched_param param = {};
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    pthread_attr_setschedparam(&attr, &param);
+    int rc = pthread_create(&server->thread, &attr, stats_thread, server);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        printf("stats: error starting thread: %d (%s)\n", rc, strerror(rc));
+        close(fd);
+        unlink(path_);
+        free(server->slots);
+        free(server);
+        return NULL;
+    }
+    pthread_detach(server->thread);
+    return server;
+}
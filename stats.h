@@ -0,0 +1,122 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <pthread.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+// Counters for a single client connection.  Each is written only by the
+// server's event loop (with relaxed atomic stores, so the hot path never takes
+// a lock or a locked instruction), and read concurrently by the stats thread.
+typedef struct {
+    uint32_t generation;    //!< Odd while the slot's identity is being changed
+    bool     active;        //!< Whether the slot belongs to a connected client
+    bool     published;     //!< Whether the slot is visible to the stats endpoint
+    int      clientFd;      //!< Socket of the client
+    char     name[64];      //!< Name of the client's device (empty until configured)
+    uint64_t connectedNs;   //!< CLOCK_MONOTONIC time at which the client connected
+
+    uint64_t bytesReceived;     //!< Bytes read from the socket
+    uint64_t framesReceived;    //!< Intact messages received
+    uint64_t checksumErrors;    //!< Frames discarded because of a bad tlvc checksum
+    uint64_t slipErrors;        //!< Frames discarded because of a slip decoding error
+    uint64_t reportsApplied;    //!< Reports written to the virtual device
+    uint64_t writeErrors;       //!< Failed writes to the virtual device
+    uint64_t writeAgain;        //!< Writes to the virtual device that failed with EAGAIN
+    uint64_t socketQueueBytes;  //!< Bytes waiting in the socket's receive queue (sampled)
+    uint64_t playoutDepth;      //!< Reports waiting in the playout buffer (sampled)
+    uint64_t playoutQueued;     //!< Reports that went through the playout buffer (sampled)
+    uint64_t playoutBypassed;   //!< Reports that skipped the playout buffer (sampled)
+    uint64_t playoutLate;       //!< Reports that arrived after their playout time (sampled)
+    uint64_t arrivalJitterNs;   //!< Smoothed interarrival jitter of timed reports (sampled)
+    uint64_t arrivalPeakNs;     //!< Largest interarrival deviation of timed reports (sampled)
+    uint64_t appliedJitterNs;   //!< Smoothed jitter of reports as applied by the playout buffer (sampled)
+    uint64_t appliedPeakNs;     //!< Largest deviation of reports as applied by the playout buffer (sampled)
+    uint64_t rttNs;             //!< Smoothed heartbeat round-trip time (sampled)
+    uint64_t latencyP50Ns;      //!< Median end-to-end report latency (sampled)
+    uint64_t latencyP99Ns;      //!< 99th percentile end-to-end report latency (sampled)
+    uint64_t latencyP999Ns;     //!< 99.9th percentile end-to-end report latency (sampled)
+    uint64_t latencyMaxNs;      //!< Largest end-to-end report latency (sampled)
+} stats_client_t;
+
+//---------------------------------------------------------------------------
+// Unix-socket endpoint serving the counters of every connected client
+typedef struct {
+    stats_client_t* slots;      //!< One slot per possible client
+    int             maxSlots;   //!< Number of slots
+    int             listenFd;   //!< Listening unix socket
+    char            path[108];  //!< Filesystem path of the socket
+    pthread_t       thread;     //!< Thread serving requests
+} stats_server_t;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief stats_server_create create the statistics endpoint, and start a
+ * (non-realtime) thread serving it.  Each connection to the socket gets one
+ * snapshot: in JSON if the first line it sends is "json", otherwise in the
+ * Prometheus text exposition format.
+ * @param path_ filesystem path of the unix socket (replaced if it exists)
+ * @param maxSlots_ maximum number of clients to track
+ * @return newly-constructed endpoint, or NULL on error
+ */
+stats_server_t* stats_server_create(const char* path_, int maxSlots_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief stats_client_acquire allocate counters for a new client.  Without an
+ * endpoint (or when all slots are taken), the counters are private.
+ * @param server_ endpoint to publish the counters on (may be NULL)
+ * @param clientFd_ socket of the client
+ * @return counters for the client, or NULL on allocation error
+ */
+stats_client_t* stats_client_acquire(stats_server_t* server_, int clientFd_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief stats_client_release release a client's counters
+ * NOTE: object must not be used after this is called.
+ * @param client_ counters to release
+ */
+void stats_client_release(stats_client_t* client_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief stats_client_set_name set the device name reported for a client
+ * @param client_ counters to update
+ * @param name_ device name
+ */
+void stats_client_set_name(stats_client_t* client_, const char* name_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief stats_add add to a counter.  Only the event loop may call this.
+ * @param counter_ counter to update
+ * @param value_ amount to add
+ */
+static inline void stats_add(uint64_t* counter_, uint64_t value_)
+{
+    __atomic_store_n(counter_, __atomic_load_n(counter_, __ATOMIC_RELAXED) + value_, __ATOMIC_RELAXED);
+}
+
+//---------------------------------------------------------------------------
+/**
+ * @brief stats_set set a sampled value.  Only the event loop may call this.
+ * @param counter_ value to update
+ * @param value_ new value
+ */
+static inline void stats_set(uint64_t* counter_, uint64_t value_)
+{
+    __atomic_store_n(counter_, value_, __ATOMIC_RELAXED);
+}
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
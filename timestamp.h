@@ -0,0 +1,45 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+#define NSEC_PER_USEC (1000ULL)
+#define NSEC_PER_MSEC (1000000ULL)
+#define NSEC_PER_SEC (1000000000ULL)
+
+//---------------------------------------------------------------------------
+/**
+ * @brief timestamp_now_ns Read the monotonic clock
+ * @return current value of CLOCK_MONOTONIC in nanoseconds
+ */
+static inline uint64_t timestamp_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * NSEC_PER_SEC) + (uint64_t)ts.tv_nsec;
+}
+
+//---------------------------------------------------------------------------
+/**
+ * @brief timestamp_to_timespec Convert a nanosecond interval into a timespec
+ * @param ns_ interval in nanoseconds
+ * @return equivalent timespec
+ */
+static inline struct timespec timestamp_to_timespec(uint64_t ns_)
+{
+    struct timespec ts;
+    ts.tv_sec  = (time_t)(ns_ / NSEC_PER_SEC);
+    ts.tv_nsec = (long)(ns_ % NSEC_PER_SEC);
+    return ts;
+}
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
@@ -0,0 +1,186 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#include "transport.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "timestamp.h"
+
+//---------------------------------------------------------------------------
+static const char* transportPolicyNames[] = { "default", "latency", "throughput" };
+
+//---------------------------------------------------------------------------
+void transport_config_init(transport_config_t* config_)
+{
+    config_->policy         = TransportPolicyDefault;
+    config_->batchWindowUs  = TRANSPORT_DEFAULT_BATCH_US;
+    config_->sendBufferSize = TRANSPORT_DEFAULT_SNDBUF;
+}
+
+//---------------------------------------------------------------------------
+bool transport_policy_from_string(const char* str_, transport_policy_t* policy_)
+{
+    for (size_t i = 0; i < sizeof(transportPolicyNames) / sizeof(transportPolicyNames[0]); i++) {
+        if (!strcmp(str_, transportPolicyNames[i])) {
+            *policy_ = (transport_policy_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+//---------------------------------------------------------------------------
+const char* transport_policy_to_string(transport_policy_t policy_)
+{
+    if ((size_t)policy_ >= sizeof(transportPolicyNames) / sizeof(transportPolicyNames[0])) {
+        return "unknown";
+    }
+    return transportPolicyNames[policy_];
+}
+
+//---------------------------------------------------------------------------
+static bool transport_set_option(int fd_, int level_, int option_, int value_, const char* name_)
+{
+    int rc = setsockopt(fd_, level_, option_, &value_, sizeof(value_));
+    if (rc != 0) {
+        printf("error setting %s on fd=%d: %d (%s)\n", name_, fd_, errno, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+bool transport_apply(int fd_, const transport_config_t* config_)
+{
+    bool ok = true;
+    switch (config_->policy) {
+        case TransportPolicyLowLatency: {
+            // Don't wait on Nagle or delayed ACKs, and keep the kernel's send buffer
+            // small so that a backed-up link is absorbed by our send queue (where
+            // stale reports get coalesced) rather than by the socket.
+            ok &= transport_set_option(fd_, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+            ok &= transport_set_option(fd_, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+            if (config_->sendBufferSize > 0) {
+                ok &= transport_set_option(fd_, SOL_SOCKET, SO_SNDBUF, config_->sendBufferSize, "SO_SNDBUF");
+            }
+        } break;
+        case TransportPolicyThroughput: {
+            // Only full segments leave the socket until we explicitly uncork it at
+            // the end of each batching window.
+            ok &= transport_set_option(fd_, IPPROTO_TCP, TCP_CORK, 1, "TCP_CORK");
+        } break;
+        case TransportPolicyDefault:
+        default: break;
+    }
+    return ok;
+}
+
+//---------------------------------------------------------------------------
+void transport_on_read(int fd_, const transport_config_t* config_)
+{
+    if (config_->policy == TransportPolicyLowLatency) {
+        int enable = 1;
+        setsockopt(fd_, IPPROTO_TCP, TCP_QUICKACK, &enable, sizeof(enable));
+    }
+}
+
+//---------------------------------------------------------------------------
+void transport_sender_init(transport_sender_t* sender_, int fd_, const transport_config_t* config_, send_queue_t* queue_)
+{
+    sender_->fd            = fd_;
+    sender_->config        = *config_;
+    sender_->queue         = queue_;
+    sender_->batchOpen     = false;
+    sender_->batchDeadline = 0;
+}
+
+//---------------------------------------------------------------------------
+// Write out a newly-queued message, unless the policy calls for it to be batched
+static send_queue_return_t transport_sender_queued(transport_sender_t* sender_, uint64_t now_)
+{
+    if ((sender_->config.policy == TransportPolicyThroughput) && !sender_->batchOpen) {
+        sender_->batchOpen     = true;
+        sender_->batchDeadline = now_ + ((uint64_t)sender_->config.batchWindowUs * NSEC_PER_USEC);
+    }
+
+    return transport_sender_service(sender_, now_);
+}
+
+//---------------------------------------------------------------------------
+send_queue_return_t transport_sender_send(
+    transport_sender_t* sender_, uint16_t tag_, const void* data_, size_t dataLen_, bool mergeable_, uint64_t now_)
+{
+    send_queue_return_t rc = send_queue_push(sender_->queue, tag_, data_, dataLen_, mergeable_);
+    if ((rc != SendQueueOk) && (rc != SendQueueWouldBlock)) {
+        return rc;
+    }
+    return transport_sender_queued(sender_, now_);
+}
+
+//---------------------------------------------------------------------------
+send_queue_return_t transport_sender_send_encoded(transport_sender_t* sender_,
+                                                  uint16_t            tag_,
+                                                  const void*         data_,
+                                                  size_t              dataLen_,
+                                                  const uint8_t*      frame_,
+                                                  size_t              frameLen_,
+                                                  bool                mergeable_,
+                                                  uint64_t            now_)
+{
+    send_queue_return_t rc
+        = send_queue_push_encoded(sender_->queue, tag_, data_, dataLen_, frame_, frameLen_, mergeable_);
+    if ((rc != SendQueueOk) && (rc != SendQueueWouldBlock)) {
+        return rc;
+    }
+    return transport_sender_queued(sender_, now_);
+}
+
+//---------------------------------------------------------------------------
+send_queue_return_t transport_sender_service(transport_sender_t* sender_, uint64_t now_)
+{
+    if (sender_->batchOpen) {
+        if (now_ < sender_->batchDeadline) {
+            return SendQueueOk;
+        }
+        sender_->batchOpen = false;
+    }
+
+    send_queue_return_t rc = send_queue_flush(sender_->queue, sender_->fd);
+
+    // Pop the cork to push out whatever partial segment is left, then put it
+    // back in place for the next batch.
+    if ((sender_->config.policy == TransportPolicyThroughput) && (rc != SendQueueErrorSocket)) {
+        int value = 0;
+        setsockopt(sender_->fd, IPPROTO_TCP, TCP_CORK, &value, sizeof(value));
+        value = 1;
+        setsockopt(sender_->fd, IPPROTO_TCP, TCP_CORK, &value, sizeof(value));
+    }
+    return rc;
+}
+
+//---------------------------------------------------------------------------
+int64_t transport_sender_timeout(const transport_sender_t* sender_, uint64_t now_)
+{
+    if (!sender_->batchOpen) {
+        return -1;
+    }
+    if (now_ >= sender_->batchDeadline) {
+        return 0;
+    }
+    return (int64_t)(sender_->batchDeadline - now_);
+}
+
+//---------------------------------------------------------------------------
+bool transport_sender_wants_write(const transport_sender_t* sender_)
+{
+    return !sender_->batchOpen && !send_queue_is_empty(sender_->queue);
+}
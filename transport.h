@@ -0,0 +1,168 @@
+// Netstick - Copyright (c) 2021 Funkenstein Software Consulting.  See LICENSE.txt
+// for more details.
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sendqueue.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------
+#define TRANSPORT_DEFAULT_BATCH_US (2000)   //!< Default batching window for the throughput policy
+#define TRANSPORT_DEFAULT_SNDBUF (4096)     //!< Default socket send buffer for the low-latency policy
+
+//---------------------------------------------------------------------------
+// Socket policies, trading latency against the number of packets on the wire
+typedef enum {
+    TransportPolicyDefault = 0,     //!< Leave the kernel's socket defaults alone
+    TransportPolicyLowLatency,      //!< TCP_NODELAY + TCP_QUICKACK, small send buffer; send every report at once
+    TransportPolicyThroughput       //!< TCP_CORK; hold reports for a batching window and send them together
+} transport_policy_t;
+
+//---------------------------------------------------------------------------
+// Transport options selected by the user
+typedef struct {
+    transport_policy_t policy;          //!< Socket policy
+    int                batchWindowUs;   //!< Throughput policy: time reports are held before being pushed out
+    int                sendBufferSize;  //!< Low-latency policy: SO_SNDBUF in bytes (0 == kernel default)
+} transport_config_t;
+
+//---------------------------------------------------------------------------
+// Sending half of a connection; a send queue plus the policy used to drain it
+typedef struct {
+    int                fd;              //!< Non-blocking socket
+    transport_config_t config;          //!< Policy applied to the socket
+    send_queue_t*      queue;           //!< Messages waiting to be written
+    bool               batchOpen;       //!< Whether a batching window is currently open
+    uint64_t           batchDeadline;   //!< Time (CLOCK_MONOTONIC ns) at which the open batch is pushed out
+} transport_sender_t;
+
+//---------------------------------------------------------------------------
+/**
+ * @brief transport_config_init initialize a transport configuration with default values
+ * @param config_ object to initialize
+ */
+void transport_config_init(transport_config_t* config_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief transport_policy_from_string parse a policy name ("default", "latency", "throughput")
+ * @param str_ string to parse
+ * @param policy_ [out] parsed policy
+ * @return true on success, false if the string does not name a policy
+ */
+bool transport_policy_from_string(const char* str_, transport_policy_t* policy_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief transport_policy_to_string return the name of a policy
+ * @param policy_ policy to name
+ * @return policy name
+ */
+const char* transport_policy_to_string(transport_policy_t policy_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief transport_apply set the socket options for the selected policy on a
+ * newly connected (or accepted) TCP socket.
+ * @param fd_ socket to configure
+ * @param config_ transport options to apply
+ * @return true if all options were applied, false if any failed
+ */
+bool transport_apply(int fd_, const transport_config_t* config_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief transport_on_read re-arm per-read socket options.  TCP_QUICKACK is
+ * not sticky, and must be set again after every read from the socket.
+ * @param fd_ socket that was read from
+ * @param config_ transport options for the socket
+ */
+void transport_on_read(int fd_, const transport_config_t* config_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief transport_sender_init prepare the sending half of a connection
+ * @param sender_ object to initialize
+ * @param fd_ non-blocking socket, with transport_apply() already called on it
+ * @param config_ transport options for the socket
+ * @param queue_ send queue to drain onto the socket
+ */
+void transport_sender_init(transport_sender_t* sender_, int fd_, const transport_config_t* config_, send_queue_t* queue_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief transport_sender_send queue a message, and write it out immediately
+ * unless the policy calls for it to be batched.
+ * @param sender_ sender to use
+ * @param tag_ message tag
+ * @param data_ message payload
+ * @param dataLen_ size of the payload in bytes
+ * @param mergeable_ whether the message may be merged with a pending one
+ * @param now_ current time (CLOCK_MONOTONIC ns)
+ * @return SendQueueOk or SendQueueWouldBlock on success, others on error
+ */
+send_queue_return_t transport_sender_send(
+    transport_sender_t* sender_, uint16_t tag_, const void* data_, size_t dataLen_, bool mergeable_, uint64_t now_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief transport_sender_send_encoded same as transport_sender_send(), for a
+ * message already encoded with message_encode() (see send_queue_push_encoded())
+ * @param sender_ sender to use
+ * @param tag_ message tag
+ * @param data_ message payload
+ * @param dataLen_ size of the payload in bytes
+ * @param frame_ encoded frame carrying tag_ and data_
+ * @param frameLen_ size of the encoded frame in bytes
+ * @param mergeable_ whether the message may be merged with a pending one
+ * @param now_ current time (CLOCK_MONOTONIC ns)
+ * @return SendQueueOk or SendQueueWouldBlock on success, others on error
+ */
+send_queue_return_t transport_sender_send_encoded(transport_sender_t* sender_,
+                                                  uint16_t            tag_,
+                                                  const void*         data_,
+                                                  size_t              dataLen_,
+                                                  const uint8_t*      frame_,
+                                                  size_t              frameLen_,
+                                                  bool                mergeable_,
+                                                  uint64_t            now_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief transport_sender_service write out queued data if the socket is
+ * writable and any batching window has elapsed.  Call when the socket becomes
+ * writable, or when the timeout returned by transport_sender_timeout() expires.
+ * @param sender_ sender to service
+ * @param now_ current time (CLOCK_MONOTONIC ns)
+ * @return SendQueueOk or SendQueueWouldBlock on success, SendQueueErrorSocket on error
+ */
+send_queue_return_t transport_sender_service(transport_sender_t* sender_, uint64_t now_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief transport_sender_timeout return the time until the sender next needs
+ * to be serviced, for use as a poll timeout.
+ * @param sender_ sender to query
+ * @param now_ current time (CLOCK_MONOTONIC ns)
+ * @return time in ns until the open batch must be sent, or -1 if no batch is open
+ */
+int64_t transport_sender_timeout(const transport_sender_t* sender_, uint64_t now_);
+
+//---------------------------------------------------------------------------
+/**
+ * @brief transport_sender_wants_write whether the sender has data that is
+ * only waiting for the socket to become writable.
+ * @param sender_ sender to query
+ * @return true if the caller should poll for POLLOUT
+ */
+bool transport_sender_wants_write(const transport_sender_t* sender_);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif